@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+
+"""Compile-time benchmark harness.
+
+Sweeps every parameter of the program generator (bench/genprog.py) over a
+range of sizes while keeping the others at their defaults, and compiles each
+program with `-ftime-phases`. For every program it records the time of each
+compiler phase and the peak memory of the compiler. For every sweep it fits
+the growth exponent k of time ~ size^k per phase, so a phase that scales
+superlinearly with a parameter (a symbol lookup that walks every scope, a
+grammar rule that keeps the whole list on the parser stack) stands out.
+"""
+
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+import genprog
+
+# Exponents above this are reported as superlinear
+SUPERLINEAR = 1.3
+
+# Phases faster than this at the largest size are too noisy to fit
+MIN_TIME = 0.02
+
+
+def run_compiler(compiler, source, flags, timeout):
+    with open(source, 'rb') as stdin, tempfile.TemporaryFile() as stderr:
+        start = time.perf_counter()
+        process = subprocess.Popen([compiler, '-ftime-phases', *flags], stdin=stdin,
+                                   stdout=subprocess.DEVNULL, stderr=stderr)
+
+        # Reap the compiler with wait4, which reports the peak memory of
+        # this compilation alone
+        while True:
+            pid, status, usage = os.wait4(process.pid, os.WNOHANG)
+            if pid:
+                break
+            if time.perf_counter() - start > timeout:
+                process.kill()
+                _, status, usage = os.wait4(process.pid, 0)
+                break
+            time.sleep(0.001)
+        elapsed = time.perf_counter() - start
+        process.returncode = os.waitstatus_to_exitcode(status)
+
+        stderr.seek(0)
+        output = stderr.read().decode(errors='replace')
+
+    result = {'total': elapsed, 'peak_rss_kb': usage.ru_maxrss, 'phases': {}}
+    messages = []
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[0] == 'phase':
+            result['phases'][fields[1]] = float(fields[2])
+        else:
+            messages.append(line)
+
+    if elapsed > timeout:
+        result['error'] = f"timed out after {timeout} seconds"
+    elif process.returncode != 0:
+        result['error'] = "\n".join(messages) or f"exit status {process.returncode}"
+    return result
+
+
+def exponent(points):
+    """Least squares slope of log(time) over log(size)."""
+    points = [(math.log(x), math.log(y)) for x, y in points if x > 0 and y > 0]
+    if len(points) < 2:
+        return None
+    mean_x = sum(x for x, _ in points) / len(points)
+    mean_y = sum(y for _, y in points) / len(points)
+    var = sum((x - mean_x) ** 2 for x, _ in points)
+    if var == 0:
+        return None
+    return sum((x - mean_x) * (y - mean_y) for x, y in points) / var
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Measures how the compile time grows with the size of generated programs.')
+    parser.add_argument('compiler_path', help='The path to the compiler executable (src/compiler).')
+    parser.add_argument('--param', choices=genprog.DEFAULTS, action='append', help='Parameter to sweep (default: all).')
+    parser.add_argument('--sizes', default='1,2,4,8', help='Multiples of the default value of the swept parameter (default: 1,2,4,8).')
+    parser.add_argument('-O', dest='optimize', action='store_true', help='Compile with optimization.')
+    parser.add_argument('--timeout', type=float, default=600, help='Seconds before a compilation is aborted (default: 600).')
+    parser.add_argument('-o', '--output', help='Write the JSON results to this file instead of stdout.')
+    genprog.add_arguments(parser)
+
+    args = parser.parse_args()
+    compiler = os.path.abspath(args.compiler_path)
+    factors = [float(f) for f in args.sizes.split(',')]
+    flags = ['-O'] if args.optimize else []
+    base = {name: getattr(args, name) for name in genprog.DEFAULTS}
+
+    sweeps = []
+    superlinear = []
+    with tempfile.TemporaryDirectory(prefix='alan_compile_') as work_dir:
+        for param in args.param or list(genprog.DEFAULTS):
+            runs = []
+            for factor in factors:
+                params = dict(base)
+                params[param] = max(1, int(round(base[param] * factor)))
+                source = os.path.join(work_dir, f"{param}_{params[param]}.alan")
+                with open(source, 'w') as f:
+                    f.write(genprog.generate(**params))
+
+                result = run_compiler(compiler, source, flags, args.timeout)
+                result.update({'size': params[param], 'params': params, 'source_bytes': os.path.getsize(source)})
+                runs.append(result)
+
+                phases = " ".join(f"{name} {value:.3f}" for name, value in result['phases'].items())
+                status = f"FAILED: {result['error'].splitlines()[0]}" if 'error' in result else phases
+                print(f"{param:12} {params[param]:7} total {result['total']:.3f}s "
+                      f"rss {result['peak_rss_kb'] // 1024}MB  {status}", file=sys.stderr)
+
+            ok = [r for r in runs if 'error' not in r]
+            exponents = {}
+            names = ['total'] + sorted({name for r in ok for name in r['phases']})
+            for name in names:
+                points = [(r['size'], r['total'] if name == 'total' else r['phases'].get(name, 0)) for r in ok]
+                if not points or max(t for _, t in points) < MIN_TIME:
+                    continue
+                exponents[name] = exponent(points)
+                if exponents[name] is not None and exponents[name] > SUPERLINEAR:
+                    superlinear.append({'param': param, 'phase': name, 'exponent': exponents[name]})
+                    print(f"  {name} grows as {param}^{exponents[name]:.2f}", file=sys.stderr)
+
+            sweeps.append({'param': param, 'runs': runs, 'exponents': exponents})
+
+    report = {
+        'compiler': compiler,
+        'optimize': args.optimize,
+        'base': base,
+        'sweeps': sweeps,
+        'superlinear': superlinear,
+    }
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+    failed = any('error' in r for s in sweeps for r in s['runs'])
+    return 1 if superlinear or failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
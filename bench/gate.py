@@ -0,0 +1,264 @@
+#!/usr/bin/env python3
+
+"""Performance regression gate.
+
+Measures the runtime benchmarks (bench/run.py), the compile time of the
+benchmark programs and of a generated program (bench/genprog.py), the
+number of LLVM IR instructions the compiler emits and the size of the code
+of the executables, and compares them with a baseline file.
+
+Timed metrics keep every repetition. A timed metric regresses when its
+median grew by more than --threshold and a one-sided Mann-Whitney U test
+says the new samples are larger with p < --alpha; counted metrics are
+deterministic, so any growth beyond --count-threshold is a regression.
+Run with --update to write the measurements as the new baseline.
+"""
+
+import argparse
+import itertools
+import json
+import math
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+
+import compile_time
+import genprog
+import inputs
+import run
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+BASELINE = os.path.join(BENCH_DIR, 'baseline.json')
+
+# The exact distribution of U is enumerated up to this many arrangements
+EXACT_LIMIT = 20000
+
+
+def mann_whitney_greater(new, base):
+    """One-sided p-value of the hypothesis that `new` tends to be larger than `base`."""
+    n, m = len(new), len(base)
+    if n == 0 or m == 0:
+        return 1.0
+
+    def u_statistic(xs, ys):
+        return sum(1.0 if x > y else 0.5 if x == y else 0.0 for x in xs for y in ys)
+
+    u = u_statistic(new, base)
+    pooled = list(new) + list(base)
+    if math.comb(n + m, n) <= EXACT_LIMIT:
+        # Share of the ways to split the pooled samples whose U is at least as large
+        count = 0
+        total = 0
+        for chosen in itertools.combinations(range(n + m), n):
+            picked = set(chosen)
+            xs = [pooled[i] for i in picked]
+            ys = [pooled[i] for i in range(n + m) if i not in picked]
+            total += 1
+            if u_statistic(xs, ys) >= u - 1e-9:
+                count += 1
+        return count / total
+
+    # Normal approximation with the tie correction
+    ties = sum(c ** 3 - c for c in (pooled.count(v) for v in set(pooled)))
+    mean = n * m / 2
+    variance = n * m / 12 * ((n + m + 1) - ties / ((n + m) * (n + m - 1)))
+    if variance <= 0:
+        return 1.0
+    z = (u - mean - 0.5) / math.sqrt(variance)
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+
+def count_ir_instructions(ir):
+    """Instructions in the function bodies of a textual LLVM module."""
+    count = 0
+    in_function = False
+    for line in ir.splitlines():
+        if line.startswith('define '):
+            in_function = True
+        elif line.startswith('}'):
+            in_function = False
+        elif in_function and line.startswith('  ') and not line.lstrip().startswith(';'):
+            count += 1
+    return count
+
+
+def code_size(executable):
+    # The text segment as reported by size(1), or the whole file without it
+    if shutil.which('size'):
+        process = subprocess.run(['size', executable], text=True, capture_output=True)
+        lines = process.stdout.splitlines()
+        if process.returncode == 0 and len(lines) >= 2:
+            return int(lines[1].split()[0])
+    return os.path.getsize(executable)
+
+
+def measure(args):
+    alanc = os.path.abspath(args.alanc_path)
+    compiler = os.path.join(os.path.dirname(alanc), 'src', 'compiler')
+    metrics = {}
+    failures = []
+
+    def add(name, kind, samples):
+        metrics[name] = {'kind': kind, 'samples': samples}
+        print(f"  {name:45} {statistics.median(samples):.6g}", file=sys.stderr)
+
+    counters = run.PerfCounters()
+    with tempfile.TemporaryDirectory(prefix='alan_gate_') as work_dir:
+        # A generated program, so the compile time covers large inputs too
+        generated = os.path.join(work_dir, 'generated.alan')
+        with open(generated, 'w') as f:
+            f.write(genprog.generate())
+        sources = {'generated': generated}
+        sources.update({b: os.path.join(BENCH_DIR, 'programs', b + '.alan') for b in args.benchmark})
+
+        for level in args.opt:
+            flags = run.OPT_LEVELS[level]
+            for name, source in sources.items():
+                extra = run.BENCHMARKS.get(name, [])
+                times = []
+                for _ in range(args.repetitions):
+                    result = compile_time.run_compiler(compiler, source, flags + extra, args.timeout)
+                    if 'error' in result:
+                        failures.append(f"compile {name}.{level}: {result['error'].splitlines()[0]}")
+                        break
+                    times.append(result['total'])
+                if len(times) < args.repetitions:
+                    continue
+                add(f"compile_time/{name}.{level}", 'time', times)
+
+                with open(source, 'rb') as stdin:
+                    ir = subprocess.run([compiler, *flags, *extra], stdin=stdin, capture_output=True).stdout
+                add(f"ir_instructions/{name}.{level}", 'count', [count_ir_instructions(ir.decode())])
+
+                if name == 'generated':
+                    continue
+
+                executable = os.path.join(work_dir, f"{name}.{level}")
+                try:
+                    run.compile_benchmark(alanc, source, executable, flags + extra)
+                except RuntimeError as e:
+                    failures.append(f"build {name}.{level}: {str(e).splitlines()[0]}")
+                    continue
+                add(f"binary_size/{name}.{level}", 'count', [code_size(executable)])
+
+                input_file = os.path.join(work_dir, f"{name}.{args.scale}.input")
+                if not os.path.exists(input_file):
+                    with open(input_file, 'w') as f:
+                        f.write(inputs.generate(name, args.scale))
+                try:
+                    result = run.run_benchmark(executable, input_file, args.repetitions, counters, args.timeout)
+                except (RuntimeError, subprocess.TimeoutExpired) as e:
+                    failures.append(f"run {name}.{level}: {str(e).splitlines()[0]}")
+                    continue
+                add(f"runtime/{name}.{args.scale}.{level}", 'time', result['times'])
+    counters.close()
+    return metrics, failures
+
+
+def compare(baseline, metrics, args):
+    rows = []
+    for name in sorted(set(baseline) | set(metrics)):
+        if name not in metrics:
+            # Only metrics of the selected benchmarks and levels are missed
+            parts = name.split('/')[1].split('.')
+            if parts[0] in args.benchmark + ['generated'] and parts[-1] in args.opt:
+                rows.append((name, 'missing', None, None, None, None))
+            continue
+        if name not in baseline:
+            rows.append((name, 'new', None, statistics.median(metrics[name]['samples']), None, None))
+            continue
+
+        base = baseline[name]['samples']
+        new = metrics[name]['samples']
+        base_median = statistics.median(base)
+        new_median = statistics.median(new)
+        change = (new_median - base_median) / base_median if base_median else 0.0
+
+        if metrics[name]['kind'] == 'time':
+            p = mann_whitney_greater(new, base)
+            regressed = change > args.threshold and p < args.alpha
+            improved = change < -args.threshold and mann_whitney_greater(base, new) < args.alpha
+        else:
+            p = None
+            regressed = change > args.count_threshold
+            improved = change < -args.count_threshold
+        status = 'REGRESSED' if regressed else 'improved' if improved else 'ok'
+        rows.append((name, status, base_median, new_median, change, p))
+    return rows
+
+
+def print_report(rows, failures):
+    def fmt(value):
+        return '-' if value is None else f"{value:.6g}"
+
+    print(f"{'metric':45} {'baseline':>12} {'current':>12} {'change':>8} {'p':>7}  status")
+    for name, status, base, new, change, p in rows:
+        change_text = '-' if change is None else f"{change * 100:+.1f}%"
+        p_text = '-' if p is None else f"{p:.3f}"
+        print(f"{name:45} {fmt(base):>12} {fmt(new):>12} {change_text:>8} {p_text:>7}  {status}")
+
+    regressions = [r for r in rows if r[1] == 'REGRESSED']
+    if regressions:
+        print(f"\n{len(regressions)} metric(s) regressed:")
+        for name, _, base, new, change, p in regressions:
+            detail = f", p = {p:.3f}" if p is not None else ""
+            print(f"  {name}: {fmt(base)} -> {fmt(new)} ({change * 100:+.1f}%{detail})")
+    for failure in failures:
+        print(f"FAILED: {failure}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Fails when a benchmark metric regresses against the stored baseline.')
+    parser.add_argument('alanc_path', help='The path to the alanc script; the compiler is src/compiler next to it.')
+    parser.add_argument('--baseline', default=BASELINE, help='The baseline file (default: bench/baseline.json).')
+    parser.add_argument('--update', action='store_true', help='Write the measurements to the baseline file instead of comparing.')
+    parser.add_argument('--benchmark', choices=run.BENCHMARKS, action='append', help='Benchmark to measure (default: all).')
+    parser.add_argument('--opt', choices=run.OPT_LEVELS, action='append', help='Optimization level (default: all).')
+    parser.add_argument('--scale', choices=inputs.SCALES, default='medium', help='Input scale of the runtime benchmarks (default: medium).')
+    parser.add_argument('-n', '--repetitions', type=int, default=7, help='Repetitions of every timed metric (default: 7).')
+    parser.add_argument('--threshold', type=float, default=0.05, help='Relative growth of a timed median that counts as a regression (default: 0.05).')
+    parser.add_argument('--count-threshold', type=float, default=0.01, help='Relative growth of a counted metric that counts as a regression (default: 0.01).')
+    parser.add_argument('--alpha', type=float, default=0.05, help='Significance level of the Mann-Whitney test (default: 0.05).')
+    parser.add_argument('--timeout', type=float, default=300, help='Seconds before a compilation or run is aborted (default: 300).')
+    parser.add_argument('-o', '--output', help='Also write the measurements and the comparison as JSON to this file.')
+
+    args = parser.parse_args()
+    args.benchmark = args.benchmark or list(run.BENCHMARKS)
+    args.opt = args.opt or list(run.OPT_LEVELS)
+
+    metrics, failures = measure(args)
+    report = {'machine': platform.machine(), 'scale': args.scale, 'repetitions': args.repetitions, 'metrics': metrics}
+
+    if args.update:
+        with open(args.baseline, 'w') as f:
+            json.dump(report, f, indent=1)
+            f.write("\n")
+        print(f"Wrote {len(metrics)} metrics to {args.baseline}")
+        for failure in failures:
+            print(f"FAILED: {failure}")
+        return 1 if failures else 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    if baseline.get('scale') != args.scale:
+        print(f"The baseline was measured at scale '{baseline.get('scale')}', not '{args.scale}'", file=sys.stderr)
+        return 2
+    rows = compare(baseline['metrics'], metrics, args)
+    print_report(rows, failures)
+
+    if args.output:
+        report['comparison'] = [dict(zip(['metric', 'status', 'baseline', 'current', 'change', 'p'], row)) for row in rows]
+        report['failures'] = failures
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2)
+
+    regressed = any(row[1] == 'REGRESSED' for row in rows)
+    return 1 if regressed or failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
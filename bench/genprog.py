@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+
+"""Generator of large synthetic Alan programs for the compile-time benchmarks.
+
+The program is a chain of nested functions (main, f1 inside main, f2 inside
+f1, ...). Main declares the variables v0, v1, ... and the helper functions
+h0, h1, ..., which every level calls; the innermost function assigns to the
+first variables of main, so they are captured through the whole chain. The
+statements are spread over the levels of the chain and are assignments,
+helper calls and `if` statements whose expressions have a fixed depth.
+
+The programs compile, but they are not meant to be run.
+"""
+
+import argparse
+import random
+import sys
+
+DEFAULTS = {
+    'statements': 2000,
+    'depth': 4,
+    'captures': 8,
+    'expr_depth': 4,
+    'identifiers': 50,
+    'functions': 20,
+}
+
+
+class Generator:
+    def __init__(self, statements, depth, captures, expr_depth, identifiers, functions, seed):
+        self.statements = statements
+        self.depth = depth
+        self.captures = min(captures, identifiers)
+        self.expr_depth = expr_depth
+        self.identifiers = identifiers
+        self.functions = functions
+        self.rng = random.Random(seed)
+        self.out = []
+
+    def emit(self, indent, line):
+        self.out.append('    ' * indent + line)
+
+    def expr(self, names, depth):
+        if depth <= 1:
+            choice = self.rng.random()
+            if choice < 0.6:
+                return self.rng.choice(names)
+            if choice < 0.8 or not self.functions:
+                return str(self.rng.randint(0, 100))
+            return f"h{self.rng.randrange(self.functions)}({self.rng.choice(names)})"
+        # Left-deep, so the size grows linearly with the depth
+        op = self.rng.choice(['+', '-', '*'])
+        return f"({self.expr(names, depth - 1)} {op} {self.expr(names, 1)})"
+
+    def stmt(self, indent, names, targets):
+        choice = self.rng.random()
+        target = self.rng.choice(targets)
+        if choice < 0.75 or not self.functions:
+            self.emit(indent, f"{target} = {self.expr(names, self.expr_depth)};")
+        elif choice < 0.9:
+            self.emit(indent, f"{target} = h{self.rng.randrange(self.functions)}({self.expr(names, self.expr_depth)});")
+        else:
+            self.emit(indent, f"if ({self.expr(names, self.expr_depth)} < {self.expr(names, 2)})")
+            self.emit(indent + 1, f"{target} = {self.expr(names, self.expr_depth)};")
+
+    def function(self, level, indent, outer):
+        locals_ = [f"l{level}_{i}" for i in range(max(1, self.identifiers // (self.depth + 1)))]
+        name = f"f{level}"
+        self.emit(indent, f"{name} (p{level} : int) : proc")
+        for var in locals_:
+            self.emit(indent + 1, f"{var} : int;")
+        if level < self.depth:
+            self.function(level + 1, indent + 1, outer)
+
+        names = locals_ + [f"p{level}"]
+        targets = locals_
+        if level == self.depth:
+            names = names + outer
+            targets = targets + outer
+
+        self.emit(indent, "{")
+        for _ in range(self.share(level)):
+            self.stmt(indent + 1, names, targets)
+        if level < self.depth:
+            self.emit(indent + 1, f"f{level + 1}({locals_[0]});")
+        self.emit(indent, "}")
+
+    def share(self, level):
+        # Statements of a level of the chain; main is level 0
+        count = self.statements // (self.depth + 1)
+        if level < self.statements % (self.depth + 1):
+            count += 1
+        return count
+
+    def generate(self):
+        variables = [f"v{i}" for i in range(self.identifiers)]
+
+        self.emit(0, "main () : proc")
+        for var in variables:
+            self.emit(1, f"{var} : int;")
+        for i in range(self.functions):
+            self.emit(1, f"h{i} (x : int) : int {{ return x + {i}; }}")
+        if self.depth > 0:
+            self.function(1, 1, variables[:self.captures])
+
+        self.emit(0, "{")
+        for _ in range(self.share(0)):
+            self.stmt(1, variables, variables)
+        if self.depth > 0:
+            self.emit(1, "f1(v0);")
+        self.emit(0, "}")
+        return "\n".join(self.out) + "\n"
+
+
+def generate(seed=42, **params):
+    values = dict(DEFAULTS)
+    values.update(params)
+    return Generator(seed=seed, **values).generate()
+
+
+def add_arguments(parser):
+    parser.add_argument('--statements', type=int, default=DEFAULTS['statements'], help='Number of statements.')
+    parser.add_argument('--depth', type=int, default=DEFAULTS['depth'], help='Nesting depth of the function definitions.')
+    parser.add_argument('--captures', type=int, default=DEFAULTS['captures'], help='Variables of main used by the innermost function.')
+    parser.add_argument('--expr-depth', type=int, default=DEFAULTS['expr_depth'], help='Depth of the expressions.')
+    parser.add_argument('--identifiers', type=int, default=DEFAULTS['identifiers'], help='Variables declared in main.')
+    parser.add_argument('--functions', type=int, default=DEFAULTS['functions'], help='Helper functions declared in main.')
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Writes a synthetic Alan program to stdout.')
+    add_arguments(parser)
+    parser.add_argument('--seed', type=int, default=42, help='Seed of the random choices.')
+
+    args = parser.parse_args()
+    sys.stdout.write(generate(seed=args.seed, statements=args.statements, depth=args.depth, captures=args.captures,
+                              expr_depth=args.expr_depth, identifiers=args.identifiers, functions=args.functions))
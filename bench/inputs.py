@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+
+"""Input generators for the runtime benchmarks in bench/programs.
+
+Every benchmark has an input at each scale; the inputs are generated from a
+fixed seed, so all runs of a scale see the same data. Run this script to
+write the inputs to a directory, e.g. to feed a benchmark by hand.
+"""
+
+import argparse
+import os
+import random
+
+SCALES = ['small', 'medium', 'large']
+
+WORDS = ['alan', 'compiler', 'closure', 'generator', 'array', 'byte', 'integer',
+         'loop', 'frame', 'register', 'vector', 'branch', 'string', 'reference']
+
+
+def sieve(scale, rng):
+    n = {'small': 100000, 'medium': 1000000, 'large': 10000000}[scale]
+    return f"{n}\n"
+
+
+def fib(scale, rng):
+    n = {'small': 27, 'medium': 32, 'large': 37}[scale]
+    return f"{n}\n"
+
+
+def knapsack(scale, rng):
+    n, w_max = {'small': (100, 10000), 'medium': (500, 50000), 'large': (1000, 200000)}[scale]
+    lines = [f"{n} {w_max}"]
+    for _ in range(n):
+        lines.append(f"{rng.randint(1, 1000)} {rng.randint(1, w_max // 10)}")
+    return "\n".join(lines) + "\n"
+
+
+def msort(scale, rng):
+    n = {'small': 100000, 'medium': 1000000, 'large': 5000000}[scale]
+    return f"{n} {rng.randint(1, 1000000)}\n"
+
+
+def strings(scale, rng):
+    n = {'small': 10000, 'medium': 100000, 'large': 1000000}[scale]
+    lines = [str(n)]
+    for _ in range(n):
+        words = [rng.choice(WORDS) for _ in range(rng.randint(1, 20))]
+        lines.append(" ".join(words)[:255])
+    return "\n".join(lines) + "\n"
+
+
+def io(scale, rng):
+    n = {'small': 100000, 'medium': 1000000, 'large': 5000000}[scale]
+    values = [str(rng.randint(-1000000, 1000000)) for _ in range(n)]
+    return f"{n}\n" + "\n".join(values) + "\n"
+
+
+GENERATORS = {
+    'sieve': sieve,
+    'fib': fib,
+    'knapsack': knapsack,
+    'msort': msort,
+    'strings': strings,
+    'io': io,
+}
+
+
+def generate(benchmark, scale, seed=42):
+    return GENERATORS[benchmark](scale, random.Random(f"{seed}:{benchmark}:{scale}"))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Writes the inputs of the runtime benchmarks as <benchmark>.<scale>.input files.')
+    parser.add_argument('output_dir', help='Directory to write the input files to.')
+    parser.add_argument('--scale', choices=SCALES, action='append', help='Scale to generate (default: all).')
+    parser.add_argument('--seed', type=int, default=42, help='Seed of the generated data.')
+
+    args = parser.parse_args()
+
+    os.makedirs(args.output_dir, exist_ok=True)
+    for benchmark in GENERATORS:
+        for scale in args.scale or SCALES:
+            with open(os.path.join(args.output_dir, f"{benchmark}.{scale}.input"), 'w') as f:
+                f.write(generate(benchmark, scale, args.seed))
@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+
+"""Runtime benchmark harness.
+
+Compiles every benchmark in bench/programs at each optimization level, runs
+it on the inputs of bench/inputs.py and reports, per benchmark, scale and
+level, the median and standard deviation of the wall clock time over the
+repetitions, together with the instructions and cycles spent when the
+kernel lets us count them with perf_event_open.
+"""
+
+import argparse
+import ctypes
+import fcntl
+import hashlib
+import json
+import os
+import platform
+import resource
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+import inputs
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+OPT_LEVELS = {'O0': [], 'O': ['-O']}
+
+# Compiler flags of every benchmark; the large arrays of sieve and msort
+# would overflow the stack
+BENCHMARKS = {
+    'sieve': ['-fvla-heap-threshold=65536'],
+    'fib': [],
+    'knapsack': ['-fvla-heap-threshold=65536'],
+    'msort': ['-fvla-heap-threshold=65536'],
+    'strings': [],
+    'io': [],
+}
+
+
+class PerfCounters:
+    """Hardware counters of the processes started while they are enabled.
+
+    The counters are opened on this process with inherit set, so they also
+    count its children; the few instructions spent spawning and waiting
+    for the child are included.
+    """
+
+    SYSCALL = {'x86_64': 298, 'aarch64': 241}
+    EVENTS = {'instructions': 1, 'cycles': 0}   # PERF_COUNT_HW_*
+    ENABLE, DISABLE, RESET = 0x2400, 0x2401, 0x2403
+
+    def __init__(self):
+        self.fds = {}
+        number = self.SYSCALL.get(platform.machine())
+        if number is None:
+            return
+
+        libc = ctypes.CDLL(None, use_errno=True)
+        for name, config in self.EVENTS.items():
+            # struct perf_event_attr (PERF_ATTR_SIZE_VER0): type PERF_TYPE_HARDWARE,
+            # flags disabled | inherit | exclude_kernel | exclude_hv
+            flags = (1 << 0) | (1 << 1) | (1 << 5) | (1 << 6)
+            attr = struct.pack('IIQQQQQIIQ', 0, 64, config, 0, 0, 0, flags, 0, 0, 0)
+            buffer = ctypes.create_string_buffer(attr, len(attr))
+            fd = libc.syscall(number, buffer, 0, -1, -1, 0)
+            if fd < 0:
+                self.close()
+                return
+            self.fds[name] = fd
+
+    def available(self):
+        return bool(self.fds)
+
+    def start(self):
+        for fd in self.fds.values():
+            fcntl.ioctl(fd, self.RESET, 0)
+            fcntl.ioctl(fd, self.ENABLE, 0)
+
+    def stop(self):
+        counts = {}
+        for name, fd in self.fds.items():
+            fcntl.ioctl(fd, self.DISABLE, 0)
+            counts[name] = struct.unpack('Q', os.read(fd, 8))[0]
+        return counts
+
+    def close(self):
+        for fd in self.fds.values():
+            os.close(fd)
+        self.fds = {}
+
+
+def compile_benchmark(compiler, source, executable, flags):
+    start = time.perf_counter()
+    process = subprocess.run([compiler, *flags, '-o', executable, source], text=True, capture_output=True)
+    elapsed = time.perf_counter() - start
+    if process.returncode != 0:
+        raise RuntimeError(f"compiling {source} failed:\n{process.stdout}{process.stderr}")
+    return elapsed
+
+
+def run_benchmark(executable, input_file, repetitions, counters, timeout):
+    times = []
+    counts = []
+    digest = None
+    for _ in range(repetitions):
+        with open(input_file, 'rb') as stdin:
+            counters.start()
+            start = time.perf_counter()
+            process = subprocess.run([executable], stdin=stdin, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                                     timeout=timeout)
+            times.append(time.perf_counter() - start)
+            if counters.available():
+                counts.append(counters.stop())
+
+        if process.returncode != 0:
+            raise RuntimeError(f"{executable} exited with status {process.returncode}:\n{process.stderr.decode()}")
+        digest = hashlib.sha1(process.stdout).hexdigest()
+
+    result = {
+        'times': times,
+        'median': statistics.median(times),
+        'stddev': statistics.stdev(times) if len(times) > 1 else 0.0,
+        'output_sha1': digest,
+    }
+    for name in PerfCounters.EVENTS:
+        result[name] = int(statistics.median(c[name] for c in counts)) if counts else None
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Runs the runtime benchmarks and reports the results as JSON.')
+    parser.add_argument('compiler_path', help='The path to the alanc script.')
+    parser.add_argument('--benchmark', choices=BENCHMARKS, action='append', help='Benchmark to run (default: all).')
+    parser.add_argument('--scale', choices=inputs.SCALES, action='append', help='Input scale (default: small and medium).')
+    parser.add_argument('--opt', choices=OPT_LEVELS, action='append', help='Optimization level (default: all).')
+    parser.add_argument('-n', '--repetitions', type=int, default=5, help='Runs of every benchmark (default: 5).')
+    parser.add_argument('--timeout', type=float, default=300, help='Seconds before a run is aborted (default: 300).')
+    parser.add_argument('-o', '--output', help='Write the JSON results to this file instead of stdout.')
+
+    args = parser.parse_args()
+    compiler = os.path.abspath(args.compiler_path)
+    benchmarks = args.benchmark or list(BENCHMARKS)
+    scales = args.scale or ['small', 'medium']
+    levels = args.opt or list(OPT_LEVELS)
+
+    counters = PerfCounters()
+    have_counters = counters.available()
+    if not have_counters:
+        print("perf_event_open is not available; instructions and cycles are not reported", file=sys.stderr)
+
+    results = []
+    failures = []
+    with tempfile.TemporaryDirectory(prefix='alan_bench_') as work_dir:
+        for benchmark in benchmarks:
+            source = os.path.join(BENCH_DIR, 'programs', benchmark + '.alan')
+            for level in levels:
+                executable = os.path.join(work_dir, f"{benchmark}.{level}")
+                try:
+                    compile_time = compile_benchmark(compiler, source, executable, OPT_LEVELS[level] + BENCHMARKS[benchmark])
+                except RuntimeError as e:
+                    failures.append({'benchmark': benchmark, 'opt': level, 'error': str(e)})
+                    print(e, file=sys.stderr)
+                    continue
+
+                for scale in scales:
+                    input_file = os.path.join(work_dir, f"{benchmark}.{scale}.input")
+                    if not os.path.exists(input_file):
+                        with open(input_file, 'w') as f:
+                            f.write(inputs.generate(benchmark, scale))
+
+                    before = resource.getrusage(resource.RUSAGE_CHILDREN)
+                    try:
+                        result = run_benchmark(executable, input_file, args.repetitions, counters, args.timeout)
+                    except (RuntimeError, subprocess.TimeoutExpired) as e:
+                        counters.stop()
+                        failures.append({'benchmark': benchmark, 'scale': scale, 'opt': level, 'error': str(e)})
+                        print(e, file=sys.stderr)
+                        continue
+                    after = resource.getrusage(resource.RUSAGE_CHILDREN)
+
+                    result.update({
+                        'benchmark': benchmark,
+                        'scale': scale,
+                        'opt': level,
+                        'compile_time': compile_time,
+                        'cpu_time': (after.ru_utime + after.ru_stime - before.ru_utime - before.ru_stime) / args.repetitions,
+                    })
+                    results.append(result)
+                    print(f"{benchmark:10} {scale:7} {level:3} median {result['median']:.4f}s "
+                          f"stddev {result['stddev']:.4f}s", file=sys.stderr)
+
+    counters.close()
+
+    # Every optimization level has to compute the same output
+    mismatches = []
+    for benchmark in benchmarks:
+        for scale in scales:
+            digests = {r['output_sha1'] for r in results if r['benchmark'] == benchmark and r['scale'] == scale}
+            if len(digests) > 1:
+                mismatches.append(f"{benchmark}.{scale}")
+                print(f"Output of {benchmark} ({scale}) differs between optimization levels", file=sys.stderr)
+
+    report = {
+        'compiler': compiler,
+        'machine': platform.machine(),
+        'repetitions': args.repetitions,
+        'perf_counters': have_counters,
+        'results': results,
+        'mismatches': mismatches,
+        'failures': failures,
+    }
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+    return 1 if mismatches or failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 void writeInteger(int n) {
   printf("%d", n);
@@ -101,3 +102,598 @@ void strcat(char* trg, char* src) {
   }
   trg[i] = '\0';
 }
+
+/* Called by the checks that -ftrapv, -fcheck-div and -fcheck-bounds insert, and by the
+   check of the size of runtime-sized arrays; error codes match enum RuntimeError in the
+   compiler */
+void __alan_runtime_error(int error, int line, int column) {
+  static const char* messages[] = {"integer overflow", "division by zero", "array index out of bounds",
+                                   "array size is not positive"};
+  fflush(stdout);
+  fprintf(stderr, "Runtime Error at line %d, column %d: %s.\n", line, column, messages[error]);
+  exit(1);
+}
+
+/* Function profile of -fprofile-functions. The compiler calls __alan_profile_enter
+   at the entry of every function and __alan_profile_exit before every return. Each
+   thread counts calls and cycles in buffers of its own: per function, and per node
+   of its calling context tree, which holds the exclusive cycles of each call stack.
+   At exit the profile is written to $ALAN_PROFILE.txt (a flat profile sorted by
+   exclusive cycles) and $ALAN_PROFILE.folded (collapsed stacks for flame graphs);
+   ALAN_PROFILE defaults to "alan-profile". */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PROFILE_UNIT "cycles"
+static unsigned long long profileClock(void) {
+  return __builtin_ia32_rdtsc();
+}
+#else
+#define PROFILE_UNIT "ns"
+static unsigned long long profileClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+typedef struct ProfileNode {
+  int function;
+  unsigned long long calls;
+  unsigned long long cycles;
+  struct ProfileNode *parent;
+  struct ProfileNode *child;
+  struct ProfileNode *sibling;
+} ProfileNode;
+
+typedef struct {
+  const char *name;
+  unsigned long long calls;
+  unsigned long long inclusive;
+  unsigned long long exclusive;
+  int active;  /* calls on the stack; only the outermost one adds inclusive cycles */
+} ProfileFunction;
+
+typedef struct {
+  ProfileNode *node;
+  int function;
+  unsigned long long start;
+  unsigned long long children;  /* cycles spent in the calls it made */
+} ProfileFrame;
+
+typedef struct ProfileThread {
+  ProfileFunction *functions;
+  int functionCount;
+  ProfileFrame *frames;
+  int depth;
+  int frameCapacity;
+  ProfileNode root;
+  struct ProfileThread *next;
+} ProfileThread;
+
+static __thread ProfileThread *profileThread;
+static ProfileThread *profileThreads;
+
+static void *profileAlloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory for the function profile.\n");
+    exit(1);
+  }
+  return p;
+}
+
+static void profileDump(void);
+
+static ProfileThread *profileStart(void) {
+  ProfileThread *t = calloc(1, sizeof(ProfileThread));
+  if (t == NULL) {
+    fprintf(stderr, "Out of memory for the function profile.\n");
+    exit(1);
+  }
+  t->root.function = -1;
+  t->next = __atomic_load_n(&profileThreads, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&profileThreads, &t->next, t, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+  if (t->next == NULL) {
+    atexit(profileDump);
+  }
+  profileThread = t;
+  return t;
+}
+
+void __alan_profile_enter(int function, const char *name) {
+  ProfileThread *t = profileThread ? profileThread : profileStart();
+
+  if (function >= t->functionCount) {
+    int count = function + 16;
+    t->functions = profileAlloc(t->functions, count * sizeof(ProfileFunction));
+    for (int i = t->functionCount; i < count; i++) {
+      t->functions[i].name = NULL;
+      t->functions[i].calls = t->functions[i].inclusive = t->functions[i].exclusive = 0;
+      t->functions[i].active = 0;
+    }
+    t->functionCount = count;
+  }
+  ProfileFunction *f = &t->functions[function];
+  f->name = name;
+  f->calls++;
+
+  /* A recursive call is folded into the node of the outermost active call of
+     the function, so the tree only grows with the distinct call stacks */
+  ProfileNode *parent = t->depth > 0 ? t->frames[t->depth - 1].node : &t->root;
+  ProfileNode *node = NULL;
+  if (f->active > 0) {
+    for (node = parent; node->function != function; node = node->parent) {
+    }
+  } else {
+    for (node = parent->child; node != NULL && node->function != function; node = node->sibling) {
+    }
+    if (node == NULL) {
+      node = profileAlloc(NULL, sizeof(ProfileNode));
+      node->function = function;
+      node->calls = node->cycles = 0;
+      node->parent = parent;
+      node->child = NULL;
+      node->sibling = parent->child;
+      parent->child = node;
+    }
+  }
+  node->calls++;
+  f->active++;
+
+  if (t->depth == t->frameCapacity) {
+    t->frameCapacity = t->frameCapacity ? 2 * t->frameCapacity : 64;
+    t->frames = profileAlloc(t->frames, t->frameCapacity * sizeof(ProfileFrame));
+  }
+  ProfileFrame *frame = &t->frames[t->depth++];
+  frame->node = node;
+  frame->function = function;
+  frame->children = 0;
+  frame->start = profileClock();
+}
+
+static void profileLeave(ProfileThread *t, unsigned long long now) {
+  ProfileFrame *frame = &t->frames[--t->depth];
+  unsigned long long elapsed = now - frame->start;
+  unsigned long long exclusive = elapsed - frame->children;
+  ProfileFunction *f = &t->functions[frame->function];
+
+  frame->node->cycles += exclusive;
+  f->exclusive += exclusive;
+  if (--f->active == 0) {
+    f->inclusive += elapsed;
+  }
+  if (t->depth > 0) {
+    t->frames[t->depth - 1].children += elapsed;
+  }
+}
+
+void __alan_profile_exit(void) {
+  profileLeave(profileThread, profileClock());
+}
+
+static void profileFolded(FILE *out, ProfileThread *t, ProfileNode *node, const char **stack, int depth) {
+  if (node->function >= 0) {
+    stack[depth++] = t->functions[node->function].name;
+    if (node->cycles > 0) {
+      for (int i = 0; i < depth; i++) {
+        fprintf(out, "%s%s", i ? ";" : "", stack[i]);
+      }
+      fprintf(out, " %llu\n", node->cycles);
+    }
+  }
+  for (ProfileNode *child = node->child; child != NULL; child = child->sibling) {
+    profileFolded(out, t, child, stack, depth);
+  }
+}
+
+static ProfileFunction *profileTotals;
+
+static int profileByExclusive(const void *a, const void *b) {
+  const ProfileFunction *x = &profileTotals[*(const int *)a];
+  const ProfileFunction *y = &profileTotals[*(const int *)b];
+  return x->exclusive < y->exclusive ? 1 : x->exclusive > y->exclusive ? -1 : 0;
+}
+
+static void profileDump(void) {
+  const char *prefix = getenv("ALAN_PROFILE");
+  char path[4096];
+  unsigned long long now = profileClock();
+  unsigned long long total = 0;
+  int count = 0;
+
+  if (prefix == NULL || prefix[0] == '\0') {
+    prefix = "alan-profile";
+  }
+
+  /* Calls still on the stack (after a runtime error) end now; the totals of
+     all threads are added up by function */
+  for (ProfileThread *t = profileThreads; t != NULL; t = t->next) {
+    while (t->depth > 0) {
+      profileLeave(t, now);
+    }
+    if (t->functionCount > count) {
+      count = t->functionCount;
+    }
+  }
+  profileTotals = profileAlloc(NULL, (count + 1) * sizeof(ProfileFunction));
+  int *order = profileAlloc(NULL, (count + 1) * sizeof(int));
+  for (int i = 0; i < count; i++) {
+    profileTotals[i].name = NULL;
+    profileTotals[i].calls = profileTotals[i].inclusive = profileTotals[i].exclusive = 0;
+    order[i] = i;
+  }
+  for (ProfileThread *t = profileThreads; t != NULL; t = t->next) {
+    for (int i = 0; i < t->functionCount; i++) {
+      if (t->functions[i].name != NULL) {
+        profileTotals[i].name = t->functions[i].name;
+      }
+      profileTotals[i].calls += t->functions[i].calls;
+      profileTotals[i].inclusive += t->functions[i].inclusive;
+      profileTotals[i].exclusive += t->functions[i].exclusive;
+      total += t->functions[i].exclusive;
+    }
+  }
+  qsort(order, count, sizeof(int), profileByExclusive);
+
+  snprintf(path, sizeof(path), "%s.txt", prefix);
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot write the function profile to %s.\n", path);
+    return;
+  }
+  fprintf(out, "Flat profile, %llu %s in total\n\n", total, PROFILE_UNIT);
+  fprintf(out, "%7s %16s %16s %12s %14s  %s\n", "self%", "self", "inclusive", "calls", "self/call", "function");
+  for (int i = 0; i < count; i++) {
+    ProfileFunction *f = &profileTotals[order[i]];
+    if (f->calls == 0) {
+      continue;
+    }
+    fprintf(out, "%6.2f%% %16llu %16llu %12llu %14.1f  %s\n",
+            total ? 100.0 * f->exclusive / total : 0.0, f->exclusive, f->inclusive, f->calls,
+            (double)f->exclusive / f->calls, f->name);
+  }
+  fclose(out);
+
+  snprintf(path, sizeof(path), "%s.folded", prefix);
+  out = fopen(path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot write the function profile to %s.\n", path);
+    return;
+  }
+  const char **stack = profileAlloc(NULL, (count + 1) * sizeof(const char *));
+  for (ProfileThread *t = profileThreads; t != NULL; t = t->next) {
+    profileFolded(out, t, &t->root, stack, 0);
+  }
+  fclose(out);
+}
+
+/* Line coverage of -fcoverage. The compiler describes the control flow graph of
+   every function it instruments: per block, its counter (generators only) and the
+   source positions of the statements that start in it; per edge, its source, its
+   target (the virtual exit block for returns) and its counter, or -1 for the edges
+   of a spanning tree. At exit the counts of those edges and of the blocks are
+   derived by flow conservation, and the program is written to $ALAN_COVERAGE
+   (by default alan-coverage.txt) with the count of every line. */
+
+typedef struct {
+  long long count;
+  long long in, out;  /* sums of the known edges */
+  int unknownIn, unknownOut;
+  int known;
+} CoverageNode;
+
+static int coverageFunctionCount;
+static const int *coverageGraph;
+static const int *coveragePositions;
+static const long long *coverageCounters;
+static const char *coverageSource;
+
+static void coverageDump(void);
+
+void __alan_coverage_init(int functions, const int *graph, const int *positions, const long long *counters,
+                          const char *source) {
+  coverageFunctionCount = functions;
+  coverageGraph = graph;
+  coveragePositions = positions;
+  coverageCounters = counters;
+  coverageSource = source;
+  atexit(coverageDump);
+}
+
+static void *coverageAlloc(size_t size) {
+  void *p = calloc(size ? size : 1, 1);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory for the coverage report.\n");
+    exit(1);
+  }
+  return p;
+}
+
+typedef struct {
+  const int *edges;  /* source, target and counter of each edge */
+  CoverageNode *nodes;
+  long long *edgeCounts;
+  char *edgeKnown;
+  int *work;
+  int top;
+} CoverageSolver;
+
+static void coverageSetEdge(CoverageSolver *s, int e, long long count) {
+  int src = s->edges[3 * e], dst = s->edges[3 * e + 1];
+  s->edgeCounts[e] = count;
+  s->edgeKnown[e] = 1;
+  s->nodes[src].out += count;
+  s->nodes[src].unknownOut--;
+  s->nodes[dst].in += count;
+  s->nodes[dst].unknownIn--;
+  s->work[s->top++] = src;
+  s->work[s->top++] = dst;
+}
+
+/* Derives the counts of the blocks of one function with a worklist: a node whose
+   edges in (or out) are all known has their sum as count, and a known node with
+   one unknown edge in (or out) determines it. Returns the next function. */
+static const int *coverageSolve(const int *graph, long long *blockCounts) {
+  int blocks = graph[0], edgeCount = graph[1], nodeCount = blocks + 1;
+  const int *block = graph + 2;
+  CoverageSolver s;
+  s.edges = block + 3 * blocks;
+  s.nodes = coverageAlloc(nodeCount * sizeof(CoverageNode));
+  s.edgeCounts = coverageAlloc(edgeCount * sizeof(long long));
+  s.edgeKnown = coverageAlloc(edgeCount);
+  s.work = coverageAlloc((2 * edgeCount + nodeCount) * sizeof(int));
+  s.top = 0;
+
+  /* The edges in and out of node n are in[inStart[n]..inStart[n + 1]) and
+     out[outStart[n]..outStart[n + 1]) */
+  int *inStart = coverageAlloc((nodeCount + 1) * sizeof(int));
+  int *outStart = coverageAlloc((nodeCount + 1) * sizeof(int));
+  int *in = coverageAlloc(edgeCount * sizeof(int));
+  int *out = coverageAlloc(edgeCount * sizeof(int));
+  for (int e = 0; e < edgeCount; e++) {
+    inStart[s.edges[3 * e + 1] + 1]++;
+    outStart[s.edges[3 * e] + 1]++;
+  }
+  for (int n = 0; n < nodeCount; n++) {
+    s.nodes[n].unknownIn = inStart[n + 1];
+    s.nodes[n].unknownOut = outStart[n + 1];
+    inStart[n + 1] += inStart[n];
+    outStart[n + 1] += outStart[n];
+  }
+  int *inFill = coverageAlloc(nodeCount * sizeof(int));
+  int *outFill = coverageAlloc(nodeCount * sizeof(int));
+  for (int e = 0; e < edgeCount; e++) {
+    int src = s.edges[3 * e], dst = s.edges[3 * e + 1];
+    in[inStart[dst] + inFill[dst]++] = e;
+    out[outStart[src] + outFill[src]++] = e;
+  }
+  free(inFill);
+  free(outFill);
+
+  for (int n = 0; n < blocks; n++) {
+    if (block[3 * n] >= 0) {
+      s.nodes[n].count = coverageCounters[block[3 * n]];
+      s.nodes[n].known = 1;
+    }
+  }
+  for (int n = 0; n < nodeCount; n++) {
+    s.work[s.top++] = n;
+  }
+  for (int e = 0; e < edgeCount; e++) {
+    if (s.edges[3 * e + 2] >= 0) {
+      coverageSetEdge(&s, e, coverageCounters[s.edges[3 * e + 2]]);
+    }
+  }
+
+  while (s.top > 0) {
+    int n = s.work[--s.top];
+    CoverageNode *v = &s.nodes[n];
+
+    if (!v->known) {
+      if (v->unknownIn == 0) {
+        v->count = v->in;  /* also 0 for the blocks no edge enters */
+      } else if (v->unknownOut == 0 && outStart[n + 1] > outStart[n]) {
+        v->count = v->out;
+      } else {
+        continue;
+      }
+      v->known = 1;
+    }
+    if (v->unknownIn == 1) {
+      for (int i = inStart[n]; i < inStart[n + 1]; i++) {
+        if (!s.edgeKnown[in[i]]) {
+          coverageSetEdge(&s, in[i], v->count - v->in);
+          break;
+        }
+      }
+    }
+    if (v->unknownOut == 1) {
+      for (int i = outStart[n]; i < outStart[n + 1]; i++) {
+        if (!s.edgeKnown[out[i]]) {
+          coverageSetEdge(&s, out[i], v->count - v->out);
+          break;
+        }
+      }
+    }
+  }
+
+  for (int b = 0; b < blocks; b++) {
+    blockCounts[b] = s.nodes[b].known ? s.nodes[b].count : -1;
+  }
+  free(s.nodes);
+  free(s.edgeCounts);
+  free(s.edgeKnown);
+  free(s.work);
+  free(inStart);
+  free(outStart);
+  free(in);
+  free(out);
+  return s.edges + 3 * edgeCount;
+}
+
+static void coverageDump(void) {
+  const char *path = getenv("ALAN_COVERAGE");
+  int lines = 1;
+
+  if (path == NULL || path[0] == '\0') {
+    path = "alan-coverage.txt";
+  }
+  for (const char *c = coverageSource; *c != '\0'; c++) {
+    lines += *c == '\n';
+  }
+
+  /* The count of a line is the largest count of the statements on it, or -1
+     if no statement starts on it */
+  long long *lineCounts = coverageAlloc((lines + 1) * sizeof(long long));
+  for (int i = 0; i <= lines; i++) {
+    lineCounts[i] = -1;
+  }
+  const int *graph = coverageGraph;
+  for (int f = 0; f < coverageFunctionCount; f++) {
+    int blocks = graph[0];
+    const int *block = graph + 2;
+    long long *blockCounts = coverageAlloc(blocks * sizeof(long long));
+    const int *next = coverageSolve(graph, blockCounts);
+    for (int b = 0; b < blocks; b++) {
+      /* Calls that a runtime error cut short leave their counts off by one */
+      long long count = blockCounts[b] < 0 ? 0 : blockCounts[b];
+      for (int p = 0; p < block[3 * b + 2]; p++) {
+        int line = coveragePositions[2 * (block[3 * b + 1] + p)];
+        if (line >= 1 && line <= lines && count > lineCounts[line]) {
+          lineCounts[line] = count;
+        }
+      }
+    }
+    free(blockCounts);
+    graph = next;
+  }
+
+  int executable = 0, executed = 0;
+  for (int i = 1; i <= lines; i++) {
+    executable += lineCounts[i] >= 0;
+    executed += lineCounts[i] > 0;
+  }
+
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot write the coverage report to %s.\n", path);
+    free(lineCounts);
+    return;
+  }
+  fprintf(out, "Lines executed: %.2f%% of %d\n\n", executable ? 100.0 * executed / executable : 0.0, executable);
+  const char *c = coverageSource;
+  for (int i = 1; i <= lines && *c != '\0'; i++) {
+    if (lineCounts[i] < 0) {
+      fprintf(out, "%9s:%5d:", "-", i);
+    } else if (lineCounts[i] == 0) {
+      fprintf(out, "%9s:%5d:", "#####", i);
+    } else {
+      fprintf(out, "%9lld:%5d:", lineCounts[i], i);
+    }
+    while (*c != '\0' && *c != '\n') {
+      fputc(*c++, out);
+    }
+    fputc('\n', out);
+    if (*c == '\n') {
+      c++;
+    }
+  }
+  fclose(out);
+  free(lineCounts);
+}
+
+/* Loop and branch profile (-fprofile-loops). The program passes a description
+   of every site, as (kind, line, column) triples with kinds as in enum
+   LoopProfileKind of the compiler, and the counters of each: for a while loop
+   LOOP_BUCKETS counts of executions by trip count, bucket 0 for no iterations
+   and bucket k for 2^(k-1) to 2^k - 1, then the total of the iterations; for
+   an if, a '&' and a '|' the counts of its condition (the left operand for
+   '&' and '|') being true and false.
+   At exit the sites are written in source order to $ALAN_LOOP_PROFILE (by
+   default alan-loops.txt). */
+
+#define LOOP_BUCKETS 65
+
+static int loopSiteCount;
+static const int *loopSites;
+static long long *const *loopCounts;
+
+static void loopDump(void);
+
+void __alan_loop_profile_init(int sites, const int *descriptions, long long *const *counts) {
+  loopSiteCount = sites;
+  loopSites = descriptions;
+  loopCounts = counts;
+  atexit(loopDump);
+}
+
+static int loopBySource(const void *a, const void *b) {
+  const int *x = loopSites + 3 * *(const int *)a;
+  const int *y = loopSites + 3 * *(const int *)b;
+  if (x[1] != y[1]) {
+    return x[1] < y[1] ? -1 : 1;
+  }
+  return x[2] < y[2] ? -1 : x[2] > y[2];
+}
+
+static void loopDump(void) {
+  static const char *kinds[] = {"while", "if", "&", "|"};
+  const char *path = getenv("ALAN_LOOP_PROFILE");
+
+  if (path == NULL || path[0] == '\0') {
+    path = "alan-loops.txt";
+  }
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot write the loop profile to %s.\n", path);
+    return;
+  }
+
+  int *order = malloc((loopSiteCount + 1) * sizeof(int));
+  for (int i = 0; i < loopSiteCount; i++) {
+    order[i] = i;
+  }
+  qsort(order, loopSiteCount, sizeof(int), loopBySource);
+
+  for (int i = 0; i < loopSiteCount; i++) {
+    const int *site = loopSites + 3 * order[i];
+    const long long *counts = loopCounts[order[i]];
+    fprintf(out, "%d:%d: %s", site[1], site[2], kinds[site[0]]);
+
+    if (site[0] != 0) {
+      long long total = counts[0] + counts[1];
+      fprintf(out, ": %lld true, %lld false", counts[0], counts[1]);
+      if (total > 0) {
+        fprintf(out, " (%.1f%% true)", 100.0 * counts[0] / total);
+      }
+      fprintf(out, "\n");
+      continue;
+    }
+
+    long long runs = 0;
+    for (int k = 0; k < LOOP_BUCKETS; k++) {
+      runs += counts[k];
+    }
+    fprintf(out, ": %lld runs, %lld iterations", runs, counts[LOOP_BUCKETS]);
+    if (runs > 0) {
+      fprintf(out, " (%.1f per run)", (double)counts[LOOP_BUCKETS] / runs);
+    }
+    fprintf(out, "\n");
+    for (int k = 0; k < LOOP_BUCKETS; k++) {
+      if (counts[k] == 0) {
+        continue;
+      }
+      if (k <= 1) {
+        fprintf(out, "  %21d: %lld\n", k, counts[k]);
+      } else {
+        unsigned long long low = 1ULL << (k - 1);
+        char range[48];
+        snprintf(range, sizeof(range), "%llu-%llu", low, low + (low - 1));
+        fprintf(out, "  %21s: %lld\n", range, counts[k]);
+      }
+    }
+  }
+  fclose(out);
+  free(order);
+}
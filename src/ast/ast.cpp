@@ -1,4 +1,6 @@
 #include "ast.hpp"
+#include <climits>
+#include <algorithm>
 
 std::string compareToString(compare op) {
     switch (op) {
@@ -24,6 +26,14 @@ TypeEnum Expr::getTypeEnum() const
     return type ? type->getType() : TypeEnum::ERROR;
 }
 
+// Computes bounds [lo, hi] for the value of an int expression. Returns false
+// when nothing is known, which is the case for every expression that reads
+// memory or calls a function.
+bool Expr::getRange(long long &lo, long long &hi) const
+{
+    return false;
+}
+
 // Stmt Class Method Implementations
 
 void Stmt::setExternal(bool e)
@@ -101,27 +111,6 @@ ParameterType Fpar::getParameterType() const {
     return parameterType;
 }
 
-// CapturedVar Class Method Implementations
-
-CapturedVar::CapturedVar(const std::string& name, Type* type, bool isParam, ParameterType paramType)
-    : name(name), type(type), isParam(isParam), parameterType(paramType) {}
-
-const std::string& CapturedVar::getName() const {
-    return name;
-}
-
-Type* CapturedVar::getType() const {
-    return type;
-}
-
-bool CapturedVar::getIsParam() const {
-    return isParam;
-}
-
-ParameterType CapturedVar::getParameterType() const {
-    return parameterType;
-}
-
 // FparList Class Method Implementations
 
 FparList::FparList(int line, int column) : AST(line, column), fpar() {}
@@ -145,10 +134,8 @@ const std::vector<Fpar *> &FparList::getParameters() const
 // FuncDef Class Method Implementations
 
 FuncDef::FuncDef(std::string *n, Type *t, LocalDefList *l, Stmt *s, FparList *f, int line, int column)
-    : LocalDef(line, column), name(n), fpar(f), type(t), localDef(l), stmts(s), hasReturn(false)
-{
-    capturedVars = std::vector<CapturedVar*>();
-}
+    : LocalDef(line, column), name(n), fpar(f), type(t), localDef(l), stmts(s), hasReturn(false), interpVars(0),
+      interpSlots(0) {}
 
 FuncDef::~FuncDef()
 {
@@ -169,11 +156,18 @@ void FuncDef::setReturn() {
 // VarDef Class Method Implementations
 
 VarDef::VarDef(std::string *n, Type *t, bool arr, int arraySize, int line, int column)
-    : LocalDef(line, column), name(n), type(t), size(arraySize), isArray(arr) {}
+    : LocalDef(line, column), name(n), type(t), size(arraySize), isArray(arr), sizeExpr(nullptr), interpSlot(-1) {}
+
+VarDef::VarDef(std::string *n, Type *t, Expr *sizeExpr, int line, int column)
+    : LocalDef(line, column), name(n), type(t), size(-1), isArray(true), sizeExpr(sizeExpr), interpSlot(-1) {}
 
 VarDef::~VarDef()
 {
     delete name;
+    if (sizeExpr)
+    {
+        delete sizeExpr;
+    }
 }
 
 // ExprList Class Method Implementations
@@ -205,9 +199,26 @@ UnOp::~UnOp()
     delete expr;
 }
 
+bool UnOp::getRange(long long &lo, long long &hi) const
+{
+    if (getTypeEnum() != TypeEnum::INT || !expr->getRange(lo, hi))
+    {
+        return false;
+    }
+
+    if (op == '-')
+    {
+        long long negLo = -hi;
+        hi = -lo;
+        lo = negLo;
+    }
+    return lo >= INT_MIN && hi <= INT_MAX;
+}
+
 // BinOp Class Method Implementations
 
-BinOp::BinOp(Expr *l, char o, Expr *r, int line, int column) : Expr(line, column), op(o), left(l), right(r) {}
+BinOp::BinOp(Expr *l, char o, Expr *r, int line, int column)
+    : Expr(line, column), op(o), left(l), right(r), leftLval(dynamic_cast<Lval *>(l)) {}
 
 BinOp::~BinOp()
 {
@@ -215,10 +226,65 @@ BinOp::~BinOp()
     delete right;
 }
 
+bool BinOp::getRange(long long &lo, long long &hi) const
+{
+    long long lLo, lHi, rLo, rHi;
+    if (getTypeEnum() != TypeEnum::INT || !left->getRange(lLo, lHi) || !right->getRange(rLo, rHi))
+    {
+        return false;
+    }
+
+    switch (op)
+    {
+    case '+':
+        lo = lLo + rLo;
+        hi = lHi + rHi;
+        break;
+    case '-':
+        lo = lLo - rHi;
+        hi = lHi - rLo;
+        break;
+    case '*':
+    {
+        long long corners[] = {lLo * rLo, lLo * rHi, lHi * rLo, lHi * rHi};
+        lo = *std::min_element(corners, corners + 4);
+        hi = *std::max_element(corners, corners + 4);
+        break;
+    }
+    case '/':
+    {
+        // Division is monotonic in each operand as long as the divisor keeps its sign
+        if (rLo <= 0 && rHi >= 0)
+        {
+            return false;
+        }
+        long long corners[] = {lLo / rLo, lLo / rHi, lHi / rLo, lHi / rHi};
+        lo = *std::min_element(corners, corners + 4);
+        hi = *std::max_element(corners, corners + 4);
+        break;
+    }
+    case '%':
+    {
+        if (rLo <= 0 && rHi >= 0)
+        {
+            return false;
+        }
+        long long bound = std::max(-rLo, rHi) - 1;
+        lo = lLo < 0 ? std::max(lLo, -bound) : 0;
+        hi = lHi > 0 ? std::min(lHi, bound) : 0;
+        break;
+    }
+    default:
+        return false;
+    }
+
+    return lo >= INT_MIN && hi <= INT_MAX;
+}
+
 // CondCompOp Class Method Implementations
 
 CondCompOp::CondCompOp(Expr *l, compare o, Expr *r, int line, int column)
-    : Cond(line, column), op(o), left(l), right(r) {}
+    : Cond(line, column), op(o), left(l), right(r), leftLval(dynamic_cast<Lval *>(l)) {}
 
 CondCompOp::~CondCompOp()
 {
@@ -255,6 +321,12 @@ int IntConst::getValue() const
     return val;
 }
 
+bool IntConst::getRange(long long &lo, long long &hi) const
+{
+    lo = hi = val;
+    return true;
+}
+
 // CharConst Class Method Implementations
 
 CharConst::CharConst(unsigned char c, int line, int column) : Expr(line, column), val(c) {}
@@ -325,9 +397,7 @@ Let::~Let()
 // FuncCall Class Method Implementations
 
 FuncCall::FuncCall(std::string *n, ExprList *e, int line, int column)
-    : Expr(line, column), name(n), exprs(e), isNested(false) {
-    capturedVars = std::vector<CapturedVar*>();
-}
+    : Expr(line, column), name(n), exprs(e), generatorUse(false), interpCallSite(nullptr), interpBuiltin(nullptr) {}
 
 FuncCall::~FuncCall()
 {
@@ -343,6 +413,10 @@ ExprList* FuncCall::getExprs() const {
     return exprs;
 }
 
+void FuncCall::setGeneratorUse(bool g) {
+    generatorUse = g;
+}
+
 // ProcCall Class Method Implementations
 
 ProcCall::ProcCall(FuncCall *f, int line, int column) : Stmt(line, column), funcCall(f) {}
@@ -366,14 +440,82 @@ If::~If()
     }
 }
 
+// LoopHint Class Method Implementations
+
+LoopHint::LoopHint(std::string *n, int v, int line, int column) : AST(line, column), name(n), value(v) {}
+
+LoopHint::~LoopHint()
+{
+    delete name;
+}
+
+const std::string &LoopHint::getName() const
+{
+    return *name;
+}
+
+int LoopHint::getValue() const
+{
+    return value;
+}
+
+// LoopHintList Class Method Implementations
+
+LoopHintList::LoopHintList(int line, int column) : AST(line, column), hints() {}
+
+LoopHintList::~LoopHintList()
+{
+    for (LoopHint *h : hints)
+        delete h;
+}
+
+void LoopHintList::append(LoopHint *hint)
+{
+    hints.push_back(hint);
+}
+
+bool LoopHintList::isIndependent() const
+{
+    for (LoopHint *h : hints)
+    {
+        if (h->getName() == "independent")
+            return true;
+    }
+    return false;
+}
+
 // While Class Method Implementations
 
-While::While(Cond *c, Stmt *b, int line, int column) : Stmt(line, column), cond(c), body(b) {}
+While::While(Cond *c, Stmt *b, LoopHintList *h, int line, int column) : Stmt(line, column), cond(c), body(b), hints(h) {}
 
 While::~While()
 {
     delete cond;
     delete body;
+    if (hints)
+    {
+        delete hints;
+    }
+}
+
+// For Class Method Implementations
+
+For::For(Lval *l, FuncCall *g, Stmt *b, int line, int column) : Stmt(line, column), lvalue(l), generator(g), body(b) {}
+
+For::~For()
+{
+    delete lvalue;
+    delete generator;
+    delete body;
+}
+
+// Yield Class Method Implementations
+
+Yield::Yield(Expr *e, int line, int column) : Stmt(line, column), expr(e) {}
+
+Yield::~Yield()
+{
+    delete expr;
 }
 
 // Return Class Method Implementations
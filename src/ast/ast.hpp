@@ -4,6 +4,8 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <unordered_set>
+#include <unordered_map>
 #include <llvm/IR/Value.h> 
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
@@ -15,13 +17,78 @@
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include "../lexer/lexer.hpp"
 #include "../symbol/types.hpp"
 #include "../symbol/symbol.hpp"
 #include "../codegen/codegen.hpp"
+#include "../mir/mir.hpp"
+#include "../vm/vm.hpp"
 
 std::string compareToString(compare op);
 
+extern int vlaHeapThreshold;
+extern bool trapOverflow;
+extern bool checkDivision;
+extern bool checkBounds;
+extern bool timePhases;
+extern bool printStats;
+extern bool stackUsage;
+extern bool profileFunctions;
+extern bool coverage;
+extern bool profileLoops;
+// The text of the program, when the compiler reads it before scanning: from
+// the source file of --jit, --interp, --vm and --tiered, which leave stdin to
+// the program, or for -fcoverage, which embeds it in the program for the report
+extern std::string sourceText;
+extern bool debugInfo;
+// The source file named in the debug info (-g); the compiler reads stdin
+extern std::string debugFile;
+// Run the program in the compiler's process instead of printing its IR,
+// compiled in memory (--jit), interpreted (--interp) or compiled to the
+// bytecode of the VM (--vm); the exit status of the compiler is then the
+// program's
+extern bool jit;
+extern bool interpret;
+extern bool bytecode;
+extern int runStatus;
+// Run the bytecode with the hot functions compiled to native code (--tiered),
+// once their calls and loop iterations reach the threshold
+extern bool tiered;
+extern int tierThreshold;
+// Print the program translated to C instead of its IR (--emit-c)
+extern bool emitC;
+
+// Reports the time spent since the previous phase ended (-ftime-phases),
+// and closes the span of the phase in the trace of -ftrace
+void timePhase(const char *phase);
+// Opens the span of a phase in the trace of -ftrace
+void tracePhase(const char *phase);
+
+// Runtime errors reported by the checks of -ftrapv, -fcheck-div and -fcheck-bounds
+enum RuntimeError { OVERFLOW_ERROR = 0, DIVISION_ERROR = 1, BOUNDS_ERROR = 2, SIZE_ERROR = 3 };
+
+// Sites counted by -fprofile-loops, named in this order by the runtime. A
+// while loop counts its executions in LOOP_BUCKETS buckets by trip count
+// (none, then one per power of two) and its iterations; the rest count how
+// often their condition was true and false
+enum LoopProfileKind { PROFILE_WHILE = 0, PROFILE_IF = 1, PROFILE_AND = 2, PROFILE_OR = 3 };
+const int LOOP_BUCKETS = 65;
+
+class Expr;
+class Stmt;
+class FuncDef;
+class FuncCall;
+struct InterpFrame;
+struct InterpGenerator;
+class Lval;
+// A builtin of lib/lib.c as the interpreter calls it; reference arguments are addresses
+typedef int (*InterpBuiltin)(const intptr_t *args);
+struct CScope;
+
 // AST Base Class
 class AST
 {
@@ -32,7 +99,18 @@ public:
     virtual ~AST() {}
     virtual void sem() {}
     virtual llvm::Value* igen() const { return nullptr; } 
+    virtual MirValue* mgen() const { return nullptr; }
+    virtual int interp() const { return 0; }
+    virtual void bgen() const {}
+    virtual void cgen() const {}
+    // Whether the C of the expression or condition makes a call
+    virtual bool cgenHasCall() const { return false; }
     void llvm_igen(bool optimize = false);
+    MirModule* mir_gen();
+    int run_interp();
+    VmProgram* vm_gen();
+    llvm::ExecutionEngine* tier_gen();
+    void c_gen();
     static llvm::LLVMContext TheContext;
     void codegenLibs();
 protected:
@@ -44,24 +122,92 @@ protected:
     static llvm::Type *i1;
     static llvm::Type *i8;
     static llvm::Type *i32;
+    static llvm::Type *i64;
     static GenScope scopes;
     static std::stack<GenBlock*> blockStack;
+    static std::unordered_set<llvm::Value*> arrayAccessPtrs;
+    static std::unordered_map<std::string, size_t> closureFieldCount;
+    static void printFunctionStats(const char *stage);
+    static void printStackUsage();
     static llvm::ConstantInt* c1(bool b); 
     static llvm::ConstantInt* c8(char c);
     static llvm::ConstantInt* c32(int n);
+    static llvm::AllocaInst* entryAlloca(llvm::Type *t, const std::string &name);
+    static void genFrameRelease();
+    static void genProfileEnter(const std::string &name);
+    static void genProfileExit();
+    static int profiledFunctions;
+    static void genCoveragePoint(llvm::BasicBlock *block, const AST *node);
+    static void genCoverage(llvm::BasicBlock *mainBlock);
+    static std::vector<std::pair<llvm::Function*, bool>> coverageFunctions;
+    static std::unordered_map<llvm::BasicBlock*, std::vector<std::pair<int, int>>> coveragePoints;
+    static llvm::GlobalVariable* genLoopProfileSite(const AST *node, LoopProfileKind kind);
+    static void genLoopProfileCount(llvm::GlobalVariable *counts, llvm::Value *index, llvm::Value *amount = nullptr);
+    static void genLoopExit(llvm::AllocaInst *trips, llvm::GlobalVariable *counts);
+    static void genLoopProfile(llvm::BasicBlock *mainBlock);
+    static std::vector<int> loopProfileDescriptions;
+    static std::vector<llvm::GlobalVariable*> loopProfileCounts;
+    static std::unique_ptr<llvm::DIBuilder> DBuilder;
+    static llvm::DIType* debugType(Type *type);
+    static void genDebugLocation(const AST *node);
+    static void genDebugVariable(llvm::AllocaInst *storage, const std::string &name, Type *type, int line, int column, unsigned argNo = 0);
+    static llvm::Value* genIntrinsic(llvm::Intrinsic::ID id, std::vector<llvm::Value*> args, const std::string &name = "");
+    void genRuntimeCheck(llvm::Value *failed, RuntimeError error) const;
+    static std::vector<std::pair<const FuncDef*, llvm::Function*>> tierFunctions;
+    static void genTierEntries();
+    static MirModule *mirModule;
+    static MirBuilder MirB;
+    static std::vector<MirScope*> mirScopes;
+    static void mirLibs();
+    static MirVar* mirLookupVar(const std::string &name);
+    static MirFunction* mirLookupFunction(const std::string &name);
+    static MirValue* mirAddress(const std::string &name);
+    static MirValue* mirValue(const Expr *e);
+    static InterpFrame *interpFrame;
+    static int interpLoad(const char *address, Type *type);
+    static void interpStore(char *address, Type *type, int value);
+    static void interpResolve();
+    static void interpOperands(const Expr *left, const Lval *leftLval, const Expr *right, int &leftVal, int &rightVal);
+    static void interpResume(InterpGenerator *generator);
+    static void interpDestroy(InterpGenerator *generator);
+    void interpRuntimeError(RuntimeError error) const;
+    static VmBuilder VmB;
+    static VmScope *vmScope;
+    static std::unordered_map<const AST*, int> vmFunctions;
+    static std::vector<const FuncDef*> vmPending;
+    static int vmFunction(const FuncDef *func);
+    static void vmLoad(const VmLval &lval, int dst);
+    static void vmStore(const VmLval &lval, int src);
+    static void vmAddress(const VmLval &lval, int dst);
+    static void bgenOperands(const Expr *left, const Expr *right, int &leftReg, int &rightReg);
+    static void bgenCount();
+    static CScope *cScope;
+    static std::string *cOut;
+    static int cIndent;
+    static void cLine(const std::string &text);
+    static std::string cTemp(Type *type, const std::string &value);
+    static std::string cPin(const Expr *e);
+    static void cgenOperands(const Expr *left, const Expr *right, std::string &leftVal, std::string &rightVal);
+    static void cgenBlock(const Stmt *stmt);
+    static void cgenHeapRelease();
 };
 
 // Expr Class
 class Expr : public AST
 {
 public:
-    Expr(int line, int column) : AST(line, column) {}
+    Expr(int line, int column) : AST(line, column), type(nullptr) {}
     virtual ~Expr() {}
     virtual void sem() override = 0;
     virtual llvm::Value* igen() const override = 0;
     virtual std::string* getName() const { return nullptr; }
     Type *getType() const;
     TypeEnum getTypeEnum() const;
+    virtual bool getRange(long long &lo, long long &hi) const;
+    virtual void bgenValue(int dst) const {}
+    virtual int bgenRegister() const { return -1; }
+    int bgenOperand() const;
+    virtual std::string cgenExpr() const { return ""; }
 
 protected:
     Type *type;
@@ -94,6 +240,10 @@ public:
     void append(Stmt *stmt);
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgen() const override;
+    virtual void cgen() const override;
 private:
     std::vector<Stmt *> stmts;
 };
@@ -119,6 +269,10 @@ public:
     void append(LocalDef *def);
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgen() const override;
+    virtual void cgen() const override;
 
 private:
     std::vector<LocalDef *> defs;
@@ -141,23 +295,6 @@ private:
     bool isArray;
 };
 
-class CapturedVar {
-public:
-    CapturedVar(const std::string& name, Type* type, bool isParam = false, ParameterType paramType = ParameterType::VALUE);
-
-    const std::string& getName() const;
-    Type* getType() const;
-    bool getIsParam() const;
-    ParameterType getParameterType() const;
-
-private:
-    std::string name; 
-    Type* type;
-    bool isParam;
-    ParameterType parameterType;
-};
-
-
 // FparList Class
 class FparList : public AST
 {
@@ -180,17 +317,31 @@ public:
     ~FuncDef();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
     std::string* getName() const;
     void setReturn();
+    void interpBind(int vars, int slots) const;
+    void interpEnter(const FuncCall *call, InterpFrame *frame) const;
+    int interpRun(InterpFrame *frame) const;
+    virtual void bgen() const override;
+    void bgenFunction() const;
+    void cgenFunction(std::string &decls, std::string &code) const;
 
 private:
+    void igenCoroutineBegin() const;
+    void igenCoroutineEnd() const;
+
     std::string *name;
     FparList *fpar;
     Type *type;
     LocalDefList *localDef;
     Stmt *stmts;
     bool hasReturn;
-    std::vector<CapturedVar*> capturedVars;
+    // Slots of the frames of the interpreter: the function's own variables,
+    // then the captured ones (see AST::interpResolve)
+    mutable int interpVars;
+    mutable int interpSlots;
 };
 
 // VarDef Class
@@ -198,15 +349,25 @@ class VarDef : public LocalDef
 {
 public:
     VarDef(std::string *n, Type *t, bool arr, int arraySize, int line, int column);
+    VarDef(std::string *n, Type *t, Expr *sizeExpr, int line, int column);
     ~VarDef();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    void interpBind(int slot) const;
+    virtual void bgen() const override;
+    virtual void cgen() const override;
 
 private:
+    llvm::Value* igenRuntimeSized() const;
+
     std::string *name;
     Type *type;
     int size;
     bool isArray;
+    Expr *sizeExpr;
+    mutable int interpSlot;
 };
 
 // ExprList Class
@@ -231,6 +392,10 @@ public:
     Cond(int line, int column) : AST(line, column) {}
     virtual void sem() override = 0;
     virtual llvm::Value* igen() const override = 0;
+    virtual void mgenBranch(MirBlock *trueBB, MirBlock *falseBB) const = 0;
+    // Jumps to the label when the condition is `when`, and falls through otherwise
+    virtual void bgenBranch(bool when, int label) const = 0;
+    virtual std::string cgenCond() const = 0;
 };
 
 // UnOp Class
@@ -241,6 +406,12 @@ public:
     ~UnOp();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgenValue(int dst) const override;
+    virtual std::string cgenExpr() const override;
+    virtual bool cgenHasCall() const override;
+    virtual bool getRange(long long &lo, long long &hi) const override;
 
 private:
     char op;
@@ -255,11 +426,24 @@ public:
     ~BinOp();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgenValue(int dst) const override;
+    virtual std::string cgenExpr() const override;
+    virtual bool cgenHasCall() const override;
+    virtual bool getRange(long long &lo, long long &hi) const override;
 
 private:
     char op;
     Expr *left;
     Expr *right;
+    // The left operand if it is a variable, for interpOperands
+    const Lval *leftLval;
+    llvm::Value* igenChecked(llvm::Intrinsic::ID id, llvm::Value *leftVal, llvm::Value *rightVal,
+                             const std::string &name) const;
+    void igenDivisionChecks(llvm::Value *leftVal, llvm::Value *rightVal) const;
+    llvm::Value* igenDivision(llvm::Instruction::BinaryOps opcode, llvm::Value *leftVal, llvm::Value *rightVal,
+                             const std::string &name) const;
 };
 
 // CondCompOp Class
@@ -270,11 +454,17 @@ public:
     ~CondCompOp();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual void mgenBranch(MirBlock *trueBB, MirBlock *falseBB) const override;
+    virtual int interp() const override;
+    virtual void bgenBranch(bool when, int label) const override;
+    virtual std::string cgenCond() const override;
+    virtual bool cgenHasCall() const override;
 
 private:
     compare op;
     Expr *left;
     Expr *right;
+    const Lval *leftLval;
 };
 
 // CondBoolOp Class
@@ -285,6 +475,11 @@ public:
     ~CondBoolOp();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual void mgenBranch(MirBlock *trueBB, MirBlock *falseBB) const override;
+    virtual int interp() const override;
+    virtual void bgenBranch(bool when, int label) const override;
+    virtual std::string cgenCond() const override;
+    virtual bool cgenHasCall() const override;
 
 private:
     char op;
@@ -300,6 +495,11 @@ public:
     ~CondUnOp();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual void mgenBranch(MirBlock *trueBB, MirBlock *falseBB) const override;
+    virtual int interp() const override;
+    virtual void bgenBranch(bool when, int label) const override;
+    virtual std::string cgenCond() const override;
+    virtual bool cgenHasCall() const override;
 
 private:
     char op;
@@ -314,6 +514,11 @@ public:
     virtual void sem() override;
     int getValue() const;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgenValue(int dst) const override;
+    virtual std::string cgenExpr() const override;
+    virtual bool getRange(long long &lo, long long &hi) const override;
 
 private:
     int val;
@@ -326,6 +531,10 @@ public:
     CharConst(unsigned char c, int line, int column);
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgenValue(int dst) const override;
+    virtual std::string cgenExpr() const override;
 
 private:
     unsigned char val;
@@ -335,14 +544,24 @@ private:
 class Lval : public Expr 
 {
 public:
-    Lval(int line, int column) : Expr(line, column) {}
+    Lval(int line, int column) : Expr(line, column), interpSlot(-1) {}
     virtual ~Lval() {}
     virtual void sem() override;
     virtual llvm::Value* igen() const override = 0;
+    virtual char* interpAddress() const = 0;
+    void interpBind(int slot) const;
+    virtual VmLval bgenLval() const = 0;
+    virtual void bgenValue(int dst) const override;
+    // With pin, an index is computed into a temporary now
+    virtual std::string cgenLval(bool pin = false) const = 0;
+    virtual std::string cgenAddress(bool pin = false) const;
+    virtual std::string cgenExpr() const override;
     virtual std::string* getName() const override;
 
 protected:
     std::string *name;
+    // Slot of the variable in the frames of the interpreter
+    mutable int interpSlot;
 };
 
 // StringConst Class
@@ -353,6 +572,12 @@ public:
     ~StringConst();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual char* interpAddress() const override;
+    virtual VmLval bgenLval() const override;
+    virtual std::string cgenLval(bool pin = false) const override;
+    virtual std::string cgenAddress(bool pin = false) const override;
 };
 
 // BoolConst Class
@@ -362,6 +587,10 @@ public:
     BoolConst(bool v, int line, int column);
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual void mgenBranch(MirBlock *trueBB, MirBlock *falseBB) const override;
+    virtual int interp() const override;
+    virtual void bgenBranch(bool when, int label) const override;
+    virtual std::string cgenCond() const override;
 
 private:
     bool val;
@@ -375,6 +604,13 @@ public:
     ~Id();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual char* interpAddress() const override;
+    virtual int bgenRegister() const override;
+    virtual VmLval bgenLval() const override;
+    virtual std::string cgenLval(bool pin = false) const override;
+    virtual std::string cgenAddress(bool pin = false) const override;
 
 private:
     SymbolType symbolType;
@@ -388,6 +624,12 @@ public:
     ~ArrayAccess();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual char* interpAddress() const override;
+    virtual VmLval bgenLval() const override;
+    virtual std::string cgenLval(bool pin = false) const override;
+    virtual bool cgenHasCall() const override;
     Expr *getIndexExpr() const;
 
 private:
@@ -402,6 +644,10 @@ public:
     ~Let();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgen() const override;
+    virtual void cgen() const override;
 
 private:
     Lval *lexpr;
@@ -416,14 +662,30 @@ public:
     ~FuncCall();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgenValue(int dst) const override;
+    virtual std::string cgenExpr() const override;
+    virtual bool cgenHasCall() const override;
     ExprList *getExprs() const;
     virtual std::string* getName() const override;
+    void setGeneratorUse(bool g);
+    InterpGenerator* interpGenerator() const;
+    void interpBind(const MirCallSite *callSite, InterpBuiltin builtin, std::vector<int> captures) const;
+    const std::vector<int>& getInterpCaptures() const;
+    int bgenArgs() const;
+    std::vector<std::string> cgenArgs() const;
 
 protected:
     std::string *name;
     ExprList *exprs;
-    std::vector<CapturedVar*> capturedVars;
-    bool isNested;
+    bool generatorUse;
+    // Resolved from the MIR, so that a call looks nothing up: the callee, the
+    // builtin it is, if any, and the slots of the caller's frame that hold
+    // the variables the callee captures
+    mutable const MirCallSite *interpCallSite;
+    mutable InterpBuiltin interpBuiltin;
+    mutable std::vector<int> interpCaptures;
 };
 
 // ProcCall Class
@@ -434,6 +696,10 @@ public:
     ~ProcCall();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgen() const override;
+    virtual void cgen() const override;
 
 private:
     FuncCall *funcCall;
@@ -447,6 +713,10 @@ public:
     ~If();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgen() const override;
+    virtual void cgen() const override;
 
 private:
     Cond *cond;
@@ -454,18 +724,89 @@ private:
     Stmt *elseStmt;
 };
 
+// LoopHint Class
+class LoopHint : public AST
+{
+public:
+    LoopHint(std::string *n, int v, int line, int column);
+    ~LoopHint();
+    virtual void sem() override;
+    const std::string &getName() const;
+    int getValue() const;
+
+private:
+    std::string *name;
+    int value;
+};
+
+// LoopHintList Class
+class LoopHintList : public AST
+{
+public:
+    LoopHintList(int line, int column);
+    ~LoopHintList();
+    void append(LoopHint *hint);
+    virtual void sem() override;
+    bool isIndependent() const;
+    llvm::MDNode *loopMetadata(llvm::MDNode *accessGroup) const;
+
+private:
+    std::vector<LoopHint *> hints;
+};
+
 // While Class
 class While : public Stmt 
 {
 public:
-    While(Cond *c, Stmt *b, int line, int column);
+    While(Cond *c, Stmt *b, LoopHintList *h, int line, int column);
     ~While();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgen() const override;
+    virtual void cgen() const override;
 
 private:
     Cond *cond;
     Stmt *body;
+    LoopHintList *hints;
+};
+
+// For Class (consumes the values yielded by a generator)
+class For : public Stmt
+{
+public:
+    For(Lval *l, FuncCall *g, Stmt *b, int line, int column);
+    ~For();
+    virtual void sem() override;
+    virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgen() const override;
+    virtual void cgen() const override;
+
+private:
+    Lval *lvalue;
+    FuncCall *generator;
+    Stmt *body;
+};
+
+// Yield Class
+class Yield : public Stmt
+{
+public:
+    Yield(Expr *e, int line, int column);
+    ~Yield();
+    virtual void sem() override;
+    virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgen() const override;
+    virtual void cgen() const override;
+
+private:
+    Expr *expr;
 };
 
 // Return Class
@@ -476,6 +817,10 @@ public:
     ~Return();
     virtual void sem() override;
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
+    virtual int interp() const override;
+    virtual void bgen() const override;
+    virtual void cgen() const override;
 
 private:
     Expr *expr;
@@ -488,6 +833,7 @@ public:
     Empty(int line, int column);
     virtual void sem() override {}
     virtual llvm::Value* igen() const override;
+    virtual MirValue* mgen() const override;
 
 };
 
@@ -0,0 +1,689 @@
+#include <climits>
+#include "ast.hpp"
+
+// Compiles the checked AST to the register bytecode of --vm (see vm/vm.hpp).
+// Variables live in registers, unless their address is taken by a reference
+// argument or by the closure of a nested function: those live in memory, as
+// arrays do. Functions are compiled when they are first called, starting
+// from main, and take their captures from the call sites of the MIR, like
+// FuncDef::igen.
+
+VmBuilder AST::VmB;
+VmScope *AST::vmScope = nullptr;
+std::unordered_map<const AST *, int> AST::vmFunctions;
+std::vector<const FuncDef *> AST::vmPending;
+
+VmProgram *AST::vm_gen()
+{
+    VmProgram *program = new VmProgram();
+    VmB.setProgram(program);
+    vmFunctions.clear();
+
+    vmFunction(static_cast<const FuncDef *>(this));
+    while (!vmPending.empty())
+    {
+        const FuncDef *func = vmPending.back();
+        vmPending.pop_back();
+        func->bgenFunction();
+    }
+    return program;
+}
+
+// Index of the function in the program; a function seen for the first time
+// is compiled later
+int AST::vmFunction(const FuncDef *func)
+{
+    auto found = vmFunctions.find(func);
+    if (found != vmFunctions.end())
+    {
+        return found->second;
+    }
+
+    int index = VmB.addFunction(mirModule->functionOf(func)->name);
+    vmFunctions[func] = index;
+    vmPending.push_back(func);
+    return index;
+}
+
+static bool isByte(Type *type)
+{
+    return type->getType() == TypeEnum::BYTE;
+}
+
+static int elementSize(Type *type)
+{
+    return isByte(type) ? 1 : sizeof(int);
+}
+
+void AST::vmLoad(const VmLval &lval, int dst)
+{
+    switch (lval.kind)
+    {
+    case VmLval::REG:
+        if (lval.reg != dst)
+        {
+            VmB.emit(VM_MOV, dst, lval.reg);
+        }
+        break;
+    case VmLval::PTR:
+        VmB.emit(lval.isByte ? VM_LOADB : VM_LOADI, dst, lval.reg);
+        break;
+    case VmLval::ELEM:
+        VmB.emit(lval.isByte ? VM_LOADXB : VM_LOADXI, dst, lval.reg, lval.index);
+        break;
+    }
+}
+
+void AST::vmStore(const VmLval &lval, int src)
+{
+    switch (lval.kind)
+    {
+    case VmLval::REG:
+        if (lval.reg != src)
+        {
+            VmB.emit(VM_MOV, lval.reg, src);
+        }
+        break;
+    case VmLval::PTR:
+        VmB.emit(lval.isByte ? VM_STOREB : VM_STOREI, lval.reg, src);
+        break;
+    case VmLval::ELEM:
+        VmB.emit(lval.isByte ? VM_STOREXB : VM_STOREXI, lval.reg, lval.index, src);
+        break;
+    }
+}
+
+void AST::vmAddress(const VmLval &lval, int dst)
+{
+    switch (lval.kind)
+    {
+    case VmLval::REG:
+        // The variable has to live in memory; the function is compiled again
+        vmScope->addressed.insert(*lval.name);
+        vmScope->retry = true;
+        break;
+    case VmLval::PTR:
+        VmB.emit(VM_MOV, dst, lval.reg);
+        break;
+    case VmLval::ELEM:
+        VmB.emit(VM_LEAX, dst, lval.reg, lval.index, lval.isByte ? 1 : sizeof(int));
+        break;
+    }
+}
+
+// The register holding the value of the expression: the variable's own, or
+// a new one the value is computed into
+int Expr::bgenOperand() const
+{
+    int reg = bgenRegister();
+    if (reg < 0)
+    {
+        reg = VmB.newRegister();
+        bgenValue(reg);
+    }
+    return reg;
+}
+
+// Like interpOperands: a variable in memory is loaded only once the other
+// operand is evaluated. Register variables cannot change meanwhile, since no
+// call reaches them
+void AST::bgenOperands(const Expr *left, const Expr *right, int &leftReg, int &rightReg)
+{
+    const Lval *lval = dynamic_cast<const Lval *>(left);
+    if (!lval || left->bgenRegister() >= 0)
+    {
+        leftReg = left->bgenOperand();
+        rightReg = right->bgenOperand();
+        return;
+    }
+
+    VmLval address = lval->bgenLval();
+    rightReg = right->bgenOperand();
+    leftReg = VmB.newRegister();
+    vmLoad(address, leftReg);
+}
+
+void StmtList::bgen() const
+{
+    for (auto it = stmts.rbegin(); it != stmts.rend(); ++it)
+    {
+        int registers = VmB.getRegisters();
+        (*it)->bgen();
+        VmB.setRegisters(registers);
+    }
+}
+
+void LocalDefList::bgen() const
+{
+    for (auto it = defs.rbegin(); it != defs.rend(); ++it)
+    {
+        (*it)->bgen();
+    }
+}
+
+void IntConst::bgenValue(int dst) const
+{
+    VmB.emit(VM_CONST, dst, 0, 0, val);
+}
+
+void CharConst::bgenValue(int dst) const
+{
+    VmB.emit(VM_CONST, dst, 0, 0, (signed char)val);
+}
+
+void BoolConst::bgenBranch(bool when, int label) const
+{
+    if (val == when)
+    {
+        VmB.emitJump(VM_JMP, label);
+    }
+}
+
+void UnOp::bgenValue(int dst) const
+{
+    if (op == '+')
+    {
+        expr->bgenValue(dst);
+        return;
+    }
+
+    int reg = expr->bgenOperand();
+    VmB.setPosition(line, column);
+    VmB.emit(trapOverflow && !mirModule->noOverflow.count(this) ? VM_NEGV : VM_NEG, dst, reg);
+}
+
+void BinOp::bgenValue(int dst) const
+{
+    bool isInt = getTypeEnum() == TypeEnum::INT;
+    bool trap = isInt && trapOverflow && !mirModule->noOverflow.count(this);
+
+    // A constant operand is an immediate, so `i = i + 1` is one instruction
+    const IntConst *constant = dynamic_cast<const IntConst *>(right);
+    if (isInt && constant)
+    {
+        int value = constant->getValue();
+        VmOp immediate = VM_HALT;
+        switch (op)
+        {
+        case '+':
+            immediate = trap ? VM_ADDIV : VM_ADDI;
+            break;
+        case '-':
+            if (value != INT_MIN)
+            {
+                immediate = trap ? VM_ADDIV : VM_ADDI;
+                value = -value;
+            }
+            break;
+        case '*':
+            immediate = trap ? VM_HALT : VM_MULI;
+            break;
+        case '/':
+        case '%':
+            // The divisors that fault are left to DIV and MOD
+            if (value != 0 && value != -1)
+            {
+                immediate = op == '/' ? VM_DIVI : VM_MODI;
+            }
+            break;
+        }
+
+        if (immediate != VM_HALT)
+        {
+            int reg = left->bgenOperand();
+            VmB.setPosition(line, column);
+            VmB.emit(immediate, dst, reg, 0, value);
+            return;
+        }
+    }
+
+    int leftReg, rightReg;
+    bgenOperands(left, right, leftReg, rightReg);
+
+    VmOp instr = VM_HALT;
+    switch (op)
+    {
+    case '+':
+        instr = !isInt ? VM_BADD : trap ? VM_ADDV : VM_ADD;
+        break;
+    case '-':
+        instr = !isInt ? VM_BSUB : trap ? VM_SUBV : VM_SUB;
+        break;
+    case '*':
+        instr = !isInt ? VM_BMUL : trap ? VM_MULV : VM_MUL;
+        break;
+    case '/':
+        instr = isInt ? VM_DIV : VM_BDIV;
+        break;
+    case '%':
+        instr = isInt ? VM_MOD : VM_BMOD;
+        break;
+    }
+    VmB.setPosition(line, column);
+    VmB.emit(instr, dst, leftReg, rightReg);
+}
+
+// The jumps of a comparison, and of its negation, are in the order lt, gt,
+// lte, gte, eq, neq after the first one
+static int branchOffset(compare op, bool when)
+{
+    switch (op)
+    {
+    case lt:
+        return when ? 0 : 3;
+    case gt:
+        return when ? 1 : 2;
+    case lte:
+        return when ? 2 : 1;
+    case gte:
+        return when ? 3 : 0;
+    case eq:
+        return when ? 4 : 5;
+    case neq:
+        return when ? 5 : 4;
+    default:
+        return 0;
+    }
+}
+
+void CondCompOp::bgenBranch(bool when, int label) const
+{
+    int offset = branchOffset(op, when);
+
+    const IntConst *constant = dynamic_cast<const IntConst *>(right);
+    if (constant)
+    {
+        int reg = left->bgenOperand();
+        VmB.emitJump(VmOp(VM_JLTI + offset), label, reg, 0, 0, constant->getValue());
+        return;
+    }
+
+    // An int element is compared where it is, so a search or a sort loop
+    // tests its array in one instruction
+    const ArrayAccess *element = dynamic_cast<const ArrayAccess *>(left);
+    if (element && element->getTypeEnum() == TypeEnum::INT)
+    {
+        VmLval address = element->bgenLval();
+        int reg = right->bgenOperand();
+        VmB.emitJump(VmOp(VM_JLTX + offset), label, address.reg, address.index, reg);
+        return;
+    }
+
+    int leftReg, rightReg;
+    bgenOperands(left, right, leftReg, rightReg);
+    VmB.emitJump(VmOp(VM_JLT + offset), label, leftReg, rightReg);
+}
+
+void CondBoolOp::bgenBranch(bool when, int label) const
+{
+    // `a & b` is true, and `a | b` false, only when both operands are
+    if ((op == '&') == when)
+    {
+        int skip = VmB.newLabel();
+        left->bgenBranch(!when, skip);
+        right->bgenBranch(when, label);
+        VmB.bind(skip);
+    }
+    else
+    {
+        left->bgenBranch(when, label);
+        right->bgenBranch(when, label);
+    }
+}
+
+void CondUnOp::bgenBranch(bool when, int label) const
+{
+    cond->bgenBranch(!when, label);
+}
+
+// Arrays live in memory from their definition to the return of the call.
+// Scalars live in registers, or in a register slot of their own when their
+// address is taken. The temporaries of a size are not given back, so the
+// registers of the variables hold zero until they are assigned
+void VarDef::bgen() const
+{
+    int reg = VmB.newRegister();
+
+    if (isArray || sizeExpr)
+    {
+        Type *elementType = type->getBaseType();
+        VmVar var = {VmVar::ARRAY, reg, elementType, -1, -1};
+        if (sizeExpr)
+        {
+            var.sizeReg = VmB.newRegister();
+            sizeExpr->bgenValue(var.sizeReg);
+            VmB.setPosition(line, column);
+            VmB.emit(VM_ALLOCAN, reg, var.sizeReg, 0, elementSize(elementType));
+        }
+        else
+        {
+            var.size = size;
+            VmB.emit(VM_ALLOCA, reg, 0, 0, size * elementSize(elementType));
+        }
+        vmScope->vars[*name] = var;
+    }
+    else if (vmScope->addressed.count(*name))
+    {
+        int slot = VmB.newRegister();
+        VmB.emit(VM_LEA, reg, 0, 0, slot);
+        vmScope->vars[*name] = {VmVar::PTR, reg, type, -1, -1};
+    }
+    else
+    {
+        vmScope->vars[*name] = {VmVar::REG, reg, type, -1, -1};
+    }
+}
+
+void Lval::bgenValue(int dst) const
+{
+    vmLoad(bgenLval(), dst);
+}
+
+VmLval StringConst::bgenLval() const
+{
+    VmProgram *program = VmB.getProgram();
+    program->strings.push_back(name->c_str());
+
+    int reg = VmB.newRegister();
+    VmB.emit(VM_STRING, reg, 0, 0, program->strings.size() - 1);
+    return {VmLval::PTR, reg, -1, true, name};
+}
+
+int Id::bgenRegister() const
+{
+    const VmVar &var = vmScope->vars.at(*name);
+    return var.kind == VmVar::REG ? var.reg : -1;
+}
+
+// An array as a whole is its address, like a scalar in memory
+VmLval Id::bgenLval() const
+{
+    const VmVar &var = vmScope->vars.at(*name);
+    return {var.kind == VmVar::REG ? VmLval::REG : VmLval::PTR, var.reg, -1, isByte(var.type), name};
+}
+
+VmLval ArrayAccess::bgenLval() const
+{
+    const VmVar &var = vmScope->vars.at(*name);
+    int index = indexExpr->bgenOperand();
+
+    if (checkBounds && !mirModule->inBounds.count(this) && (var.size >= 0 || var.sizeReg >= 0))
+    {
+        VmB.setPosition(line, column);
+        if (var.size >= 0)
+        {
+            VmB.emit(VM_BOUNDI, index, 0, 0, var.size);
+        }
+        else
+        {
+            VmB.emit(VM_BOUND, index, var.sizeReg);
+        }
+    }
+    return {VmLval::ELEM, var.reg, index, isByte(type), name};
+}
+
+// An assignment to a register variable computes the value right into it
+void Let::bgen() const
+{
+    int reg = lexpr->bgenRegister();
+    if (reg >= 0)
+    {
+        rexpr->bgenValue(reg);
+        return;
+    }
+
+    int value = rexpr->bgenOperand();
+    vmStore(lexpr->bgenLval(), value);
+}
+
+// Places the arguments of the call in consecutive registers: the parameters,
+// then the captured variables; returns the first
+int FuncCall::bgenArgs() const
+{
+    const MirCallSite &callSite = mirModule->callSiteOf(this);
+    const MirFunction *callee = callSite.callee;
+    size_t params = exprs ? exprs->getExprs().size() : 0;
+    int first = VmB.newRegisters(params + callee->captures.size());
+
+    for (size_t index = 0; index < params; ++index)
+    {
+        Expr *arg = exprs->getExprs()[params - 1 - index];
+        if (callee->paramByRef[index])
+        {
+            vmAddress(static_cast<Lval *>(arg)->bgenLval(), first + index);
+        }
+        else
+        {
+            arg->bgenValue(first + index);
+        }
+    }
+
+    for (size_t index = 0; index < callee->captures.size(); ++index)
+    {
+        // The owner finds the variable by its name; every other caller
+        // received it through its own closure
+        const MirVar *var = callee->captures[index].var;
+        const VmVar &captured = callSite.caller == var->owner ? vmScope->vars.at(var->name)
+                                                              : vmScope->captured.at(var);
+        VmLval address = {captured.kind == VmVar::REG ? VmLval::REG : VmLval::PTR, captured.reg, -1, false,
+                          &var->name};
+        vmAddress(address, first + params + index);
+    }
+    return first;
+}
+
+void FuncCall::bgenValue(int dst) const
+{
+    const MirFunction *callee = mirModule->callSiteOf(this).callee;
+
+    if (!callee->isExternal)
+    {
+        int first = bgenArgs();
+        VmB.emit(tiered ? VM_CALLT : VM_CALL, dst, first, 0, vmFunction(static_cast<const FuncDef *>(callee->origin)));
+        return;
+    }
+
+    // Bytes are held sign extended, so extend and shrink are at most a truncation
+    if (callee->name == "extend")
+    {
+        exprs->getExprs()[0]->bgenValue(dst);
+    }
+    else if (callee->name == "shrink")
+    {
+        VmB.emit(VM_TRUNC, dst, exprs->getExprs()[0]->bgenOperand());
+    }
+    else
+    {
+        int first = bgenArgs();
+        VmB.emit(VM_CALLB, dst, first, 0, vmBuiltin(callee->name));
+    }
+}
+
+void ProcCall::bgen() const
+{
+    funcCall->bgenValue(VmB.newRegister());
+}
+
+void If::bgen() const
+{
+    int elseLabel = VmB.newLabel();
+    cond->bgenBranch(false, elseLabel);
+    thenStmt->bgen();
+
+    if (!elseStmt)
+    {
+        VmB.bind(elseLabel);
+        return;
+    }
+    int endLabel = VmB.newLabel();
+    VmB.emitJump(VM_JMP, endLabel);
+    VmB.bind(elseLabel);
+    elseStmt->bgen();
+    VmB.bind(endLabel);
+}
+
+// Counts an iteration of a loop towards the native tier of --tiered.
+// Generators are only run by the VM
+void AST::bgenCount()
+{
+    if (tiered && !vmScope->isGenerator)
+    {
+        VmB.emit(VM_COUNT, 0, 0, 0, vmScope->function);
+    }
+}
+
+// The condition is at the bottom, so an iteration takes one jump
+void While::bgen() const
+{
+    int bodyLabel = VmB.newLabel();
+    int condLabel = VmB.newLabel();
+
+    VmB.emitJump(VM_JMP, condLabel);
+    VmB.bind(bodyLabel);
+    bgenCount();
+    body->bgen();
+    VmB.bind(condLabel);
+    cond->bgenBranch(true, bodyLabel);
+}
+
+// Like the coroutine of igen, the generator runs up to its first yield
+// before the loop starts
+void For::bgen() const
+{
+    const FuncDef *func = static_cast<const FuncDef *>(mirModule->callSiteOf(generator).callee->origin);
+    int handle = VmB.newRegister();
+    int first = generator->bgenArgs();
+    VmB.emit(VM_GENNEW, handle, first, 0, vmFunction(func));
+
+    int nextLabel = VmB.newLabel();
+    int doneLabel = VmB.newLabel();
+    VmB.bind(nextLabel);
+    int reg = lvalue->bgenRegister();
+    int value = reg >= 0 ? reg : VmB.newRegister();
+    VmB.emitJump(VM_FORNEXT, doneLabel, handle, value);
+    if (reg < 0)
+    {
+        vmStore(lvalue->bgenLval(), value);
+    }
+
+    vmScope->generators.push_back(handle);
+    bgenCount();
+    body->bgen();
+    vmScope->generators.pop_back();
+    VmB.emitJump(VM_RESUME, nextLabel, handle);
+
+    VmB.bind(doneLabel);
+    VmB.emit(VM_GENFREE, handle);
+}
+
+void Yield::bgen() const
+{
+    VmB.emit(VM_YIELD, expr->bgenOperand());
+}
+
+// A return from inside for loops frees their generators
+void Return::bgen() const
+{
+    int value = expr ? expr->bgenOperand() : 0;
+
+    for (auto it = vmScope->generators.rbegin(); it != vmScope->generators.rend(); ++it)
+    {
+        VmB.emit(VM_GENFREE, *it);
+    }
+
+    if (vmScope->isGenerator)
+    {
+        VmB.emit(VM_GENEND);
+    }
+    else
+    {
+        VmB.emit(expr ? VM_RET : VM_RETV, value);
+    }
+}
+
+// Nested functions are compiled when they are first called, so their
+// definitions do nothing
+void FuncDef::bgen() const
+{
+}
+
+// Compiles the function; when a register variable turns out to need an
+// address, it starts over with the variable in memory
+void FuncDef::bgenFunction() const
+{
+    const MirFunction *func = mirModule->functionOf(this);
+    int index = vmFunction(this);
+    const std::vector<Fpar *> params = fpar ? fpar->getParameters() : std::vector<Fpar *>();
+    size_t argCount = params.size() + func->captures.size();
+
+    VmScope scope;
+    scope.function = index;
+    scope.isGenerator = type->getType() == TypeEnum::GENERATOR;
+    // The variables nested functions capture are shared with them through
+    // their addresses
+    for (const MirFunction *f : mirModule->functions)
+    {
+        for (const MirCapture &capture : f->captures)
+        {
+            if (capture.var->owner == func)
+            {
+                scope.addressed.insert(capture.var->name);
+            }
+        }
+    }
+
+    vmScope = &scope;
+    do
+    {
+        scope.retry = false;
+        scope.vars.clear();
+        scope.captured.clear();
+        VmB.beginFunction(index);
+        VmB.newRegisters(argCount);
+
+        for (size_t i = 0; i < func->captures.size(); ++i)
+        {
+            const MirVar *var = func->captures[i].var;
+            int reg = params.size() + i;
+            VmVar captured = var->isScalar() ? VmVar{VmVar::PTR, reg, var->type, -1, -1}
+                                             : VmVar{VmVar::ARRAY, reg, var->type->getBaseType(), -1, -1};
+            scope.vars[var->name] = captured;
+            scope.captured[var] = captured;
+        }
+
+        for (size_t i = 0; i < params.size(); ++i)
+        {
+            Fpar *param = params[params.size() - 1 - i];
+            Type *paramType = param->getType();
+            int reg = i;
+
+            if (paramType->getType() == TypeEnum::ARRAY)
+            {
+                scope.vars[*param->getName()] = {VmVar::ARRAY, reg, paramType->getBaseType(), -1, -1};
+            }
+            else if (param->getParameterType() == ParameterType::REFERENCE)
+            {
+                scope.vars[*param->getName()] = {VmVar::PTR, reg, paramType, -1, -1};
+            }
+            else if (scope.addressed.count(*param->getName()))
+            {
+                // The value moves to a slot, and its register to the address
+                int slot = VmB.newRegister();
+                VmB.emit(VM_MOV, slot, reg);
+                VmB.emit(VM_LEA, reg, 0, 0, slot);
+                scope.vars[*param->getName()] = {VmVar::PTR, reg, paramType, -1, -1};
+            }
+            else
+            {
+                scope.vars[*param->getName()] = {VmVar::REG, reg, paramType, -1, -1};
+            }
+        }
+
+        localDef->bgen();
+        int locals = VmB.getRegisters();
+        stmts->bgen();
+        VmB.emit(scope.isGenerator ? VM_GENEND : VM_RETV);
+        VmB.endFunction(argCount, locals);
+    } while (scope.retry);
+    vmScope = nullptr;
+}
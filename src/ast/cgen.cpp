@@ -0,0 +1,885 @@
+#include <climits>
+#include "ast.hpp"
+
+// Translates the checked AST to portable C (--emit-c), for hosts without
+// LLVM: the output builds with any C99 compiler, linked with lib/lib.c.
+// Nested functions become top-level static functions that take the variables
+// they capture through an environment struct, with the fields of the MIR's
+// MirCapture: the value of a read-only scalar, or the address of the variable.
+// Reference parameters are pointers. A generator becomes a heap frame and a
+// switch over its yields that next() resumes, run by a for loop like the
+// coroutines of igen.
+//
+// C leaves the order of the operands of most operators unspecified, so calls
+// are hoisted into temporaries wherever the other back ends would evaluate
+// something else around them, and an lvalue operand is still read after the
+// call, as in compiled code.
+
+// A variable of the function being translated: the C lvalue of a scalar or
+// the pointer to the elements of an array, and the address of a scalar.
+// Arrays declared in the function know their number of elements for
+// -fcheck-bounds
+struct CVar
+{
+    std::string value;
+    std::string address;
+    Type *type;
+    bool isArray;
+    std::string size;
+};
+
+// Names visible while translating a function, like VmScope. The variables of
+// a generator live in its frame, g, and it keeps a copy of its environment
+struct CScope
+{
+    std::unordered_map<std::string, CVar> vars;
+    std::unordered_map<const MirVar *, CVar> captured;
+    bool isGenerator = false;
+    // Temporaries, environments and generator handles are numbered per function
+    int temps = 0;
+    int yields = 0;
+    // Handles of the generators of the enclosing for loops, freed by a return
+    std::vector<std::string> generators;
+    // Runtime-sized arrays of the function that may be on the heap, under
+    // -fvla-heap-threshold; freed by every return and at the end of the body
+    std::vector<std::string> heapArrays;
+    // Members of the frame of a generator
+    std::vector<std::string> fields;
+};
+
+CScope *AST::cScope = nullptr;
+std::string *AST::cOut = nullptr;
+int AST::cIndent = 0;
+
+// Declarations of lib/lib.c, and the arithmetic of Alan: ints wrap around,
+// and the checks report like __alan_runtime_error does for compiled code
+static const char *const cPrelude = R"(
+void writeInteger(int n);
+void writeByte(char b);
+void writeChar(char c);
+void writeString(char *s);
+int readInteger(void);
+char readByte(void);
+char readChar(void);
+void readString(int n, char *s);
+int extend(char b);
+char shrink(int i);
+int strlen(char *s);
+int strcmp(char *s1, char *s2);
+void strcpy(char *trg, char *src);
+void strcat(char *trg, char *src);
+void __alan_runtime_error(int error, int line, int column);
+
+static inline int32_t alan_add(int32_t a, int32_t b) { return (int32_t)((uint32_t)a + (uint32_t)b); }
+static inline int32_t alan_sub(int32_t a, int32_t b) { return (int32_t)((uint32_t)a - (uint32_t)b); }
+static inline int32_t alan_mul(int32_t a, int32_t b) { return (int32_t)((uint32_t)a * (uint32_t)b); }
+static inline int32_t alan_neg(int32_t a) { return (int32_t)(0u - (uint32_t)a); }
+
+static inline int32_t alan_overflow(int64_t r, int line, int column)
+{
+    if (r < INT32_MIN || r > INT32_MAX)
+        __alan_runtime_error(OVERFLOW_ERROR, line, column);
+    return (int32_t)r;
+}
+static inline int32_t alan_addv(int32_t a, int32_t b, int l, int c) { return alan_overflow((int64_t)a + b, l, c); }
+static inline int32_t alan_subv(int32_t a, int32_t b, int l, int c) { return alan_overflow((int64_t)a - b, l, c); }
+static inline int32_t alan_mulv(int32_t a, int32_t b, int l, int c) { return alan_overflow((int64_t)a * b, l, c); }
+static inline int32_t alan_negv(int32_t a, int l, int c) { return alan_overflow(-(int64_t)a, l, c); }
+
+static inline void alan_check_div(int32_t a, int32_t b, int line, int column)
+{
+    if (b == 0)
+        __alan_runtime_error(DIVISION_ERROR, line, column);
+    if (a == INT32_MIN && b == -1)
+        __alan_runtime_error(OVERFLOW_ERROR, line, column);
+}
+static inline int32_t alan_div(int32_t a, int32_t b, int l, int c) { alan_check_div(a, b, l, c); return a / b; }
+static inline int32_t alan_mod(int32_t a, int32_t b, int l, int c) { alan_check_div(a, b, l, c); return a % b; }
+
+static inline int32_t alan_bound(int32_t i, int32_t n, int line, int column)
+{
+    if ((uint32_t)i >= (uint32_t)n)
+        __alan_runtime_error(BOUNDS_ERROR, line, column);
+    return i;
+}
+
+static inline int32_t alan_size(int32_t n, int line, int column)
+{
+    if (n <= 0)
+        __alan_runtime_error(SIZE_ERROR, line, column);
+    return n;
+}
+
+static inline void alan_zero(void *p, size_t n)
+{
+    char *c = (char *)p;
+    while (n--)
+        *c++ = 0;
+}
+)";
+
+static std::string cType(Type *type)
+{
+    switch (type->getType())
+    {
+    case TypeEnum::INT:
+        return "int32_t";
+    case TypeEnum::BYTE:
+        // Bytes are signed, like the i8 of compiled code, whatever the
+        // signedness of char; the calls into lib/lib.c convert to char
+        return "int8_t";
+    default:
+        return "void";
+    }
+}
+
+// The name of a function in C; the MIR tells apart the nested functions of
+// the same name as "f.2", and no Alan name starts with a digit
+static std::string cName(const MirFunction *f)
+{
+    size_t dot = f->name.find('.');
+    return dot == std::string::npos ? f->name : f->name.substr(dot + 1) + "_" + f->name.substr(0, dot);
+}
+
+static std::string cField(const MirVar *var)
+{
+    return var->name + "_" + std::to_string(var->id);
+}
+
+static std::string cInt(long long value)
+{
+    // -2147483648 would be the negation of a long
+    if (value == INT_MIN)
+    {
+        return "(-2147483647 - 1)";
+    }
+    return value < 0 ? "(" + std::to_string(value) + ")" : std::to_string(value);
+}
+
+// A character of a C literal quoted with quote; the rest of the unprintable
+// ones, and '?' of the trigraphs, are in octal
+static std::string cEscape(unsigned char c, char quote)
+{
+    switch (c)
+    {
+    case '\n':
+        return "\\n";
+    case '\t':
+        return "\\t";
+    case '\\':
+        return "\\\\";
+    }
+    if (c == quote)
+    {
+        return std::string("\\") + (char)c;
+    }
+    if (c >= ' ' && c <= '~' && c != '?')
+    {
+        return std::string(1, c);
+    }
+    static const char digits[] = "01234567";
+    return {'\\', digits[c >> 6], digits[(c >> 3) & 7], digits[c & 7]};
+}
+
+static std::string cJoin(const std::vector<std::string> &items)
+{
+    std::string joined;
+    for (const std::string &item : items)
+    {
+        joined += (joined.empty() ? "" : ", ") + item;
+    }
+    return joined;
+}
+
+static std::string cPosition(const AST *node)
+{
+    return std::to_string(node->line) + ", " + std::to_string(node->column);
+}
+
+// The condition of an if or a while, in parentheses of its own
+static std::string cCondition(const std::string &cond)
+{
+    if (cond.front() == '(')
+    {
+        int depth = 0;
+        for (size_t i = 0; i < cond.size(); ++i)
+        {
+            depth += cond[i] == '(' ? 1 : cond[i] == ')' ? -1 : 0;
+            if (depth == 0)
+            {
+                if (i == cond.size() - 1)
+                {
+                    return cond;
+                }
+                break;
+            }
+        }
+    }
+    return "(" + cond + ")";
+}
+
+void AST::cLine(const std::string &text)
+{
+    cOut->append(4 * cIndent, ' ');
+    *cOut += text + "\n";
+}
+
+std::string AST::cTemp(Type *type, const std::string &value)
+{
+    std::string temp = "t" + std::to_string(++cScope->temps);
+    cLine(cType(type) + " " + temp + " = " + value + ";");
+    return temp;
+}
+
+// The value of the expression, computed now unless it is a constant
+std::string AST::cPin(const Expr *e)
+{
+    if (dynamic_cast<const IntConst *>(e) || dynamic_cast<const CharConst *>(e))
+    {
+        return e->cgenExpr();
+    }
+    return cTemp(e->getType(), e->cgenExpr());
+}
+
+// Like bgenOperands: with a call in either operand the left one is evaluated
+// first, but a left lvalue is only read once the right operand is
+void AST::cgenOperands(const Expr *left, const Expr *right, std::string &leftVal, std::string &rightVal)
+{
+    if (!left->cgenHasCall() && !right->cgenHasCall())
+    {
+        leftVal = left->cgenExpr();
+        rightVal = right->cgenExpr();
+        return;
+    }
+
+    const Lval *lval = dynamic_cast<const Lval *>(left);
+    leftVal = lval ? lval->cgenLval(true) : cPin(left);
+    rightVal = right->cgenHasCall() ? cPin(right) : right->cgenExpr();
+}
+
+void AST::cgenBlock(const Stmt *stmt)
+{
+    cLine("{");
+    ++cIndent;
+    stmt->cgen();
+    --cIndent;
+    cLine("}");
+}
+
+void AST::c_gen()
+{
+    std::string decls, code;
+
+    for (const MirFunction *f : mirModule->functions)
+    {
+        if (!f->isExternal)
+        {
+            static_cast<const FuncDef *>(f->origin)->cgenFunction(decls, code);
+        }
+    }
+
+    std::cout << "/* Generated by the Alan compiler; build with: cc -fno-builtin program.c lib/lib.c */\n"
+              << "#include <stdint.h>\n#include <stdlib.h>\n\n"
+              << "enum { OVERFLOW_ERROR = " << OVERFLOW_ERROR << ", DIVISION_ERROR = " << DIVISION_ERROR
+              << ", BOUNDS_ERROR = " << BOUNDS_ERROR << ", SIZE_ERROR = " << SIZE_ERROR << " };\n";
+    std::cout << cPrelude << "\n" << decls << code;
+    std::cout << "int main(void)\n{\n    fn_" << cName(mirModule->functionOf(static_cast<const FuncDef *>(this)))
+              << "();\n    return 0;\n}\n";
+}
+
+void AST::cgenHeapRelease()
+{
+    for (const std::string &heap : cScope->heapArrays)
+    {
+        cLine("free(" + heap + ");");
+    }
+}
+
+void StmtList::cgen() const
+{
+    for (auto it = stmts.rbegin(); it != stmts.rend(); ++it)
+    {
+        (*it)->cgen();
+    }
+}
+
+void LocalDefList::cgen() const
+{
+    for (auto it = defs.rbegin(); it != defs.rend(); ++it)
+    {
+        (*it)->cgen();
+    }
+}
+
+std::string IntConst::cgenExpr() const
+{
+    return cInt(val);
+}
+
+std::string CharConst::cgenExpr() const
+{
+    signed char c = val;
+    return c < 0 ? cInt(c) : "'" + cEscape(c, '\'') + "'";
+}
+
+std::string BoolConst::cgenCond() const
+{
+    return val ? "1" : "0";
+}
+
+std::string UnOp::cgenExpr() const
+{
+    std::string value = expr->cgenExpr();
+    if (op == '+')
+    {
+        return value;
+    }
+    if (trapOverflow && !mirModule->noOverflow.count(this))
+    {
+        return "alan_negv(" + value + ", " + cPosition(this) + ")";
+    }
+    return mirModule->noOverflow.count(this) ? "(-" + value + ")" : "alan_neg(" + value + ")";
+}
+
+bool UnOp::cgenHasCall() const
+{
+    return expr->cgenHasCall();
+}
+
+std::string BinOp::cgenExpr() const
+{
+    std::string l, r;
+    cgenOperands(left, right, l, r);
+
+    const char opText[] = {' ', op, ' ', '\0'};
+    if (getTypeEnum() == TypeEnum::BYTE)
+    {
+        // Bytes wrap around in the conversion back from int
+        if ((op == '/' || op == '%') && checkDivision && !mirModule->nonZeroDivisor.count(this))
+        {
+            return std::string("(int8_t)") + (op == '/' ? "alan_div(" : "alan_mod(") + l + ", " + r + ", " +
+                   cPosition(this) + ")";
+        }
+        return "(int8_t)(" + l + opText + r + ")";
+    }
+
+    long long lo, hi;
+    bool fits = getRange(lo, hi) || mirModule->noOverflow.count(this);
+    switch (op)
+    {
+    case '+':
+    case '-':
+    case '*':
+    {
+        std::string name = op == '+' ? "alan_add" : op == '-' ? "alan_sub" : "alan_mul";
+        if (fits)
+        {
+            return "(" + l + opText + r + ")";
+        }
+        if (trapOverflow)
+        {
+            return name + "v(" + l + ", " + r + ", " + cPosition(this) + ")";
+        }
+        return name + "(" + l + ", " + r + ")";
+    }
+    default:
+    {
+        // The same checks as igenDivisionChecks
+        long long lLo, lHi, rLo, rHi;
+        bool leftKnown = left->getRange(lLo, lHi);
+        bool rightKnown = right->getRange(rLo, rHi);
+        bool zero = (!rightKnown || (rLo <= 0 && rHi >= 0)) && !mirModule->nonZeroDivisor.count(this);
+        bool overflow = (!rightKnown || (rLo <= -1 && rHi >= -1)) && (!leftKnown || lLo == INT_MIN) &&
+                        !mirModule->noOverflow.count(this);
+        if (checkDivision && (zero || overflow))
+        {
+            return std::string(op == '/' ? "alan_div(" : "alan_mod(") + l + ", " + r + ", " + cPosition(this) + ")";
+        }
+        return "(" + l + opText + r + ")";
+    }
+    }
+}
+
+bool BinOp::cgenHasCall() const
+{
+    return left->cgenHasCall() || right->cgenHasCall();
+}
+
+std::string CondCompOp::cgenCond() const
+{
+    std::string l, r;
+    cgenOperands(left, right, l, r);
+
+    static const char *const ops[] = {" < ", " > ", " <= ", " >= ", " == ", " != "};
+    return "(" + l + ops[op] + r + ")";
+}
+
+bool CondCompOp::cgenHasCall() const
+{
+    return left->cgenHasCall() || right->cgenHasCall();
+}
+
+// The calls of the right operand are only made when the left one does not
+// decide the result
+std::string CondBoolOp::cgenCond() const
+{
+    std::string l = left->cgenCond();
+    if (!right->cgenHasCall())
+    {
+        return "(" + l + (op == '&' ? " && " : " || ") + right->cgenCond() + ")";
+    }
+
+    std::string temp = "t" + std::to_string(++cScope->temps);
+    cLine("int " + temp + " = " + l + ";");
+    cLine(op == '&' ? "if (" + temp + ")" : "if (!" + temp + ")");
+    cLine("{");
+    ++cIndent;
+    std::string r = right->cgenCond();
+    cLine(temp + " = " + r + ";");
+    --cIndent;
+    cLine("}");
+    return temp;
+}
+
+bool CondBoolOp::cgenHasCall() const
+{
+    return left->cgenHasCall() || right->cgenHasCall();
+}
+
+std::string CondUnOp::cgenCond() const
+{
+    return "(!" + cond->cgenCond() + ")";
+}
+
+bool CondUnOp::cgenHasCall() const
+{
+    return cond->cgenHasCall();
+}
+
+// Arrays are zeroed like the allocas of igen. A runtime-sized array is a
+// variable length array; generators only have constant sizes
+void VarDef::cgen() const
+{
+    std::string var = "v_" + *name;
+
+    if (cScope->isGenerator)
+    {
+        if (isArray)
+        {
+            cScope->fields.push_back(cType(type->getBaseType()) + " " + var + "[" + std::to_string(size) + "]");
+            cScope->vars[*name] = {"g->" + var, "g->" + var, type->getBaseType(), true, std::to_string(size)};
+        }
+        else
+        {
+            cScope->fields.push_back(cType(type) + " " + var);
+            cScope->vars[*name] = {"g->" + var, "&g->" + var, type, false, ""};
+        }
+        return;
+    }
+
+    if (sizeExpr)
+    {
+        std::string count = "n_" + *name;
+        std::string elementType = cType(type->getBaseType());
+        cLine("int32_t " + count + " = alan_size(" + sizeExpr->cgenExpr() + ", " + cPosition(this) + ");");
+        if (vlaHeapThreshold < 0)
+        {
+            cLine(elementType + " " + var + "[" + count + "];");
+        }
+        else
+        {
+            // Above the threshold the array is malloc'ed, as in igen, and the
+            // variable length array shrinks to one element
+            std::string heap = "h_" + *name, stack = "s_" + *name;
+            std::string bytes = "(size_t)" + count + " * sizeof(" + elementType + ")";
+            cLine(elementType + " *" + heap + " = " + bytes + " > " + std::to_string(vlaHeapThreshold) +
+                  "u ? malloc(" + bytes + ") : NULL;");
+            cLine(elementType + " " + stack + "[" + heap + " ? 1 : " + count + "];");
+            cLine(elementType + " *" + var + " = " + heap + " ? " + heap + " : " + stack + ";");
+            cScope->heapArrays.push_back(heap);
+        }
+        cLine("alan_zero(" + var + ", (size_t)" + count + " * sizeof *" + var + ");");
+        cScope->vars[*name] = {var, var, type->getBaseType(), true, count};
+    }
+    else if (isArray)
+    {
+        cLine(cType(type->getBaseType()) + " " + var + "[" + std::to_string(size) + "] = {0};");
+        cScope->vars[*name] = {var, var, type->getBaseType(), true, std::to_string(size)};
+    }
+    else
+    {
+        cLine(cType(type) + " " + var + " = 0;");
+        cScope->vars[*name] = {var, "&" + var, type, false, ""};
+    }
+}
+
+std::string Lval::cgenExpr() const
+{
+    return cgenLval();
+}
+
+std::string Lval::cgenAddress(bool pin) const
+{
+    return "&" + cgenLval(pin);
+}
+
+// A string is an array of bytes
+std::string StringConst::cgenLval(bool pin) const
+{
+    std::string literal = "\"";
+    for (unsigned char c : *name)
+    {
+        literal += cEscape(c, '"');
+    }
+    return literal + "\"";
+}
+
+std::string StringConst::cgenAddress(bool pin) const
+{
+    return cgenLval(pin);
+}
+
+std::string Id::cgenLval(bool pin) const
+{
+    return cScope->vars.at(*name).value;
+}
+
+// An array as a whole is the pointer to its elements
+std::string Id::cgenAddress(bool pin) const
+{
+    const CVar &var = cScope->vars.at(*name);
+    return var.isArray ? var.value : var.address;
+}
+
+// With pin, the index is computed now, so that the element is the one the
+// other back ends address before evaluating the rest of the expression
+std::string ArrayAccess::cgenLval(bool pin) const
+{
+    const CVar &var = cScope->vars.at(*name);
+    std::string index = indexExpr->cgenExpr();
+
+    if (checkBounds && !mirModule->inBounds.count(this) && !var.size.empty())
+    {
+        index = "alan_bound(" + index + ", " + var.size + ", " + cPosition(this) + ")";
+    }
+    if (pin && !dynamic_cast<const IntConst *>(indexExpr))
+    {
+        index = cTemp(indexExpr->getType(), index);
+    }
+    return var.value + "[" + index + "]";
+}
+
+bool ArrayAccess::cgenHasCall() const
+{
+    return indexExpr->cgenHasCall();
+}
+
+// The value is computed before the element it is stored to is addressed
+void Let::cgen() const
+{
+    bool ordered = lexpr->cgenHasCall() || (rexpr->cgenHasCall() && dynamic_cast<const ArrayAccess *>(lexpr));
+    std::string value = ordered ? cPin(rexpr) : rexpr->cgenExpr();
+    cLine(lexpr->cgenLval() + " = " + value + ";");
+}
+
+// The environment of the callee, then the arguments. Once an argument makes a
+// call, the ones before it are computed first
+std::vector<std::string> FuncCall::cgenArgs() const
+{
+    const MirCallSite &callSite = mirModule->callSiteOf(this);
+    const MirFunction *callee = callSite.callee;
+    std::vector<std::string> args;
+
+    if (!callee->captures.empty())
+    {
+        std::vector<std::string> fields;
+        for (const MirCapture &capture : callee->captures)
+        {
+            // The owner finds the variable by its name; every other caller
+            // received it through its own environment
+            const MirVar *var = capture.var;
+            const CVar &captured = callSite.caller == var->owner ? cScope->vars.at(var->name)
+                                                                 : cScope->captured.at(var);
+            fields.push_back(capture.byValue ? captured.value
+                                             : captured.isArray ? captured.value : captured.address);
+        }
+        std::string env = "e" + std::to_string(++cScope->temps);
+        cLine("struct env_" + cName(callee) + " " + env + " = {" + cJoin(fields) + "};");
+        args.push_back("&" + env);
+    }
+
+    const std::vector<Expr *> exprList = exprs ? exprs->getExprs() : std::vector<Expr *>();
+    size_t params = exprList.size();
+    size_t ordered = 0;
+    for (size_t index = 0; index < params; ++index)
+    {
+        if (exprList[params - 1 - index]->cgenHasCall())
+        {
+            ordered = index + 1;
+        }
+    }
+
+    // The bytes and strings of lib/lib.c are char, which may be unsigned
+    for (size_t index = 0; index < params; ++index)
+    {
+        Expr *arg = exprList[params - 1 - index];
+        if (callee->paramByRef[index])
+        {
+            std::string address = static_cast<Lval *>(arg)->cgenAddress(index < ordered);
+            bool string = dynamic_cast<const StringConst *>(arg);
+            if (callee->isExternal != string)
+            {
+                address = (string ? "(int8_t *)" : "(char *)") + address;
+            }
+            args.push_back(address);
+        }
+        else
+        {
+            std::string value = index < ordered ? cPin(arg) : arg->cgenExpr();
+            bool byte = callee->isExternal && callee->params[index]->type == MirType::I8;
+            args.push_back(byte ? "(char)" + value : value);
+        }
+    }
+    return args;
+}
+
+std::string FuncCall::cgenExpr() const
+{
+    const MirFunction *callee = mirModule->callSiteOf(this).callee;
+    std::string function = callee->isExternal ? callee->name : "fn_" + cName(callee);
+    std::string call = function + "(" + cJoin(cgenArgs()) + ")";
+    return callee->isExternal && callee->returnType == MirType::I8 ? "(int8_t)" + call : call;
+}
+
+bool FuncCall::cgenHasCall() const
+{
+    return true;
+}
+
+void ProcCall::cgen() const
+{
+    cLine(funcCall->cgenExpr() + ";");
+}
+
+void If::cgen() const
+{
+    cLine("if " + cCondition(cond->cgenCond()));
+    cgenBlock(thenStmt);
+    if (elseStmt)
+    {
+        cLine("else");
+        cgenBlock(elseStmt);
+    }
+}
+
+// A condition that makes calls is computed at the top of the loop body
+void While::cgen() const
+{
+    if (!cond->cgenHasCall())
+    {
+        cLine("while " + cCondition(cond->cgenCond()));
+        cgenBlock(body);
+        return;
+    }
+
+    cLine("while (1)");
+    cLine("{");
+    ++cIndent;
+    cLine("if (!" + cCondition(cond->cgenCond()) + ")");
+    cLine("    break;");
+    body->cgen();
+    --cIndent;
+    cLine("}");
+}
+
+// The handle of the generator lives in the frame when the loop is in a
+// generator itself, since the loop body may yield
+void For::cgen() const
+{
+    std::string name = cName(mirModule->callSiteOf(generator).callee);
+    std::string args = cJoin(generator->cgenArgs());
+    std::string handle = "h" + std::to_string(++cScope->temps);
+
+    if (cScope->isGenerator)
+    {
+        cScope->fields.push_back("struct gen_" + name + " *" + handle);
+        handle = "g->" + handle;
+        cLine(handle + " = fn_" + name + "_new(" + args + ");");
+    }
+    else
+    {
+        cLine("struct gen_" + name + " *" + handle + " = fn_" + name + "_new(" + args + ");");
+    }
+
+    cLine("while (fn_" + name + "_next(" + handle + "))");
+    cLine("{");
+    ++cIndent;
+    cLine(lvalue->cgenLval() + " = " + handle + "->value;");
+    cScope->generators.push_back(handle);
+    body->cgen();
+    cScope->generators.pop_back();
+    --cIndent;
+    cLine("}");
+    cLine("free(" + handle + ");");
+}
+
+// next() returns at a yield, and resumes at the case label after it
+void Yield::cgen() const
+{
+    std::string state = std::to_string(++cScope->yields);
+    cLine("g->value = " + expr->cgenExpr() + ";");
+    cLine("g->state = " + state + ";");
+    cLine("return 1;");
+    cLine("case " + state + ":;");
+}
+
+// A return from inside for loops frees their generators, and every return
+// the arrays of the function on the heap
+void Return::cgen() const
+{
+    std::string value;
+    if (expr)
+    {
+        value = cScope->generators.empty() && cScope->heapArrays.empty() ? expr->cgenExpr() : cPin(expr);
+    }
+
+    for (auto it = cScope->generators.rbegin(); it != cScope->generators.rend(); ++it)
+    {
+        cLine("free(" + *it + ");");
+    }
+    cgenHeapRelease();
+
+    if (cScope->isGenerator)
+    {
+        cLine("g->state = -1;");
+        cLine("return 0;");
+    }
+    else
+    {
+        cLine(expr ? "return " + value + ";" : "return;");
+    }
+}
+
+// Appends the environment struct and the prototype of the function to decls,
+// and its definition to code. A generator is a frame, allocated by new() with
+// its arguments, and a next() that runs it to its next yield and returns 0
+// once it is done
+void FuncDef::cgenFunction(std::string &decls, std::string &code) const
+{
+    const MirFunction *func = mirModule->functionOf(this);
+    const std::vector<Fpar *> params = fpar ? fpar->getParameters() : std::vector<Fpar *>();
+    std::string name = cName(func);
+
+    CScope scope;
+    scope.isGenerator = type->getType() == TypeEnum::GENERATOR;
+    std::string frame = scope.isGenerator ? "g->" : "";
+
+    std::vector<std::string> args;
+    if (!func->captures.empty())
+    {
+        decls += "struct env_" + name + "\n{\n";
+        for (const MirCapture &capture : func->captures)
+        {
+            const MirVar *var = capture.var;
+            std::string field = (scope.isGenerator ? "g->env." : "env->") + cField(var);
+            CVar captured;
+            if (capture.byValue)
+            {
+                decls += "    " + cType(var->type) + " " + cField(var) + ";\n";
+                captured = {field, "", var->type, false, ""};
+            }
+            else if (var->isScalar())
+            {
+                decls += "    " + cType(var->type) + " *" + cField(var) + ";\n";
+                captured = {"(*" + field + ")", field, var->type, false, ""};
+            }
+            else
+            {
+                decls += "    " + cType(var->type->getBaseType()) + " *" + cField(var) + ";\n";
+                captured = {field, field, var->type->getBaseType(), true, ""};
+            }
+            scope.vars[var->name] = captured;
+            scope.captured[var] = captured;
+        }
+        decls += "};\n";
+        args.push_back("struct env_" + name + " *env");
+    }
+
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        Fpar *param = params[params.size() - 1 - i];
+        Type *paramType = param->getType();
+        std::string var = "v_" + *param->getName();
+
+        if (paramType->getType() == TypeEnum::ARRAY)
+        {
+            args.push_back(cType(paramType->getBaseType()) + " *" + var);
+            scope.vars[*param->getName()] = {frame + var, frame + var, paramType->getBaseType(), true, ""};
+        }
+        else if (param->getParameterType() == ParameterType::REFERENCE)
+        {
+            args.push_back(cType(paramType) + " *" + var);
+            scope.vars[*param->getName()] = {"(*" + frame + var + ")", frame + var, paramType, false, ""};
+        }
+        else
+        {
+            args.push_back(cType(paramType) + " " + var);
+            scope.vars[*param->getName()] = {frame + var, "&" + frame + var, paramType, false, ""};
+        }
+    }
+
+    std::string body;
+    cScope = &scope;
+    cOut = &body;
+    cIndent = scope.isGenerator ? 2 : 1;
+    localDef->cgen();
+    stmts->cgen();
+    cgenHeapRelease();
+    cScope = nullptr;
+    cOut = nullptr;
+
+    std::string signature = cJoin(args);
+    if (!scope.isGenerator)
+    {
+        std::string head = "static " + cType(type) + " fn_" + name + "(" + (args.empty() ? "void" : signature) + ")";
+        decls += head + ";\n";
+        code += "\n" + head + "\n{\n" + body + "}\n";
+        return;
+    }
+
+    decls += "struct gen_" + name + "\n{\n    int state;\n    int32_t value;\n";
+    if (!func->captures.empty())
+    {
+        decls += "    struct env_" + name + " env;\n";
+    }
+    for (const std::string &arg : args)
+    {
+        if (arg.compare(0, 7, "struct ") != 0)
+        {
+            decls += "    " + arg + ";\n";
+        }
+    }
+    for (const std::string &field : scope.fields)
+    {
+        decls += "    " + field + ";\n";
+    }
+    decls += "};\n";
+
+    std::string create = "static struct gen_" + name + " *fn_" + name + "_new(" + (args.empty() ? "void" : signature) + ")";
+    std::string next = "static int fn_" + name + "_next(struct gen_" + name + " *g)";
+    decls += create + ";\n" + next + ";\n";
+
+    code += "\n" + create + "\n{\n    struct gen_" + name + " *g = calloc(1, sizeof *g);\n";
+    if (!func->captures.empty())
+    {
+        code += "    g->env = *env;\n";
+    }
+    for (const Fpar *param : params)
+    {
+        code += "    g->v_" + *param->getName() + " = v_" + *param->getName() + ";\n";
+    }
+    code += "    return g;\n}\n";
+
+    code += "\n" + next + "\n{\n    switch (g->state)\n    {\n    case 0:;\n" + body + "    }\n";
+    code += "    g->state = -1;\n    return 0;\n}\n";
+}
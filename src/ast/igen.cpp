@@ -1,15 +1,40 @@
 #include "ast.hpp"
+#include "../jit/jit.hpp"
+#include <climits>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Transforms/InstCombine/InstCombine.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Scalar/GVN.h>
 #include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/Vectorize.h>
+#include <llvm/Analysis/VectorUtils.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <numeric>
 
 llvm::LLVMContext AST::TheContext;
 llvm::IRBuilder<> AST::Builder(AST::TheContext);
@@ -18,8 +43,18 @@ std::unique_ptr<llvm::legacy::FunctionPassManager> AST::TheFPM;
 llvm::Type *AST::proc = llvm::Type::getVoidTy(TheContext);
 llvm::Type *AST::i8 = llvm::IntegerType::get(TheContext, 8);
 llvm::Type *AST::i32 = llvm::IntegerType::get(TheContext, 32);
+llvm::Type *AST::i64 = llvm::IntegerType::get(TheContext, 64);
 GenScope AST::scopes;
 std::stack<GenBlock *> AST::blockStack;
+std::unordered_set<llvm::Value *> AST::arrayAccessPtrs;
+std::unordered_map<std::string, size_t> AST::closureFieldCount;
+int AST::profiledFunctions = 0;
+std::vector<std::pair<llvm::Function *, bool>> AST::coverageFunctions;
+std::unordered_map<llvm::BasicBlock *, std::vector<std::pair<int, int>>> AST::coveragePoints;
+std::vector<int> AST::loopProfileDescriptions;
+std::vector<llvm::GlobalVariable *> AST::loopProfileCounts;
+std::vector<std::pair<const FuncDef *, llvm::Function *>> AST::tierFunctions;
+std::unique_ptr<llvm::DIBuilder> AST::DBuilder;
 
 llvm::ConstantInt *AST::c1(bool c)
 {
@@ -36,9 +71,443 @@ llvm::ConstantInt *AST::c32(int n)
     return llvm::ConstantInt::get(TheContext, llvm::APInt(32, n, true));
 }
 
+llvm::AllocaInst *AST::entryAlloca(llvm::Type *t, const std::string &name)
+{
+    llvm::BasicBlock &entry = blockStack.top()->getFunc()->getEntryBlock();
+    llvm::IRBuilder<> TmpB(&entry, entry.begin());
+    return TmpB.CreateAlloca(t, nullptr, name);
+}
+
+llvm::Value *AST::genIntrinsic(llvm::Intrinsic::ID id, std::vector<llvm::Value *> args, const std::string &name)
+{
+    llvm::Function *intrinsic = llvm::Intrinsic::getDeclaration(TheModule.get(), id);
+
+    if (intrinsic->getReturnType()->isVoidTy())
+    {
+        return Builder.CreateCall(intrinsic, args);
+    }
+    return Builder.CreateCall(intrinsic, args, name);
+}
+
+void AST::genRuntimeCheck(llvm::Value *failed, RuntimeError error) const
+{
+    llvm::Function *func = Builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *trapBB = llvm::BasicBlock::Create(TheContext, "check_fail", func);
+    llvm::BasicBlock *contBB = llvm::BasicBlock::Create(TheContext, "check_ok", func);
+
+    llvm::MDBuilder MDB(TheContext);
+    Builder.CreateCondBr(failed, trapBB, contBB, MDB.createBranchWeights(1, 1 << 20));
+
+    // The error routine never returns, so the trap blocks stay off the hot path
+    llvm::FunctionCallee errorFunc = TheModule->getOrInsertFunction(
+        "__alan_runtime_error", llvm::FunctionType::get(proc, {i32, i32, i32}, false));
+    llvm::Function *errorDecl = llvm::cast<llvm::Function>(errorFunc.getCallee());
+    errorDecl->addFnAttr(llvm::Attribute::Cold);
+    errorDecl->addFnAttr(llvm::Attribute::NoReturn);
+
+    Builder.SetInsertPoint(trapBB);
+    Builder.CreateCall(errorFunc, {c32(error), c32(line), c32(column)});
+    Builder.CreateUnreachable();
+
+    Builder.SetInsertPoint(contBB);
+}
+
+void AST::genFrameRelease()
+{
+    GenBlock *currentBlock = blockStack.top();
+
+    for (llvm::Value *handle : currentBlock->getActiveGenerators())
+    {
+        genIntrinsic(llvm::Intrinsic::coro_destroy, {handle});
+    }
+
+    for (llvm::AllocaInst *slot : currentBlock->getHeapArrays())
+    {
+        llvm::Value *heapPtr = Builder.CreateLoad(slot->getAllocatedType(), slot, slot->getName() + "_load");
+        llvm::FunctionCallee freeFunc = TheModule->getOrInsertFunction(
+            "free", llvm::FunctionType::get(proc, {i8->getPointerTo()}, false));
+        Builder.CreateCall(freeFunc, {Builder.CreateBitCast(heapPtr, i8->getPointerTo())});
+    }
+
+    if (currentBlock->getStackSave())
+    {
+        genIntrinsic(llvm::Intrinsic::stackrestore, {currentBlock->getStackSave()});
+    }
+
+    // A return ends the runs of the while loops around it (-fprofile-loops)
+    for (auto &loop : currentBlock->getActiveLoops())
+    {
+        genLoopExit(loop.first, loop.second);
+    }
+}
+
+// Records the entry of the current function in the profile of the runtime
+// (-fprofile-functions); the runtime keeps the stack of active calls, so the
+// exit needs no arguments
+void AST::genProfileEnter(const std::string &name)
+{
+    llvm::FunctionCallee enterFunc = TheModule->getOrInsertFunction(
+        "__alan_profile_enter", llvm::FunctionType::get(proc, {i32, i8->getPointerTo()}, false));
+    llvm::Value *nameStr = Builder.CreateGlobalStringPtr(name, "profile_name");
+    Builder.CreateCall(enterFunc, {c32(profiledFunctions++), nameStr});
+}
+
+void AST::genProfileExit()
+{
+    llvm::FunctionCallee exitFunc = TheModule->getOrInsertFunction(
+        "__alan_profile_exit", llvm::FunctionType::get(proc, {}, false));
+    Builder.CreateCall(exitFunc, {});
+}
+
+// Records that the statement or definition at node starts in block
+// (-fcoverage); a block statement is covered by the statements in it
+void AST::genCoveragePoint(llvm::BasicBlock *block, const AST *node)
+{
+    if (coverage && node && !dynamic_cast<const StmtList *>(node))
+    {
+        coveragePoints[block].push_back({node->line, node->column});
+    }
+}
+
+// Places the counters of -fcoverage and passes the runtime a description of
+// every instrumented function: its blocks with their source positions, and
+// its edges. The edges of a maximum spanning tree of the CFG, weighted by
+// loop depth, get no counter; the runtime derives their counts by flow
+// conservation, with a virtual exit block whose edge back to the entry
+// counts the calls. The coroutine passes resume the frame of a generator
+// behind the back of its CFG, so the blocks of generators count themselves.
+void AST::genCoverage(llvm::BasicBlock *mainBlock)
+{
+    struct Edge
+    {
+        int src;
+        int dst;
+        int weight;
+        int successor; // of the terminator of src, or -1 for an edge to the exit
+        int counter;
+    };
+    struct Site
+    {
+        llvm::BasicBlock *block;
+        int successor; // as above, or -2 for the block itself
+        int counter;
+    };
+
+    std::vector<int> graph;
+    std::vector<int> positions;
+    std::vector<Site> sites;
+    int counters = 0;
+
+    for (auto &coverageFunction : coverageFunctions)
+    {
+        llvm::Function *func = coverageFunction.first;
+        bool generator = coverageFunction.second;
+        std::vector<llvm::BasicBlock *> blocks;
+        std::unordered_map<llvm::BasicBlock *, int> index;
+        for (llvm::BasicBlock &block : *func)
+        {
+            index[&block] = blocks.size();
+            blocks.push_back(&block);
+        }
+        int exit = blocks.size();
+
+        std::vector<Edge> edges;
+        if (!generator)
+        {
+            llvm::DominatorTree dominators(*func);
+            llvm::LoopInfo loops(dominators);
+
+            edges.push_back({exit, 0, INT_MAX, -1, -1});
+            for (llvm::BasicBlock *block : blocks)
+            {
+                llvm::Instruction *term = block->getTerminator();
+                if (term->getNumSuccessors() == 0)
+                {
+                    edges.push_back({index[block], exit, INT_MAX, -1, -1});
+                }
+                for (unsigned i = 0; i < term->getNumSuccessors(); ++i)
+                {
+                    llvm::BasicBlock *succ = term->getSuccessor(i);
+                    int depth = std::min(loops.getLoopDepth(block), loops.getLoopDepth(succ));
+                    edges.push_back({index[block], index[succ], depth, static_cast<int>(i), -1});
+                }
+            }
+
+            // Kruskal, heaviest first: the edges that would close a cycle are counted
+            std::vector<int> parent(exit + 1);
+            std::iota(parent.begin(), parent.end(), 0);
+            auto root = [&parent](int n)
+            {
+                while (parent[n] != n)
+                {
+                    n = parent[n] = parent[parent[n]];
+                }
+                return n;
+            };
+            std::vector<size_t> order(edges.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(),
+                             [&edges](size_t a, size_t b) { return edges[a].weight > edges[b].weight; });
+            for (size_t e : order)
+            {
+                int a = root(edges[e].src);
+                int b = root(edges[e].dst);
+                if (a != b)
+                {
+                    parent[a] = b;
+                }
+                else
+                {
+                    edges[e].counter = counters++;
+                    sites.push_back({blocks[edges[e].src], edges[e].successor, edges[e].counter});
+                }
+            }
+        }
+
+        graph.push_back(blocks.size());
+        graph.push_back(edges.size());
+        for (llvm::BasicBlock *block : blocks)
+        {
+            auto points = coveragePoints.find(block);
+            int counter = -1;
+            if (generator && points != coveragePoints.end())
+            {
+                counter = counters++;
+                sites.push_back({block, -2, counter});
+            }
+            graph.push_back(counter);
+            graph.push_back(positions.size() / 2);
+            graph.push_back(points == coveragePoints.end() ? 0 : points->second.size());
+            if (points != coveragePoints.end())
+            {
+                for (auto &point : points->second)
+                {
+                    positions.push_back(point.first);
+                    positions.push_back(point.second);
+                }
+            }
+        }
+        for (const Edge &edge : edges)
+        {
+            graph.push_back(edge.src);
+            graph.push_back(edge.dst);
+            graph.push_back(edge.counter);
+        }
+    }
+
+    llvm::ArrayType *countersType = llvm::ArrayType::get(i64, std::max(counters, 1));
+    llvm::GlobalVariable *countersVar = new llvm::GlobalVariable(
+        *TheModule, countersType, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantAggregateZero::get(countersType), "__alan_coverage_counters");
+
+    // A counted edge is incremented at the end of its source if it is the only
+    // edge out, at the start of its target if it is the only edge in, and in a
+    // block of its own otherwise
+    for (const Site &site : sites)
+    {
+        llvm::Instruction *term = site.block->getTerminator();
+        llvm::Instruction *at = term;
+        if (site.successor == -2)
+        {
+            at = &*site.block->getFirstInsertionPt();
+        }
+        else if (site.successor >= 0 && term->getNumSuccessors() > 1)
+        {
+            llvm::BasicBlock *succ = term->getSuccessor(site.successor);
+            if (succ->getSinglePredecessor())
+            {
+                at = &*succ->getFirstInsertionPt();
+            }
+            else
+            {
+                llvm::BasicBlock *edgeBB = llvm::BasicBlock::Create(TheContext, "coverage_edge", succ->getParent(), succ);
+                at = llvm::BranchInst::Create(succ, edgeBB);
+                term->setSuccessor(site.successor, edgeBB);
+                for (llvm::PHINode &phi : succ->phis())
+                {
+                    phi.setIncomingBlock(phi.getBasicBlockIndex(site.block), edgeBB);
+                }
+            }
+        }
+
+        llvm::IRBuilder<> counterBuilder(at);
+        llvm::Value *counter = counterBuilder.CreateConstInBoundsGEP2_32(countersType, countersVar, 0, site.counter);
+        llvm::Value *count = counterBuilder.CreateLoad(i64, counter);
+        counterBuilder.CreateStore(counterBuilder.CreateAdd(count, llvm::ConstantInt::get(i64, 1)), counter);
+    }
+
+    auto table = [](const std::vector<int> &values, const std::string &name)
+    {
+        llvm::Constant *init = llvm::ConstantDataArray::get(TheContext, llvm::ArrayRef<int>(values));
+        return new llvm::GlobalVariable(*TheModule, init->getType(), true, llvm::GlobalValue::PrivateLinkage, init, name);
+    };
+    llvm::GlobalVariable *graphVar = table(graph, "__alan_coverage_graph");
+    llvm::GlobalVariable *positionsVar = table(positions, "__alan_coverage_positions");
+
+    Builder.SetInsertPoint(mainBlock);
+    llvm::FunctionCallee initFunc = TheModule->getOrInsertFunction(
+        "__alan_coverage_init",
+        llvm::FunctionType::get(proc, {i32, i32->getPointerTo(), i32->getPointerTo(), i64->getPointerTo(), i8->getPointerTo()}, false));
+    Builder.CreateCall(initFunc, {c32(coverageFunctions.size()),
+                                  Builder.CreateConstInBoundsGEP2_32(graphVar->getValueType(), graphVar, 0, 0),
+                                  Builder.CreateConstInBoundsGEP2_32(positionsVar->getValueType(), positionsVar, 0, 0),
+                                  Builder.CreateConstInBoundsGEP2_32(countersType, countersVar, 0, 0),
+                                  Builder.CreateGlobalStringPtr(sourceText, "__alan_coverage_source")});
+}
+
+// Places the counters of a site of -fprofile-loops at node
+llvm::GlobalVariable *AST::genLoopProfileSite(const AST *node, LoopProfileKind kind)
+{
+    llvm::ArrayType *countsType = llvm::ArrayType::get(i64, kind == PROFILE_WHILE ? LOOP_BUCKETS + 1 : 2);
+    llvm::GlobalVariable *counts = new llvm::GlobalVariable(
+        *TheModule, countsType, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantAggregateZero::get(countsType), "__alan_loop_counts");
+    loopProfileDescriptions.insert(loopProfileDescriptions.end(), {kind, node->line, node->column});
+    loopProfileCounts.push_back(counts);
+    return counts;
+}
+
+// Adds amount (by default 1) to the counter at index of a site
+void AST::genLoopProfileCount(llvm::GlobalVariable *counts, llvm::Value *index, llvm::Value *amount)
+{
+    llvm::Value *counter = Builder.CreateInBoundsGEP(counts->getValueType(), counts, {c32(0), index});
+    llvm::Value *count = Builder.CreateLoad(i64, counter);
+    Builder.CreateStore(Builder.CreateAdd(count, amount ? amount : llvm::ConstantInt::get(i64, 1)), counter);
+}
+
+// Counts a run of a while loop in the bucket of its trip count, the number
+// of significant bits of it
+void AST::genLoopExit(llvm::AllocaInst *trips, llvm::GlobalVariable *counts)
+{
+    llvm::Value *tripCount = Builder.CreateLoad(i64, trips, "trips");
+    llvm::Value *zeros = Builder.CreateBinaryIntrinsic(llvm::Intrinsic::ctlz, tripCount, c1(false));
+    genLoopProfileCount(counts, Builder.CreateSub(llvm::ConstantInt::get(i64, 64), zeros, "trip_bucket"));
+    genLoopProfileCount(counts, c32(LOOP_BUCKETS), tripCount);
+}
+
+// Passes the runtime the sites of -fprofile-loops and their counters
+void AST::genLoopProfile(llvm::BasicBlock *mainBlock)
+{
+    std::vector<llvm::Constant *> countPtrs;
+    for (llvm::GlobalVariable *counts : loopProfileCounts)
+    {
+        countPtrs.push_back(llvm::ConstantExpr::getInBoundsGetElementPtr(
+            counts->getValueType(), counts, llvm::ArrayRef<llvm::Constant *>{c32(0), c32(0)}));
+    }
+    llvm::ArrayType *tableType = llvm::ArrayType::get(i64->getPointerTo(), std::max<size_t>(countPtrs.size(), 1));
+    if (countPtrs.empty())
+    {
+        countPtrs.push_back(llvm::ConstantPointerNull::get(i64->getPointerTo()));
+    }
+    llvm::GlobalVariable *countsVar = new llvm::GlobalVariable(
+        *TheModule, tableType, true, llvm::GlobalValue::PrivateLinkage,
+        llvm::ConstantArray::get(tableType, countPtrs), "__alan_loop_profile_counts");
+
+    std::vector<int> descriptions = loopProfileDescriptions;
+    if (descriptions.empty())
+    {
+        descriptions.push_back(0);
+    }
+    llvm::Constant *descriptionsInit = llvm::ConstantDataArray::get(TheContext, llvm::ArrayRef<int>(descriptions));
+    llvm::GlobalVariable *descriptionsVar = new llvm::GlobalVariable(
+        *TheModule, descriptionsInit->getType(), true, llvm::GlobalValue::PrivateLinkage,
+        descriptionsInit, "__alan_loop_profile_sites");
+
+    Builder.SetInsertPoint(mainBlock);
+    llvm::FunctionCallee initFunc = TheModule->getOrInsertFunction(
+        "__alan_loop_profile_init",
+        llvm::FunctionType::get(proc, {i32, i32->getPointerTo(), i64->getPointerTo()->getPointerTo()}, false));
+    Builder.CreateCall(initFunc, {c32(loopProfileCounts.size()),
+                                  Builder.CreateConstInBoundsGEP2_32(descriptionsVar->getValueType(), descriptionsVar, 0, 0),
+                                  Builder.CreateConstInBoundsGEP2_32(tableType, countsVar, 0, 0)});
+}
+
+// Debug info types (-g); arrays of unknown size have a count of -1
+llvm::DIType *AST::debugType(Type *type)
+{
+    switch (type->getType())
+    {
+    case TypeEnum::INT:
+        return DBuilder->createBasicType("int", 32, llvm::dwarf::DW_ATE_signed);
+    case TypeEnum::BYTE:
+        return DBuilder->createBasicType("byte", 8, llvm::dwarf::DW_ATE_unsigned_char);
+    case TypeEnum::ARRAY:
+    {
+        llvm::DIType *element = debugType(type->getBaseType());
+        int count = static_cast<ArrayType *>(type)->getSize();
+        return DBuilder->createArrayType(count > 0 ? count * element->getSizeInBits() : 0, element->getSizeInBits(),
+                                         element, DBuilder->getOrCreateArray({DBuilder->getOrCreateSubrange(0, count)}));
+    }
+    case TypeEnum::GENERATOR:
+        return DBuilder->createPointerType(debugType(type->getBaseType()), 64, 0, llvm::None, "gen");
+    default:
+        return nullptr;
+    }
+}
+
+// Attributes the instructions generated next to the position of node (-g)
+void AST::genDebugLocation(const AST *node)
+{
+    llvm::DISubprogram *subprogram = Builder.GetInsertBlock()->getParent()->getSubprogram();
+    if (subprogram && node && !dynamic_cast<const StmtList *>(node))
+    {
+        Builder.SetCurrentDebugLocation(llvm::DILocation::get(TheContext, node->line, node->column, subprogram));
+    }
+}
+
+// Describes a local variable or parameter (argNo > 0) of the current function.
+// Slots of pointer type hold the address of the variable: reference
+// parameters, captured variables and runtime-sized arrays
+void AST::genDebugVariable(llvm::AllocaInst *storage, const std::string &name, Type *type, int line, int column, unsigned argNo)
+{
+    llvm::DISubprogram *subprogram = Builder.GetInsertBlock()->getParent()->getSubprogram();
+    if (!subprogram)
+    {
+        return;
+    }
+
+    llvm::DIFile *file = subprogram->getFile();
+    llvm::DILocalVariable *var = argNo
+        ? DBuilder->createParameterVariable(subprogram, name, argNo, file, line, debugType(type), true)
+        : DBuilder->createAutoVariable(subprogram, name, file, line, debugType(type), true);
+
+    llvm::SmallVector<uint64_t, 1> address;
+    if (storage->getAllocatedType()->isPointerTy())
+    {
+        address.push_back(llvm::dwarf::DW_OP_deref);
+    }
+    DBuilder->insertDeclare(storage, var, DBuilder->createExpression(address),
+                            llvm::DILocation::get(TheContext, line, column, subprogram), Builder.GetInsertBlock());
+}
+
 void AST::llvm_igen(bool optimize)
 {
+    tracePhase("llvm-ir");
+
+    // Drop what the previous module left behind before it is replaced
+    TheFPM.reset();
+    arrayAccessPtrs.clear();
+    closureFieldCount.clear();
+    profiledFunctions = 0;
+    coverageFunctions.clear();
+    coveragePoints.clear();
+    loopProfileDescriptions.clear();
+    loopProfileCounts.clear();
+    tierFunctions.clear();
+
     TheModule = std::make_unique<llvm::Module>(filename, TheContext);
+    Builder.SetCurrentDebugLocation(llvm::DebugLoc());
+    DBuilder.reset();
+
+    // The debuggers print Alan values best as C values
+    if (debugInfo)
+    {
+        TheModule->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+        TheModule->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+        DBuilder = std::make_unique<llvm::DIBuilder>(*TheModule);
+        llvm::DIFile *file = DBuilder->createFile(llvm::sys::path::filename(debugFile), llvm::sys::path::parent_path(debugFile));
+        DBuilder->createCompileUnit(llvm::dwarf::DW_LANG_C99, file, "alan compiler", optimize, "", 0);
+    }
 
     scopes.openScope();
 
@@ -49,6 +518,11 @@ void AST::llvm_igen(bool optimize)
         TheFPM->add(llvm::createInstructionCombiningPass());
         TheFPM->add(llvm::createReassociatePass());
         TheFPM->add(llvm::createGVNPass());
+        TheFPM->add(llvm::createLoopRotatePass());
+        TheFPM->add(llvm::createLICMPass());
+        TheFPM->add(llvm::createLoopVectorizePass());
+        TheFPM->add(llvm::createLoopUnrollPass());
+        TheFPM->add(llvm::createInstructionCombiningPass());
         TheFPM->add(llvm::createCFGSimplificationPass());
     }
     TheFPM->doInitialization();
@@ -60,39 +534,443 @@ void AST::llvm_igen(bool optimize)
 
     this->igen();
 
-    FuncDef *mainFuncDef = dynamic_cast<FuncDef *>(this);
-    if (mainFuncDef)
-    {
-        llvm::Function *sourceMainFunc = scopes.getFunction(*(mainFuncDef->getName()));
-        if (sourceMainFunc)
+    if (coverage)
+    {
+        genCoverage(BB);
+    }
+
+    if (profileLoops)
+    {
+        genLoopProfile(BB);
+    }
+
+    if (tiered)
+    {
+        genTierEntries();
+    }
+
+    if (debugInfo)
+    {
+        DBuilder->finalize();
+    }
+
+    FuncDef *mainFuncDef = dynamic_cast<FuncDef *>(this);
+    if (mainFuncDef)
+    {
+        llvm::Function *sourceMainFunc = scopes.getFunction(*(mainFuncDef->getName()));
+        if (sourceMainFunc)
+        {
+            Builder.SetInsertPoint(BB);
+            Builder.CreateCall(sourceMainFunc, {});
+        }
+        else
+        {
+            std::cerr << "Error: main function not found in source program." << std::endl;
+        }
+    }
+
+    Builder.CreateRet(c32(0));
+
+    scopes.closeScope();
+
+    bool bad = llvm::verifyModule(*TheModule, &llvm::errs());
+    if (bad)
+    {
+        std::cerr << "The IR is bad!" << std::endl;
+        TheModule->print(llvm::errs(), nullptr);
+        std::exit(1);
+    }
+    timePhase("llvm-ir");
+
+    if (printStats)
+    {
+        printFunctionStats("before optimization");
+    }
+
+    // The legacy pass manager traces every function and pass of -ftrace itself
+    tracePhase("optimize");
+    for (auto &func : TheModule->functions())
+    {
+        TheFPM->run(func);
+    }
+
+    // Generators are split into ramp, resume and destroy functions by the
+    // coroutine passes, which need the whole module (new pass manager only)
+    if (TheModule->getFunction("llvm.coro.begin"))
+    {
+        llvm::LoopAnalysisManager LAM;
+        llvm::FunctionAnalysisManager FAM;
+        llvm::CGSCCAnalysisManager CGAM;
+        llvm::ModuleAnalysisManager MAM;
+        llvm::PassInstrumentationCallbacks PIC;
+        if (llvm::timeTraceProfilerEnabled())
+        {
+            PIC.registerBeforeNonSkippedPassCallback([](llvm::StringRef pass, llvm::Any) {
+                llvm::timeTraceProfilerBegin(pass, "");
+            });
+            PIC.registerAfterPassCallback([](llvm::StringRef, llvm::Any, const llvm::PreservedAnalyses &) {
+                llvm::timeTraceProfilerEnd();
+            });
+            PIC.registerAfterPassInvalidatedCallback([](llvm::StringRef, const llvm::PreservedAnalyses &) {
+                llvm::timeTraceProfilerEnd();
+            });
+        }
+        llvm::PassBuilder PB(nullptr, llvm::PipelineTuningOptions(), llvm::None, &PIC);
+
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+        llvm::ModulePassManager MPM = optimize
+            ? PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2)
+            : PB.buildO0DefaultPipeline(llvm::OptimizationLevel::O0);
+        MPM.run(*TheModule, MAM);
+    }
+    timePhase("optimize");
+
+    if (printStats)
+    {
+        printFunctionStats("after optimization");
+    }
+
+    if (stackUsage)
+    {
+        printStackUsage();
+    }
+
+    // The module of --tiered is compiled by tier_gen
+    if (tiered)
+    {
+        return;
+    }
+
+    if (jit)
+    {
+        runStatus = runJIT(std::move(TheModule), optimize);
+        return;
+    }
+
+    tracePhase("print");
+    TheModule->print(llvm::outs(), nullptr);
+    llvm::outs().flush();
+    timePhase("print");
+}
+
+// The entries of the functions for the calls of the VM in --tiered:
+// i32 __tier_<name>(ptr args) takes the parameters, then the addresses of
+// the captured variables, from the registers of the VM, and fills the
+// closure of the function from them like FuncCall::igen
+void AST::genTierEntries()
+{
+    llvm::FunctionType *entryType = llvm::FunctionType::get(i32, {i64->getPointerTo()}, false);
+    Builder.SetCurrentDebugLocation(llvm::DebugLoc());
+
+    for (const auto &tierFunction : tierFunctions)
+    {
+        const MirFunction *mirFunc = mirModule->functionOf(tierFunction.first);
+        llvm::Function *func = tierFunction.second;
+        llvm::Function *entry = llvm::Function::Create(entryType, llvm::Function::ExternalLinkage,
+                                                       "__tier_" + mirFunc->name, TheModule.get());
+        Builder.SetInsertPoint(llvm::BasicBlock::Create(TheContext, "entry", entry));
+
+        llvm::Value *regs = &*entry->arg_begin();
+        auto slot = [&](size_t index, llvm::Type *type) {
+            llvm::Value *address = Builder.CreateGEP(i64, regs, llvm::ConstantInt::get(i64, index));
+            return Builder.CreateLoad(type, Builder.CreateBitCast(address, type->getPointerTo()));
+        };
+
+        std::vector<llvm::Value *> args;
+        const std::vector<MirCapture> &captures = mirFunc->captures;
+        size_t params = func->arg_size() - (captures.empty() ? 0 : 1);
+        if (!captures.empty())
+        {
+            llvm::StructType *closureType = llvm::StructType::getTypeByName(TheContext, mirFunc->name + "_closure");
+            llvm::Value *closure = Builder.CreateAlloca(closureType);
+            for (size_t index = 0; index < captures.size(); ++index)
+            {
+                llvm::Type *fieldType = closureType->getElementType(index);
+                llvm::Value *address = slot(params + index, i8->getPointerTo());
+                llvm::Value *field = captures[index].byValue
+                    ? (llvm::Value *)Builder.CreateLoad(fieldType, Builder.CreateBitCast(address, fieldType->getPointerTo()))
+                    : Builder.CreateBitCast(address, fieldType);
+                Builder.CreateStore(field, Builder.CreateStructGEP(closureType, closure, index));
+            }
+            args.push_back(closure);
+        }
+
+        // Bytes are held sign extended in the registers
+        for (size_t index = 0; index < params; ++index)
+        {
+            llvm::Type *paramType = func->getFunctionType()->getParamType(args.size());
+            args.push_back(paramType == i8 ? Builder.CreateTrunc(slot(index, i32), i8) : slot(index, paramType));
+        }
+
+        llvm::Value *result = Builder.CreateCall(func, args);
+        if (func->getReturnType() == i8)
+        {
+            result = Builder.CreateSExt(result, i32);
+        }
+        Builder.CreateRet(func->getReturnType() == proc ? c32(0) : result);
+    }
+}
+
+// Compiles the program for the native tier of --tiered, on the thread of
+// the VM that found it hot: LLVM IR as for -O, with the entries of
+// genTierEntries, in a JIT of its own. The instrumentation options only
+// concern compiled executables, so the tier is built without them
+llvm::ExecutionEngine *AST::tier_gen()
+{
+    profileFunctions = false;
+    coverage = false;
+    profileLoops = false;
+    printStats = false;
+    stackUsage = false;
+    llvm_igen(true);
+    return buildJIT(std::move(TheModule), true);
+}
+
+void AST::printFunctionStats(const char *stage)
+{
+    // Frame bytes count the allocas of constant size; runtime-sized arrays
+    // and the frames of generators on the heap are not included
+    const llvm::DataLayout &layout = TheModule->getDataLayout();
+    const char *columns[] = {"allocas", "loads", "stores", "calls", "blocks", "closure", "frame"};
+    const int COLUMNS = 7;
+    size_t totals[COLUMNS] = {};
+
+    fprintf(stderr, "stats %s\n  %-28s", stage, "function");
+    for (const char *column : columns)
+    {
+        fprintf(stderr, " %8s", column);
+    }
+    fprintf(stderr, "\n");
+
+    for (auto &func : TheModule->functions())
+    {
+        if (func.isDeclaration())
+        {
+            continue;
+        }
+
+        size_t counts[COLUMNS] = {};
+        for (auto &block : func)
+        {
+            counts[4]++;
+            for (auto &inst : block)
+            {
+                if (auto *alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst))
+                {
+                    counts[0]++;
+                    if (auto size = alloca->getAllocationSizeInBits(layout))
+                    {
+                        counts[6] += size->getFixedSize() / 8;
+                    }
+                }
+                else if (llvm::isa<llvm::LoadInst>(inst))
+                {
+                    counts[1]++;
+                }
+                else if (llvm::isa<llvm::StoreInst>(inst))
+                {
+                    counts[2]++;
+                }
+                else if (llvm::isa<llvm::CallBase>(inst) && !llvm::isa<llvm::IntrinsicInst>(inst))
+                {
+                    counts[3]++;
+                }
+            }
+        }
+        auto fields = closureFieldCount.find(func.getName().str());
+        counts[5] = fields != closureFieldCount.end() ? fields->second : 0;
+
+        fprintf(stderr, "  %-28s", func.getName().str().c_str());
+        for (int i = 0; i < COLUMNS; i++)
+        {
+            fprintf(stderr, " %8zu", counts[i]);
+            totals[i] += counts[i];
+        }
+        fprintf(stderr, "\n");
+    }
+
+    fprintf(stderr, "  %-28s", "total");
+    for (int i = 0; i < COLUMNS; i++)
+    {
+        fprintf(stderr, " %8zu", totals[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+// Collects the frame sizes the prologue/epilogue inserter of the backend
+// reports as "StackSize" remarks
+class StackSizeHandler : public llvm::DiagnosticHandler
+{
+public:
+    std::unordered_map<std::string, uint64_t> sizes;
+
+    bool isAnalysisRemarkEnabled(llvm::StringRef passName) const override
+    {
+        return passName == "prologepilog";
+    }
+
+    bool isAnyRemarkEnabled() const override
+    {
+        return true;
+    }
+
+    bool handleDiagnostics(const llvm::DiagnosticInfo &info) override
+    {
+        auto *remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&info);
+        if (!remark || remark->getRemarkName() != "StackSize")
+        {
+            return false;
+        }
+        for (const llvm::DiagnosticInfoOptimizationBase::Argument &arg : remark->getArgs())
+        {
+            if (arg.Key == "NumStackBytes")
+            {
+                sizes[remark->getFunction().getName().str()] = std::stoull(arg.Val);
+            }
+        }
+        return true;
+    }
+};
+
+// Prints the frame size of every function as the backend lays it out (code
+// generation of a copy of the module, as llc does it), and the worst-case
+// stack depth of a call to it over the direct calls of the call graph. A
+// call pushes its return address. Frames of runtime-sized arrays are
+// dynamic and recursion is unbounded: such depths are lower bounds (+), and
+// every recursive cycle is listed with the bytes of one trip around it
+void AST::printStackUsage()
+{
+    std::string error;
+    std::string triple = TheModule->getTargetTriple().empty() ? llvm::sys::getDefaultTargetTriple() : TheModule->getTargetTriple();
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+    if (!target)
+    {
+        fprintf(stderr, "stack usage unavailable: %s\n", error.c_str());
+        return;
+    }
+    std::unique_ptr<llvm::TargetMachine> machine(target->createTargetMachine(
+        triple, llvm::sys::getHostCPUName(), "", llvm::TargetOptions(), llvm::None));
+
+    // Leaf functions may keep their locals in the red zone below the stack
+    // pointer, which the frame size of the backend leaves out; without it the
+    // backend allocates those bytes in the frame, where they are counted
+    std::unique_ptr<llvm::Module> copy = llvm::CloneModule(*TheModule);
+    copy->setTargetTriple(triple);
+    copy->setDataLayout(machine->createDataLayout());
+    for (llvm::Function &func : *copy)
+    {
+        func.addFnAttr(llvm::Attribute::NoRedZone);
+    }
+
+    auto handler = std::make_unique<StackSizeHandler>();
+    StackSizeHandler *sizes = handler.get();
+    std::unique_ptr<llvm::DiagnosticHandler> previous = TheContext.getDiagnosticHandler();
+    TheContext.setDiagnosticHandler(std::move(handler));
+    llvm::legacy::PassManager codegen;
+    llvm::raw_null_ostream discard;
+    machine->addPassesToEmitFile(codegen, discard, nullptr, llvm::CGFT_ObjectFile);
+    codegen.run(*copy);
+    std::unordered_map<std::string, uint64_t> frames = std::move(sizes->sizes);
+    TheContext.setDiagnosticHandler(std::move(previous));
+
+    uint64_t returnAddress = copy->getDataLayout().getPointerSize();
+    std::unordered_map<const llvm::Function *, uint64_t> worst;
+    std::unordered_map<const llvm::Function *, bool> unbounded;
+    std::unordered_map<const llvm::Function *, bool> dynamic;
+    std::vector<std::pair<std::vector<const llvm::Function *>, uint64_t>> cycles;
+
+    for (auto &func : TheModule->functions())
+    {
+        for (llvm::BasicBlock &block : func)
+        {
+            for (llvm::Instruction &inst : block)
+            {
+                auto *alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst);
+                if (alloca && !alloca->isStaticAlloca())
+                {
+                    dynamic[&func] = true;
+                }
+            }
+        }
+    }
+
+    // Bottom up over the strongly connected components: callees come first
+    llvm::CallGraph graph(*TheModule);
+    for (auto scc = llvm::scc_begin(&graph); !scc.isAtEnd(); ++scc)
+    {
+        std::vector<const llvm::Function *> members;
+        for (llvm::CallGraphNode *node : *scc)
+        {
+            if (node->getFunction() && !node->getFunction()->isDeclaration())
+            {
+                members.push_back(node->getFunction());
+            }
+        }
+        if (members.empty())
+        {
+            continue;
+        }
+
+        bool recursive = scc.hasCycle();
+        uint64_t cost = 0;
+        uint64_t deepest = 0;
+        bool open = recursive;
+        for (const llvm::Function *func : members)
         {
-            Builder.SetInsertPoint(BB);
-            Builder.CreateCall(sourceMainFunc, {});
+            cost += frames[func->getName().str()] + returnAddress;
+            open |= dynamic[func];
         }
-        else
+        for (llvm::CallGraphNode *node : *scc)
         {
-            std::cerr << "Error: main function not found in source program." << std::endl;
+            for (const llvm::CallGraphNode::CallRecord &call : *node)
+            {
+                const llvm::Function *callee = call.second->getFunction();
+                if (callee && worst.count(callee) && std::find(members.begin(), members.end(), callee) == members.end())
+                {
+                    deepest = std::max(deepest, worst[callee]);
+                    open |= unbounded[callee];
+                }
+            }
+        }
+        if (recursive)
+        {
+            cycles.push_back({members, cost});
+        }
+        for (const llvm::Function *func : members)
+        {
+            worst[func] = (recursive ? cost : frames[func->getName().str()] + returnAddress) + deepest;
+            unbounded[func] = open;
         }
     }
 
-    Builder.CreateRet(c32(0));
-
-    scopes.closeScope();
-
-    bool bad = llvm::verifyModule(*TheModule, &llvm::errs());
-    if (bad)
+    fprintf(stderr, "stack usage\n  %-28s %8s %8s\n", "function", "frame", "worst");
+    for (auto &func : TheModule->functions())
     {
-        std::cerr << "The IR is bad!" << std::endl;
-        TheModule->print(llvm::errs(), nullptr);
-        std::exit(1);
+        if (func.isDeclaration())
+        {
+            continue;
+        }
+        std::string name = func.getName().str();
+        fprintf(stderr, "  %-28s %8llu %7llu%s%s\n", name.c_str(), (unsigned long long)frames[name],
+                (unsigned long long)worst[&func], unbounded[&func] ? "+" : " ",
+                dynamic[&func] ? " dynamic" : "");
     }
-
-    for (auto &func : TheModule->functions())
+    for (auto &cycle : cycles)
     {
-        TheFPM->run(func);
+        fprintf(stderr, "  recursive cycle of %llu bytes per iteration:", (unsigned long long)cycle.second);
+        for (const llvm::Function *func : cycle.first)
+        {
+            fprintf(stderr, " %s", func->getName().str().c_str());
+        }
+        fprintf(stderr, "\n");
     }
-    
-    TheModule->print(llvm::outs(), nullptr);
 }
 
 llvm::Value *StmtList::igen() const
@@ -100,7 +978,15 @@ llvm::Value *StmtList::igen() const
     for (auto it = stmts.rbegin(); it != stmts.rend(); ++it)
     {
         auto stmt = *it;
+        genDebugLocation(stmt);
+        genCoveragePoint(Builder.GetInsertBlock(), stmt);
         stmt->igen();
+
+        // The statements after a return are unreachable
+        if (Builder.GetInsertBlock()->getTerminator())
+        {
+            break;
+        }
     }
     return nullptr;
 }
@@ -144,8 +1030,21 @@ llvm::Value *UnOp::igen() const
     switch (op)
     {
     case '-':
-        result = Builder.CreateNeg(loadedExpr, "negtmp");
+    {
+        long long lo, hi;
+        if (trapOverflow && !getRange(lo, hi))
+        {
+            llvm::Function *intrinsic = llvm::Intrinsic::getDeclaration(TheModule.get(), llvm::Intrinsic::ssub_with_overflow, {i32});
+            llvm::Value *pair = Builder.CreateCall(intrinsic, {c32(0), loadedExpr}, "negtmp_checked");
+            genRuntimeCheck(Builder.CreateExtractValue(pair, 1, "negtmp_overflow"), OVERFLOW_ERROR);
+            result = Builder.CreateExtractValue(pair, 0, "negtmp");
+        }
+        else
+        {
+            result = Builder.CreateNeg(loadedExpr, "negtmp");
+        }
         break;
+    }
     case '+':
         result = loadedExpr;
         break;
@@ -173,22 +1072,33 @@ llvm::Value *BinOp::igen() const
 
     llvm::Value *result = nullptr;
 
+    // Checks are only emitted for int operations whose result is not already
+    // known to fit; byte arithmetic wraps around by definition
+    long long lo, hi;
+    bool checkOverflow = trapOverflow && getTypeEnum() == TypeEnum::INT && !getRange(lo, hi) &&
+                         !mirModule->noOverflow.count(this);
+
     switch (op)
     {
     case '+':
-        result = Builder.CreateAdd(leftVal, rightVal, "addtmp");
+        result = checkOverflow ? igenChecked(llvm::Intrinsic::sadd_with_overflow, leftVal, rightVal, "addtmp")
+                               : Builder.CreateAdd(leftVal, rightVal, "addtmp");
         break;
     case '-':
-        result = Builder.CreateSub(leftVal, rightVal, "subtmp");
+        result = checkOverflow ? igenChecked(llvm::Intrinsic::ssub_with_overflow, leftVal, rightVal, "subtmp")
+                               : Builder.CreateSub(leftVal, rightVal, "subtmp");
         break;
     case '*':
-        result = Builder.CreateMul(leftVal, rightVal, "multmp");
+        result = checkOverflow ? igenChecked(llvm::Intrinsic::smul_with_overflow, leftVal, rightVal, "multmp")
+                               : Builder.CreateMul(leftVal, rightVal, "multmp");
         break;
     case '/':
-        result = Builder.CreateSDiv(leftVal, rightVal, "divtmp");
+        igenDivisionChecks(leftVal, rightVal);
+        result = igenDivision(llvm::Instruction::SDiv, leftVal, rightVal, "divtmp");
         break;
     case '%':
-        result = Builder.CreateSRem(leftVal, rightVal, "modtmp");
+        igenDivisionChecks(leftVal, rightVal);
+        result = igenDivision(llvm::Instruction::SRem, leftVal, rightVal, "modtmp");
         break;
     default:
         return nullptr;
@@ -197,6 +1107,60 @@ llvm::Value *BinOp::igen() const
     return result;
 }
 
+// Byte quotients wrap around like the rest of byte arithmetic, but an i8
+// sdiv of -128 by -1 overflows (and faults on x86); the division is done in
+// int, where it fits, and truncated back, as the interpreter, the VM and the
+// C backend do it
+llvm::Value *BinOp::igenDivision(llvm::Instruction::BinaryOps opcode, llvm::Value *leftVal, llvm::Value *rightVal,
+                                 const std::string &name) const
+{
+    if (getTypeEnum() != TypeEnum::BYTE)
+    {
+        return Builder.CreateBinOp(opcode, leftVal, rightVal, name);
+    }
+    llvm::Type *i32 = llvm::Type::getInt32Ty(TheContext);
+    llvm::Value *wide = Builder.CreateBinOp(opcode, Builder.CreateSExt(leftVal, i32, name + "_left"),
+                                            Builder.CreateSExt(rightVal, i32, name + "_right"), name + "_wide");
+    return Builder.CreateTrunc(wide, leftVal->getType(), name);
+}
+
+llvm::Value *BinOp::igenChecked(llvm::Intrinsic::ID id, llvm::Value *leftVal, llvm::Value *rightVal,
+                                const std::string &name) const
+{
+    llvm::Function *intrinsic = llvm::Intrinsic::getDeclaration(TheModule.get(), id, {leftVal->getType()});
+    llvm::Value *pair = Builder.CreateCall(intrinsic, {leftVal, rightVal}, name + "_checked");
+
+    genRuntimeCheck(Builder.CreateExtractValue(pair, 1, name + "_overflow"), OVERFLOW_ERROR);
+    return Builder.CreateExtractValue(pair, 0, name);
+}
+
+void BinOp::igenDivisionChecks(llvm::Value *leftVal, llvm::Value *rightVal) const
+{
+    if (!checkDivision)
+    {
+        return;
+    }
+
+    long long lLo, lHi, rLo, rHi;
+    bool leftKnown = left->getRange(lLo, lHi);
+    bool rightKnown = right->getRange(rLo, rHi);
+    llvm::Type *t = rightVal->getType();
+
+    if ((!rightKnown || (rLo <= 0 && rHi >= 0)) && !mirModule->nonZeroDivisor.count(this))
+    {
+        genRuntimeCheck(Builder.CreateICmpEQ(rightVal, llvm::ConstantInt::get(t, 0), "div_zero"), DIVISION_ERROR);
+    }
+
+    // The quotient of the smallest int by -1 does not fit either, and faults like a division by zero
+    if (getTypeEnum() == TypeEnum::INT && (!rightKnown || (rLo <= -1 && rHi >= -1)) && (!leftKnown || lLo == INT_MIN) &&
+        !mirModule->noOverflow.count(this))
+    {
+        llvm::Value *isMin = Builder.CreateICmpEQ(leftVal, llvm::ConstantInt::get(t, INT_MIN), "div_min");
+        llvm::Value *isMinusOne = Builder.CreateICmpEQ(rightVal, llvm::ConstantInt::getSigned(t, -1), "div_minus_one");
+        genRuntimeCheck(Builder.CreateAnd(isMin, isMinusOne, "div_overflow"), OVERFLOW_ERROR);
+    }
+}
+
 llvm::Value *CondCompOp::igen() const
 {
     llvm::Value *leftVal = left->igen();
@@ -251,12 +1215,27 @@ llvm::Value *CondBoolOp::igen() const
 
     llvm::Value *result = nullptr;
 
+    // -fprofile-loops counts the left operand at the start of both branches
+    llvm::GlobalVariable *branchCounts = nullptr;
+    if (profileLoops && (op == '&' || op == '|'))
+    {
+        branchCounts = genLoopProfileSite(this, op == '&' ? PROFILE_AND : PROFILE_OR);
+    }
+    auto countBranch = [branchCounts](int index)
+    {
+        if (branchCounts)
+        {
+            genLoopProfileCount(branchCounts, c32(index));
+        }
+    };
+
     switch (op)
     {
     case '&': {
         Builder.CreateCondBr(leftValue, trueBlock, falseBlock);
 
         Builder.SetInsertPoint(trueBlock);
+        countBranch(0);
         llvm::Value *rightValue = right->igen();
         Builder.CreateBr(mergeBlock);
 
@@ -264,6 +1243,7 @@ llvm::Value *CondBoolOp::igen() const
 
         function->getBasicBlockList().push_back(falseBlock);
         Builder.SetInsertPoint(falseBlock);
+        countBranch(1);
         llvm::Value *falseValue = llvm::ConstantInt::getFalse(TheContext);
         Builder.CreateBr(mergeBlock);
 
@@ -279,14 +1259,18 @@ llvm::Value *CondBoolOp::igen() const
         Builder.CreateCondBr(leftValue, trueBlock, falseBlock);
 
         Builder.SetInsertPoint(trueBlock);
+        countBranch(0);
         llvm::Value *trueValue = llvm::ConstantInt::getTrue(TheContext);
         Builder.CreateBr(mergeBlock);
 
         function->getBasicBlockList().push_back(falseBlock);
         Builder.SetInsertPoint(falseBlock);
+        countBranch(1);
         llvm::Value *rightValue = right->igen();
         Builder.CreateBr(mergeBlock);
 
+        falseBlock = Builder.GetInsertBlock();
+
         function->getBasicBlockList().push_back(mergeBlock);
         Builder.SetInsertPoint(mergeBlock);
         llvm::PHINode *phiNode = Builder.CreatePHI(llvm::Type::getInt1Ty(TheContext), 2, "ortmp");
@@ -310,8 +1294,99 @@ llvm::Value *CondUnOp::igen() const
     return result;
 }
 
+llvm::Value *VarDef::igenRuntimeSized() const
+{
+    GenBlock *currentBlock = blockStack.top();
+    llvm::Type *elementType = translateType(type->getBaseType(), ParameterType::VALUE);
+
+    llvm::Value *count = sizeExpr->igen();
+    if (count->getType()->isPointerTy())
+    {
+        count = Builder.CreateLoad(i32, count, *name + "_size");
+    }
+
+    // A size of zero or less would corrupt the stack (or the heap); it is an
+    // error in every mode, like in the interpreter and the VM
+    long long lo, hi;
+    if (!sizeExpr->getRange(lo, hi) || lo <= 0)
+    {
+        genRuntimeCheck(Builder.CreateICmpSLE(count, c32(0), *name + "_bad_size"), SIZE_ERROR);
+    }
+
+    if (!currentBlock->getStackSave())
+    {
+        currentBlock->setStackSave(genIntrinsic(llvm::Intrinsic::stacksave, {}, "stack_save"));
+    }
+
+    llvm::Value *bytes = Builder.CreateMul(Builder.CreateSExt(count, i64),
+                                           llvm::ConstantInt::get(i64, elementType->getPrimitiveSizeInBits() / 8),
+                                           *name + "_bytes");
+    llvm::Value *arrayPtr = nullptr;
+
+    if (vlaHeapThreshold < 0)
+    {
+        arrayPtr = Builder.CreateAlloca(elementType, count, *name + "_vla");
+    }
+    else
+    {
+        // Arrays above the threshold go to the heap; the slot keeps the pointer
+        // to free on return, or null when the array was placed on the stack.
+        llvm::Function *func = currentBlock->getFunc();
+        llvm::BasicBlock *stackBB = llvm::BasicBlock::Create(TheContext, *name + "_stack", func);
+        llvm::BasicBlock *heapBB = llvm::BasicBlock::Create(TheContext, *name + "_heap", func);
+        llvm::BasicBlock *mergeBB = llvm::BasicBlock::Create(TheContext, *name + "_alloc", func);
+
+        llvm::Value *onHeap = Builder.CreateICmpUGT(bytes, llvm::ConstantInt::get(i64, vlaHeapThreshold), *name + "_on_heap");
+        Builder.CreateCondBr(onHeap, heapBB, stackBB);
+
+        Builder.SetInsertPoint(stackBB);
+        llvm::Value *stackPtr = Builder.CreateAlloca(elementType, count, *name + "_vla");
+        Builder.CreateBr(mergeBB);
+
+        Builder.SetInsertPoint(heapBB);
+        llvm::FunctionCallee mallocFunc = TheModule->getOrInsertFunction(
+            "malloc", llvm::FunctionType::get(i8->getPointerTo(), {i64}, false));
+        llvm::Value *heapPtr = Builder.CreateBitCast(Builder.CreateCall(mallocFunc, {bytes}, *name + "_malloc"),
+                                                     elementType->getPointerTo());
+        Builder.CreateBr(mergeBB);
+
+        Builder.SetInsertPoint(mergeBB);
+        currentBlock->setBlock(mergeBB);
+        llvm::PHINode *phi = Builder.CreatePHI(elementType->getPointerTo(), 2, *name + "_ptr");
+        phi->addIncoming(stackPtr, stackBB);
+        phi->addIncoming(heapPtr, heapBB);
+        arrayPtr = phi;
+
+        llvm::PHINode *heapOnly = Builder.CreatePHI(elementType->getPointerTo(), 2, *name + "_heap_ptr");
+        heapOnly->addIncoming(llvm::ConstantPointerNull::get(elementType->getPointerTo()), stackBB);
+        heapOnly->addIncoming(heapPtr, heapBB);
+
+        llvm::AllocaInst *heapSlot = entryAlloca(heapOnly->getType(), *name + "_heap_slot");
+        Builder.CreateStore(heapOnly, heapSlot);
+        currentBlock->addHeapArray(heapSlot);
+    }
+
+    Builder.CreateMemSet(arrayPtr, c8('\0'), bytes, llvm::MaybeAlign());
+
+    llvm::AllocaInst *slot = entryAlloca(arrayPtr->getType(), *name);
+    Builder.CreateStore(arrayPtr, slot);
+    currentBlock->addAlloca(*name, slot);
+    currentBlock->addArraySize(*name, count);
+    if (debugInfo)
+    {
+        genDebugVariable(slot, *name, type, line, column);
+    }
+
+    return nullptr;
+}
+
 llvm::Value *VarDef::igen() const
 {
+    if (sizeExpr)
+    {
+        return igenRuntimeSized();
+    }
+
     llvm::Type *t = nullptr;
     llvm::Value *defaultValue = nullptr;
 
@@ -329,10 +1404,6 @@ llvm::Value *VarDef::igen() const
         {
             defaultElement = c8('\0');
         }
-
-        defaultValue = llvm::ConstantArray::get(
-            llvm::cast<llvm::ArrayType>(t),
-            llvm::Constant::getNullValue(elementType));
     }
     else
     {
@@ -348,11 +1419,24 @@ llvm::Value *VarDef::igen() const
         }
     }
 
-    llvm::AllocaInst *Alloca = Builder.CreateAlloca(t, nullptr, *name);
+    llvm::AllocaInst *Alloca = entryAlloca(t, *name);
 
-    Builder.CreateStore(defaultValue, Alloca);
+    // Arrays are cleared with a memset; the backend expands an aggregate
+    // store into one store per element
+    if (isArray)
+    {
+        Builder.CreateMemSet(Alloca, c8(0), TheModule->getDataLayout().getTypeAllocSize(t), Alloca->getAlign());
+    }
+    else
+    {
+        Builder.CreateStore(defaultValue, Alloca);
+    }
     GenBlock *currentBlock = blockStack.top();
     currentBlock->addAlloca(*name, Alloca);
+    if (debugInfo)
+    {
+        genDebugVariable(Alloca, *name, type, line, column);
+    }
 
     return nullptr;
 }
@@ -388,6 +1472,22 @@ llvm::Value *ArrayAccess::igen() const
     llvm::AllocaInst *arrayPtrAlloc = currentBlock->getAlloca(*name);
     llvm::Value *elementPtr = nullptr;
 
+    // Only arrays declared in this function have a known size; the check is
+    // dropped when the MIR proved the index in range
+    if (checkBounds && !mirModule->inBounds.count(this))
+    {
+        llvm::Value *size = currentBlock->getArraySize(*name);
+        if (arrayPtrAlloc->getAllocatedType()->isArrayTy())
+        {
+            size = llvm::ConstantInt::get(indexValue->getType(), arrayPtrAlloc->getAllocatedType()->getArrayNumElements());
+        }
+
+        if (size)
+        {
+            genRuntimeCheck(Builder.CreateICmpUGE(indexValue, size, "out_of_bounds"), BOUNDS_ERROR);
+        }
+    }
+
     if (!arrayPtrAlloc->getAllocatedType()->isArrayTy())
     {
         llvm::Value *arrayLoad = Builder.CreateLoad(arrayPtrAlloc->getAllocatedType(), arrayPtrAlloc, *name + "_arrayptr");
@@ -399,6 +1499,9 @@ llvm::Value *ArrayAccess::igen() const
         elementPtr = Builder.CreateGEP(arrayPtrAlloc->getAllocatedType(), arrayPtrAlloc, std::vector<llvm::Value *>({c32(0), indexValue}), "elementptr");
     }
 
+    // Loads and stores through this pointer join the access group of every
+    // enclosing '@independent' loop (see While::igen).
+    arrayAccessPtrs.insert(elementPtr);
 
     return elementPtr;
 }
@@ -424,23 +1527,36 @@ llvm::Value *FuncCall::igen() const
     llvm::Function *func = scopes.getFunction(*name);
     std::vector<llvm::Value *> args;
 
-    if (!capturedVars.empty())
+    const MirCallSite &callSite = mirModule->callSiteOf(this);
+    const std::vector<MirCapture> &captures = callSite.callee->captures;
+
+    if (!captures.empty())
     {
-        llvm::StructType *closureType = llvm::StructType::getTypeByName(TheContext, *name + "_closure");
+        llvm::StructType *closureType = llvm::StructType::getTypeByName(TheContext, callSite.callee->name + "_closure");
 
         llvm::Value *closureAlloc = Builder.CreateAlloca(closureType, nullptr, *name + "_closure_instance");
 
         size_t index = 0;
-        for (const auto &capturedVar : capturedVars)
+        for (const auto &capture : captures)
         {
-            llvm::AllocaInst *varAlloca = blockStack.top()->getAlloca(capturedVar->getName());
+            const std::string &varName = capture.var->name;
+
+            // The owner finds the variable by its name; every other caller
+            // received it through its own closure
+            llvm::AllocaInst *varAlloca = callSite.caller == capture.var->owner
+                ? blockStack.top()->getAlloca(varName)
+                : blockStack.top()->getAlloca(varName + "#" + std::to_string(capture.var->id));
             llvm::Value *varValue = varAlloca;
-            llvm::Value *fieldPtr = Builder.CreateStructGEP(closureType, closureAlloc, index, capturedVar->getName() + "_ptr");
+            llvm::Value *fieldPtr = Builder.CreateStructGEP(closureType, closureAlloc, index, varName + "_ptr");
 
-            if(isNested && varAlloca->getAllocatedType()->isPointerTy()){
-                varValue = Builder.CreateLoad(varAlloca->getAllocatedType(), varValue, capturedVar->getName() + "_load");
+            // Captured variables, reference parameters and runtime-sized arrays
+            // already live behind a pointer, so pass the pointer on. Variables
+            // captured by value are copied.
+            if (capture.byValue || varAlloca->getAllocatedType()->isPointerTy())
+            {
+                varValue = Builder.CreateLoad(varAlloca->getAllocatedType(), varValue, varName + "_load");
             }
-            
+
             Builder.CreateStore(varValue, fieldPtr);
             ++index;
         }
@@ -455,7 +1571,7 @@ llvm::Value *FuncCall::igen() const
         auto exprIt = exprList.rbegin();
         for (auto &arg : funcArgs)
         {
-            if (!capturedVars.empty() && &arg == func->arg_begin())
+            if (!captures.empty() && &arg == func->arg_begin())
             {
                 continue;
             }
@@ -482,6 +1598,8 @@ llvm::Value *FuncCall::igen() const
         }
     }
 
+    // The arguments may have moved the location to calls of their own
+    genDebugLocation(this);
     if (func->getReturnType()->isVoidTy())
     {
         Builder.CreateCall(func, args);
@@ -508,8 +1626,16 @@ llvm::Value *If::igen() const
 
     Builder.CreateCondBr(condValue, thenBB, elseBB);
 
+    llvm::GlobalVariable *branchCounts = profileLoops ? genLoopProfileSite(this, PROFILE_IF) : nullptr;
+
     Builder.SetInsertPoint(thenBB);
     blockStack.top()->setBlock(thenBB);
+    genDebugLocation(thenStmt);
+    genCoveragePoint(thenBB, thenStmt);
+    if (branchCounts)
+    {
+        genLoopProfileCount(branchCounts, c32(0));
+    }
     thenStmt->igen();
 
     bool thenHasTerminator = Builder.GetInsertBlock()->getTerminator() != nullptr;
@@ -521,8 +1647,14 @@ llvm::Value *If::igen() const
     func->getBasicBlockList().push_back(elseBB);
     Builder.SetInsertPoint(elseBB);
     blockStack.top()->setBlock(elseBB);
+    if (branchCounts)
+    {
+        genLoopProfileCount(branchCounts, c32(1));
+    }
     if (elseStmt)
     {
+        genDebugLocation(elseStmt);
+        genCoveragePoint(elseBB, elseStmt);
         elseStmt->igen();
     }
 
@@ -549,9 +1681,21 @@ llvm::Value *While::igen() const
     llvm::BasicBlock *loopBB = llvm::BasicBlock::Create(TheContext, "loop");
     llvm::BasicBlock *afterBB = llvm::BasicBlock::Create(TheContext, "afterloop");
 
+    // The trip count of the current run, counted by -fprofile-loops at its end
+    llvm::AllocaInst *trips = nullptr;
+    llvm::GlobalVariable *tripCounts = nullptr;
+    if (profileLoops)
+    {
+        tripCounts = genLoopProfileSite(this, PROFILE_WHILE);
+        trips = entryAlloca(i64, "trips");
+        Builder.CreateStore(llvm::ConstantInt::get(i64, 0), trips);
+        blockStack.top()->pushLoop(trips, tripCounts);
+    }
+
     Builder.CreateBr(condBB);
     Builder.SetInsertPoint(condBB);
     blockStack.top()->setBlock(condBB);
+    genCoveragePoint(condBB, this);
 
     llvm::Value *condValue = cond->igen();
 
@@ -567,20 +1711,120 @@ llvm::Value *While::igen() const
     TheFunction->getBasicBlockList().push_back(loopBB);
     Builder.SetInsertPoint(loopBB);
     blockStack.top()->setBlock(loopBB);
+    genDebugLocation(body);
+    genCoveragePoint(loopBB, body);
+    if (trips)
+    {
+        Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(i64, trips), llvm::ConstantInt::get(i64, 1)), trips);
+    }
     body->igen();
-    Builder.CreateBr(condBB);
+    llvm::BranchInst *latch = nullptr;
+    if (!Builder.GetInsertBlock()->getTerminator())
+    {
+        latch = Builder.CreateBr(condBB);
+    }
 
     TheFunction->getBasicBlockList().push_back(afterBB);
     Builder.SetInsertPoint(afterBB);
     blockStack.top()->setBlock(afterBB);
+    if (trips)
+    {
+        blockStack.top()->popLoop();
+        genLoopExit(trips, tripCounts);
+    }
+
+    // A body that always returns does not loop, so it has no latch to annotate
+    if (hints && latch)
+    {
+        llvm::MDNode *accessGroup = nullptr;
+        if (hints->isIndependent())
+        {
+            accessGroup = llvm::MDNode::getDistinct(TheContext, {});
+
+            // Every block between the condition and the exit belongs to the loop,
+            // since nested statements append their blocks in order.
+            for (auto bb = condBB->getIterator(); &*bb != afterBB; ++bb)
+            {
+                for (llvm::Instruction &inst : *bb)
+                {
+                    llvm::Value *ptr = nullptr;
+                    if (auto *load = llvm::dyn_cast<llvm::LoadInst>(&inst))
+                        ptr = load->getPointerOperand();
+                    else if (auto *store = llvm::dyn_cast<llvm::StoreInst>(&inst))
+                        ptr = store->getPointerOperand();
+
+                    if (!ptr || arrayAccessPtrs.find(ptr) == arrayAccessPtrs.end())
+                        continue;
+
+                    llvm::MDNode *groups = llvm::uniteAccessGroups(
+                        inst.getMetadata(llvm::LLVMContext::MD_access_group), accessGroup);
+                    inst.setMetadata(llvm::LLVMContext::MD_access_group, groups);
+                }
+            }
+        }
+
+        latch->setMetadata(llvm::LLVMContext::MD_loop, hints->loopMetadata(accessGroup));
+    }
 
     return nullptr;
 }
 
+llvm::MDNode *LoopHintList::loopMetadata(llvm::MDNode *accessGroup) const
+{
+    std::vector<llvm::Metadata *> ops;
+    ops.push_back(nullptr);
+
+    auto intProperty = [&](const char *key, int value) {
+        ops.push_back(llvm::MDNode::get(TheContext, {llvm::MDString::get(TheContext, key),
+                                                     llvm::ConstantAsMetadata::get(c32(value))}));
+    };
+
+    for (auto it = hints.rbegin(); it != hints.rend(); ++it)
+    {
+        const std::string &hint = (*it)->getName();
+        if (hint == "unroll")
+        {
+            intProperty("llvm.loop.unroll.count", (*it)->getValue());
+        }
+        else if (hint == "vectorize")
+        {
+            intProperty("llvm.loop.vectorize.width", (*it)->getValue());
+            ops.push_back(llvm::MDNode::get(TheContext, {llvm::MDString::get(TheContext, "llvm.loop.vectorize.enable"),
+                                                         llvm::ConstantAsMetadata::get(c1(true))}));
+        }
+        else if (hint == "interleave")
+        {
+            intProperty("llvm.loop.interleave.count", (*it)->getValue());
+        }
+    }
+
+    if (accessGroup)
+    {
+        ops.push_back(llvm::MDNode::get(TheContext, {llvm::MDString::get(TheContext, "llvm.loop.parallel_accesses"),
+                                                     accessGroup}));
+    }
+
+    llvm::MDNode *loopID = llvm::MDNode::getDistinct(TheContext, ops);
+    loopID->replaceOperandWith(0, loopID);
+    return loopID;
+}
+
 llvm::Value *Return::igen() const
 {
-    if (!expr)
+    GenCoroutine *coroutine = blockStack.top()->getCoroutine();
+
+    if (coroutine)
+    {
+        genFrameRelease();
+        Builder.CreateBr(coroutine->finalSuspend);
+    }
+    else if (!expr)
     {
+        genFrameRelease();
+        if (profileFunctions)
+        {
+            genProfileExit();
+        }
         Builder.CreateRetVoid();
     }
     else
@@ -591,6 +1835,11 @@ llvm::Value *Return::igen() const
             value = Builder.CreateLoad(translateType(expr->getType(), ParameterType::VALUE), value, "ret_val");
         }
 
+        genFrameRelease();
+        if (profileFunctions)
+        {
+            genProfileExit();
+        }
         Builder.CreateRet(value);
     }
 
@@ -600,20 +1849,24 @@ llvm::Value *Return::igen() const
 
 llvm::Value *FuncDef::igen() const
 {
+    llvm::TimeTraceScope trace("igen", *name);
     llvm::Type *returnType = translateType(type, ParameterType::VALUE);
     std::vector<llvm::Type *> argTypes;
     auto args = fpar ? fpar->getParameters() : std::vector<Fpar *>();
 
+    // The closure holds the variables the MIR found this function and its
+    // callees need: a copy of those captured by value, the address of the rest
+    const std::vector<MirCapture> &captures = mirModule->functionOf(this)->captures;
     llvm::StructType *closureType = nullptr;
-    if (!capturedVars.empty())
+    if (!captures.empty())
     {
         std::vector<llvm::Type *> closureFieldTypes;
-        for (const auto &capturedVar : capturedVars)
+        for (const auto &capture : captures)
         {
-            llvm::Type *varType = translateType(capturedVar->getType(), ParameterType::REFERENCE);
+            llvm::Type *varType = translateType(capture.var->type, capture.byValue ? ParameterType::VALUE : ParameterType::REFERENCE);
             closureFieldTypes.push_back(varType);
         }
-        closureType = llvm::StructType::create(TheContext, closureFieldTypes, *name + "_closure");
+        closureType = llvm::StructType::create(TheContext, closureFieldTypes, mirModule->functionOf(this)->name + "_closure");
     }
 
     if (closureType)
@@ -628,6 +1881,11 @@ llvm::Value *FuncDef::igen() const
     }
     llvm::FunctionType *funcType = llvm::FunctionType::get(returnType, argTypes, false);
     llvm::Function *func = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, *name, TheModule.get());
+    closureFieldCount[func->getName().str()] = captures.size();
+    if (tiered && type->getType() != TypeEnum::GENERATOR)
+    {
+        tierFunctions.push_back({this, func});
+    }
 
     llvm::BasicBlock *BB = llvm::BasicBlock::Create(TheContext, *name + "_entry", func);
     Builder.SetInsertPoint(BB);
@@ -637,6 +1895,46 @@ llvm::Value *FuncDef::igen() const
     currentBlock->setBlock(BB);
     blockStack.push(currentBlock);
 
+    // The location of the enclosing function is restored after the body
+    llvm::DebugLoc outerLocation = Builder.getCurrentDebugLocation();
+    if (debugInfo)
+    {
+        std::vector<llvm::Metadata *> signature = {debugType(type)};
+        for (auto it = args.rbegin(); it != args.rend(); ++it)
+        {
+            llvm::DIType *argType = debugType((*it)->getType());
+            if ((*it)->getParameterType() == ParameterType::REFERENCE)
+            {
+                argType = DBuilder->createReferenceType(llvm::dwarf::DW_TAG_reference_type, argType);
+            }
+            signature.push_back(argType);
+        }
+        llvm::DIFile *file = DBuilder->createFile(llvm::sys::path::filename(debugFile), llvm::sys::path::parent_path(debugFile));
+        llvm::DISubprogram *subprogram = DBuilder->createFunction(
+            file, *name, func->getName(), file, line,
+            DBuilder->createSubroutineType(DBuilder->getOrCreateTypeArray(signature)), line,
+            llvm::DINode::FlagPrototyped, llvm::DISubprogram::SPFlagDefinition);
+        func->setSubprogram(subprogram);
+        genDebugLocation(this);
+    }
+
+    if (coverage)
+    {
+        coverageFunctions.push_back({func, type->getType() == TypeEnum::GENERATOR});
+        genCoveragePoint(BB, this);
+    }
+
+    // The frame of a generator outlives the calls that resume it, so only
+    // the calls of functions and procedures are profiled
+    if (type->getType() == TypeEnum::GENERATOR)
+    {
+        igenCoroutineBegin();
+    }
+    else if (profileFunctions)
+    {
+        genProfileEnter(*name + ":" + std::to_string(line));
+    }
+
     scopes.addFunction(*name, func);
     scopes.openScope();
 
@@ -648,20 +1946,24 @@ llvm::Value *FuncDef::igen() const
         closureArg->setName("closure");
 
         size_t index = 0;
-        for (const auto &capturedVar : capturedVars)
+        for (const auto &capture : captures)
         {
-            llvm::Value *fieldPtr = Builder.CreateStructGEP(closureType, closureArg, index, capturedVar->getName() + "_ptr");
+            const std::string &varName = capture.var->name;
+            llvm::Value *fieldPtr = Builder.CreateStructGEP(closureType, closureArg, index, varName + "_ptr");
 
-            llvm::Value *varValue = Builder.CreateLoad(
-                translateType(capturedVar->getType(), ParameterType::REFERENCE),
-                fieldPtr,
-                capturedVar->getName());
+            llvm::Type *fieldType = closureType->getElementType(index);
+            llvm::Value *varValue = Builder.CreateLoad(fieldType, fieldPtr, varName);
 
-            llvm::AllocaInst *varAlloca = Builder.CreateAlloca(varValue->getType(), nullptr, capturedVar->getName());
+            llvm::AllocaInst *varAlloca = Builder.CreateAlloca(fieldType, nullptr, varName);
 
             Builder.CreateStore(varValue, varAlloca);
 
-            blockStack.top()->addAlloca(capturedVar->getName(), varAlloca);
+            blockStack.top()->addAlloca(varName, varAlloca);
+            blockStack.top()->addAlloca(varName + "#" + std::to_string(capture.var->id), varAlloca);
+            if (debugInfo)
+            {
+                genDebugVariable(varAlloca, varName, capture.var->type, line, column);
+            }
 
             ++index;
         }
@@ -683,19 +1985,34 @@ llvm::Value *FuncDef::igen() const
 
             Builder.CreateStore(&param, alloca);
             blockStack.top()->addAlloca(*args[index]->getName(), alloca);
+            if (debugInfo)
+            {
+                genDebugVariable(alloca, *args[index]->getName(), args[index]->getType(),
+                                 args[index]->line, args[index]->column, args.size() - index);
+            }
         }
     }
 
     localDef->igen();
     stmts->igen();
 
-    if (!hasReturn)
+    if (type->getType() == TypeEnum::GENERATOR)
+    {
+        igenCoroutineEnd();
+    }
+    else if (!hasReturn)
     {
+        genFrameRelease();
+        if (profileFunctions)
+        {
+            genProfileExit();
+        }
         Builder.CreateRetVoid();
     }
 
     blockStack.pop();
     scopes.closeScope();
+    Builder.SetCurrentDebugLocation(outerLocation);
 
     if (!blockStack.empty())
         Builder.SetInsertPoint(blockStack.top()->getBlock());
@@ -703,6 +2020,179 @@ llvm::Value *FuncDef::igen() const
     return nullptr;
 }
 
+void FuncDef::igenCoroutineBegin() const
+{
+    GenBlock *currentBlock = blockStack.top();
+    llvm::Function *func = currentBlock->getFunc();
+    llvm::Type *i8ptr = i8->getPointerTo();
+
+#if LLVM_VERSION_MAJOR >= 15
+    func->setPresplitCoroutine();
+#else
+    func->addFnAttr("coroutine.presplit", "0");
+#endif
+
+    GenCoroutine *coroutine = new GenCoroutine();
+    coroutine->promise = Builder.CreateAlloca(translateType(type->getBaseType(), ParameterType::VALUE), nullptr, "promise");
+    coroutine->promise->setAlignment(llvm::Align(4));
+
+    coroutine->id = genIntrinsic(llvm::Intrinsic::coro_id,
+                                 {c32(0), Builder.CreateBitCast(coroutine->promise, i8ptr),
+                                  llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(i8ptr)),
+                                  llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(i8ptr))},
+                                 "id");
+
+    // The frame is heap allocated unless the coroutine passes elide it
+    llvm::BasicBlock *entryBB = Builder.GetInsertBlock();
+    llvm::BasicBlock *allocBB = llvm::BasicBlock::Create(TheContext, "coro_alloc", func);
+    llvm::BasicBlock *beginBB = llvm::BasicBlock::Create(TheContext, "coro_begin", func);
+
+    llvm::Value *needAlloc = genIntrinsic(llvm::Intrinsic::coro_alloc, {coroutine->id}, "need_alloc");
+    Builder.CreateCondBr(needAlloc, allocBB, beginBB);
+
+    Builder.SetInsertPoint(allocBB);
+    llvm::Value *frameSize = Builder.CreateCall(
+        llvm::Intrinsic::getDeclaration(TheModule.get(), llvm::Intrinsic::coro_size, {i64}), {}, "frame_size");
+    llvm::FunctionCallee mallocFunc = TheModule->getOrInsertFunction(
+        "malloc", llvm::FunctionType::get(i8ptr, {i64}, false));
+    llvm::Value *frame = Builder.CreateCall(mallocFunc, {frameSize}, "frame");
+    Builder.CreateBr(beginBB);
+
+    Builder.SetInsertPoint(beginBB);
+    llvm::PHINode *mem = Builder.CreatePHI(i8ptr, 2, "mem");
+    mem->addIncoming(llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(i8ptr)), entryBB);
+    mem->addIncoming(frame, allocBB);
+    coroutine->handle = genIntrinsic(llvm::Intrinsic::coro_begin, {coroutine->id, mem}, "handle");
+
+    coroutine->finalSuspend = llvm::BasicBlock::Create(TheContext, "coro_final");
+    coroutine->cleanup = llvm::BasicBlock::Create(TheContext, "coro_cleanup");
+    coroutine->suspend = llvm::BasicBlock::Create(TheContext, "coro_suspend");
+
+    currentBlock->setBlock(beginBB);
+    currentBlock->setCoroutine(coroutine);
+}
+
+void FuncDef::igenCoroutineEnd() const
+{
+    GenBlock *currentBlock = blockStack.top();
+    GenCoroutine *coroutine = currentBlock->getCoroutine();
+    llvm::Function *func = currentBlock->getFunc();
+
+    if (!Builder.GetInsertBlock()->getTerminator())
+    {
+        Builder.CreateBr(coroutine->finalSuspend);
+    }
+
+    // Resuming a generator after its final suspend point is a bug in the consumer
+    func->getBasicBlockList().push_back(coroutine->finalSuspend);
+    Builder.SetInsertPoint(coroutine->finalSuspend);
+    llvm::Value *state = genIntrinsic(llvm::Intrinsic::coro_suspend,
+                                      {llvm::ConstantTokenNone::get(TheContext), c1(true)}, "final_state");
+    llvm::BasicBlock *trapBB = llvm::BasicBlock::Create(TheContext, "coro_trap", func);
+    llvm::SwitchInst *finalSwitch = Builder.CreateSwitch(state, coroutine->suspend, 2);
+    finalSwitch->addCase(c8(0), trapBB);
+    finalSwitch->addCase(c8(1), coroutine->cleanup);
+
+    Builder.SetInsertPoint(trapBB);
+    genIntrinsic(llvm::Intrinsic::trap, {});
+    Builder.CreateUnreachable();
+
+    func->getBasicBlockList().push_back(coroutine->cleanup);
+    Builder.SetInsertPoint(coroutine->cleanup);
+    llvm::Value *mem = genIntrinsic(llvm::Intrinsic::coro_free, {coroutine->id, coroutine->handle}, "mem");
+    llvm::FunctionCallee freeFunc = TheModule->getOrInsertFunction(
+        "free", llvm::FunctionType::get(proc, {i8->getPointerTo()}, false));
+    Builder.CreateCall(freeFunc, {mem});
+    Builder.CreateBr(coroutine->suspend);
+
+    func->getBasicBlockList().push_back(coroutine->suspend);
+    Builder.SetInsertPoint(coroutine->suspend);
+    llvm::Function *coroEnd = llvm::Intrinsic::getDeclaration(TheModule.get(), llvm::Intrinsic::coro_end);
+    std::vector<llvm::Value *> endArgs = {coroutine->handle, c1(false)};
+    if (coroEnd->arg_size() == 3)
+    {
+        endArgs.push_back(llvm::ConstantTokenNone::get(TheContext));
+    }
+    Builder.CreateCall(coroEnd, endArgs);
+    Builder.CreateRet(coroutine->handle);
+
+    delete coroutine;
+    currentBlock->setCoroutine(nullptr);
+}
+
+llvm::Value *Yield::igen() const
+{
+    GenBlock *currentBlock = blockStack.top();
+    GenCoroutine *coroutine = currentBlock->getCoroutine();
+
+    llvm::Value *value = expr->igen();
+    if (value->getType()->isPointerTy())
+    {
+        value = Builder.CreateLoad(translateType(expr->getType(), ParameterType::VALUE), value, "yield_val");
+    }
+    Builder.CreateStore(value, coroutine->promise);
+
+    llvm::Value *state = genIntrinsic(llvm::Intrinsic::coro_suspend,
+                                      {llvm::ConstantTokenNone::get(TheContext), c1(false)}, "yield_state");
+    llvm::BasicBlock *resumeBB = llvm::BasicBlock::Create(TheContext, "resume", currentBlock->getFunc());
+    llvm::SwitchInst *yieldSwitch = Builder.CreateSwitch(state, coroutine->suspend, 2);
+    yieldSwitch->addCase(c8(0), resumeBB);
+    yieldSwitch->addCase(c8(1), coroutine->cleanup);
+
+    Builder.SetInsertPoint(resumeBB);
+    currentBlock->setBlock(resumeBB);
+
+    return nullptr;
+}
+
+llvm::Value *For::igen() const
+{
+    GenBlock *currentBlock = blockStack.top();
+    llvm::Function *TheFunction = currentBlock->getFunc();
+    llvm::Type *valueType = translateType(generator->getType()->getBaseType(), ParameterType::VALUE);
+
+    llvm::Value *handle = generator->igen();
+
+    llvm::BasicBlock *condBB = llvm::BasicBlock::Create(TheContext, "for_cond", TheFunction);
+    llvm::BasicBlock *loopBB = llvm::BasicBlock::Create(TheContext, "for_loop");
+    llvm::BasicBlock *afterBB = llvm::BasicBlock::Create(TheContext, "for_after");
+
+    Builder.CreateBr(condBB);
+    Builder.SetInsertPoint(condBB);
+    currentBlock->setBlock(condBB);
+    genCoveragePoint(condBB, this);
+
+    llvm::Value *done = genIntrinsic(llvm::Intrinsic::coro_done, {handle}, "gen_done");
+    Builder.CreateCondBr(done, afterBB, loopBB);
+
+    TheFunction->getBasicBlockList().push_back(loopBB);
+    Builder.SetInsertPoint(loopBB);
+    currentBlock->setBlock(loopBB);
+
+    llvm::Value *promise = genIntrinsic(llvm::Intrinsic::coro_promise, {handle, c32(4), c1(false)}, "gen_promise");
+    llvm::Value *value = Builder.CreateLoad(valueType, Builder.CreateBitCast(promise, valueType->getPointerTo()), "gen_value");
+    Builder.CreateStore(value, lvalue->igen());
+
+    currentBlock->pushGenerator(handle);
+    genDebugLocation(body);
+    genCoveragePoint(loopBB, body);
+    body->igen();
+    currentBlock->popGenerator();
+
+    if (!Builder.GetInsertBlock()->getTerminator())
+    {
+        genIntrinsic(llvm::Intrinsic::coro_resume, {handle});
+        Builder.CreateBr(condBB);
+    }
+
+    TheFunction->getBasicBlockList().push_back(afterBB);
+    Builder.SetInsertPoint(afterBB);
+    currentBlock->setBlock(afterBB);
+    genIntrinsic(llvm::Intrinsic::coro_destroy, {handle});
+
+    return nullptr;
+}
+
 llvm::Value *ExprList::igen() const
 {
     for (auto it = exprs.rbegin(); it != exprs.rend(); ++it)
@@ -0,0 +1,707 @@
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <climits>
+#include <memory>
+#include "ast.hpp"
+#include "../jit/runtime.hpp"
+
+// Tree-walking interpreter of the checked AST (--interp). Variables are laid
+// out in memory like in the compiled program (ints of 4 bytes, bytes of 1 and
+// arrays of them), so the builtins of lib/lib.c work on them directly, and
+// reference parameters and closures are plain addresses. The variables a call
+// hands to a nested function are the captures the MIR found for it, as in
+// FuncDef::igen. Names are resolved once, from the MIR (interpResolve): a
+// variable is a slot of the frame and a call knows its callee, so running
+// the program looks nothing up.
+
+// A stack for the program or for a generator. The tree walk needs much more
+// stack per call than the compiled code, so the stacks are large; their pages
+// are only committed when touched, and the lowest one is a guard page
+struct InterpStack
+{
+    char *base;
+    size_t size;
+
+    InterpStack(size_t size) : size(size)
+    {
+        base = (char *)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            fprintf(stderr, "Error: cannot allocate the stack of the interpreter\n");
+            exit(1);
+        }
+        mprotect(base, sysconf(_SC_PAGESIZE), PROT_NONE);
+    }
+
+    ~InterpStack()
+    {
+        munmap(base, size);
+    }
+};
+
+const size_t PROGRAM_STACK_SIZE = 1ull << 30;
+const size_t GENERATOR_STACK_SIZE = 64ull << 20;
+
+// The addresses of the variables of a call, by slot: the function's own
+// variables in the order of the vars of its MirFunction (the parameters, then
+// the locals), then the captured ones in the order of its captures. Only the
+// arrays declared in the call have a known size for -fcheck-bounds (-1 for
+// the other slots)
+struct InterpFrame
+{
+    llvm::SmallVector<char *, 8> slots;
+    llvm::SmallVector<int, 8> arraySizes;
+    // The generator running in this frame, if any
+    InterpGenerator *generator = nullptr;
+    // Set by a return; the statements around it stop until the call ends
+    bool returning = false;
+    int result = 0;
+
+    // Zero initialized storage that lives as long as the frame; the scalars
+    // fit in the frame itself
+    char *allocate(size_t bytes)
+    {
+        bytes = (bytes + sizeof(int) - 1) & ~(sizeof(int) - 1);
+        if (used + bytes <= sizeof(scalars))
+        {
+            char *slot = scalars + used;
+            used += bytes;
+            memset(slot, 0, bytes);
+            return slot;
+        }
+        arrays.push_back(std::make_unique<char[]>(bytes));
+        return arrays.back().get();
+    }
+
+private:
+    alignas(int) char scalars[64];
+    size_t used = 0;
+    std::vector<std::unique_ptr<char[]>> arrays;
+};
+
+// A running generator: its frame, its stack and the value of its last yield.
+// A generator destroyed before it finished is resumed once more, and leaves
+// its body from the yield as if it returned
+struct InterpGenerator
+{
+    const FuncDef *func;
+    std::unique_ptr<InterpFrame> frame;
+    InterpStack stack;
+    ucontext_t context;
+    ucontext_t consumer;
+    int value = 0;
+    bool done = false;
+    bool destroyed = false;
+
+    InterpGenerator(const FuncDef *func)
+        : func(func), frame(std::make_unique<InterpFrame>()), stack(GENERATOR_STACK_SIZE) {}
+};
+
+// makecontext cannot pass pointers, so the function to start is left here
+static InterpGenerator *startingGenerator = nullptr;
+static const FuncDef *startingProgram = nullptr;
+
+static void generatorMain()
+{
+    InterpGenerator *generator = startingGenerator;
+    generator->func->interpRun(generator->frame.get());
+    generator->done = true;
+}
+
+static void programMain()
+{
+    InterpFrame frame;
+    startingProgram->interpEnter(nullptr, &frame);
+    startingProgram->interpRun(&frame);
+}
+
+static size_t interpSize(Type *type)
+{
+    return type->getType() == TypeEnum::BYTE ? 1 : sizeof(int);
+}
+
+// The builtins of lib/lib.c by name; reference arguments are addresses
+static const std::unordered_map<std::string, InterpBuiltin> interpBuiltins = {
+    {"writeInteger", [](const intptr_t *args) { writeInteger(args[0]); return 0; }},
+    {"writeByte", [](const intptr_t *args) { writeByte(args[0]); return 0; }},
+    {"writeChar", [](const intptr_t *args) { writeChar(args[0]); return 0; }},
+    {"writeString", [](const intptr_t *args) { writeString((char *)args[0]); return 0; }},
+    {"readInteger", [](const intptr_t *args) { return readInteger(); }},
+    {"readByte", [](const intptr_t *args) { return (int)(signed char)readByte(); }},
+    {"readChar", [](const intptr_t *args) { return (int)(signed char)readChar(); }},
+    {"readString", [](const intptr_t *args) { readString(args[0], (char *)args[1]); return 0; }},
+    {"extend", [](const intptr_t *args) { return extend(args[0]); }},
+    {"shrink", [](const intptr_t *args) { return (int)(signed char)shrink(args[0]); }},
+    {"strlen", [](const intptr_t *args) { return __alan_strlen((char *)args[0]); }},
+    {"strcmp", [](const intptr_t *args) { return __alan_strcmp((char *)args[0], (char *)args[1]); }},
+    {"strcpy", [](const intptr_t *args) { __alan_strcpy((char *)args[0], (char *)args[1]); return 0; }},
+    {"strcat", [](const intptr_t *args) { __alan_strcat((char *)args[0], (char *)args[1]); return 0; }},
+};
+
+InterpFrame *AST::interpFrame = nullptr;
+
+// The slot of a variable in the frames of a function
+static int interpSlotOf(const MirFunction *func, const MirVar *var)
+{
+    if (var->owner == func)
+    {
+        return std::find(func->vars.begin(), func->vars.end(), var) - func->vars.begin();
+    }
+    for (size_t index = 0; index < func->captures.size(); ++index)
+    {
+        if (func->captures[index].var == var)
+        {
+            return func->vars.size() + index;
+        }
+    }
+    return -1;
+}
+
+// Binds the names of the program to what they are once closure conversion
+// has found the captures: the frame layout of every function, the slot of
+// every variable and the callee of every call
+void AST::interpResolve()
+{
+    for (const MirFunction *func : mirModule->functions)
+    {
+        if (!func->isExternal)
+        {
+            static_cast<const FuncDef *>(func->origin)->interpBind(func->vars.size(),
+                                                                  func->vars.size() + func->captures.size());
+        }
+    }
+
+    for (const MirVarUse &use : mirModule->varUses)
+    {
+        int slot = interpSlotOf(use.func, use.var);
+        if (const Lval *lval = dynamic_cast<const Lval *>(use.node))
+        {
+            lval->interpBind(slot);
+        }
+        else
+        {
+            static_cast<const VarDef *>(use.node)->interpBind(slot);
+        }
+    }
+
+    for (const auto &entry : mirModule->callSites)
+    {
+        const MirCallSite &callSite = entry.second;
+        std::vector<int> captures;
+        for (const MirCapture &capture : callSite.callee->captures)
+        {
+            captures.push_back(interpSlotOf(callSite.caller, capture.var));
+        }
+        InterpBuiltin builtin = callSite.callee->isExternal ? interpBuiltins.at(callSite.callee->name) : nullptr;
+        static_cast<const FuncCall *>(entry.first)->interpBind(&callSite, builtin, std::move(captures));
+    }
+}
+
+// Runs the program on a stack of its own; returns its exit status
+int AST::run_interp()
+{
+    const FuncDef *main = dynamic_cast<const FuncDef *>(this);
+    if (!main)
+    {
+        std::cerr << "Error: main function not found in source program." << std::endl;
+        return 1;
+    }
+
+    tracePhase("run");
+    InterpStack stack(PROGRAM_STACK_SIZE);
+    ucontext_t program, compiler;
+    getcontext(&program);
+    program.uc_stack.ss_sp = stack.base;
+    program.uc_stack.ss_size = stack.size;
+    program.uc_link = &compiler;
+    makecontext(&program, programMain, 0);
+
+    startingProgram = main;
+    swapcontext(&compiler, &program);
+    fflush(stdout);
+    timePhase("run");
+    return 0;
+}
+
+int AST::interpLoad(const char *address, Type *type)
+{
+    if (type->getType() == TypeEnum::BYTE)
+    {
+        return (signed char)*address;
+    }
+    int value;
+    memcpy(&value, address, sizeof(value));
+    return value;
+}
+
+void AST::interpStore(char *address, Type *type, int value)
+{
+    if (type->getType() == TypeEnum::BYTE)
+    {
+        *address = (char)value;
+        return;
+    }
+    memcpy(address, &value, sizeof(value));
+}
+
+void AST::interpResume(InterpGenerator *generator)
+{
+    InterpFrame *consumerFrame = interpFrame;
+    interpFrame = generator->frame.get();
+    swapcontext(&generator->consumer, &generator->context);
+    interpFrame = consumerFrame;
+}
+
+void AST::interpDestroy(InterpGenerator *generator)
+{
+    if (!generator->done)
+    {
+        generator->destroyed = true;
+        interpResume(generator);
+    }
+    delete generator;
+}
+
+void AST::interpRuntimeError(RuntimeError error) const
+{
+    __alan_runtime_error(error, line, column);
+}
+
+int StmtList::interp() const
+{
+    for (auto it = stmts.rbegin(); it != stmts.rend() && !interpFrame->returning; ++it)
+    {
+        (*it)->interp();
+    }
+    return 0;
+}
+
+int LocalDefList::interp() const
+{
+    for (auto it = defs.rbegin(); it != defs.rend(); ++it)
+    {
+        (*it)->interp();
+    }
+    return 0;
+}
+
+int IntConst::interp() const
+{
+    return val;
+}
+
+int CharConst::interp() const
+{
+    return (signed char)val;
+}
+
+int BoolConst::interp() const
+{
+    return val;
+}
+
+int UnOp::interp() const
+{
+    int value = expr->interp();
+
+    if (op == '+')
+    {
+        return value;
+    }
+    if (trapOverflow && value == INT_MIN)
+    {
+        interpRuntimeError(OVERFLOW_ERROR);
+    }
+    return (int)(0u - (unsigned)value);
+}
+
+// Compiled code loads a variable operand only once the other one is
+// evaluated, so a call on the right sees what it assigned to the left
+void AST::interpOperands(const Expr *left, const Lval *leftLval, const Expr *right, int &leftVal, int &rightVal)
+{
+    if (!leftLval)
+    {
+        leftVal = left->interp();
+        rightVal = right->interp();
+        return;
+    }
+
+    char *address = leftLval->interpAddress();
+    rightVal = right->interp();
+    leftVal = interpLoad(address, left->getType());
+}
+
+int BinOp::interp() const
+{
+    int leftVal, rightVal;
+    interpOperands(left, leftLval, right, leftVal, rightVal);
+
+    // Byte arithmetic wraps around by definition, and so does int arithmetic
+    // without -ftrapv
+    bool isInt = getTypeEnum() == TypeEnum::INT;
+    bool overflow = false;
+    int result = 0;
+
+    switch (op)
+    {
+    case '+':
+        overflow = __builtin_add_overflow(leftVal, rightVal, &result);
+        break;
+    case '-':
+        overflow = __builtin_sub_overflow(leftVal, rightVal, &result);
+        break;
+    case '*':
+        overflow = __builtin_mul_overflow(leftVal, rightVal, &result);
+        break;
+    case '/':
+    case '%':
+        // Unchecked, these fault like the division of the compiled program
+        if (rightVal == 0)
+        {
+            if (checkDivision)
+            {
+                interpRuntimeError(DIVISION_ERROR);
+            }
+            raise(SIGFPE);
+        }
+        if (isInt && leftVal == INT_MIN && rightVal == -1)
+        {
+            if (checkDivision)
+            {
+                interpRuntimeError(OVERFLOW_ERROR);
+            }
+            raise(SIGFPE);
+        }
+        result = op == '/' ? leftVal / rightVal : leftVal % rightVal;
+        break;
+    default:
+        return 0;
+    }
+
+    if (!isInt)
+    {
+        return (signed char)result;
+    }
+    if (overflow && trapOverflow)
+    {
+        interpRuntimeError(OVERFLOW_ERROR);
+    }
+    return result;
+}
+
+int CondCompOp::interp() const
+{
+    int leftVal, rightVal;
+    interpOperands(left, leftLval, right, leftVal, rightVal);
+
+    switch (op)
+    {
+    case lt:
+        return leftVal < rightVal;
+    case gt:
+        return leftVal > rightVal;
+    case lte:
+        return leftVal <= rightVal;
+    case gte:
+        return leftVal >= rightVal;
+    case eq:
+        return leftVal == rightVal;
+    case neq:
+        return leftVal != rightVal;
+    default:
+        return 0;
+    }
+}
+
+int CondBoolOp::interp() const
+{
+    if (op == '&')
+    {
+        return left->interp() && right->interp();
+    }
+    return left->interp() || right->interp();
+}
+
+int CondUnOp::interp() const
+{
+    return !cond->interp();
+}
+
+int VarDef::interp() const
+{
+    bool array = isArray || sizeExpr;
+    size_t elementSize = interpSize(array ? type->getBaseType() : type);
+    int count = sizeExpr ? sizeExpr->interp() : isArray ? size : 1;
+
+    if (count <= 0)
+    {
+        interpRuntimeError(SIZE_ERROR);
+    }
+
+    interpFrame->slots[interpSlot] = interpFrame->allocate(elementSize * count);
+    if (array && checkBounds)
+    {
+        interpFrame->arraySizes[interpSlot] = count;
+    }
+    return 0;
+}
+
+void VarDef::interpBind(int slot) const
+{
+    interpSlot = slot;
+}
+
+void Lval::interpBind(int slot) const
+{
+    interpSlot = slot;
+}
+
+int Id::interp() const
+{
+    return interpLoad(interpAddress(), type);
+}
+
+char *Id::interpAddress() const
+{
+    return interpFrame->slots[interpSlot];
+}
+
+int ArrayAccess::interp() const
+{
+    return interpLoad(interpAddress(), type);
+}
+
+char *ArrayAccess::interpAddress() const
+{
+    int index = indexExpr->interp();
+
+    if (checkBounds)
+    {
+        int size = interpFrame->arraySizes[interpSlot];
+        if (size >= 0 && (unsigned)index >= (unsigned)size)
+        {
+            interpRuntimeError(BOUNDS_ERROR);
+        }
+    }
+    return interpFrame->slots[interpSlot] + (ptrdiff_t)index * interpSize(type);
+}
+
+int StringConst::interp() const
+{
+    return 0;
+}
+
+char *StringConst::interpAddress() const
+{
+    return const_cast<char *>(name->c_str());
+}
+
+int Let::interp() const
+{
+    int value = rexpr->interp();
+    interpStore(lexpr->interpAddress(), lexpr->getType(), value);
+    return 0;
+}
+
+int FuncCall::interp() const
+{
+    if (interpBuiltin)
+    {
+        llvm::SmallVector<intptr_t, 2> args;
+        if (exprs)
+        {
+            const std::vector<Expr *> &exprList = exprs->getExprs();
+            size_t index = 0;
+            for (auto it = exprList.rbegin(); it != exprList.rend(); ++it, ++index)
+            {
+                args.push_back(interpCallSite->callee->paramByRef[index]
+                                   ? (intptr_t) static_cast<Lval *>(*it)->interpAddress()
+                                   : (intptr_t)(*it)->interp());
+            }
+        }
+        return interpBuiltin(args.data());
+    }
+
+    const FuncDef *func = static_cast<const FuncDef *>(interpCallSite->callee->origin);
+    InterpFrame frame;
+    func->interpEnter(this, &frame);
+    return func->interpRun(&frame);
+}
+
+void FuncCall::interpBind(const MirCallSite *callSite, InterpBuiltin builtin, std::vector<int> captures) const
+{
+    interpCallSite = callSite;
+    interpBuiltin = builtin;
+    interpCaptures = std::move(captures);
+}
+
+const std::vector<int> &FuncCall::getInterpCaptures() const
+{
+    return interpCaptures;
+}
+
+InterpGenerator *FuncCall::interpGenerator() const
+{
+    const FuncDef *func = static_cast<const FuncDef *>(interpCallSite->callee->origin);
+    InterpGenerator *generator = new InterpGenerator(func);
+    func->interpEnter(this, generator->frame.get());
+    generator->frame->generator = generator;
+
+    getcontext(&generator->context);
+    generator->context.uc_stack.ss_sp = generator->stack.base;
+    generator->context.uc_stack.ss_size = generator->stack.size;
+    generator->context.uc_link = &generator->consumer;
+    makecontext(&generator->context, generatorMain, 0);
+
+    // Like the coroutine of igen, the generator runs up to its first yield
+    startingGenerator = generator;
+    interpResume(generator);
+    return generator;
+}
+
+int ProcCall::interp() const
+{
+    return funcCall->interp();
+}
+
+int If::interp() const
+{
+    if (cond->interp())
+    {
+        thenStmt->interp();
+    }
+    else if (elseStmt)
+    {
+        elseStmt->interp();
+    }
+    return 0;
+}
+
+int While::interp() const
+{
+    while (cond->interp())
+    {
+        body->interp();
+        if (interpFrame->returning)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+int For::interp() const
+{
+    InterpGenerator *handle = generator->interpGenerator();
+
+    while (!handle->done)
+    {
+        interpStore(lvalue->interpAddress(), lvalue->getType(), handle->value);
+        body->interp();
+        if (interpFrame->returning)
+        {
+            break;
+        }
+        interpResume(handle);
+    }
+    interpDestroy(handle);
+    return 0;
+}
+
+int Yield::interp() const
+{
+    InterpGenerator *generator = interpFrame->generator;
+
+    generator->value = expr->interp();
+    swapcontext(&generator->context, &generator->consumer);
+    if (generator->destroyed)
+    {
+        interpFrame->returning = true;
+    }
+    return 0;
+}
+
+int Return::interp() const
+{
+    if (expr)
+    {
+        interpFrame->result = expr->interp();
+    }
+    interpFrame->returning = true;
+    return 0;
+}
+
+// Nested functions are found through the call sites of the MIR, so their
+// definitions do nothing
+int FuncDef::interp() const
+{
+    return 0;
+}
+
+void FuncDef::interpBind(int vars, int slots) const
+{
+    interpVars = vars;
+    interpSlots = slots;
+}
+
+// Builds the frame of a call in the frame of the caller: the captured
+// variables are the caller's, and the arguments are evaluated in order. The
+// captures by value share the variable too, since the MIR only copies the
+// variables nothing changes while the callee runs. The main function is
+// entered without a call
+void FuncDef::interpEnter(const FuncCall *call, InterpFrame *frame) const
+{
+    frame->slots.resize(interpSlots);
+    if (checkBounds)
+    {
+        frame->arraySizes.assign(interpSlots, -1);
+    }
+    if (!call)
+    {
+        return;
+    }
+
+    const std::vector<int> &captures = call->getInterpCaptures();
+    for (size_t index = 0; index < captures.size(); ++index)
+    {
+        frame->slots[interpVars + index] = interpFrame->slots[captures[index]];
+    }
+
+    if (!fpar)
+    {
+        return;
+    }
+    // The parameters are the first variables, in the order of the source
+    const std::vector<Fpar *> &args = fpar->getParameters();
+    const std::vector<Expr *> &exprList = call->getExprs()->getExprs();
+    for (size_t index = args.size(); index-- > 0;)
+    {
+        Fpar *param = args[index];
+        Expr *arg = exprList[index];
+        size_t slot = args.size() - 1 - index;
+
+        if (param->getParameterType() == ParameterType::REFERENCE || param->getType()->getType() == TypeEnum::ARRAY)
+        {
+            frame->slots[slot] = static_cast<Lval *>(arg)->interpAddress();
+        }
+        else
+        {
+            frame->slots[slot] = frame->allocate(interpSize(param->getType()));
+            interpStore(frame->slots[slot], param->getType(), arg->interp());
+        }
+    }
+}
+
+// Runs the body of the function in its frame; returns its result
+int FuncDef::interpRun(InterpFrame *frame) const
+{
+    InterpFrame *callerFrame = interpFrame;
+    interpFrame = frame;
+    localDef->interp();
+    stmts->interp();
+    interpFrame = callerFrame;
+    return frame->result;
+}
@@ -0,0 +1,496 @@
+#include "ast.hpp"
+
+MirModule *AST::mirModule = nullptr;
+MirBuilder AST::MirB;
+std::vector<MirScope *> AST::mirScopes;
+
+static MirFunction *declareExternal(MirModule *m, const std::string &name, MirType ret,
+                                    std::vector<MirType> params, std::vector<bool> byRef)
+{
+    MirFunction *func = new MirFunction(name, ret, nullptr, nullptr);
+    func->isExternal = true;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        func->params.push_back(new MirArg(params[i], "p" + std::to_string(i), nullptr));
+        func->paramByRef.push_back(byRef[i]);
+    }
+    return m->addFunction(func);
+}
+
+void AST::mirLibs()
+{
+    declareExternal(mirModule, "writeInteger", MirType::VOID, {MirType::I32}, {false});
+    declareExternal(mirModule, "writeByte", MirType::VOID, {MirType::I8}, {false});
+    declareExternal(mirModule, "writeChar", MirType::VOID, {MirType::I8}, {false});
+    declareExternal(mirModule, "writeString", MirType::VOID, {MirType::PTR}, {true});
+    declareExternal(mirModule, "readInteger", MirType::I32, {}, {});
+    declareExternal(mirModule, "readByte", MirType::I8, {}, {});
+    declareExternal(mirModule, "readChar", MirType::I8, {}, {});
+    declareExternal(mirModule, "readString", MirType::VOID, {MirType::I32, MirType::PTR}, {false, true});
+    declareExternal(mirModule, "extend", MirType::I32, {MirType::I8}, {false});
+    declareExternal(mirModule, "shrink", MirType::I8, {MirType::I32}, {false});
+    declareExternal(mirModule, "strlen", MirType::I32, {MirType::PTR}, {true});
+    declareExternal(mirModule, "strcmp", MirType::I32, {MirType::PTR, MirType::PTR}, {true, true});
+    declareExternal(mirModule, "strcpy", MirType::VOID, {MirType::PTR, MirType::PTR}, {true, true});
+    declareExternal(mirModule, "strcat", MirType::VOID, {MirType::PTR, MirType::PTR}, {true, true});
+}
+
+MirModule *AST::mir_gen()
+{
+    mirModule = new MirModule();
+    mirLibs();
+
+    // The outermost scope only holds the name of the main function
+    mirScopes.push_back(new MirScope(nullptr));
+    this->mgen();
+    mirModule->main = mirModule->functionOf(this);
+    delete mirScopes.back();
+    mirScopes.clear();
+
+    mirOptimize(mirModule);
+    interpResolve();
+    return mirModule;
+}
+
+MirVar *AST::mirLookupVar(const std::string &name)
+{
+    for (auto it = mirScopes.rbegin(); it != mirScopes.rend(); ++it)
+    {
+        auto found = (*it)->vars.find(name);
+        if (found != (*it)->vars.end())
+            return found->second;
+    }
+    return nullptr;
+}
+
+MirFunction *AST::mirLookupFunction(const std::string &name)
+{
+    for (auto it = mirScopes.rbegin(); it != mirScopes.rend(); ++it)
+    {
+        auto found = (*it)->functions.find(name);
+        if (found != (*it)->functions.end())
+            return found->second;
+    }
+    return mirModule->getExternal(name);
+}
+
+MirValue *AST::mirAddress(const std::string &name)
+{
+    MirScope *scope = mirScopes.back();
+    MirVar *var = mirLookupVar(name);
+
+    if (var->owner == scope->func)
+    {
+        return var->address;
+    }
+
+    // Variables of enclosing functions are reached through the closure;
+    // one ENV per variable and function, at the top of the entry block
+    auto found = scope->env.find(var);
+    if (found != scope->env.end())
+    {
+        return found->second;
+    }
+
+    MirInstr *env = new MirInstr(MirOp::ENV, MirType::PTR);
+    env->var = var;
+    env->parent = scope->func->entry();
+    env->parent->instrs.insert(env->parent->instrs.begin(), env);
+    scope->env[var] = env;
+    return env;
+}
+
+MirValue *AST::mirValue(const Expr *e)
+{
+    MirValue *v = e->mgen();
+
+    if (v->type == MirType::PTR && (e->getTypeEnum() == TypeEnum::INT || e->getTypeEnum() == TypeEnum::BYTE))
+    {
+        v = MirB.createLoad(mirTypeOf(e->getType()), v);
+    }
+    return v;
+}
+
+MirValue *StmtList::mgen() const
+{
+    for (auto it = stmts.rbegin(); it != stmts.rend(); ++it)
+    {
+        (*it)->mgen();
+    }
+    return nullptr;
+}
+
+MirValue *LocalDefList::mgen() const
+{
+    for (auto it = defs.rbegin(); it != defs.rend(); ++it)
+    {
+        (*it)->mgen();
+    }
+    return nullptr;
+}
+
+MirValue *IntConst::mgen() const
+{
+    return MirBuilder::constant(MirType::I32, val);
+}
+
+MirValue *CharConst::mgen() const
+{
+    return MirBuilder::constant(MirType::I8, static_cast<signed char>(val));
+}
+
+MirValue *StringConst::mgen() const
+{
+    return new MirString(*name);
+}
+
+MirValue *UnOp::mgen() const
+{
+    MirValue *value = mirValue(expr);
+
+    if (op == '-')
+    {
+        return MirB.create(MirOp::NEG, mirTypeOf(type), {value}, this);
+    }
+    return value;
+}
+
+MirValue *BinOp::mgen() const
+{
+    MirValue *leftVal = mirValue(left);
+    MirValue *rightVal = mirValue(right);
+    MirOp mop;
+
+    switch (op)
+    {
+    case '+': mop = MirOp::ADD; break;
+    case '-': mop = MirOp::SUB; break;
+    case '*': mop = MirOp::MUL; break;
+    case '/': mop = MirOp::DIV; break;
+    default:  mop = MirOp::MOD; break;
+    }
+
+    return MirB.create(mop, mirTypeOf(type), {leftVal, rightVal}, this);
+}
+
+void CondCompOp::mgenBranch(MirBlock *trueBB, MirBlock *falseBB) const
+{
+    MirValue *leftVal = mirValue(left);
+    MirValue *rightVal = mirValue(right);
+    MirOp mop;
+
+    switch (op)
+    {
+    case lt:  mop = MirOp::LT; break;
+    case gt:  mop = MirOp::GT; break;
+    case lte: mop = MirOp::LE; break;
+    case gte: mop = MirOp::GE; break;
+    case eq:  mop = MirOp::EQ; break;
+    default:  mop = MirOp::NE; break;
+    }
+
+    MirB.createCondBr(MirB.create(mop, MirType::I1, {leftVal, rightVal}, this), trueBB, falseBB);
+}
+
+void CondBoolOp::mgenBranch(MirBlock *trueBB, MirBlock *falseBB) const
+{
+    MirBlock *rightBB = MirB.createBlock(op == '&' ? "and_rhs" : "or_rhs");
+
+    if (op == '&')
+    {
+        left->mgenBranch(rightBB, falseBB);
+    }
+    else
+    {
+        left->mgenBranch(trueBB, rightBB);
+    }
+
+    MirB.appendBlock(rightBB);
+    MirB.setInsertPoint(rightBB);
+    right->mgenBranch(trueBB, falseBB);
+}
+
+void CondUnOp::mgenBranch(MirBlock *trueBB, MirBlock *falseBB) const
+{
+    cond->mgenBranch(falseBB, trueBB);
+}
+
+void BoolConst::mgenBranch(MirBlock *trueBB, MirBlock *falseBB) const
+{
+    MirB.createBr(val ? trueBB : falseBB);
+}
+
+MirValue *Id::mgen() const
+{
+    mirModule->varUses.push_back({this, MirB.getFunction(), mirLookupVar(*name)});
+    return mirAddress(*name);
+}
+
+MirValue *ArrayAccess::mgen() const
+{
+    mirModule->varUses.push_back({this, MirB.getFunction(), mirLookupVar(*name)});
+    MirValue *index = mirValue(indexExpr);
+    MirInstr *element = MirB.create(MirOp::INDEX, MirType::PTR, {mirAddress(*name), index}, this);
+    element->elemType = mirTypeOf(type);
+    return element;
+}
+
+MirValue *Let::mgen() const
+{
+    MirValue *rValue = mirValue(rexpr);
+    MirValue *lValue = lexpr->mgen();
+    MirB.createStore(rValue, lValue);
+    return nullptr;
+}
+
+MirValue *FuncCall::mgen() const
+{
+    MirFunction *callee = mirLookupFunction(*name);
+    mirModule->callSites[this] = {MirB.getFunction(), callee};
+
+    std::vector<MirValue *> args;
+    if (exprs)
+    {
+        auto exprList = exprs->getExprs();
+        size_t index = 0;
+        for (auto it = exprList.rbegin(); it != exprList.rend(); ++it, ++index)
+        {
+            args.push_back(callee->paramByRef[index] ? (*it)->mgen() : mirValue(*it));
+        }
+    }
+
+    MirInstr *call = MirB.create(MirOp::CALL, callee->returnType, args, this);
+    call->callee = callee;
+    return call;
+}
+
+MirValue *ProcCall::mgen() const
+{
+    return funcCall->mgen();
+}
+
+MirValue *If::mgen() const
+{
+    MirBlock *thenBB = MirB.createBlock("then");
+    MirBlock *elseBB = elseStmt ? MirB.createBlock("else") : nullptr;
+    MirBlock *mergeBB = MirB.createBlock("ifcont");
+
+    cond->mgenBranch(thenBB, elseBB ? elseBB : mergeBB);
+
+    MirB.appendBlock(thenBB);
+    MirB.setInsertPoint(thenBB);
+    thenStmt->mgen();
+    if (!MirB.isTerminated())
+    {
+        MirB.createBr(mergeBB);
+    }
+
+    if (elseBB)
+    {
+        MirB.appendBlock(elseBB);
+        MirB.setInsertPoint(elseBB);
+        elseStmt->mgen();
+        if (!MirB.isTerminated())
+        {
+            MirB.createBr(mergeBB);
+        }
+    }
+
+    MirB.appendBlock(mergeBB);
+    MirB.setInsertPoint(mergeBB);
+    return nullptr;
+}
+
+MirValue *While::mgen() const
+{
+    MirBlock *condBB = MirB.createBlock("cond");
+    MirBlock *loopBB = MirB.createBlock("loop");
+    MirBlock *afterBB = MirB.createBlock("afterloop");
+
+    MirB.createBr(condBB);
+    MirB.appendBlock(condBB);
+    MirB.setInsertPoint(condBB);
+    cond->mgenBranch(loopBB, afterBB);
+
+    MirB.appendBlock(loopBB);
+    MirB.setInsertPoint(loopBB);
+    body->mgen();
+    if (!MirB.isTerminated())
+    {
+        MirB.createBr(condBB);
+    }
+
+    MirB.appendBlock(afterBB);
+    MirB.setInsertPoint(afterBB);
+    return nullptr;
+}
+
+MirValue *For::mgen() const
+{
+    MirScope *scope = mirScopes.back();
+    MirValue *handle = generator->mgen();
+
+    MirBlock *condBB = MirB.createBlock("for_cond");
+    MirBlock *loopBB = MirB.createBlock("for_loop");
+    MirBlock *afterBB = MirB.createBlock("for_after");
+
+    MirB.createBr(condBB);
+    MirB.appendBlock(condBB);
+    MirB.setInsertPoint(condBB);
+    MirB.createCondBr(MirB.create(MirOp::GEN_DONE, MirType::I1, {handle}), afterBB, loopBB);
+
+    MirB.appendBlock(loopBB);
+    MirB.setInsertPoint(loopBB);
+    MirValue *value = MirB.create(MirOp::GEN_VALUE, mirTypeOf(generator->getType()->getBaseType()), {handle});
+    MirB.createStore(value, lvalue->mgen());
+
+    scope->activeGenerators.push_back(handle);
+    body->mgen();
+    scope->activeGenerators.pop_back();
+
+    if (!MirB.isTerminated())
+    {
+        MirB.create(MirOp::GEN_RESUME, MirType::VOID, {handle});
+        MirB.createBr(condBB);
+    }
+
+    MirB.appendBlock(afterBB);
+    MirB.setInsertPoint(afterBB);
+    MirB.create(MirOp::GEN_DESTROY, MirType::VOID, {handle});
+    return nullptr;
+}
+
+MirValue *Yield::mgen() const
+{
+    MirB.create(MirOp::YIELD, MirType::VOID, {mirValue(expr)}, this);
+    return nullptr;
+}
+
+MirValue *Return::mgen() const
+{
+    MirValue *value = expr ? mirValue(expr) : nullptr;
+
+    for (MirValue *handle : mirScopes.back()->activeGenerators)
+    {
+        MirB.create(MirOp::GEN_DESTROY, MirType::VOID, {handle});
+    }
+
+    if (value)
+    {
+        MirB.create(MirOp::RET, MirType::VOID, {value}, this);
+    }
+    else
+    {
+        MirB.create(MirOp::RET, MirType::VOID, {}, this);
+    }
+    return nullptr;
+}
+
+MirValue *Empty::mgen() const
+{
+    return nullptr;
+}
+
+MirValue *VarDef::mgen() const
+{
+    MirFunction *func = MirB.getFunction();
+    MirVar *var = new MirVar(*name, type, func, false, mirModule->varCounter++);
+    MirType elemType = mirTypeOf(isArray ? type->getBaseType() : type);
+    MirInstr *slot = nullptr;
+
+    if (sizeExpr)
+    {
+        slot = MirB.create(MirOp::SLOT, MirType::PTR, {mirValue(sizeExpr)}, this);
+        slot->elemType = elemType;
+        slot->var = var;
+    }
+    else
+    {
+        slot = MirB.createEntrySlot(elemType, MirBuilder::constant(MirType::I32, isArray ? size : 1), var);
+        slot->origin = this;
+    }
+
+    var->address = slot;
+    func->vars.push_back(var);
+    mirScopes.back()->vars[*name] = var;
+    mirModule->varUses.push_back({this, func, var});
+    return nullptr;
+}
+
+MirValue *FuncDef::mgen() const
+{
+    MirScope *outer = mirScopes.back();
+    MirFunction *func = new MirFunction(*name, mirTypeOf(type), outer->func, this);
+
+    // Functions of different scopes may share a name
+    int clashes = 0;
+    for (MirFunction *f : mirModule->functions)
+    {
+        if (!f->isExternal && (f->name == *name || f->name.rfind(*name + ".", 0) == 0))
+            ++clashes;
+    }
+    if (clashes)
+    {
+        func->name += "." + std::to_string(clashes);
+    }
+
+    if (type->getType() == TypeEnum::GENERATOR)
+    {
+        func->isGenerator = true;
+        func->yieldType = mirTypeOf(type->getBaseType());
+    }
+    mirModule->addFunction(func);
+    outer->functions[*name] = func;
+
+    MirFunction *prevFunc = MirB.getFunction();
+    MirBlock *prevBlock = MirB.getInsertBlock();
+    MirScope *scope = new MirScope(func);
+    mirScopes.push_back(scope);
+
+    MirB.setFunction(func);
+    MirBlock *entry = MirB.createBlock("entry");
+    MirB.appendBlock(entry);
+    MirB.setInsertPoint(entry);
+
+    auto args = fpar ? fpar->getParameters() : std::vector<Fpar *>();
+    for (auto it = args.rbegin(); it != args.rend(); ++it)
+    {
+        Fpar *param = *it;
+        bool byRef = param->getParameterType() == ParameterType::REFERENCE ||
+                     param->getType()->getType() == TypeEnum::ARRAY;
+        MirVar *var = new MirVar(*param->getName(), param->getType(), func, byRef, mirModule->varCounter++);
+        MirArg *arg = new MirArg(byRef ? MirType::PTR : mirTypeOf(param->getType()), *param->getName(), var);
+
+        func->params.push_back(arg);
+        func->paramByRef.push_back(byRef);
+        func->vars.push_back(var);
+
+        if (byRef)
+        {
+            var->address = arg;
+        }
+        else
+        {
+            var->address = MirB.createEntrySlot(arg->type, MirBuilder::constant(MirType::I32, 1), var);
+            MirB.createStore(arg, var->address);
+        }
+        scope->vars[*param->getName()] = var;
+    }
+
+    localDef->mgen();
+    stmts->mgen();
+
+    if (!MirB.isTerminated())
+    {
+        if (func->returnType == MirType::VOID || func->isGenerator)
+            MirB.create(MirOp::RET, MirType::VOID, {});
+        else
+            MirB.create(MirOp::UNREACHABLE, MirType::VOID, {});
+    }
+
+    mirScopes.pop_back();
+    delete scope;
+    MirB.setFunction(prevFunc);
+    MirB.setInsertPoint(prevBlock);
+    return nullptr;
+}
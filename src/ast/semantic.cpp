@@ -1,5 +1,6 @@
 #include "ast.hpp"
 #include "../symbol/symbol_table.hpp"
+#include <llvm/Support/TimeProfiler.h>
 
 SymbolTable st;
 
@@ -76,6 +77,7 @@ void FparList::sem()
 
 void FuncDef::sem()
 {
+    llvm::TimeTraceScope trace("sem", *name);
     if (st.findSymbolInCurrentScope(*name))
     {
         semantic_error(this->line, this->column,
@@ -86,6 +88,11 @@ void FuncDef::sem()
         semantic_error(this->line, this->column,
             "Main function must have a 'proc' return type.");
     }
+    else if(!st.getCurrentFunctionContext() && fpar)
+    {
+        semantic_error(this->line, this->column,
+            "Main function must not have parameters.");
+    }
     else
     {
 
@@ -122,19 +129,6 @@ void FuncDef::sem()
             setReturn();
         }
 
-        for (auto &captured : funcSymbol->getCapturedSymbols())
-        {
-            if (captured->getSymbolType() == SymbolType::VARIABLE)
-            {
-                capturedVars.push_back(new CapturedVar(captured->getName(), captured->getType()));
-            }
-            else
-            {
-                capturedVars.push_back(new CapturedVar(captured->getName(), captured->getType(), true,
-                                                       static_cast<ParameterSymbol *>(captured)->getParameterType()));
-            }
-        }
-
         st.exitFunctionScope();
     }
 }
@@ -148,6 +142,25 @@ void VarDef::sem()
         semantic_error(this->line, this->column,
             "Variable name '" + *name + "' is already declared in the same scope.");
     }
+    else if (sizeExpr)
+    {
+        if (st.getCurrentFunctionReturnType()->getType() == TypeEnum::GENERATOR)
+        {
+            semantic_error(this->line, this->column,
+                "Array '" + *name + "' in generator '" + st.getCurrentFunctionName() + "' must have a constant size.");
+        }
+
+        sizeExpr->sem();
+        if (sizeExpr->getTypeEnum() != TypeEnum::INT)
+        {
+            semantic_error(this->line, this->column,
+                "Array size for variable '" + *name + "' must be an integer expression, but found type '" +
+                typeToString(sizeExpr->getTypeEnum()) + "'.");
+        }
+
+        type = new ArrayType(type);
+        st.addSymbol(*name, new VariableSymbol(*name, type));
+    }
     else if (isArray)
     {
         if (size <= 0)
@@ -489,23 +502,12 @@ void FuncCall::sem()
 
             type = func->getType();
 
-            for (auto &captured : func->getCapturedSymbols())
+            if (type->getType() == TypeEnum::GENERATOR && !generatorUse)
             {
-                if (captured->getSymbolType() == SymbolType::VARIABLE)
-                {
-                    capturedVars.push_back(new CapturedVar(captured->getName(), captured->getType()));
-                }
-                else
-                {
-                    capturedVars.push_back(new CapturedVar(captured->getName(), captured->getType(), true,
-                                                           static_cast<ParameterSymbol *>(captured)->getParameterType()));
-                }
+                semantic_error(this->line, this->column,
+                    "Generator '" + *name + "' can only be consumed by a 'for' statement.");
             }
 
-            if (func->getNestingLevel() > 1)
-            {
-                isNested = true;
-            }
         }
     }
 }
@@ -542,15 +544,120 @@ void If::sem()
     }
 }
 
+// LoopHint Class Semantic Method Implementation
+
+void LoopHint::sem()
+{
+    if (*name == "unroll" || *name == "vectorize" || *name == "interleave")
+    {
+        if (value <= 0)
+        {
+            semantic_error(this->line, this->column,
+                "Loop hint '" + *name + "' requires a positive count, e.g. '@" + *name + "(4)'.");
+        }
+    }
+    else if (*name == "independent")
+    {
+        if (value != -1)
+        {
+            semantic_error(this->line, this->column,
+                "Loop hint 'independent' does not take an argument.");
+        }
+    }
+    else
+    {
+        semantic_error(this->line, this->column,
+            "Unknown loop hint '" + *name + "'. Expected one of 'unroll', 'vectorize', 'interleave' or 'independent'.");
+    }
+}
+
+// LoopHintList Class Semantic Method Implementation
+
+void LoopHintList::sem()
+{
+    for (auto it = hints.rbegin(); it != hints.rend(); ++it)
+    {
+        auto hint = *it;
+        hint->sem();
+        for (auto prev = hints.rbegin(); prev != it; ++prev)
+        {
+            if ((*prev)->getName() == hint->getName())
+            {
+                semantic_error(hint->line, hint->column,
+                    "Loop hint '" + hint->getName() + "' is given more than once.");
+                break;
+            }
+        }
+    }
+}
+
 // While Class Semantic Method Implementation
 
 void While::sem()
 {
+    if (hints)
+    {
+        hints->sem();
+    }
     cond->sem();
     body->setExternal(false);
     body->sem();
 }
 
+// For Class Semantic Method Implementation
+
+void For::sem()
+{
+    generator->setGeneratorUse(true);
+    generator->sem();
+    lvalue->sem();
+
+    if (generator->getTypeEnum() != TypeEnum::GENERATOR)
+    {
+        if (generator->getTypeEnum() != TypeEnum::ERROR)
+        {
+            semantic_error(this->line, this->column,
+                "Function '" + *generator->getName() + "' in 'for' statement is not a generator.");
+        }
+    }
+    else if (dynamic_cast<StringConst *>(lvalue))
+    {
+        semantic_error(this->line, this->column,
+            "Loop variable of 'for' statement cannot be a constant string.");
+    }
+    else if (!equalTypes(lvalue->getTypeEnum(), generator->getType()->getBaseType()->getType()))
+    {
+        semantic_error(this->line, this->column,
+            "Type mismatch in 'for' statement: generator '" + *generator->getName() + "' yields '" +
+            typeToString(generator->getType()->getBaseType()->getType()) + "', but loop variable is '" +
+            typeToString(lvalue->getTypeEnum()) + "'.");
+    }
+
+    body->setExternal(false);
+    body->sem();
+}
+
+// Yield Class Semantic Method Implementation
+
+void Yield::sem()
+{
+    Type *generatorType = st.getCurrentFunctionReturnType();
+
+    expr->sem();
+
+    if (!generatorType || generatorType->getType() != TypeEnum::GENERATOR)
+    {
+        semantic_error(this->line, this->column,
+            "'yield' can only be used inside a generator.");
+    }
+    else if (!equalTypes(expr->getTypeEnum(), generatorType->getBaseType()->getType()))
+    {
+        semantic_error(this->line, this->column,
+            "Yield type mismatch in generator '" + st.getCurrentFunctionName() + "': expected '" +
+            typeToString(generatorType->getBaseType()->getType()) + "', but found '" + typeToString(expr->getTypeEnum()) + "'.");
+    }
+}
+
 // Return Class Semantic Method Implementation
 
 void Return::sem()
@@ -566,6 +673,11 @@ void Return::sem()
             semantic_error(this->line, this->column,
                 "Void function '" + st.getCurrentFunctionName() + "' should not return a value.");
         }
+        else if (expectedReturnType->getType() == TypeEnum::GENERATOR)
+        {
+            semantic_error(this->line, this->column,
+                "Generator '" + st.getCurrentFunctionName() + "' cannot return a value; use 'yield' instead.");
+        }
         else if (expr->getType() && expr->getType()->getType() != expectedReturnType->getType())
         {
             semantic_error(this->line, this->column,
@@ -573,7 +685,7 @@ void Return::sem()
         }
     }
 
-    else if (expectedReturnType->getType() != TypeEnum::VOID)
+    else if (expectedReturnType->getType() != TypeEnum::VOID && expectedReturnType->getType() != TypeEnum::GENERATOR)
     {
         semantic_error(this->line, this->column,
             "Non-void function '" + st.getCurrentFunctionName() + "' should return a value of type '" + typeToString(expectedReturnType->getType()) + "'.");
@@ -16,6 +16,8 @@ llvm::Type* translateType(Type* type, ParameterType pt) {
         t = proc;
     } else if (type->getType() == TypeEnum::ARRAY) {
         t = translateType(type->getBaseType(), ParameterType::VALUE)->getPointerTo();
+    } else if (type->getType() == TypeEnum::GENERATOR) {
+        t = i8->getPointerTo();
     }
     if (pt == ParameterType::REFERENCE) {
         t = t->getPointerTo();
@@ -24,7 +26,7 @@ llvm::Type* translateType(Type* type, ParameterType pt) {
 }
 
 // GenBlock constructor
-GenBlock::GenBlock() : func(nullptr), block(nullptr), hasReturnFlag(false) {}
+GenBlock::GenBlock() : func(nullptr), block(nullptr), hasReturnFlag(false), stackSave(nullptr), coroutine(nullptr) {}
 
 // GenBlock destructor
 GenBlock::~GenBlock() {
@@ -73,6 +75,77 @@ bool GenBlock::hasReturn() {
     return hasReturnFlag;
 }
 
+// Set stack pointer saved before the first runtime-sized array of GenBlock
+void GenBlock::setStackSave(llvm::Value* s) {
+    stackSave = s;
+}
+
+// Get stack pointer saved before the first runtime-sized array of GenBlock
+llvm::Value* GenBlock::getStackSave() {
+    return stackSave;
+}
+
+// Add slot holding a heap allocated array (or null) that must be freed on return
+void GenBlock::addHeapArray(llvm::AllocaInst* slot) {
+    heapArrays.push_back(slot);
+}
+
+// Get slots of heap allocated arrays for GenBlock
+const std::vector<llvm::AllocaInst*>& GenBlock::getHeapArrays() {
+    return heapArrays;
+}
+
+// Add element count of a runtime-sized array to GenBlock
+void GenBlock::addArraySize(const std::string& name, llvm::Value* size) {
+    arraySizes[name] = size;
+}
+
+// Get element count of a runtime-sized array, or null if not declared in GenBlock
+llvm::Value* GenBlock::getArraySize(const std::string& name) {
+    auto it = arraySizes.find(name);
+    return it == arraySizes.end() ? nullptr : it->second;
+}
+
+// Set coroutine state when GenBlock belongs to a generator
+void GenBlock::setCoroutine(GenCoroutine* c) {
+    coroutine = c;
+}
+
+// Get coroutine state of GenBlock (null for ordinary functions)
+GenCoroutine* GenBlock::getCoroutine() {
+    return coroutine;
+}
+
+// Push handle of a generator consumed by an enclosing 'for' statement
+void GenBlock::pushGenerator(llvm::Value* handle) {
+    activeGenerators.push_back(handle);
+}
+
+// Pop handle of the innermost consumed generator
+void GenBlock::popGenerator() {
+    activeGenerators.pop_back();
+}
+
+// Get handles of generators that must be destroyed on return
+const std::vector<llvm::Value*>& GenBlock::getActiveGenerators() {
+    return activeGenerators;
+}
+
+// Push trip counter and counters of a while loop profiled by -fprofile-loops
+void GenBlock::pushLoop(llvm::AllocaInst* trips, llvm::GlobalVariable* counts) {
+    activeLoops.push_back({trips, counts});
+}
+
+// Pop the innermost profiled while loop
+void GenBlock::popLoop() {
+    activeLoops.pop_back();
+}
+
+// Get profiled while loops whose runs end on return
+const std::vector<std::pair<llvm::AllocaInst*, llvm::GlobalVariable*>>& GenBlock::getActiveLoops() {
+    return activeLoops;
+}
+
 // GenScope constructor
 GenScope::GenScope() {}
 
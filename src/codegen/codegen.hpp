@@ -22,12 +22,29 @@
 // Function to translate custom types to LLVM types
 llvm::Type* translateType(Type* type, ParameterType pt);
 
+// Coroutine state of a generator function: its handle, the promise slot
+// holding the yielded value, and the blocks every suspend point branches to
+struct GenCoroutine {
+    llvm::Value* id;
+    llvm::Value* handle;
+    llvm::AllocaInst* promise;
+    llvm::BasicBlock* finalSuspend;
+    llvm::BasicBlock* cleanup;
+    llvm::BasicBlock* suspend;
+};
+
 class GenBlock {
 private:
     llvm::Function* func;
     llvm::BasicBlock* block;
     bool hasReturnFlag; 
     std::unordered_map<std::string, llvm::AllocaInst*> allocas;
+    llvm::Value* stackSave;
+    std::vector<llvm::AllocaInst*> heapArrays;
+    std::unordered_map<std::string, llvm::Value*> arraySizes;
+    GenCoroutine* coroutine;
+    std::vector<llvm::Value*> activeGenerators;
+    std::vector<std::pair<llvm::AllocaInst*, llvm::GlobalVariable*>> activeLoops;
 
 
 public:
@@ -45,6 +62,26 @@ public:
 
     void addReturn();
     bool hasReturn();
+
+    void setStackSave(llvm::Value* s);
+    llvm::Value* getStackSave();
+
+    void addHeapArray(llvm::AllocaInst* slot);
+    const std::vector<llvm::AllocaInst*>& getHeapArrays();
+
+    void addArraySize(const std::string& name, llvm::Value* size);
+    llvm::Value* getArraySize(const std::string& name);
+
+    void setCoroutine(GenCoroutine* c);
+    GenCoroutine* getCoroutine();
+
+    void pushGenerator(llvm::Value* handle);
+    void popGenerator();
+    const std::vector<llvm::Value*>& getActiveGenerators();
+
+    void pushLoop(llvm::AllocaInst* trips, llvm::GlobalVariable* counts);
+    void popLoop();
+    const std::vector<std::pair<llvm::AllocaInst*, llvm::GlobalVariable*>>& getActiveLoops();
 };
 
 class GenScope {
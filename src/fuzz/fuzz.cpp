@@ -0,0 +1,499 @@
+// In-process fuzz target of the compiler. Every input goes through the
+// lexer, the parser, the semantic analysis, the MIR and the LLVM code
+// generation without starting a process, and the mutator edits inputs along
+// the grammar of parser.y.
+//
+// Besides crashes, the target reports inputs that are too expensive for
+// their size: an input aborts when its compile time or the memory it
+// allocates exceeds a budget linear in its size, or when repeating the
+// statements of its outermost body makes the cost grow with an exponent
+// above SUPERLINEAR.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <unistd.h>
+#include <vector>
+
+#include "fuzz.hpp"
+#include "../ast/ast.hpp"
+#include "../parser/parser.hpp"
+#include "../lexer/lexer.hpp"
+
+// Byte-level mutator of libFuzzer, missing in the standalone driver
+extern "C" size_t LLVMFuzzerMutate(uint8_t *data, size_t size, size_t maxSize) __attribute__((weak));
+
+// The compiler frees neither its AST nor its MIR, so leak checking would
+// stop at the first input
+extern "C" const char *__asan_default_options() {
+    return "detect_leaks=0";
+}
+
+typedef std::chrono::steady_clock Clock;
+
+// Budgets per byte of input (ALAN_FUZZ_SECONDS_PER_BYTE and
+// ALAN_FUZZ_ALLOCATED_PER_BYTE); shorter inputs get the budget of
+// MIN_BUDGET_SIZE bytes
+static double secondsPerByte = 200e-6;
+static double allocatedPerByte = 16 * 1024;
+static const size_t MIN_BUDGET_SIZE = 1024;
+
+// Inputs that use this share of a budget have their scaling measured
+static const double SUSPICIOUS = 0.25;
+static const double SUPERLINEAR = 1.3;
+
+// Growth below these is too small to fit an exponent to
+static const double MIN_FIT_SECONDS = 0.01;
+static const double MIN_FIT_BYTES = 1 << 20;
+
+// Bytes requested from operator new since the start
+static size_t allocatedBytes = 0;
+
+void *operator new(size_t size) {
+    allocatedBytes += size;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        abort();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+CompileCost compileInput(const uint8_t *data, size_t size) {
+    resetFrontend();
+    size_t before = allocatedBytes;
+    auto start = Clock::now();
+
+    YY_BUFFER_STATE buffer = yy_scan_bytes(reinterpret_cast<const char *>(data), static_cast<int>(size));
+    yyparse();
+    yy_delete_buffer(buffer);
+
+    CompileCost cost;
+    cost.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    cost.allocatedBytes = allocatedBytes - before;
+    return cost;
+}
+
+// Tokens
+
+enum TokenKind { IDENT, NUMBER, CHAR, STRING, PUNCT };
+
+struct Token {
+    size_t begin;
+    size_t end;
+    TokenKind kind;
+};
+
+// Splits the text like lexer.l, without the comments; malformed tokens end
+// at the end of the line or of the text
+static std::vector<Token> tokenize(const std::string &text) {
+    std::vector<Token> tokens;
+    size_t n = text.size();
+    size_t i = 0;
+    while (i < n) {
+        char c = text[i];
+        if (isspace(static_cast<unsigned char>(c))) {
+            ++i;
+            continue;
+        }
+        if (c == '-' && i + 1 < n && text[i + 1] == '-') {
+            while (i < n && text[i] != '\n') ++i;
+            continue;
+        }
+        if (c == '(' && i + 1 < n && text[i + 1] == '*') {
+            int depth = 0;
+            for (i += 2; i < n; ++i) {
+                if (text.compare(i, 2, "(*") == 0) {
+                    ++depth;
+                    ++i;
+                } else if (text.compare(i, 2, "*)") == 0) {
+                    ++i;
+                    if (depth-- == 0) {
+                        ++i;
+                        break;
+                    }
+                }
+            }
+            continue;
+        }
+
+        Token token = {i, i, PUNCT};
+        if (isalpha(static_cast<unsigned char>(c))) {
+            while (i < n && (isalnum(static_cast<unsigned char>(text[i])) || text[i] == '_')) ++i;
+            token.kind = IDENT;
+        } else if (isdigit(static_cast<unsigned char>(c))) {
+            while (i < n && isdigit(static_cast<unsigned char>(text[i]))) ++i;
+            token.kind = NUMBER;
+        } else if (c == '\'' || c == '"') {
+            for (++i; i < n && text[i] != c && text[i] != '\n'; ++i) {
+                if (text[i] == '\\') ++i;
+            }
+            i = std::min(i + 1, n);
+            token.kind = c == '"' ? STRING : CHAR;
+        } else if (strchr("<>=!", c) && i + 1 < n && text[i + 1] == '=') {
+            i += 2;
+        } else {
+            ++i;
+        }
+        token.end = i;
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+static bool isPunct(const std::string &text, const Token &token, const char *p) {
+    return token.kind == PUNCT && text.compare(token.begin, token.end - token.begin, p) == 0;
+}
+
+// Index of the token that closes the bracket at index open, or the size
+static size_t matching(const std::string &text, const std::vector<Token> &tokens, size_t open) {
+    const char *pairs[][2] = {{"(", ")"}, {"[", "]"}, {"{", "}"}};
+    for (auto &pair : pairs) {
+        if (!isPunct(text, tokens[open], pair[0])) continue;
+        int depth = 0;
+        for (size_t t = open; t < tokens.size(); ++t) {
+            if (isPunct(text, tokens[t], pair[0])) {
+                ++depth;
+            } else if (isPunct(text, tokens[t], pair[1]) && --depth == 0) {
+                return t;
+            }
+        }
+    }
+    return tokens.size();
+}
+
+// Grammar
+
+typedef std::vector<std::vector<std::string>> Alternatives;
+
+// The rules of parser.y. Names in angle brackets are nonterminals; ID,
+// HINT, CONST, CHAR and STRING stand for the token classes of lexer.l.
+// The first alternative of every rule is the shortest one, and the only
+// one taken once the derivation is too deep.
+static const std::map<std::string, Alternatives> grammar = {
+    {"funcdef", {{"ID", "(", ")", ":", "<rtype>", "<localdefs>", "<compoundstmt>"},
+                 {"ID", "(", "<fparlist>", ")", ":", "<rtype>", "<localdefs>", "<compoundstmt>"}}},
+    {"fparlist", {{"<fpardef>", "<fpardefs>"}}},
+    {"fpardef", {{"ID", ":", "<type>"}, {"ID", ":", "reference", "<type>"}}},
+    {"fpardefs", {{}, {",", "<fpardef>", "<fpardefs>"}}},
+    {"datatype", {{"int"}, {"byte"}}},
+    {"type", {{"<datatype>"}, {"<datatype>", "[", "]"}}},
+    {"rtype", {{"proc"}, {"<datatype>"}, {"gen", "<datatype>"}}},
+    {"localdefs", {{}, {"<localdef>", "<localdefs>"}}},
+    {"localdef", {{"<vardef>"}, {"<funcdef>"}}},
+    {"vardef", {{"ID", ":", "<datatype>", ";"}, {"ID", ":", "<datatype>", "[", "<expr>", "]", ";"}}},
+    {"stmt", {{";"}, {"<lvalue>", "=", "<expr>", ";"}, {"<compoundstmt>"}, {"<funccall>", ";"},
+              {"if", "(", "<cond>", ")", "<stmt>", "else", "<stmt>"}, {"if", "(", "<cond>", ")", "<stmt>"},
+              {"while", "(", "<cond>", ")", "<stmt>"}, {"<loophints>", "while", "(", "<cond>", ")", "<stmt>"},
+              {"for", "(", "<lvalue>", ":", "<funccall>", ")", "<stmt>"}, {"yield", "<expr>", ";"},
+              {"return", "<expr>", ";"}, {"return", ";"}}},
+    {"loophint", {{"@", "HINT"}, {"@", "HINT", "(", "CONST", ")"}}},
+    {"loophints", {{"<loophint>"}, {"<loophint>", "<loophints>"}}},
+    {"stmts", {{}, {"<stmt>", "<stmts>"}}},
+    {"compoundstmt", {{"{", "<stmts>", "}"}}},
+    {"funccall", {{"ID", "(", ")"}, {"ID", "(", "<exprlist>", ")"}}},
+    {"exprlist", {{"<expr>", "<exprs>"}}},
+    {"expr", {{"CONST"}, {"CHAR"}, {"<lvalue>"}, {"(", "<expr>", ")"}, {"<funccall>"}, {"+", "<expr>"},
+              {"-", "<expr>"}, {"<expr>", "+", "<expr>"}, {"<expr>", "-", "<expr>"}, {"<expr>", "*", "<expr>"},
+              {"<expr>", "/", "<expr>"}, {"<expr>", "%", "<expr>"}}},
+    {"exprs", {{}, {",", "<expr>", "<exprs>"}}},
+    {"lvalue", {{"ID"}, {"ID", "[", "<expr>", "]"}, {"STRING"}}},
+    {"cond", {{"true"}, {"false"}, {"(", "<cond>", ")"}, {"!", "<cond>"}, {"<expr>", "==", "<expr>"},
+              {"<expr>", "!=", "<expr>"}, {"<expr>", "<", "<expr>"}, {"<expr>", ">", "<expr>"},
+              {"<expr>", "<=", "<expr>"}, {"<expr>", ">=", "<expr>"}, {"<cond>", "&", "<cond>"},
+              {"<cond>", "|", "<cond>"}}},
+};
+
+// Few names, so that the uses of a name often find its declaration
+static const std::vector<std::string> identifiers = {
+    "main", "x", "y", "n", "i", "a", "s", "f", "g", "writeInteger", "writeByte", "writeChar", "writeString",
+    "readInteger", "strlen", "strcpy", "extend", "shrink"};
+static const std::vector<std::string> hints = {"unroll", "vectorize", "interleave", "independent"};
+static const std::vector<std::string> numbers = {
+    "0", "1", "2", "3", "7", "8", "10", "100", "255", "256", "65535", "2147483647", "2147483648", "4294967296"};
+static const std::vector<std::string> chars = {"'a'", "'0'", "'\\n'", "'\\0'", "'\\x41'", "'\\''", "'\\\\'"};
+static const std::vector<std::string> strings = {"\"\"", "\"hello\\n\"", "\"\\x41\\t\\\"\\0\"", "\"(* --\""};
+
+static const std::vector<std::vector<std::string>> operatorClasses = {
+    {"+", "-", "*", "/", "%"}, {"==", "!=", "<", ">", "<=", ">="}, {"&", "|"}, {";", ",", ":", "=", "!", "@"}};
+
+static const std::string &pick(const std::vector<std::string> &choices, std::mt19937 &rng) {
+    return choices[rng() % choices.size()];
+}
+
+static bool isNonterminal(const std::string &symbol) {
+    return symbol.size() > 2 && symbol.front() == '<' && symbol.back() == '>';
+}
+
+static void derive(const std::string &symbol, std::mt19937 &rng, int depth, std::string &out) {
+    if (isNonterminal(symbol)) {
+        const Alternatives &alternatives = grammar.at(symbol.substr(1, symbol.size() - 2));
+        const std::vector<std::string> &alternative =
+            depth <= 0 ? alternatives[0] : alternatives[rng() % alternatives.size()];
+        for (const std::string &s : alternative) {
+            derive(s, rng, depth - 1, out);
+        }
+        return;
+    }
+
+    if (symbol == "ID") {
+        out += pick(identifiers, rng);
+    } else if (symbol == "HINT") {
+        out += pick(hints, rng);
+    } else if (symbol == "CONST") {
+        out += pick(numbers, rng);
+    } else if (symbol == "CHAR") {
+        out += pick(chars, rng);
+    } else if (symbol == "STRING") {
+        out += pick(strings, rng);
+    } else {
+        out += symbol;
+    }
+    out += symbol == ";" || symbol == "{" || symbol == "}" ? "\n" : " ";
+}
+
+std::string generateProgram(std::mt19937 &rng, int depth) {
+    std::string out;
+    derive("<funcdef>", rng, depth, out);
+    return out;
+}
+
+// Mutations
+
+enum Mutation { REPLACE_TOKEN, INSERT_STMT, INSERT_EXPR, DUPLICATE_REGION, DELETE_REGION, WRAP_BLOCK, GENERATE, MUTATIONS };
+
+static std::string replaceTokens(const std::string &text, const std::vector<Token> &tokens, size_t first,
+                                 size_t last, const std::string &replacement) {
+    return text.substr(0, tokens[first].begin) + replacement + text.substr(tokens[last].end);
+}
+
+static std::string mutate(const std::string &text, std::mt19937 &rng) {
+    std::vector<Token> tokens = tokenize(text);
+    Mutation mutation = tokens.empty() ? GENERATE : static_cast<Mutation>(rng() % MUTATIONS);
+    size_t t = tokens.empty() ? 0 : rng() % tokens.size();
+    int depth = 2 + rng() % 6;
+
+    switch (mutation) {
+    case REPLACE_TOKEN: {
+        const Token &token = tokens[t];
+        std::string replacement;
+        if (token.kind == IDENT) {
+            // Another name of the input, or one of the usual names
+            const Token &other = tokens[rng() % tokens.size()];
+            replacement = other.kind == IDENT && rng() % 2
+                ? text.substr(other.begin, other.end - other.begin) : pick(identifiers, rng);
+        } else if (token.kind == NUMBER) {
+            replacement = pick(numbers, rng);
+        } else if (token.kind == CHAR) {
+            replacement = pick(chars, rng);
+        } else if (token.kind == STRING) {
+            replacement = pick(strings, rng);
+        } else {
+            replacement = pick(operatorClasses.back(), rng);
+            for (auto &operators : operatorClasses) {
+                if (std::find(operators.begin(), operators.end(), text.substr(token.begin, token.end - token.begin)) != operators.end()) {
+                    replacement = pick(operators, rng);
+                }
+            }
+        }
+        return replaceTokens(text, tokens, t, t, replacement);
+    }
+    case INSERT_STMT: {
+        // After a token that can end a statement
+        for (size_t k = 0; k < tokens.size(); ++k, t = (t + 1) % tokens.size()) {
+            if (isPunct(text, tokens[t], ";") || isPunct(text, tokens[t], "{") || isPunct(text, tokens[t], "}")) {
+                std::string stmt;
+                derive("<stmt>", rng, depth, stmt);
+                return text.substr(0, tokens[t].end) + "\n" + stmt + text.substr(tokens[t].end);
+            }
+        }
+        return "";
+    }
+    case INSERT_EXPR: {
+        // In place of an operand
+        for (size_t k = 0; k < tokens.size(); ++k, t = (t + 1) % tokens.size()) {
+            if (tokens[t].kind != PUNCT) {
+                std::string expr;
+                derive("<expr>", rng, depth, expr);
+                return replaceTokens(text, tokens, t, t, "(" + expr + ")");
+            }
+        }
+        return "";
+    }
+    case DUPLICATE_REGION:
+    case DELETE_REGION: {
+        // A bracketed region, so that the result still nests
+        for (size_t k = 0; k < tokens.size(); ++k, t = (t + 1) % tokens.size()) {
+            size_t close = matching(text, tokens, t);
+            if (close == tokens.size()) continue;
+            std::string region = text.substr(tokens[t].begin, tokens[close].end - tokens[t].begin);
+            if (mutation == DELETE_REGION) {
+                return replaceTokens(text, tokens, t, close, "");
+            }
+            return text.substr(0, tokens[close].end) + " " + region + text.substr(tokens[close].end);
+        }
+        return replaceTokens(text, tokens, t, t, "");
+    }
+    case WRAP_BLOCK: {
+        // Nest a block one level deeper in a loop or a branch
+        for (size_t k = 0; k < tokens.size(); ++k, t = (t + 1) % tokens.size()) {
+            if (!isPunct(text, tokens[t], "{")) continue;
+            std::string cond;
+            derive("<cond>", rng, 2, cond);
+            return text.substr(0, tokens[t].begin) + (rng() % 2 ? "while (" : "if (") + cond + ") " +
+                   text.substr(tokens[t].begin);
+        }
+        return "";
+    }
+    default:
+        return generateProgram(rng, depth + 4);
+    }
+}
+
+extern "C" size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size, size_t maxSize, unsigned int seed) {
+    std::mt19937 rng(seed);
+
+    // Some byte-level mutations, which find what the grammar does not cover
+    if (LLVMFuzzerMutate && rng() % 8 == 0) {
+        return LLVMFuzzerMutate(data, size, maxSize);
+    }
+
+    std::string text(reinterpret_cast<const char *>(data), size);
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        std::string result = mutate(text, rng);
+        if (!result.empty() && result.size() <= maxSize) {
+            memcpy(data, result.data(), result.size());
+            return result.size();
+        }
+    }
+    return LLVMFuzzerMutate ? LLVMFuzzerMutate(data, size, maxSize) : size;
+}
+
+// Scaling
+
+std::string pumpProgram(const std::string &text, int copies) {
+    std::vector<Token> tokens = tokenize(text);
+
+    // The outermost body is the last block at depth 0
+    size_t open = tokens.size();
+    size_t close = tokens.size();
+    size_t candidate = tokens.size();
+    int depth = 0;
+    for (size_t t = 0; t < tokens.size(); ++t) {
+        if (isPunct(text, tokens[t], "{")) {
+            if (depth++ == 0) candidate = t;
+        } else if (isPunct(text, tokens[t], "}")) {
+            if (--depth < 0) return "";
+            if (depth == 0) {
+                open = candidate;
+                close = t;
+            }
+        }
+    }
+    if (close == tokens.size()) {
+        return "";
+    }
+
+    std::string body = text.substr(tokens[open].end, tokens[close].begin - tokens[open].end);
+    std::string result = text.substr(0, tokens[open].end);
+    for (int i = 0; i < copies; ++i) {
+        result += body + "\n";
+    }
+    return result + text.substr(tokens[close].begin);
+}
+
+// Exponent k of cost = a + b * copies^k from the costs at 2, 4 and 8 copies,
+// or 0 when the cost does not grow
+static double growthExponent(double cost2, double cost4, double cost8) {
+    if (cost4 <= cost2 || cost8 <= cost4) {
+        return 0;
+    }
+    return std::log2((cost8 - cost4) / (cost4 - cost2));
+}
+
+Scaling measureScaling(const std::string &text) {
+    Scaling scaling = {false, 0, 0, false, false};
+    CompileCost costs[3];
+    int copies[3] = {2, 4, 8};
+    for (int i = 0; i < 3; ++i) {
+        std::string pumped = pumpProgram(text, copies[i]);
+        if (pumped.empty()) {
+            return scaling;
+        }
+        costs[i] = compileInput(reinterpret_cast<const uint8_t *>(pumped.data()), pumped.size());
+    }
+
+    scaling.valid = true;
+    scaling.time = growthExponent(costs[0].seconds, costs[1].seconds, costs[2].seconds);
+    scaling.memory = growthExponent(costs[0].allocatedBytes, costs[1].allocatedBytes, costs[2].allocatedBytes);
+    scaling.timeSignificant = costs[2].seconds >= MIN_FIT_SECONDS;
+    scaling.memorySignificant = costs[2].allocatedBytes >= costs[1].allocatedBytes + MIN_FIT_BYTES;
+    return scaling;
+}
+
+// Entry points of libFuzzer
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    if (const char *value = getenv("ALAN_FUZZ_SECONDS_PER_BYTE")) {
+        secondsPerByte = atof(value);
+    }
+    if (const char *value = getenv("ALAN_FUZZ_ALLOCATED_PER_BYTE")) {
+        allocatedPerByte = atof(value);
+    }
+
+    // The code generation prints every module to stdout
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    CompileCost cost = compileInput(data, size);
+
+    double budgetSize = std::max(size, MIN_BUDGET_SIZE);
+    double secondsBudget = secondsPerByte * budgetSize;
+    double allocatedBudget = allocatedPerByte * budgetSize;
+    if (cost.seconds > secondsBudget || cost.allocatedBytes > allocatedBudget) {
+        fprintf(stderr, "==alan-fuzz== %zu bytes took %.3f s and allocated %zu bytes, over the budget of %.3f s and %.0f bytes\n",
+                size, cost.seconds, cost.allocatedBytes, secondsBudget, allocatedBudget);
+        abort();
+    }
+
+    if (cost.seconds > SUSPICIOUS * secondsBudget || cost.allocatedBytes > SUSPICIOUS * allocatedBudget) {
+        Scaling scaling = measureScaling(std::string(reinterpret_cast<const char *>(data), size));
+        if ((scaling.timeSignificant && scaling.time > SUPERLINEAR) ||
+            (scaling.memorySignificant && scaling.memory > SUPERLINEAR)) {
+            fprintf(stderr, "==alan-fuzz== %zu bytes: repeating the outermost body grows the time with exponent %.2f and the memory with %.2f\n",
+                    size, scaling.time, scaling.memory);
+            abort();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef __FUZZ_HPP__
+#define __FUZZ_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+// Cost of compiling one input in-process: the wall time and the bytes
+// requested from operator new
+struct CompileCost {
+    double seconds;
+    size_t allocatedBytes;
+};
+
+// Exponents k of cost ~ copies^k, fitted over copies of the outermost body
+// of an input; an exponent is only significant if its cost grew enough
+struct Scaling {
+    bool valid;
+    double time;
+    double memory;
+    bool timeSignificant;
+    bool memorySignificant;
+};
+
+CompileCost compileInput(const uint8_t *data, size_t size);
+
+// A random derivation of the grammar of parser.y
+std::string generateProgram(std::mt19937 &rng, int depth);
+
+// The program with the statements of its outermost body repeated, or an
+// empty string when it has no outermost body
+std::string pumpProgram(const std::string &text, int copies);
+Scaling measureScaling(const std::string &text);
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv);
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+extern "C" size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size, size_t maxSize, unsigned int seed);
+
+#endif // __FUZZ_HPP__
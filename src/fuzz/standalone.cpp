@@ -0,0 +1,119 @@
+// Driver of the fuzz target for builds without libFuzzer. It compiles every
+// file once (to reproduce a crash), prints how the cost of every file scales
+// with its size (-scaling), or mutates the files, or generated programs when
+// there are none, at random without coverage feedback (-runs=N).
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "fuzz.hpp"
+
+// The input being compiled, so that it survives a crash
+static const char *LAST_INPUT = "fuzz-last-input.alan";
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-runs=N] [-seed=S] [-max_len=L] [-scaling] [file...]\n", program);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    long runs = 0;
+    unsigned int seed = 1;
+    size_t maxLen = 4096;
+    bool scaling = false;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "-runs=", 6) == 0) {
+            runs = atol(argv[i] + 6);
+        }
+        else if (strncmp(argv[i], "-seed=", 6) == 0) {
+            seed = strtoul(argv[i] + 6, nullptr, 10);
+        }
+        else if (strncmp(argv[i], "-max_len=", 9) == 0) {
+            maxLen = strtoul(argv[i] + 9, nullptr, 10);
+        }
+        else if (strcmp(argv[i], "-scaling") == 0) {
+            scaling = true;
+        }
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        }
+        else {
+            files.push_back(argv[i]);
+        }
+    }
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    std::vector<std::string> corpus;
+    for (const std::string &file : files) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) {
+            fprintf(stderr, "Cannot read %s\n", file.c_str());
+            return 1;
+        }
+        std::stringstream text;
+        text << in.rdbuf();
+        corpus.push_back(text.str());
+    }
+
+    if (scaling) {
+        for (size_t i = 0; i < corpus.size(); ++i) {
+            Scaling s = measureScaling(corpus[i]);
+            if (s.valid) {
+                fprintf(stderr, "%s: time exponent %.2f%s, memory exponent %.2f%s\n", files[i].c_str(),
+                        s.time, s.timeSignificant ? "" : " (too fast to fit)",
+                        s.memory, s.memorySignificant ? "" : " (too little to fit)");
+            } else {
+                fprintf(stderr, "%s: has no outermost body to repeat\n", files[i].c_str());
+            }
+        }
+        return 0;
+    }
+
+    if (runs == 0) {
+        for (size_t i = 0; i < corpus.size(); ++i) {
+            CompileCost cost = compileInput(reinterpret_cast<const uint8_t *>(corpus[i].data()), corpus[i].size());
+            fprintf(stderr, "%s: %.3f s, %zu bytes allocated\n", files[i].c_str(), cost.seconds, cost.allocatedBytes);
+            LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(corpus[i].data()), corpus[i].size());
+        }
+        return 0;
+    }
+
+    std::mt19937 rng(seed);
+    if (corpus.empty()) {
+        for (int i = 0; i < 16; ++i) {
+            corpus.push_back(generateProgram(rng, 8));
+        }
+    }
+
+    std::vector<uint8_t> data(maxLen);
+    for (long run = 1; run <= runs; ++run) {
+        const std::string &base = corpus[rng() % corpus.size()];
+        size_t size = std::min(base.size(), maxLen);
+        std::copy(base.begin(), base.begin() + size, data.begin());
+        size = LLVMFuzzerCustomMutator(data.data(), size, maxLen, rng());
+
+        std::ofstream(LAST_INPUT, std::ios::binary).write(reinterpret_cast<const char *>(data.data()), size);
+        LLVMFuzzerTestOneInput(data.data(), size);
+
+        // Keep some of the mutants, so that mutations accumulate
+        std::string mutant(data.begin(), data.begin() + size);
+        if (corpus.size() < 1000) {
+            corpus.push_back(mutant);
+        } else if (rng() % 10 == 0) {
+            corpus[rng() % corpus.size()] = mutant;
+        }
+
+        if (run % 1000 == 0 || run == runs) {
+            fprintf(stderr, "#%ld corpus %zu\n", run, corpus.size());
+        }
+    }
+    remove(LAST_INPUT);
+    return 0;
+}
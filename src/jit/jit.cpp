@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include <unordered_map>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include "jit.hpp"
+#include "runtime.hpp"
+#include "../ast/ast.hpp"
+
+// Resolves the calls of the program to the runtime library before the
+// symbols of the process, where strlen and friends are the C library's
+class RuntimeMemoryManager : public llvm::SectionMemoryManager
+{
+public:
+    uint64_t getSymbolAddress(const std::string &name) override
+    {
+        static const std::unordered_map<std::string, void*> runtime = {
+            {"writeInteger", (void*)writeInteger},
+            {"writeByte", (void*)writeByte},
+            {"writeChar", (void*)writeChar},
+            {"writeString", (void*)writeString},
+            {"readInteger", (void*)readInteger},
+            {"readByte", (void*)readByte},
+            {"readChar", (void*)readChar},
+            {"readString", (void*)readString},
+            {"extend", (void*)extend},
+            {"shrink", (void*)shrink},
+            {"strlen", (void*)__alan_strlen},
+            {"strcmp", (void*)__alan_strcmp},
+            {"strcpy", (void*)__alan_strcpy},
+            {"strcat", (void*)__alan_strcat},
+            {"__alan_runtime_error", (void*)__alan_runtime_error},
+            {"__alan_profile_enter", (void*)__alan_profile_enter},
+            {"__alan_profile_exit", (void*)__alan_profile_exit},
+            {"__alan_coverage_init", (void*)__alan_coverage_init},
+            {"__alan_loop_profile_init", (void*)__alan_loop_profile_init},
+        };
+
+        auto it = runtime.find(name);
+        if (it != runtime.end())
+        {
+            return (uint64_t)it->second;
+        }
+        return llvm::SectionMemoryManager::getSymbolAddress(name);
+    }
+};
+
+// Writes the functions of every loaded object to /tmp/perf-<pid>.map, the
+// file perf reads to name the code of JITs. Unlike the PerfJITEventListener
+// (a jitdump for `perf inject --jit`) it works with `perf top` directly.
+class PerfMapListener : public llvm::JITEventListener
+{
+    FILE *map;
+
+public:
+    PerfMapListener()
+    {
+        std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+        map = fopen(path.c_str(), "w");
+        if (!map)
+        {
+            fprintf(stderr, "Warning: cannot write %s\n", path.c_str());
+        }
+    }
+
+    ~PerfMapListener()
+    {
+        if (map)
+        {
+            fclose(map);
+        }
+    }
+
+    void notifyObjectLoaded(ObjectKey key, const llvm::object::ObjectFile &object,
+                            const llvm::RuntimeDyld::LoadedObjectInfo &info) override
+    {
+        if (!map)
+        {
+            return;
+        }
+
+        // The debug object has the sections at the addresses they were loaded to
+        llvm::object::OwningBinary<llvm::object::ObjectFile> loaded = info.getObjectForDebug(object);
+        if (!loaded.getBinary())
+        {
+            return;
+        }
+
+        for (const std::pair<llvm::object::SymbolRef, uint64_t> &symbol : llvm::object::computeSymbolSizes(*loaded.getBinary()))
+        {
+            llvm::Expected<llvm::object::SymbolRef::Type> type = symbol.first.getType();
+            llvm::Expected<llvm::StringRef> name = symbol.first.getName();
+            llvm::Expected<uint64_t> address = symbol.first.getAddress();
+            if (!type || !name || !address)
+            {
+                llvm::consumeError(type.takeError());
+                llvm::consumeError(name.takeError());
+                llvm::consumeError(address.takeError());
+                continue;
+            }
+            if (*type != llvm::object::SymbolRef::ST_Function || symbol.second == 0)
+            {
+                continue;
+            }
+            fprintf(map, "%llx %llx %s\n", (unsigned long long)*address, (unsigned long long)symbol.second,
+                    name->str().c_str());
+        }
+        fflush(map);
+    }
+};
+
+// The object files of -fjit-cache, one per program, named by the SHA-1 of
+// the IR of the module, the host CPU, the code generation level and the
+// version of LLVM. A file is written under a name of its own and renamed
+// into place, so processes compiling the same program at once never see a
+// partial object; the cache only saves time, so its errors are ignored
+class DiskObjectCache : public llvm::ObjectCache
+{
+    std::string dir;
+    std::string cpu;
+    bool optimize;
+    std::unordered_map<const llvm::Module*, std::string> paths;
+
+    // The IR is hashed before code generation changes the module
+    const std::string &pathOf(const llvm::Module *module)
+    {
+        auto it = paths.find(module);
+        if (it != paths.end())
+        {
+            return it->second;
+        }
+
+        std::string key;
+        llvm::raw_string_ostream out(key);
+        out << LLVM_VERSION_STRING << "\n" << cpu << "\n" << optimize << "\n";
+        module->print(out, nullptr);
+        out.flush();
+        std::array<uint8_t, 20> hash = llvm::SHA1::hash(llvm::arrayRefFromStringRef(key));
+        return paths[module] = dir + "/" + llvm::toHex(hash, true) + ".o";
+    }
+
+public:
+    DiskObjectCache(const std::string &dir, bool optimize)
+        : dir(dir), cpu(llvm::sys::getHostCPUName().str()), optimize(optimize)
+    {
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *module) override
+    {
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer = llvm::MemoryBuffer::getFile(pathOf(module));
+        if (!buffer)
+        {
+            return nullptr;
+        }
+
+        // A damaged file is compiled again, and replaced
+        llvm::Expected<std::unique_ptr<llvm::object::ObjectFile>> object =
+            llvm::object::ObjectFile::createObjectFile((*buffer)->getMemBufferRef());
+        if (!object)
+        {
+            llvm::consumeError(object.takeError());
+            return nullptr;
+        }
+        return std::move(*buffer);
+    }
+
+    void notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object) override
+    {
+        const std::string &path = pathOf(module);
+        if (llvm::sys::fs::create_directories(dir))
+        {
+            return;
+        }
+
+        int fd;
+        llvm::SmallString<128> temp;
+        if (llvm::sys::fs::createUniqueFile(path + ".%%%%%%.tmp", fd, temp))
+        {
+            return;
+        }
+        {
+            llvm::raw_fd_ostream out(fd, true);
+            out << object.getBuffer();
+            out.close();
+            if (out.has_error())
+            {
+                out.clear_error();
+                llvm::sys::fs::remove(temp);
+                return;
+            }
+        }
+        if (llvm::sys::fs::rename(temp, path))
+        {
+            llvm::sys::fs::remove(temp);
+        }
+    }
+};
+
+// $XDG_CACHE_HOME/alan/jit, ~/.cache/alan/jit, or under the temporary
+// directory for a user without a home
+static std::string defaultCacheDir()
+{
+    llvm::SmallString<128> dir;
+    if (const char *xdg = getenv("XDG_CACHE_HOME"))
+    {
+        dir = xdg;
+    }
+    else if (llvm::sys::path::home_directory(dir))
+    {
+        llvm::sys::path::append(dir, ".cache");
+    }
+    else
+    {
+        llvm::sys::path::system_temp_directory(true, dir);
+    }
+    llvm::sys::path::append(dir, "alan", "jit");
+    return dir.str().str();
+}
+
+llvm::ExecutionEngine *buildJIT(std::unique_ptr<llvm::Module> module, bool optimize)
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+
+    std::string error;
+    llvm::ExecutionEngine *engine = llvm::EngineBuilder(std::move(module))
+        .setEngineKind(llvm::EngineKind::JIT)
+        .setErrorStr(&error)
+        .setMCJITMemoryManager(std::make_unique<RuntimeMemoryManager>())
+        .setOptLevel(optimize ? llvm::CodeGenOpt::Default : llvm::CodeGenOpt::None)
+        .create();
+    if (!engine)
+    {
+        fprintf(stderr, "Error: cannot create the JIT: %s\n", error.c_str());
+        return nullptr;
+    }
+
+    if (jitCache)
+    {
+        engine->setObjectCache(new DiskObjectCache(jitCacheDir.empty() ? defaultCacheDir() : jitCacheDir, optimize));
+    }
+
+    // The jitdump of the perf listener is only written with -fperf-map; it is
+    // null when LLVM was built without perf support. Like the engine, the
+    // listeners live as long as the code
+    engine->RegisterJITEventListener(llvm::JITEventListener::createGDBRegistrationListener());
+    if (perfMap)
+    {
+        engine->RegisterJITEventListener(new PerfMapListener());
+        if (llvm::JITEventListener *perf = llvm::JITEventListener::createPerfJITEventListener())
+        {
+            engine->RegisterJITEventListener(perf);
+        }
+    }
+
+    engine->finalizeObject();
+    if (engine->hasError())
+    {
+        fprintf(stderr, "Error: %s\n", engine->getErrorMessage().c_str());
+        return nullptr;
+    }
+    return engine;
+}
+
+int runJIT(std::unique_ptr<llvm::Module> module, bool optimize)
+{
+    tracePhase("jit");
+    llvm::ExecutionEngine *engine = buildJIT(std::move(module), optimize);
+    if (!engine)
+    {
+        return 1;
+    }
+    auto programMain = (int (*)())engine->getFunctionAddress("main");
+    if (!programMain)
+    {
+        fprintf(stderr, "Error: the program has no main function\n");
+        return 1;
+    }
+    timePhase("jit");
+
+    // The engine is not deleted: the reports of -fprofile-functions and
+    // -fcoverage are written at exit, from data in the JIT'd module
+    tracePhase("run");
+    int status = programMain();
+    fflush(stdout);
+    timePhase("run");
+    return status;
+}
+
+// Compiles the program when the VM first finds a function hot, and finds
+// the entries genTierEntries made for the functions
+class TierCompiler : public VmCompiler
+{
+    AST *program;
+    llvm::ExecutionEngine *engine;
+
+public:
+    TierCompiler(AST *program) : program(program), engine(nullptr) {}
+
+    void compile() override
+    {
+        engine = program->tier_gen();
+    }
+
+    VmNative entry(const std::string &name) override
+    {
+        return engine ? (VmNative)engine->getFunctionAddress("__tier_" + name) : nullptr;
+    }
+};
+
+VmCompiler *tierCompiler(AST *program)
+{
+    return new TierCompiler(program);
+}
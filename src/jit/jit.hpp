@@ -0,0 +1,32 @@
+#ifndef __JIT_HPP__
+#define __JIT_HPP__
+
+#include <memory>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/Module.h>
+#include "../vm/vm.hpp"
+
+class AST;
+
+// Write /tmp/perf-<pid>.map and a perf jitdump for the JIT'd program (-fperf-map)
+extern bool perfMap;
+// Keep the machine code of the JIT'd programs in a directory, to be loaded
+// again by later runs of the same program (-fjit-cache[=<dir>]). An empty
+// directory is the default one of the user
+extern bool jitCache;
+extern std::string jitCacheDir;
+
+// Compiles the module to machine code in memory and runs its main, with the
+// runtime library of lib/lib.c linked into the compiler. Returns the exit
+// status of the program. The perf and GDB JIT interfaces are told about the
+// generated code, so perf and gdb can name the Alan functions.
+int runJIT(std::unique_ptr<llvm::Module> module, bool optimize);
+
+// Compiles the module to machine code in memory like runJIT, or loads the
+// code from the cache of -fjit-cache, without running it. Returns the engine holding the code, or null after reporting an error.
+llvm::ExecutionEngine *buildJIT(std::unique_ptr<llvm::Module> module, bool optimize);
+
+// The native tier of --tiered for the checked program
+VmCompiler *tierCompiler(AST *program);
+
+#endif
@@ -0,0 +1,14 @@
+/* The runtime library, compiled into the compiler for programs run by --jit
+   and --interp. The string functions of Alan are renamed so that they do not
+   take the place of the C library's in the compiler; jit.cpp maps the Alan
+   names back. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define strlen __alan_strlen
+#define strcmp __alan_strcmp
+#define strcpy __alan_strcpy
+#define strcat __alan_strcat
+
+#include "../../lib/lib.c"
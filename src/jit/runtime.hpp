@@ -0,0 +1,29 @@
+#ifndef __RUNTIME_HPP__
+#define __RUNTIME_HPP__
+
+// The runtime library, compiled into the compiler from runtime.c for the
+// programs run by --jit and --interp
+extern "C" {
+    void writeInteger(int n);
+    void writeByte(char c);
+    void writeChar(char c);
+    void writeString(char *s);
+    int readInteger();
+    char readByte();
+    char readChar();
+    void readString(int n, char *s);
+    int extend(char b);
+    char shrink(int i);
+    int __alan_strlen(char *s);
+    int __alan_strcmp(char *s1, char *s2);
+    void __alan_strcpy(char *trg, char *src);
+    void __alan_strcat(char *trg, char *src);
+    void __alan_runtime_error(int error, int line, int column);
+    void __alan_profile_enter(int function, const char *name);
+    void __alan_profile_exit(void);
+    void __alan_coverage_init(int functions, const int *graph, const int *positions, const long long *counters,
+                              const char *source);
+    void __alan_loop_profile_init(int sites, const int *descriptions, long long *const *counts);
+}
+
+#endif
@@ -6,6 +6,16 @@
 int yylex();
 void yyerror(const char *s);
 void semantic_error(int line, int column, const std::string &msg);
+// Forgets the errors and symbols of the previous program, so that one
+// process can compile several (the fuzz target does)
+void resetFrontend();
+// Buffer interface of the scanner generated by flex, to scan a program held
+// in memory
+struct yy_buffer_state;
+typedef yy_buffer_state *YY_BUFFER_STATE;
+YY_BUFFER_STATE yy_scan_string(const char *str);
+YY_BUFFER_STATE yy_scan_bytes(const char *bytes, int length);
+void yy_delete_buffer(YY_BUFFER_STATE buffer);
 unsigned char fixChar(char *c);
 unsigned char fixHex(char *s);
 unsigned char findChar(char *c);
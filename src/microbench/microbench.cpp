@@ -0,0 +1,316 @@
+// Microbenchmarks of the data structures on the hot paths of the compiler:
+// the symbol table, the scopes of the code generator, type translation and
+// the scanner. Every case runs at several scales and is reported in
+// nanoseconds per operation, the best of a few repetitions that each last
+// at least the minimum time.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../ast/ast.hpp"
+#include "../parser/parser.hpp"
+#include "../lexer/lexer.hpp"
+#include "../codegen/codegen.hpp"
+#include "../symbol/symbol_table.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static double minTime = 0.05;
+static int repetitions = 5;
+static const char *filter = nullptr;
+
+// Results are folded into this, so the measured calls are not optimized away
+static volatile uintptr_t sink;
+
+static void consume(const void *p) {
+    sink = sink ^ reinterpret_cast<uintptr_t>(p);
+}
+
+// Fake, never dereferenced LLVM objects for the code generation scopes
+template <typename T>
+static T *fake(size_t i) {
+    return reinterpret_cast<T *>(static_cast<uintptr_t>(16 * (i + 1)));
+}
+
+static std::vector<std::string> names(size_t n, const char *prefix) {
+    std::vector<std::string> result;
+    for (size_t i = 0; i < n; ++i) {
+        result.push_back(prefix + std::to_string(i));
+    }
+    return result;
+}
+
+static bool selected(const char *name) {
+    return filter == nullptr || strstr(name, filter) != nullptr;
+}
+
+static void report(const char *name, const std::string &scale, double ns, const std::string &note = "") {
+    printf("%-40s %14s %12.2f  %s\n", name, scale.c_str(), ns, note.c_str());
+    fflush(stdout);
+}
+
+// Runs setup, body and teardown until the bodies took minTime, and returns
+// the best time of the body per operation over the repetitions
+template <typename Setup, typename Body, typename Teardown>
+static double measure(long ops, Setup setup, Body body, Teardown teardown) {
+    double best = 1e300;
+    for (int r = 0; r < repetitions; ++r) {
+        double elapsed = 0;
+        long iterations = 0;
+        while (elapsed < minTime) {
+            setup();
+            auto start = Clock::now();
+            body();
+            elapsed += std::chrono::duration<double>(Clock::now() - start).count();
+            teardown();
+            ++iterations;
+        }
+        best = std::min(best, elapsed * 1e9 / (static_cast<double>(iterations) * ops));
+    }
+    return best;
+}
+
+template <typename Body>
+static double measure(long ops, Body body) {
+    return measure(ops, [] {}, body, [] {});
+}
+
+// Symbols declared in one scope, as in a function with many locals
+static void benchAddSymbol() {
+    const char *name = "SymbolTable::addSymbol";
+    if (!selected(name)) return;
+    for (size_t n : {100, 1000, 10000}) {
+        SymbolTable table;
+        std::vector<std::string> ids = names(n, "v");
+        std::vector<Symbol *> symbols;
+        double ns = measure(n,
+            [&] {
+                table.enterScope();
+                symbols.clear();
+                for (size_t i = 0; i < n; ++i) {
+                    symbols.push_back(new VariableSymbol(ids[i], typeInteger));
+                }
+            },
+            [&] {
+                for (size_t i = 0; i < n; ++i) {
+                    table.addSymbol(ids[i], symbols[i]);
+                }
+            },
+            [&] { table.exitScope(); });
+        report(name, std::to_string(n) + " symbols", ns);
+    }
+}
+
+// Lookups of the symbols of one scope
+static void benchFindSymbol() {
+    const char *name = "SymbolTable::findSymbol";
+    if (!selected(name)) return;
+    for (size_t n : {100, 1000, 10000}) {
+        SymbolTable table;
+        std::vector<std::string> ids = names(n, "v");
+        table.enterScope();
+        for (size_t i = 0; i < n; ++i) {
+            table.addSymbol(ids[i], new VariableSymbol(ids[i], typeInteger));
+        }
+        double ns = measure(n, [&] {
+            for (size_t i = 0; i < n; ++i) {
+                consume(table.findSymbol(ids[i]));
+            }
+        });
+        table.exitScope();
+        report(name, std::to_string(n) + " symbols", ns);
+    }
+}
+
+// Lookups of a variable of the outermost function from nested functions,
+// which record the capture in every function in between
+static void benchFindCaptured() {
+    const char *name = "SymbolTable::findSymbol (captured)";
+    if (!selected(name)) return;
+    const long lookups = 1000;
+    for (int depth : {1, 8, 64}) {
+        SymbolTable table;
+        std::vector<FunctionSymbol *> functions;
+        table.addSymbol("x", new VariableSymbol("x", typeInteger));
+        for (int i = 0; i < depth; ++i) {
+            functions.push_back(new FunctionSymbol("f" + std::to_string(i), typeVoid));
+            table.enterFunctionScope(functions.back());
+        }
+        double ns = measure(lookups, [&] {
+            for (long i = 0; i < lookups; ++i) {
+                consume(table.findSymbol("x"));
+            }
+        });
+        for (FunctionSymbol *f : functions) {
+            table.exitFunctionScope();
+            delete f;
+        }
+        report(name, "depth " + std::to_string(depth), ns);
+    }
+}
+
+// Blocks that declare a few symbols each, as in a function with nested blocks
+static void benchScopes() {
+    const char *name = "SymbolTable::enterScope+exitScope";
+    if (!selected(name)) return;
+    const long scopes = 1000;
+    for (size_t n : {0, 8, 64}) {
+        SymbolTable table;
+        std::vector<std::string> ids = names(n, "v");
+        double ns = measure(scopes, [&] {
+            for (long s = 0; s < scopes; ++s) {
+                table.enterScope();
+                for (size_t i = 0; i < n; ++i) {
+                    table.addSymbol(ids[i], new VariableSymbol(ids[i], typeInteger));
+                }
+                table.exitScope();
+            }
+        });
+        report(name, std::to_string(n) + " symbols", ns);
+    }
+}
+
+// Calls of a function of the outermost scope from nested scopes
+static void benchGetFunction() {
+    const char *name = "GenScope::getFunction";
+    if (!selected(name)) return;
+    const long lookups = 1000;
+    const size_t perScope = 16;
+    for (int depth : {1, 8, 64}) {
+        GenScope scope;
+        for (int d = 0; d < depth; ++d) {
+            scope.openScope();
+            std::vector<std::string> ids = names(perScope, ("f" + std::to_string(d) + "_").c_str());
+            for (size_t i = 0; i < perScope; ++i) {
+                scope.addFunction(ids[i], fake<llvm::Function>(d * perScope + i));
+            }
+        }
+        double ns = measure(lookups, [&] {
+            for (long i = 0; i < lookups; ++i) {
+                consume(scope.getFunction("f0_0"));
+            }
+        });
+        report(name, "depth " + std::to_string(depth), ns);
+    }
+}
+
+// Lookups of the local variables of a function
+static void benchGetAlloca() {
+    const char *name = "GenBlock::getAlloca";
+    if (!selected(name)) return;
+    for (size_t n : {10, 100, 1000}) {
+        // The destructor deletes the allocas, so the block is never destroyed
+        GenBlock *block = new GenBlock();
+        std::vector<std::string> ids = names(n, "v");
+        for (size_t i = 0; i < n; ++i) {
+            block->addAlloca(ids[i], fake<llvm::AllocaInst>(i));
+        }
+        double ns = measure(n, [&] {
+            for (size_t i = 0; i < n; ++i) {
+                consume(block->getAlloca(ids[i]));
+            }
+        });
+        report(name, std::to_string(n) + " locals", ns);
+    }
+}
+
+static void benchTranslateType() {
+    const char *name = "translateType";
+    if (!selected(name)) return;
+    const long calls = 1000;
+    struct { const char *label; Type *type; ParameterType pt; } cases[] = {
+        {"int", typeInteger, ParameterType::VALUE},
+        {"byte", typeByte, ParameterType::VALUE},
+        {"int[]", new ArrayType(typeInteger, 10), ParameterType::VALUE},
+        {"ref byte[]", new ArrayType(typeByte), ParameterType::REFERENCE},
+    };
+    for (auto &c : cases) {
+        double ns = measure(calls, [&] {
+            for (long i = 0; i < calls; ++i) {
+                consume(translateType(c.type, c.pt));
+            }
+        });
+        report(name, c.label, ns);
+    }
+}
+
+// Source text of about the given number of tokens, mixing the token kinds
+// of ordinary programs
+static std::string tokenStream(long tokens) {
+    static const char *line =
+        "    counter_1 : int; buffer : byte[256]; -- locals\n"
+        "    while (counter_1 <= 1000) { buffer[counter_1 % 256] = 'x'; counter_1 = counter_1 + 17; }\n"
+        "    if (strcmp(buffer, \"hello\\n\") != 0 & total >= 42) writeString(\"done\\x21\\n\");\n"
+        "    (* a comment *) result = (left * 3 - right / 2) % 7;\n";
+    std::string text;
+    long count = 0;
+    while (count < tokens) {
+        text += line;
+        count += 68;
+    }
+    return text;
+}
+
+static long scanAll(const std::string &text) {
+    long tokens = 0;
+    YY_BUFFER_STATE buffer = yy_scan_string(text.c_str());
+    int token;
+    while ((token = yylex()) != 0) {
+        if (token == T_id) {
+            delete yylval.var;
+        } else if (token == T_string) {
+            delete yylval.str;
+        }
+        ++tokens;
+    }
+    yy_delete_buffer(buffer);
+    return tokens;
+}
+
+static void benchScanner() {
+    const char *name = "yylex";
+    if (!selected(name)) return;
+    for (long size : {1000, 10000, 100000}) {
+        std::string text = tokenStream(size);
+        long tokens = scanAll(text);
+        double ns = measure(tokens, [&] { sink = sink + scanAll(text); });
+        char note[64];
+        snprintf(note, sizeof(note), "%.1f MB/s", text.size() / (ns * tokens / 1e9) / 1e6);
+        report(name, std::to_string(tokens) + " tokens", ns, note);
+    }
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            minTime = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+        }
+        else if (argv[i][0] != '-') {
+            filter = argv[i];
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-t min-seconds] [-r repetitions] [case-filter]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%-40s %14s %12s\n", "case", "scale", "ns/op");
+    benchAddSymbol();
+    benchFindSymbol();
+    benchFindCaptured();
+    benchScopes();
+    benchGetFunction();
+    benchGetAlloca();
+    benchTranslateType();
+    benchScanner();
+    return 0;
+}
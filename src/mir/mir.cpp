@@ -0,0 +1,512 @@
+#include "mir.hpp"
+#include <algorithm>
+#include <sstream>
+
+std::string mirTypeToString(MirType t)
+{
+    switch (t)
+    {
+    case MirType::VOID:   return "void";
+    case MirType::I1:     return "i1";
+    case MirType::I8:     return "i8";
+    case MirType::I32:    return "i32";
+    case MirType::PTR:    return "ptr";
+    case MirType::HANDLE: return "handle";
+    default:              return "unknown";
+    }
+}
+
+std::string mirOpToString(MirOp op)
+{
+    switch (op)
+    {
+    case MirOp::ADD:         return "add";
+    case MirOp::SUB:         return "sub";
+    case MirOp::MUL:         return "mul";
+    case MirOp::DIV:         return "div";
+    case MirOp::MOD:         return "mod";
+    case MirOp::NEG:         return "neg";
+    case MirOp::LT:          return "lt";
+    case MirOp::GT:          return "gt";
+    case MirOp::LE:          return "le";
+    case MirOp::GE:          return "ge";
+    case MirOp::EQ:          return "eq";
+    case MirOp::NE:          return "ne";
+    case MirOp::PHI:         return "phi";
+    case MirOp::SLOT:        return "slot";
+    case MirOp::ENV:         return "env";
+    case MirOp::LOAD:        return "load";
+    case MirOp::STORE:       return "store";
+    case MirOp::INDEX:       return "index";
+    case MirOp::CALL:        return "call";
+    case MirOp::YIELD:       return "yield";
+    case MirOp::GEN_DONE:    return "gen.done";
+    case MirOp::GEN_VALUE:   return "gen.value";
+    case MirOp::GEN_RESUME:  return "gen.resume";
+    case MirOp::GEN_DESTROY: return "gen.destroy";
+    case MirOp::BR:          return "br";
+    case MirOp::CONDBR:      return "condbr";
+    case MirOp::RET:         return "ret";
+    case MirOp::UNREACHABLE: return "unreachable";
+    default:                 return "unknown";
+    }
+}
+
+MirType mirTypeOf(Type *t)
+{
+    switch (t->getType())
+    {
+    case TypeEnum::INT:       return MirType::I32;
+    case TypeEnum::BYTE:      return MirType::I8;
+    case TypeEnum::VOID:      return MirType::VOID;
+    case TypeEnum::GENERATOR: return MirType::HANDLE;
+    default:                  return MirType::PTR;
+    }
+}
+
+// MirVar Class Method Implementations
+
+MirVar::MirVar(const std::string &name, Type *type, MirFunction *owner, bool byReference, int id)
+    : name(name), type(type), owner(owner), byReference(byReference), address(nullptr), id(id) {}
+
+bool MirVar::isScalar() const
+{
+    return type->getType() == TypeEnum::INT || type->getType() == TypeEnum::BYTE;
+}
+
+// MirValue Class Method Implementations
+
+std::string MirValue::toString() const
+{
+    return "%" + (name.empty() ? std::to_string(id) : name);
+}
+
+std::string MirConst::toString() const
+{
+    return std::to_string(value);
+}
+
+std::string MirString::toString() const
+{
+    std::ostringstream out;
+    out << '"';
+    for (unsigned char c : value)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (c >= 32 && c < 127)
+            out << c;
+        else
+        {
+            const char *hex = "0123456789abcdef";
+            out << "\\x" << hex[c >> 4] << hex[c & 15];
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+std::string MirInstr::toString() const
+{
+    return "%" + std::to_string(id);
+}
+
+// MirInstr Class Method Implementations
+
+bool MirInstr::isTerminator() const
+{
+    return op == MirOp::BR || op == MirOp::CONDBR || op == MirOp::RET || op == MirOp::UNREACHABLE;
+}
+
+bool MirInstr::hasResult() const
+{
+    return type != MirType::VOID;
+}
+
+// MirBlock Class Method Implementations
+
+MirInstr *MirBlock::getTerminator() const
+{
+    if (instrs.empty() || !instrs.back()->isTerminator())
+        return nullptr;
+    return instrs.back();
+}
+
+std::vector<MirBlock *> MirBlock::successors() const
+{
+    MirInstr *term = getTerminator();
+    if (!term)
+        return {};
+    return term->blocks;
+}
+
+// MirFunction Class Method Implementations
+
+MirFunction::MirFunction(const std::string &n, MirType ret, MirFunction *p, const AST *o)
+    : name(n), returnType(ret), yieldType(MirType::VOID), isGenerator(false), isExternal(false),
+      parent(p), origin(o) {}
+
+MirBlock *MirFunction::entry() const
+{
+    return blocks.empty() ? nullptr : blocks.front();
+}
+
+void MirFunction::computePreds()
+{
+    for (MirBlock *b : blocks)
+        b->preds.clear();
+    for (MirBlock *b : blocks)
+        for (MirBlock *s : b->successors())
+            s->preds.push_back(b);
+}
+
+// Iterative dominator computation of Cooper, Harvey and Kennedy, on the
+// reverse postorder of the blocks
+void MirFunction::computeDominators()
+{
+    idom.clear();
+    if (blocks.empty())
+        return;
+
+    std::vector<MirBlock *> postorder;
+    std::unordered_set<MirBlock *> visited;
+    std::vector<std::pair<MirBlock *, size_t>> stack = {{entry(), 0}};
+    visited.insert(entry());
+    while (!stack.empty())
+    {
+        MirBlock *block = stack.back().first;
+        std::vector<MirBlock *> succs = block->successors();
+        if (stack.back().second < succs.size())
+        {
+            MirBlock *s = succs[stack.back().second++];
+            if (visited.insert(s).second)
+                stack.push_back({s, 0});
+        }
+        else
+        {
+            postorder.push_back(block);
+            stack.pop_back();
+        }
+    }
+
+    std::unordered_map<MirBlock *, int> order;
+    for (size_t i = 0; i < postorder.size(); ++i)
+        order[postorder[i]] = i;
+
+    auto intersect = [&](MirBlock *a, MirBlock *b) {
+        while (a != b)
+        {
+            while (order[a] < order[b])
+                a = idom[a];
+            while (order[b] < order[a])
+                b = idom[b];
+        }
+        return a;
+    };
+
+    idom[entry()] = entry();
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto it = postorder.rbegin(); it != postorder.rend(); ++it)
+        {
+            MirBlock *b = *it;
+            if (b == entry())
+                continue;
+            MirBlock *newIdom = nullptr;
+            for (MirBlock *p : b->preds)
+            {
+                if (!idom.count(p))
+                    continue;
+                newIdom = newIdom ? intersect(p, newIdom) : p;
+            }
+            if (newIdom && idom[b] != newIdom)
+            {
+                idom[b] = newIdom;
+                changed = true;
+            }
+        }
+    }
+
+    std::unordered_map<MirBlock *, std::vector<MirBlock *>> children;
+    for (auto &entry : idom)
+        if (entry.first != entry.second)
+            children[entry.second].push_back(entry.first);
+
+    domInterval.clear();
+    int counter = 0;
+    std::vector<std::pair<MirBlock *, size_t>> walk = {{entry(), 0}};
+    domInterval[entry()].first = counter++;
+    while (!walk.empty())
+    {
+        MirBlock *block = walk.back().first;
+        std::vector<MirBlock *> &kids = children[block];
+        if (walk.back().second < kids.size())
+        {
+            MirBlock *child = kids[walk.back().second++];
+            domInterval[child].first = counter++;
+            walk.push_back({child, 0});
+        }
+        else
+        {
+            domInterval[block].second = counter++;
+            walk.pop_back();
+        }
+    }
+}
+
+bool MirFunction::dominates(MirBlock *a, MirBlock *b) const
+{
+    auto ia = domInterval.find(a);
+    auto ib = domInterval.find(b);
+    if (ia == domInterval.end() || ib == domInterval.end())
+        return false;
+    return ia->second.first <= ib->second.first && ib->second.second <= ia->second.second;
+}
+
+void MirFunction::number()
+{
+    int next = 0;
+    for (MirBlock *b : blocks)
+    {
+        b->id = next++;
+    }
+    next = 0;
+    for (MirBlock *b : blocks)
+        for (MirInstr *i : b->instrs)
+            i->id = i->hasResult() ? next++ : -1;
+}
+
+void MirFunction::print(std::ostream &out) const
+{
+    out << (isExternal ? "declare " : "func ") << mirTypeToString(returnType);
+    if (isGenerator)
+        out << " gen " << mirTypeToString(yieldType);
+    out << " @" << name << "(";
+
+    bool first = true;
+    for (const MirCapture &c : captures)
+    {
+        out << (first ? "" : ", ") << (c.byValue ? "capture " : "capture ref ")
+            << mirTypeToString(c.arg->type) << " " << c.arg->toString();
+        first = false;
+    }
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        out << (first ? "" : ", ") << (paramByRef[i] ? "ref " : "") << mirTypeToString(params[i]->type)
+            << " " << params[i]->toString();
+        first = false;
+    }
+    out << ")";
+
+    if (isExternal)
+    {
+        out << "\n";
+        return;
+    }
+    out << " {\n";
+
+    for (MirBlock *b : blocks)
+    {
+        out << "b" << b->id << ":    ; " << b->name;
+        if (!b->preds.empty())
+        {
+            out << ", preds:";
+            for (MirBlock *p : b->preds)
+                out << " b" << p->id;
+        }
+        out << "\n";
+
+        for (MirInstr *i : b->instrs)
+        {
+            out << "  ";
+            if (i->hasResult())
+                out << i->toString() << " = ";
+            out << mirOpToString(i->op);
+            if (i->hasResult())
+                out << " " << mirTypeToString(i->type);
+
+            switch (i->op)
+            {
+            case MirOp::PHI:
+                for (size_t k = 0; k < i->operands.size(); ++k)
+                    out << (k ? ", [" : " [") << i->operands[k]->toString() << ", b" << i->blocks[k]->id << "]";
+                break;
+            case MirOp::SLOT:
+                out << " " << mirTypeToString(i->elemType) << " x " << i->operands[0]->toString();
+                if (i->var)
+                    out << "  ; " << i->var->name;
+                break;
+            case MirOp::ENV:
+                out << " " << i->var->name << "#" << i->var->id;
+                break;
+            case MirOp::INDEX:
+                out << " " << mirTypeToString(i->elemType) << " " << i->operands[0]->toString() << ", "
+                    << i->operands[1]->toString();
+                break;
+            case MirOp::CALL:
+                out << " @" << i->callee->name << "(";
+                for (size_t k = 0; k < i->operands.size(); ++k)
+                    out << (k ? ", " : "") << i->operands[k]->toString();
+                out << ")";
+                break;
+            case MirOp::BR:
+                out << " b" << i->blocks[0]->id;
+                break;
+            case MirOp::CONDBR:
+                out << " " << i->operands[0]->toString() << ", b" << i->blocks[0]->id << ", b" << i->blocks[1]->id;
+                break;
+            default:
+                for (size_t k = 0; k < i->operands.size(); ++k)
+                    out << (k ? ", " : " ") << i->operands[k]->toString();
+                break;
+            }
+            out << "\n";
+        }
+    }
+    out << "}\n";
+}
+
+// MirModule Class Method Implementations
+
+MirFunction *MirModule::addFunction(MirFunction *f)
+{
+    functions.push_back(f);
+    if (f->origin)
+        definitions[f->origin] = f;
+    return f;
+}
+
+MirFunction *MirModule::getExternal(const std::string &name) const
+{
+    for (MirFunction *f : functions)
+        if (f->isExternal && f->name == name)
+            return f;
+    return nullptr;
+}
+
+MirFunction *MirModule::functionOf(const AST *funcDef) const
+{
+    auto it = definitions.find(funcDef);
+    return it == definitions.end() ? nullptr : it->second;
+}
+
+const MirCallSite &MirModule::callSiteOf(const AST *funcCall) const
+{
+    return callSites.at(funcCall);
+}
+
+void MirModule::print(std::ostream &out) const
+{
+    bool first = true;
+    for (MirFunction *f : functions)
+    {
+        if (!f->isExternal && !first)
+            out << "\n";
+        f->number();
+        f->print(out);
+        first = false;
+    }
+}
+
+// MirBuilder Class Method Implementations
+
+void MirBuilder::setFunction(MirFunction *f)
+{
+    func = f;
+}
+
+MirFunction *MirBuilder::getFunction() const
+{
+    return func;
+}
+
+void MirBuilder::setInsertPoint(MirBlock *b)
+{
+    block = b;
+}
+
+MirBlock *MirBuilder::getInsertBlock() const
+{
+    return block;
+}
+
+bool MirBuilder::isTerminated() const
+{
+    return block->getTerminator() != nullptr;
+}
+
+MirBlock *MirBuilder::createBlock(const std::string &name)
+{
+    return new MirBlock(name, func);
+}
+
+void MirBuilder::appendBlock(MirBlock *b)
+{
+    func->blocks.push_back(b);
+}
+
+MirInstr *MirBuilder::create(MirOp op, MirType t, std::vector<MirValue *> operands, const AST *origin)
+{
+    // Code after a return is collected in a block without predecessors,
+    // which mirRemoveUnreachable deletes
+    if (isTerminated())
+    {
+        MirBlock *dead = createBlock("dead");
+        appendBlock(dead);
+        block = dead;
+    }
+
+    MirInstr *instr = new MirInstr(op, t);
+    instr->operands = std::move(operands);
+    instr->origin = origin;
+    instr->parent = block;
+    block->instrs.push_back(instr);
+    return instr;
+}
+
+MirInstr *MirBuilder::createEntrySlot(MirType elemType, MirValue *count, MirVar *var)
+{
+    MirInstr *slot = new MirInstr(MirOp::SLOT, MirType::PTR);
+    slot->operands = {count};
+    slot->elemType = elemType;
+    slot->var = var;
+
+    MirBlock *entry = func->entry();
+    slot->parent = entry;
+    auto it = entry->instrs.begin();
+    while (it != entry->instrs.end() && ((*it)->op == MirOp::SLOT || (*it)->op == MirOp::ENV))
+        ++it;
+    entry->instrs.insert(it, slot);
+    return slot;
+}
+
+MirInstr *MirBuilder::createLoad(MirType t, MirValue *ptr)
+{
+    return create(MirOp::LOAD, t, {ptr});
+}
+
+MirInstr *MirBuilder::createStore(MirValue *value, MirValue *ptr)
+{
+    return create(MirOp::STORE, MirType::VOID, {value, ptr});
+}
+
+MirInstr *MirBuilder::createBr(MirBlock *target)
+{
+    MirInstr *br = create(MirOp::BR, MirType::VOID, {});
+    br->blocks = {target};
+    return br;
+}
+
+MirInstr *MirBuilder::createCondBr(MirValue *cond, MirBlock *trueBB, MirBlock *falseBB)
+{
+    MirInstr *br = create(MirOp::CONDBR, MirType::VOID, {cond});
+    br->blocks = {trueBB, falseBB};
+    return br;
+}
+
+MirConst *MirBuilder::constant(MirType t, long long v)
+{
+    return new MirConst(t, v);
+}
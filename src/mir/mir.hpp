@@ -0,0 +1,276 @@
+#ifndef __MIR_HPP__
+#define __MIR_HPP__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "../symbol/types.hpp"
+
+// Alan MIR: a typed control flow graph in SSA form that sits between the
+// semantic analysis and the LLVM code generation. Functions are closure
+// converted (captured variables are explicit arguments), so the MIR of a
+// program can be analysed and executed without the symbol table.
+
+class AST;
+class MirBlock;
+class MirFunction;
+class MirInstr;
+
+// Types of MIR values. Arrays and strings only exist behind PTR values;
+// HANDLE is the state of a running generator.
+enum class MirType { VOID, I1, I8, I32, PTR, HANDLE };
+
+enum class MirOp
+{
+    // Arithmetic on I8 / I32 values
+    ADD, SUB, MUL, DIV, MOD, NEG,
+    // Signed comparisons producing I1 values
+    LT, GT, LE, GE, EQ, NE,
+    PHI,
+    // Zero initialized storage for `count` elements of `elemType`
+    SLOT,
+    // Address of a variable of an enclosing function; removed by closure conversion
+    ENV,
+    LOAD, STORE, INDEX,
+    CALL,
+    // Generators: hand a value to the consuming loop, and the loop side
+    YIELD, GEN_DONE, GEN_VALUE, GEN_RESUME, GEN_DESTROY,
+    // Terminators
+    BR, CONDBR, RET, UNREACHABLE
+};
+
+std::string mirTypeToString(MirType t);
+std::string mirOpToString(MirOp op);
+MirType mirTypeOf(Type *t);
+
+// A variable or parameter of the source program. The closure analysis
+// works on these, since the same variable is reached through different
+// values in every function that uses it.
+class MirVar
+{
+public:
+    MirVar(const std::string &name, Type *type, MirFunction *owner, bool byReference, int id);
+
+    std::string name;
+    Type *type;
+    MirFunction *owner;
+    // Reference and array parameters: the storage belongs to the caller
+    bool byReference;
+    // SLOT or PTR argument holding the variable in its owner
+    class MirValue *address;
+    int id;
+
+    bool isScalar() const;
+};
+
+class MirValue
+{
+public:
+    MirValue(MirType t) : type(t), id(-1) {}
+    virtual ~MirValue() {}
+    virtual std::string toString() const;
+
+    MirType type;
+    std::string name;
+    int id;
+};
+
+class MirConst : public MirValue
+{
+public:
+    MirConst(MirType t, long long v) : MirValue(t), value(v) {}
+    virtual std::string toString() const override;
+
+    long long value;
+};
+
+class MirString : public MirValue
+{
+public:
+    MirString(const std::string &v) : MirValue(MirType::PTR), value(v) {}
+    virtual std::string toString() const override;
+
+    std::string value;
+};
+
+class MirArg : public MirValue
+{
+public:
+    MirArg(MirType t, const std::string &n, MirVar *v) : MirValue(t), var(v) { name = n; }
+
+    // Parameter or captured variable this argument carries
+    MirVar *var;
+};
+
+class MirInstr : public MirValue
+{
+public:
+    MirInstr(MirOp op, MirType t) : MirValue(t), op(op), elemType(MirType::VOID), callee(nullptr),
+                                    var(nullptr), origin(nullptr), parent(nullptr) {}
+    virtual std::string toString() const override;
+
+    bool isTerminator() const;
+    bool hasResult() const;
+
+    MirOp op;
+    std::vector<MirValue *> operands;
+    // BR: target; CONDBR: true and false targets; PHI: incoming block of every operand
+    std::vector<MirBlock *> blocks;
+    // SLOT and INDEX: type of the elements
+    MirType elemType;
+    MirFunction *callee;
+    // SLOT and ENV: the source variable
+    MirVar *var;
+    // Source node the instruction was lowered from, if any
+    const AST *origin;
+    MirBlock *parent;
+};
+
+class MirBlock
+{
+public:
+    MirBlock(const std::string &n, MirFunction *f) : name(n), parent(f), id(-1) {}
+
+    MirInstr *getTerminator() const;
+    std::vector<MirBlock *> successors() const;
+
+    std::string name;
+    std::vector<MirInstr *> instrs;
+    std::vector<MirBlock *> preds;
+    MirFunction *parent;
+    int id;
+};
+
+// A variable passed to a function through its closure
+struct MirCapture
+{
+    MirVar *var;
+    bool byValue;
+    MirArg *arg;
+};
+
+class MirFunction
+{
+public:
+    MirFunction(const std::string &n, MirType ret, MirFunction *p, const AST *o);
+
+    MirBlock *entry() const;
+    void computePreds();
+    void computeDominators();
+    bool dominates(MirBlock *a, MirBlock *b) const;
+    void number();
+    void print(std::ostream &out) const;
+
+    std::string name;
+    MirType returnType;
+    // Generators: type of the yielded values
+    MirType yieldType;
+    bool isGenerator;
+    bool isExternal;
+    std::vector<MirArg *> params;
+    // Whether each parameter is passed by address
+    std::vector<bool> paramByRef;
+    std::vector<MirCapture> captures;
+    std::vector<MirBlock *> blocks;
+    std::vector<MirVar *> vars;
+    MirFunction *parent;
+    const AST *origin;
+    std::unordered_map<MirBlock *, MirBlock *> idom;
+    // Entry and exit numbers of every block in a walk of the dominator tree,
+    // so dominance is a constant time interval test
+    std::unordered_map<MirBlock *, std::pair<int, int>> domInterval;
+};
+
+// Caller and callee of a call in the source
+struct MirCallSite
+{
+    MirFunction *caller;
+    MirFunction *callee;
+};
+
+// A name of a variable in the source (an Id, an ArrayAccess or the VarDef
+// itself) and the function it appears in, which for a captured variable is
+// not its owner
+struct MirVarUse
+{
+    const AST *node;
+    MirFunction *func;
+    MirVar *var;
+};
+
+class MirModule
+{
+public:
+    MirModule() : main(nullptr), varCounter(0) {}
+
+    MirFunction *addFunction(MirFunction *f);
+    MirFunction *getExternal(const std::string &name) const;
+    MirFunction *functionOf(const AST *funcDef) const;
+    const MirCallSite &callSiteOf(const AST *funcCall) const;
+    void print(std::ostream &out) const;
+
+    std::vector<MirFunction *> functions;
+    MirFunction *main;
+    int varCounter;
+    std::unordered_map<const AST *, MirFunction *> definitions;
+    std::unordered_map<const AST *, MirCallSite> callSites;
+    std::vector<MirVarUse> varUses;
+
+    // Facts the passes prove about source nodes, used by the LLVM code generation
+    std::unordered_set<const AST *> noOverflow;
+    std::unordered_set<const AST *> nonZeroDivisor;
+    std::unordered_set<const AST *> inBounds;
+};
+
+// Names visible while lowering a function: its variables and nested
+// functions, the ENV of every captured variable and the generators whose
+// loops enclose the current statement
+struct MirScope
+{
+    MirScope(MirFunction *f) : func(f) {}
+
+    MirFunction *func;
+    std::unordered_map<std::string, MirVar *> vars;
+    std::unordered_map<std::string, MirFunction *> functions;
+    std::unordered_map<MirVar *, MirInstr *> env;
+    std::vector<MirValue *> activeGenerators;
+};
+
+// Builds instructions at the end of a block
+class MirBuilder
+{
+public:
+    MirBuilder() : func(nullptr), block(nullptr) {}
+
+    void setFunction(MirFunction *f);
+    MirFunction *getFunction() const;
+    void setInsertPoint(MirBlock *b);
+    MirBlock *getInsertBlock() const;
+    bool isTerminated() const;
+
+    MirBlock *createBlock(const std::string &name);
+    void appendBlock(MirBlock *b);
+    MirInstr *create(MirOp op, MirType t, std::vector<MirValue *> operands, const AST *origin = nullptr);
+    MirInstr *createEntrySlot(MirType elemType, MirValue *count, MirVar *var);
+    MirInstr *createLoad(MirType t, MirValue *ptr);
+    MirInstr *createStore(MirValue *value, MirValue *ptr);
+    MirInstr *createBr(MirBlock *target);
+    MirInstr *createCondBr(MirValue *cond, MirBlock *trueBB, MirBlock *falseBB);
+
+    static MirConst *constant(MirType t, long long v);
+
+private:
+    MirFunction *func;
+    MirBlock *block;
+};
+
+// Passes over a whole module (see passes.cpp)
+void mirConvertClosures(MirModule *m);
+void mirPromoteSlots(MirFunction *f);
+void mirRemoveUnreachable(MirFunction *f);
+void mirProveChecks(MirModule *m, MirFunction *f);
+void mirOptimize(MirModule *m);
+
+#endif // __MIR_HPP__
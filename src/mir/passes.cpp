@@ -0,0 +1,751 @@
+#include "mir.hpp"
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <set>
+
+static void insertBefore(MirInstr *pos, MirInstr *instr)
+{
+    std::vector<MirInstr *> &instrs = pos->parent->instrs;
+    instr->parent = pos->parent;
+    instrs.insert(std::find(instrs.begin(), instrs.end(), pos), instr);
+}
+
+// Rewrites every operand through `replacement`, following chains of replaced values
+static void replaceOperands(MirFunction *f, const std::unordered_map<MirValue *, MirValue *> &replacement)
+{
+    if (replacement.empty())
+        return;
+
+    auto resolve = [&](MirValue *v) {
+        auto it = replacement.find(v);
+        while (it != replacement.end())
+        {
+            v = it->second;
+            it = replacement.find(v);
+        }
+        return v;
+    };
+
+    for (MirBlock *b : f->blocks)
+        for (MirInstr *i : b->instrs)
+            for (MirValue *&operand : i->operands)
+                operand = resolve(operand);
+}
+
+static void eraseInstrs(MirFunction *f, const std::unordered_set<MirInstr *> &dead)
+{
+    if (dead.empty())
+        return;
+
+    for (MirBlock *b : f->blocks)
+    {
+        std::vector<MirInstr *> kept;
+        for (MirInstr *i : b->instrs)
+            if (!dead.count(i))
+                kept.push_back(i);
+        b->instrs = std::move(kept);
+    }
+}
+
+// Unreachable Block Removal
+
+void mirRemoveUnreachable(MirFunction *f)
+{
+    std::unordered_set<MirBlock *> reachable;
+    std::vector<MirBlock *> worklist = {f->entry()};
+    reachable.insert(f->entry());
+    while (!worklist.empty())
+    {
+        MirBlock *b = worklist.back();
+        worklist.pop_back();
+        for (MirBlock *s : b->successors())
+            if (reachable.insert(s).second)
+                worklist.push_back(s);
+    }
+
+    std::vector<MirBlock *> kept;
+    for (MirBlock *b : f->blocks)
+        if (reachable.count(b))
+            kept.push_back(b);
+    f->blocks = std::move(kept);
+    f->computePreds();
+}
+
+// Closure Conversion
+//
+// The variables a function needs from its enclosing functions are the ones
+// it uses itself, plus those needed by the functions it calls that it does
+// not own. Only these are passed, so closures shrink to what is used, and
+// calls between sibling functions forward the variables of their callees.
+//
+// A captured scalar is passed by value when no function but its owner can
+// change it while a closure holding it is alive: it is never written or
+// passed by reference outside its owner, its address never leaves the owner
+// through a reference parameter, and no generator (whose frame outlives the
+// call) needs it. The owner can then keep the variable in a register.
+
+void mirConvertClosures(MirModule *m)
+{
+    auto byId = [](MirVar *a, MirVar *b) { return a->id < b->id; };
+    std::unordered_map<MirFunction *, std::set<MirVar *, decltype(byId)>> needs;
+    std::unordered_map<MirFunction *, std::vector<MirFunction *>> calls;
+    std::unordered_set<MirVar *> escapes;
+
+    for (MirFunction *f : m->functions)
+    {
+        if (f->isExternal)
+            continue;
+        needs.emplace(f, std::set<MirVar *, decltype(byId)>(byId));
+
+        for (MirBlock *b : f->blocks)
+        {
+            for (MirInstr *i : b->instrs)
+            {
+                if (i->op == MirOp::ENV)
+                {
+                    needs.at(f).insert(i->var);
+                }
+                else if (i->op == MirOp::STORE)
+                {
+                    MirInstr *target = dynamic_cast<MirInstr *>(i->operands[1]);
+                    if (target && target->op == MirOp::ENV)
+                        escapes.insert(target->var);
+                }
+                else if (i->op == MirOp::CALL)
+                {
+                    if (!i->callee->isExternal)
+                        calls[f].push_back(i->callee);
+
+                    for (size_t k = 0; k < i->operands.size(); ++k)
+                    {
+                        MirInstr *arg = dynamic_cast<MirInstr *>(i->operands[k]);
+                        if (i->callee->paramByRef[k] && arg && (arg->op == MirOp::ENV || arg->op == MirOp::SLOT) && arg->var)
+                            escapes.insert(arg->var);
+                    }
+                }
+            }
+        }
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto &entry : calls)
+        {
+            MirFunction *f = entry.first;
+            for (MirFunction *callee : entry.second)
+                for (MirVar *var : needs.at(callee))
+                    if (var->owner != f && needs.at(f).insert(var).second)
+                        changed = true;
+        }
+    }
+
+    for (MirFunction *f : m->functions)
+    {
+        if (f->isExternal || !f->isGenerator)
+            continue;
+        for (MirVar *var : needs.at(f))
+            escapes.insert(var);
+    }
+
+    for (MirFunction *f : m->functions)
+    {
+        if (f->isExternal)
+            continue;
+        for (MirVar *var : needs.at(f))
+        {
+            bool byValue = var->isScalar() && !var->byReference && !escapes.count(var);
+            MirArg *arg = new MirArg(byValue ? mirTypeOf(var->type) : MirType::PTR, var->name + "." + std::to_string(var->id), var);
+            f->captures.push_back({var, byValue, arg});
+        }
+    }
+
+    for (MirFunction *f : m->functions)
+    {
+        if (f->isExternal)
+            continue;
+
+        // Every variable reached through an ENV, or needed by a callee the
+        // function does not own it in, is among its captures
+        auto captureOf = [&](MirVar *var) -> const MirCapture & {
+            size_t k = 0;
+            while (f->captures[k].var != var)
+                ++k;
+            return f->captures[k];
+        };
+
+        std::unordered_map<MirValue *, MirValue *> replacement;
+        std::unordered_set<MirInstr *> dead;
+        std::vector<MirInstr *> callInstrs;
+
+        for (MirBlock *b : f->blocks)
+        {
+            for (MirInstr *i : b->instrs)
+            {
+                if (i->op == MirOp::ENV)
+                {
+                    const MirCapture &c = captureOf(i->var);
+                    if (!c.byValue)
+                        replacement[i] = c.arg;
+                    dead.insert(i);
+                }
+                else if (i->op == MirOp::LOAD)
+                {
+                    MirInstr *ptr = dynamic_cast<MirInstr *>(i->operands[0]);
+                    if (ptr && ptr->op == MirOp::ENV && captureOf(ptr->var).byValue)
+                    {
+                        replacement[i] = captureOf(ptr->var).arg;
+                        dead.insert(i);
+                    }
+                }
+                else if (i->op == MirOp::CALL && !i->callee->isExternal)
+                {
+                    callInstrs.push_back(i);
+                }
+            }
+        }
+
+        for (MirInstr *call : callInstrs)
+        {
+            std::vector<MirValue *> closure;
+            for (const MirCapture &c : call->callee->captures)
+            {
+                if (c.var->owner != f)
+                {
+                    closure.push_back(captureOf(c.var).arg);
+                }
+                else if (c.byValue)
+                {
+                    MirInstr *load = new MirInstr(MirOp::LOAD, c.arg->type);
+                    load->operands = {c.var->address};
+                    insertBefore(call, load);
+                    closure.push_back(load);
+                }
+                else
+                {
+                    closure.push_back(c.var->address);
+                }
+            }
+            call->operands.insert(call->operands.begin(), closure.begin(), closure.end());
+        }
+
+        replaceOperands(f, replacement);
+        eraseInstrs(f, dead);
+    }
+}
+
+// Scalar Promotion
+//
+// Slots of scalars that are only loaded and stored are replaced by SSA
+// values, with phis placed on the iterated dominance frontier of the stores.
+
+void mirPromoteSlots(MirFunction *f)
+{
+    f->computePreds();
+    f->computeDominators();
+
+    std::unordered_set<MirInstr *> promotable;
+    for (MirBlock *b : f->blocks)
+        for (MirInstr *i : b->instrs)
+        {
+            MirConst *count = i->op == MirOp::SLOT ? dynamic_cast<MirConst *>(i->operands[0]) : nullptr;
+            if (count && count->value == 1 && i->var && i->var->isScalar())
+                promotable.insert(i);
+        }
+
+    for (MirBlock *b : f->blocks)
+        for (MirInstr *i : b->instrs)
+            for (size_t k = 0; k < i->operands.size(); ++k)
+            {
+                MirInstr *slot = dynamic_cast<MirInstr *>(i->operands[k]);
+                bool allowed = (i->op == MirOp::LOAD && k == 0) || (i->op == MirOp::STORE && k == 1);
+                if (slot && !allowed)
+                    promotable.erase(slot);
+            }
+
+    if (promotable.empty())
+        return;
+
+    std::unordered_map<MirBlock *, std::unordered_set<MirBlock *>> frontier;
+    for (MirBlock *b : f->blocks)
+    {
+        if (b->preds.size() < 2)
+            continue;
+        for (MirBlock *p : b->preds)
+            for (MirBlock *runner = p; runner != f->idom.at(b); runner = f->idom.at(runner))
+                frontier[runner].insert(b);
+    }
+
+    // Slots in program order, so the phis are placed deterministically
+    std::vector<MirInstr *> slots;
+    for (MirBlock *b : f->blocks)
+        for (MirInstr *i : b->instrs)
+            if (promotable.count(i))
+                slots.push_back(i);
+
+    std::unordered_map<MirInstr *, MirInstr *> phiSlot;
+    std::unordered_map<MirBlock *, std::vector<MirInstr *>> phis;
+    for (MirInstr *slot : slots)
+    {
+        std::vector<MirBlock *> worklist = {f->entry()};
+        for (MirBlock *b : f->blocks)
+            for (MirInstr *i : b->instrs)
+                if (i->op == MirOp::STORE && i->operands[1] == slot)
+                    worklist.push_back(b);
+
+        std::unordered_set<MirBlock *> placed;
+        while (!worklist.empty())
+        {
+            MirBlock *b = worklist.back();
+            worklist.pop_back();
+            for (MirBlock *d : frontier[b])
+            {
+                if (!placed.insert(d).second)
+                    continue;
+                MirInstr *phi = new MirInstr(MirOp::PHI, slot->elemType);
+                phi->parent = d;
+                phiSlot[phi] = slot;
+                phis[d].push_back(phi);
+                worklist.push_back(d);
+            }
+        }
+    }
+
+    for (auto &entry : phis)
+        entry.first->instrs.insert(entry.first->instrs.begin(), entry.second.begin(), entry.second.end());
+
+    std::unordered_map<MirBlock *, std::vector<MirBlock *>> children;
+    for (MirBlock *b : f->blocks)
+        if (b != f->entry() && f->idom.count(b))
+            children[f->idom.at(b)].push_back(b);
+
+    std::unordered_map<MirInstr *, std::vector<MirValue *>> stacks;
+    for (MirInstr *slot : promotable)
+        stacks[slot].push_back(MirBuilder::constant(slot->elemType, 0));
+
+    std::unordered_map<MirValue *, MirValue *> replacement;
+    std::unordered_set<MirInstr *> dead(promotable.begin(), promotable.end());
+
+    auto resolve = [&](MirValue *v) {
+        auto it = replacement.find(v);
+        while (it != replacement.end())
+        {
+            v = it->second;
+            it = replacement.find(v);
+        }
+        return v;
+    };
+
+    std::function<void(MirBlock *)> rename = [&](MirBlock *b) {
+        std::unordered_map<MirInstr *, size_t> saved;
+        for (auto &entry : stacks)
+            saved[entry.first] = entry.second.size();
+
+        for (MirInstr *i : b->instrs)
+        {
+            if (i->op == MirOp::PHI && phiSlot.count(i))
+            {
+                stacks[phiSlot[i]].push_back(i);
+            }
+            else if (i->op == MirOp::LOAD && promotable.count(dynamic_cast<MirInstr *>(i->operands[0])))
+            {
+                replacement[i] = stacks[static_cast<MirInstr *>(i->operands[0])].back();
+                dead.insert(i);
+            }
+            else if (i->op == MirOp::STORE && promotable.count(dynamic_cast<MirInstr *>(i->operands[1])))
+            {
+                stacks[static_cast<MirInstr *>(i->operands[1])].push_back(resolve(i->operands[0]));
+                dead.insert(i);
+            }
+        }
+
+        for (MirBlock *s : b->successors())
+            for (MirInstr *i : s->instrs)
+                if (i->op == MirOp::PHI && phiSlot.count(i))
+                {
+                    i->operands.push_back(stacks[phiSlot[i]].back());
+                    i->blocks.push_back(b);
+                }
+
+        for (MirBlock *child : children[b])
+            rename(child);
+
+        for (auto &entry : stacks)
+            entry.second.resize(saved[entry.first]);
+    };
+    rename(f->entry());
+
+    // Phis whose operands are all the same value (or the phi itself) are redundant
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto &entry : phiSlot)
+        {
+            MirInstr *phi = entry.first;
+            if (dead.count(phi))
+                continue;
+            MirValue *same = nullptr;
+            bool trivial = true;
+            for (MirValue *op : phi->operands)
+            {
+                op = resolve(op);
+                if (op == phi || op == same)
+                    continue;
+                if (same)
+                {
+                    trivial = false;
+                    break;
+                }
+                same = op;
+            }
+            if (trivial && same)
+            {
+                replacement[phi] = same;
+                dead.insert(phi);
+                changed = true;
+            }
+        }
+    }
+
+    replaceOperands(f, replacement);
+    eraseInstrs(f, dead);
+}
+
+// Check Elimination
+//
+// Proves facts about the operands of arithmetic and array accesses from
+// constants, the conditions of the branches that dominate them and simple
+// induction variables, and records the source nodes whose runtime checks
+// are unnecessary. Arrays declared in the function have a known size, so
+// an index proven to lie in [0, size) needs no bounds check.
+
+namespace
+{
+
+struct Guard
+{
+    MirBlock *region;
+    MirOp op;
+    MirValue *left;
+    MirValue *right;
+};
+
+class RangeProver
+{
+public:
+    RangeProver(MirFunction *f) : func(f)
+    {
+        for (MirBlock *b : f->blocks)
+        {
+            MirInstr *term = b->getTerminator();
+            MirInstr *cmp = term && term->op == MirOp::CONDBR ? dynamic_cast<MirInstr *>(term->operands[0]) : nullptr;
+            if (!cmp || cmp->op < MirOp::LT || cmp->op > MirOp::NE)
+                continue;
+
+            if (term->blocks[0]->preds.size() == 1)
+                addGuard({term->blocks[0], cmp->op, cmp->operands[0], cmp->operands[1]});
+            if (term->blocks[1]->preds.size() == 1)
+                addGuard({term->blocks[1], negate(cmp->op), cmp->operands[0], cmp->operands[1]});
+        }
+    }
+
+    // v < bound holds in block b
+    bool lessThan(MirValue *v, MirValue *bound, MirBlock *b, int depth = 0)
+    {
+        long long c, k;
+        if (constant(v, c) && constant(bound, k))
+            return c < k;
+        if (depth > 4)
+            return false;
+
+        bool boundConst = constant(bound, k);
+        for (const Guard &g : guardsOn(v))
+        {
+            if (!func->dominates(g.region, b))
+                continue;
+            MirOp op;
+            MirValue *other;
+            if (!orient(g, v, op, other))
+                continue;
+            long long o;
+            if (op == MirOp::LT && (other == bound || (boundConst && constant(other, o) && o <= k)))
+                return true;
+            if (op == MirOp::LE && boundConst && constant(other, o) && o < k)
+                return true;
+            if (op == MirOp::LT && other != bound && lessThan(other, bound, b, depth + 1))
+                return true;
+        }
+
+        MirInstr *i = dynamic_cast<MirInstr *>(v);
+        if (i && i->op == MirOp::MOD && boundConst && constant(i->operands[1], c) && c > 0 && c <= k)
+            return true;
+        return false;
+    }
+
+    // v >= 0 holds in block b
+    bool nonNegative(MirValue *v, MirBlock *b, int depth = 0)
+    {
+        long long c;
+        if (constant(v, c))
+            return c >= 0;
+        if (depth > 4)
+            return false;
+
+        for (const Guard &g : guardsOn(v))
+        {
+            if (!func->dominates(g.region, b))
+                continue;
+            MirOp op;
+            MirValue *other;
+            long long o;
+            if (orient(g, v, op, other) && constant(other, o) &&
+                ((op == MirOp::GE && o >= 0) || (op == MirOp::GT && o >= -1)))
+                return true;
+        }
+
+        MirInstr *i = dynamic_cast<MirInstr *>(v);
+        if (!i)
+            return false;
+        if (i->op == MirOp::MOD)
+            return nonNegative(i->operands[0], i->parent, depth + 1);
+        if (i->op == MirOp::ADD && noOverflow(i))
+            return nonNegative(i->operands[0], i->parent, depth + 1) && nonNegative(i->operands[1], i->parent, depth + 1);
+        if (i->op == MirOp::PHI)
+        {
+            // Induction: assume the phi is non-negative while checking its inputs
+            if (assumed.count(i))
+                return true;
+            assumed.insert(i);
+            bool result = true;
+            for (size_t k = 0; k < i->operands.size() && result; ++k)
+                result = nonNegative(i->operands[k], i->blocks[k], depth + 1);
+            assumed.erase(i);
+            return result;
+        }
+        return false;
+    }
+
+    // v != 0 holds in block b
+    bool nonZero(MirValue *v, MirBlock *b)
+    {
+        long long c;
+        if (constant(v, c))
+            return c != 0;
+        if (positive(v, b))
+            return true;
+
+        for (const Guard &g : guardsOn(v))
+        {
+            MirOp op;
+            MirValue *other;
+            long long o;
+            if (func->dominates(g.region, b) && orient(g, v, op, other) && constant(other, o) &&
+                ((op == MirOp::NE && o == 0) || (op == MirOp::LT && o <= 0) || (op == MirOp::LE && o < 0)))
+                return true;
+        }
+        return false;
+    }
+
+    // v > 0 holds in block b
+    bool positive(MirValue *v, MirBlock *b)
+    {
+        long long c;
+        if (constant(v, c))
+            return c > 0;
+
+        for (const Guard &g : guardsOn(v))
+        {
+            MirOp op;
+            MirValue *other;
+            long long o;
+            if (func->dominates(g.region, b) && orient(g, v, op, other) && constant(other, o) &&
+                ((op == MirOp::GT && o >= 0) || (op == MirOp::GE && o >= 1)))
+                return true;
+        }
+
+        // x + c with x >= 0 and c > 0, as in a divisor `i + 1`
+        MirInstr *i = dynamic_cast<MirInstr *>(v);
+        if (i && i->op == MirOp::ADD && noOverflow(i))
+        {
+            if (constant(i->operands[1], c) && c > 0)
+                return nonNegative(i->operands[0], b);
+            if (constant(i->operands[0], c) && c > 0)
+                return nonNegative(i->operands[1], b);
+        }
+        return false;
+    }
+
+    // An I32 add or subtract of a constant that cannot leave the range of int
+    bool noOverflow(MirInstr *i)
+    {
+        long long c;
+        if (i->type != MirType::I32)
+            return false;
+        MirValue *v = i->operands[0];
+        if (i->op == MirOp::ADD && constant(v, c))
+            v = i->operands[1];
+        else if (!constant(i->operands[1], c))
+            return false;
+        if (i->op == MirOp::SUB)
+            c = -c;
+        else if (i->op != MirOp::ADD)
+            return false;
+
+        if (c == 0)
+            return true;
+        for (const Guard &g : guardsOn(v))
+        {
+            MirOp op;
+            MirValue *other;
+            long long o;
+            if (!func->dominates(g.region, i->parent) || !orient(g, v, op, other))
+                continue;
+            bool otherConst = constant(other, o);
+            // v < other <= INT_MAX, so v + 1 fits; likewise for v - 1
+            if (c == 1 && op == MirOp::LT)
+                return true;
+            if (c == -1 && op == MirOp::GT)
+                return true;
+            if (c > 0 && otherConst && ((op == MirOp::LT && o - 1 <= INT_MAX - c) || (op == MirOp::LE && o <= INT_MAX - c)))
+                return true;
+            if (c < 0 && otherConst && ((op == MirOp::GT && o + 1 >= INT_MIN - c) || (op == MirOp::GE && o >= INT_MIN - c)))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    static bool constant(MirValue *v, long long &c)
+    {
+        MirConst *k = dynamic_cast<MirConst *>(v);
+        if (k)
+            c = k->value;
+        return k != nullptr;
+    }
+
+    static MirOp negate(MirOp op)
+    {
+        switch (op)
+        {
+        case MirOp::LT: return MirOp::GE;
+        case MirOp::GT: return MirOp::LE;
+        case MirOp::LE: return MirOp::GT;
+        case MirOp::GE: return MirOp::LT;
+        case MirOp::EQ: return MirOp::NE;
+        default:        return MirOp::EQ;
+        }
+    }
+
+    static MirOp swap(MirOp op)
+    {
+        switch (op)
+        {
+        case MirOp::LT: return MirOp::GT;
+        case MirOp::GT: return MirOp::LT;
+        case MirOp::LE: return MirOp::GE;
+        case MirOp::GE: return MirOp::LE;
+        default:        return op;
+        }
+    }
+
+    // Writes the guard as `v op other`, if it is about v
+    static bool orient(const Guard &g, MirValue *v, MirOp &op, MirValue *&other)
+    {
+        if (g.left == v)
+        {
+            op = g.op;
+            other = g.right;
+            return true;
+        }
+        if (g.right == v)
+        {
+            op = swap(g.op);
+            other = g.left;
+            return true;
+        }
+        return false;
+    }
+
+    // Guards are indexed by the values they compare
+    void addGuard(const Guard &g)
+    {
+        guards[g.left].push_back(g);
+        if (g.right != g.left)
+            guards[g.right].push_back(g);
+    }
+
+    const std::vector<Guard> &guardsOn(MirValue *v) const
+    {
+        static const std::vector<Guard> none;
+        auto it = guards.find(v);
+        return it == guards.end() ? none : it->second;
+    }
+
+    MirFunction *func;
+    std::unordered_map<MirValue *, std::vector<Guard>> guards;
+    std::unordered_set<MirInstr *> assumed;
+};
+
+}
+
+void mirProveChecks(MirModule *m, MirFunction *f)
+{
+    f->computePreds();
+    f->computeDominators();
+    RangeProver prover(f);
+
+    for (MirBlock *b : f->blocks)
+    {
+        for (MirInstr *i : b->instrs)
+        {
+            if (!i->origin)
+                continue;
+
+            switch (i->op)
+            {
+            case MirOp::ADD:
+            case MirOp::SUB:
+                if (prover.noOverflow(i))
+                    m->noOverflow.insert(i->origin);
+                break;
+            case MirOp::DIV:
+            case MirOp::MOD:
+                if (prover.nonZero(i->operands[1], b))
+                    m->nonZeroDivisor.insert(i->origin);
+                if (prover.positive(i->operands[1], b) || prover.nonNegative(i->operands[0], b))
+                    m->noOverflow.insert(i->origin);
+                break;
+            case MirOp::INDEX:
+            {
+                MirInstr *array = dynamic_cast<MirInstr *>(i->operands[0]);
+                if (array && array->op == MirOp::SLOT && prover.nonNegative(i->operands[1], b) &&
+                    prover.lessThan(i->operands[1], array->operands[0], b))
+                    m->inBounds.insert(i->origin);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+}
+
+void mirOptimize(MirModule *m)
+{
+    for (MirFunction *f : m->functions)
+        if (!f->isExternal)
+            mirRemoveUnreachable(f);
+
+    mirConvertClosures(m);
+
+    for (MirFunction *f : m->functions)
+    {
+        if (f->isExternal)
+            continue;
+        mirPromoteSlots(f);
+        mirProveChecks(m, f);
+    }
+}
@@ -2,6 +2,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "../jit/jit.hpp"
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/Error.h>
 #include "../lexer/lexer.hpp"
 #include "../ast/ast.hpp"
 #include "../symbol/types.hpp"
@@ -10,18 +16,49 @@
 
 int syntax_errors = 0;
 extern int lexical_errors;
+extern int lineno;
+extern int column;
+extern SymbolTable st;
 std::vector<std::string> syntax_error_buffer;  
 
 int semantic_errors = 0;
 std::vector<std::string> semantic_error_buffer;
 
 void yyerror(const char *msg);  
+void writeTrace();
 
 Type *typeInteger = new IntType();
 Type *typeByte = new ByteType();
 Type *typeVoid = new VoidType();
 
 bool optimize = false;
+int vlaHeapThreshold = -1;
+bool trapOverflow = false;
+bool checkDivision = false;
+bool checkBounds = false;
+bool dumpMir = false;
+bool timePhases = false;
+bool printStats = false;
+bool stackUsage = false;
+bool profileFunctions = false;
+bool coverage = false;
+bool profileLoops = false;
+std::string sourceText;
+bool debugInfo = false;
+std::string debugFile = "<stdin>";
+bool jit = false;
+bool interpret = false;
+bool bytecode = false;
+bool dumpBytecode = false;
+bool tiered = false;
+int tierThreshold = 1000;
+bool emitC = false;
+int runStatus = 0;
+bool perfMap = false;
+bool jitCache = false;
+std::string jitCacheDir;
+std::string traceFile;
+int tracedPhases = 0;
 
 %}
 
@@ -50,12 +87,16 @@ bool optimize = false;
     Cond *cond;
     Lval *lvalue;
     FuncCall *fun;
+    LoopHint *loophint;
+    LoopHintList *loophints;
 }
 
 // Tokens
 %token T_byte "byte"
 %token T_else "else"
 %token T_false "false"
+%token T_for "for"
+%token T_gen "gen"
 %token T_if "if"
 %token T_int "int"
 %token T_proc "proc"
@@ -63,6 +104,7 @@ bool optimize = false;
 %token T_return "return"
 %token T_while "while"
 %token T_true "true"
+%token T_yield "yield"
 %token T_lte "<="
 %token T_gte ">="
 %token T_eq "=="
@@ -96,6 +138,8 @@ bool optimize = false;
 %type <lvalue> lvalue
 %type <type> datatype type rtype
 %type <fun> funccall
+%type <loophint> loophint
+%type <loophints> loophints
 
 %%
 
@@ -105,12 +149,42 @@ program :
             YYABORT; 
             return 1;
         }
+        timePhase("parse");
+
+        tracePhase("semantic");
         $1->sem();
         if (semantic_errors > 0) {
             YYABORT;
         }
+        timePhase("semantic");
+
+        tracePhase("mir");
+        MirModule *mir = $1->mir_gen();
+        timePhase("mir");
+        if (dumpMir) {
+            mir->print(std::cerr);
+        }
 
-        $1->llvm_igen(optimize);
+        if (interpret) {
+            runStatus = $1->run_interp();
+        }
+        else if (bytecode) {
+            tracePhase("bytecode");
+            VmProgram *program = $1->vm_gen();
+            timePhase("bytecode");
+            if (dumpBytecode) {
+                program->print(std::cerr);
+            }
+            runStatus = runVM(*program, tiered ? tierCompiler($1) : nullptr);
+        }
+        else if (emitC) {
+            tracePhase("c");
+            $1->c_gen();
+            timePhase("c");
+        }
+        else {
+            $1->llvm_igen(optimize);
+        }
     }
 ;
 
@@ -172,6 +246,9 @@ rtype :
 |   T_proc {
         $$ = typeVoid;
     }
+|   T_gen datatype {
+        $$ = new GeneratorType($2);
+    }
 ;
 
 localdef :
@@ -193,8 +270,14 @@ localdefs :
 ;
 
 vardef :
-    T_id ':' datatype '[' T_const ']' ';' {
-        $$ = new VarDef($1, $3, true, $5, @1.first_line, @1.first_column);
+    T_id ':' datatype '[' expr ']' ';' {
+        IntConst *size = dynamic_cast<IntConst *>($5);
+        if (size) {
+            $$ = new VarDef($1, $3, true, size->getValue(), @1.first_line, @1.first_column);
+            delete size;
+        } else {
+            $$ = new VarDef($1, $3, $5, @1.first_line, @1.first_column);
+        }
     } 
 |   T_id ':' datatype  ';' {
         $$ = new VarDef($1, $3, false, -1, @1.first_line, @1.first_column);
@@ -221,7 +304,16 @@ stmt :
         $$ = new If($3, $5, nullptr, @1.first_line, @1.first_column);
     }
 |   T_while '(' cond ')' stmt {
-        $$ = new While($3, $5, @1.first_line, @1.first_column);
+        $$ = new While($3, $5, nullptr, @1.first_line, @1.first_column);
+    }
+|   loophints T_while '(' cond ')' stmt {
+        $$ = new While($4, $6, $1, @2.first_line, @2.first_column);
+    }
+|   T_for '(' lvalue ':' funccall ')' stmt {
+        $$ = new For($3, $5, $7, @1.first_line, @1.first_column);
+    }
+|   T_yield expr ';' {
+        $$ = new Yield($2, @1.first_line, @1.first_column);
     }
 |   T_return expr ';' {
         $$ = new Return($2, @1.first_line, @1.first_column);
@@ -231,6 +323,25 @@ stmt :
     }
 ;
 
+loophint :
+    '@' T_id {
+        $$ = new LoopHint($2, -1, @1.first_line, @1.first_column);
+    }
+|   '@' T_id '(' T_const ')' {
+        $$ = new LoopHint($2, $4, @1.first_line, @1.first_column);
+    }
+;
+
+loophints :
+    loophint {
+        $$ = new LoopHintList(@1.first_line, @1.first_column);
+        $$->append($1);
+    }
+|   loophint loophints {
+        $2->append($1); $$ = $2;
+    }
+;
+
 stmts :
     /* nothing */ {
         $$ = new StmtList(@$.first_line, @$.first_column);
@@ -363,14 +474,118 @@ cond :
 %%
 
 int main(int argc, char **argv) {
+    const char *sourceFile = nullptr;
 
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "-O") == 0) {
             optimize = true;
         }
+        else if (strncmp(argv[i], "-fvla-heap-threshold=", 21) == 0) {
+            vlaHeapThreshold = atoi(argv[i] + 21);
+        }
+        else if (strcmp(argv[i], "-ftrapv") == 0) {
+            trapOverflow = true;
+        }
+        else if (strcmp(argv[i], "-fcheck-div") == 0) {
+            checkDivision = true;
+        }
+        else if (strcmp(argv[i], "-fcheck-bounds") == 0) {
+            checkBounds = true;
+        }
+        else if (strcmp(argv[i], "-fdump-mir") == 0) {
+            dumpMir = true;
+        }
+        else if (strcmp(argv[i], "-ftime-phases") == 0) {
+            timePhases = true;
+        }
+        else if (strcmp(argv[i], "-fstats") == 0) {
+            printStats = true;
+        }
+        else if (strcmp(argv[i], "-fstack-usage") == 0) {
+            stackUsage = true;
+        }
+        else if (strcmp(argv[i], "-fprofile-functions") == 0) {
+            profileFunctions = true;
+        }
+        else if (strcmp(argv[i], "-fcoverage") == 0) {
+            coverage = true;
+        }
+        else if (strcmp(argv[i], "-fprofile-loops") == 0) {
+            profileLoops = true;
+        }
+        else if (strcmp(argv[i], "-g") == 0) {
+            debugInfo = true;
+        }
+        else if (strncmp(argv[i], "-fdebug-file=", 13) == 0) {
+            debugFile = argv[i] + 13;
+        }
+        else if (strcmp(argv[i], "--jit") == 0) {
+            jit = true;
+        }
+        else if (strcmp(argv[i], "--interp") == 0) {
+            interpret = true;
+        }
+        else if (strcmp(argv[i], "--vm") == 0) {
+            bytecode = true;
+        }
+        else if (strcmp(argv[i], "--tiered") == 0) {
+            bytecode = true;
+            tiered = true;
+        }
+        else if (strncmp(argv[i], "-ftier-threshold=", 17) == 0) {
+            tierThreshold = std::max(atoi(argv[i] + 17), 1);
+        }
+        else if (strcmp(argv[i], "--emit-c") == 0) {
+            emitC = true;
+        }
+        else if (strcmp(argv[i], "-fdump-bytecode") == 0) {
+            dumpBytecode = true;
+        }
+        else if (strcmp(argv[i], "-fperf-map") == 0) {
+            perfMap = true;
+        }
+        else if (strcmp(argv[i], "-fjit-cache") == 0) {
+            jitCache = true;
+        }
+        else if (strncmp(argv[i], "-fjit-cache=", 12) == 0) {
+            jitCache = true;
+            jitCacheDir = argv[i] + 12;
+        }
+        else if (strncmp(argv[i], "-ftrace=", 8) == 0) {
+            traceFile = argv[i] + 8;
+        }
+        else if (argv[i][0] != '-') {
+            sourceFile = argv[i];
+        }
     }
 
+    // The program is read into sourceText before scanning when it comes from
+    // a file, so that stdin is left to the program it runs (--jit, --interp,
+    // --vm, --tiered), and for the coverage report, which prints it
+    if (coverage || sourceFile) {
+        FILE *in = sourceFile ? fopen(sourceFile, "r") : stdin;
+        if (!in) {
+            fprintf(stderr, "Error: cannot open %s\n", sourceFile);
+            return 1;
+        }
+        char chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+            sourceText.append(chunk, n);
+        }
+        if (sourceFile) {
+            fclose(in);
+        }
+        yy_scan_bytes(sourceText.data(), sourceText.size());
+    }
+
+    if (!traceFile.empty()) {
+        llvm::timeTraceProfilerInitialize(0, "alan compiler");
+    }
+    timePhase(nullptr);
+    tracePhase("parse");
     int result = yyparse();
+    writeTrace();
     
     if (lexical_errors > 0) {
         for (const std::string &error : error_buffer) {
@@ -391,7 +606,7 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    return result;
+    return result != 0 ? result : runStatus;
 }
 
 void yyerror(const char *msg) {
@@ -421,3 +636,59 @@ void semantic_error(int line, int column, const std::string &msg) {
     semantic_error_buffer.push_back(error_message);
     semantic_errors++;
 }
+
+void resetFrontend() {
+    lineno = 1;
+    column = 1;
+    lexical_errors = 0;
+    error_buffer.clear();
+    syntax_errors = 0;
+    syntax_error_buffer.clear();
+    semantic_errors = 0;
+    semantic_error_buffer.clear();
+    st.reset();
+}
+
+void timePhase(const char *phase) {
+    static std::chrono::steady_clock::time_point last;
+    static std::thread::id mainThread = std::this_thread::get_id();
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    // The native tier of --tiered is compiled on a thread of its own, while
+    // the program runs
+    if (std::this_thread::get_id() != mainThread) {
+        return;
+    }
+
+    if (timePhases && phase) {
+        fprintf(stderr, "phase %-10s %.6f\n", phase, std::chrono::duration<double>(now - last).count());
+    }
+    last = now;
+
+    if (phase && tracedPhases > 0) {
+        llvm::timeTraceProfilerEnd();
+        tracedPhases--;
+    }
+}
+
+void tracePhase(const char *phase) {
+    if (llvm::timeTraceProfilerEnabled()) {
+        llvm::timeTraceProfilerBegin(phase, "");
+        tracedPhases++;
+    }
+}
+
+// Writes the trace of -ftrace in the Chrome trace event format. The phases
+// an error cut short are closed here
+void writeTrace() {
+    if (!llvm::timeTraceProfilerEnabled()) {
+        return;
+    }
+    for (; tracedPhases > 0; tracedPhases--) {
+        llvm::timeTraceProfilerEnd();
+    }
+    if (llvm::Error error = llvm::timeTraceProfilerWrite(traceFile, "")) {
+        fprintf(stderr, "Error: cannot write the trace: %s\n", llvm::toString(std::move(error)).c_str());
+    }
+    llvm::timeTraceProfilerCleanup();
+}
@@ -32,7 +32,7 @@ FunctionSymbol::FunctionSymbol(const std::string& name, Type *type) : parameters
     this->type = type;
     this->symbolType = SymbolType::FUNCTION;
     this->returnType = type->getType();
-    this->needsReturn = (returnType != TypeEnum::VOID);
+    this->needsReturn = (returnType != TypeEnum::VOID && returnType != TypeEnum::GENERATOR);
     this->returnStatementFound = false;
 }
 
@@ -3,6 +3,11 @@
 #include "../symbol/types.hpp"
 
 SymbolTable::SymbolTable() : currentFunctionNestingLevel(0) {
+    declareLibrary();
+}
+
+// Declare the functions of the runtime library in the outermost scope
+void SymbolTable::declareLibrary() {
     enterScope();
 
     FunctionSymbol* writeInteger = new FunctionSymbol("writeInteger", typeVoid);
@@ -72,6 +77,19 @@ SymbolTable::~SymbolTable() {
     }
 }
 
+// Forget every symbol but the library functions, to analyze another program
+void SymbolTable::reset() {
+    while (!scopes.empty()) {
+        exitScope();
+    }
+    while (!currentFunctionContext.empty()) {
+        currentFunctionContext.pop();
+    }
+    globalSymbols.clear();
+    currentFunctionNestingLevel = 0;
+    declareLibrary();
+}
+
 // Enter a new scope
 void SymbolTable::enterScope() {
     scopes.push(new Scope());
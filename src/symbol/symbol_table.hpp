@@ -10,6 +10,8 @@ public:
     SymbolTable();
     ~SymbolTable();
 
+    void reset();
+
     void enterScope();
     void exitScope();
     
@@ -29,6 +31,7 @@ public:
     FunctionSymbol* getCurrentFunctionContext() const;
 
 private:
+    void declareLibrary();
     Symbol* findGlobalSymbol(const std::string& name);
 
     std::stack<Scope*> scopes;
@@ -39,6 +39,18 @@ Type *ArrayType::getBaseType() const
     return baseType;
 }
 
+// Implementation of GeneratorType constructor
+GeneratorType::GeneratorType(Type *baseType) : baseType(baseType)
+{
+    type = TypeEnum::GENERATOR;
+}
+
+// Implementation of getBaseType for GeneratorType
+Type *GeneratorType::getBaseType() const
+{
+    return baseType;
+}
+
 // Implementation of typeToString
 std::string typeToString(TypeEnum type)
 {
@@ -52,6 +64,8 @@ std::string typeToString(TypeEnum type)
             return "void";
         case TypeEnum::ARRAY:
             return "array";
+        case TypeEnum::GENERATOR:
+            return "generator";
         case TypeEnum::ERROR:
             return "undefined";
         default:
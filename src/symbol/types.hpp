@@ -10,6 +10,7 @@ enum class TypeEnum
     BYTE,
     VOID,
     ARRAY,
+    GENERATOR,
     ERROR
 };
 
@@ -62,6 +63,17 @@ private:
     int size;
 };
 
+// Derived class for Generator type (the return type of a generator, yielding values of the base type)
+class GeneratorType : public Type
+{
+public:
+    GeneratorType(Type *baseType);
+    Type *getBaseType() const override;
+
+private:
+    Type *baseType;
+};
+
 // Function to compare types
 inline bool equalTypes(TypeEnum t1, TypeEnum t2)
 {
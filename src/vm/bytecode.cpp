@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <climits>
+#include "vm.hpp"
+
+#define VM_NAME(name, operands) #name,
+static const char *const opNames[] = { VM_OPS(VM_NAME) };
+#undef VM_NAME
+
+#define VM_OPERANDS(name, operands) operands,
+static const char *const opOperands[] = { VM_OPS(VM_OPERANDS) };
+#undef VM_OPERANDS
+
+static void printString(std::ostream &out, const char *s)
+{
+    out << '"';
+    for (; *s; ++s)
+    {
+        switch (*s)
+        {
+        case '\n':
+            out << "\\n";
+            break;
+        case '\t':
+            out << "\\t";
+            break;
+        case '"':
+        case '\\':
+            out << '\\' << *s;
+            break;
+        default:
+            out << *s;
+        }
+    }
+    out << '"';
+}
+
+// VmProgram Method Implementations
+
+void VmProgram::print(std::ostream &out) const
+{
+    // Functions are compiled as they are first called, so their code is not
+    // in the order of their indices
+    std::vector<const VmFunction *> byEntry;
+    for (const VmFunction &f : functions)
+        byEntry.push_back(&f);
+    std::sort(byEntry.begin(), byEntry.end(),
+              [](const VmFunction *x, const VmFunction *y) { return x->entry < y->entry; });
+
+    for (const VmFunction *f : byEntry)
+    {
+        out << f->name << ": " << f->argCount << " arguments, " << f->locals - f->argCount << " variable registers, "
+            << f->frameSize << " registers\n";
+        for (int pc = f->entry; pc < f->end; ++pc)
+        {
+            const VmInstr &instr = code[pc];
+            const uint16_t regs[] = {instr.a, instr.b, instr.c};
+            int reg = 0;
+
+            out << "  " << pc << "\t" << opNames[instr.op];
+            for (const char *operand = opOperands[instr.op]; *operand; ++operand)
+            {
+                out << (operand == opOperands[instr.op] ? "\t" : ", ");
+                switch (*operand)
+                {
+                case 'r':
+                    out << "r" << regs[reg++];
+                    break;
+                case 'i':
+                    out << instr.imm;
+                    break;
+                case 't':
+                    out << "@" << instr.target;
+                    break;
+                case 's':
+                    printString(out, strings[instr.imm]);
+                    break;
+                case 'f':
+                    out << functions[instr.imm].name;
+                    break;
+                case 'n':
+                    out << vmBuiltinName(instr.imm);
+                    break;
+                }
+            }
+            out << "\n";
+        }
+    }
+}
+
+// VmBuilder Method Implementations
+
+void VmBuilder::setProgram(VmProgram *p)
+{
+    program = p;
+}
+
+VmProgram *VmBuilder::getProgram() const
+{
+    return program;
+}
+
+int VmBuilder::addFunction(const std::string &name)
+{
+    program->functions.push_back({name, -1, -1, 0, 0, 0});
+    return program->functions.size() - 1;
+}
+
+void VmBuilder::beginFunction(int index)
+{
+    VmFunction &f = program->functions[index];
+    if (f.entry < 0)
+    {
+        f.entry = program->code.size();
+    }
+    program->code.resize(f.entry);
+    program->positions.resize(f.entry);
+
+    function = index;
+    registers = 0;
+    maxRegisters = 0;
+    labels.clear();
+    fixups.clear();
+}
+
+void VmBuilder::endFunction(int argCount, int locals)
+{
+    for (const auto &fixup : fixups)
+    {
+        program->code[fixup.first].target = labels[fixup.second];
+    }
+
+    VmFunction &f = program->functions[function];
+    if (maxRegisters > UINT16_MAX)
+    {
+        std::cerr << "Error: function " << f.name << " needs more than " << UINT16_MAX << " registers" << std::endl;
+        exit(1);
+    }
+    f.end = program->code.size();
+    f.argCount = argCount;
+    f.locals = locals;
+    f.frameSize = maxRegisters;
+}
+
+int VmBuilder::newRegister()
+{
+    return newRegisters(1);
+}
+
+int VmBuilder::newRegisters(int count)
+{
+    int first = registers;
+    registers += count;
+    maxRegisters = std::max(maxRegisters, registers);
+    return first;
+}
+
+int VmBuilder::getRegisters() const
+{
+    return registers;
+}
+
+void VmBuilder::setRegisters(int count)
+{
+    registers = count;
+}
+
+int VmBuilder::newLabel()
+{
+    labels.push_back(-1);
+    return labels.size() - 1;
+}
+
+void VmBuilder::bind(int label)
+{
+    labels[label] = program->code.size();
+}
+
+void VmBuilder::setPosition(int l, int c)
+{
+    line = l;
+    column = c;
+}
+
+void VmBuilder::emit(VmOp op, int a, int b, int c, int imm)
+{
+    program->code.push_back({op, (uint16_t)a, (uint16_t)b, (uint16_t)c, imm, 0});
+    program->positions.push_back({line, column});
+}
+
+void VmBuilder::emitJump(VmOp op, int label, int a, int b, int c, int imm)
+{
+    fixups.push_back({(int)program->code.size(), label});
+    emit(op, a, b, c, imm);
+}
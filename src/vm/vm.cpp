@@ -0,0 +1,573 @@
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <climits>
+#include <memory>
+#include <thread>
+#include "vm.hpp"
+#include "../jit/runtime.hpp"
+#include "../ast/ast.hpp"
+
+// The builtins of lib/lib.c, called with the registers of their arguments
+struct VmBuiltin
+{
+    const char *name;
+    int (*call)(const VmSlot *args);
+};
+
+static const VmBuiltin builtins[] = {
+    {"writeInteger", [](const VmSlot *args) { writeInteger(args[0].i); return 0; }},
+    {"writeByte", [](const VmSlot *args) { writeByte(args[0].i); return 0; }},
+    {"writeChar", [](const VmSlot *args) { writeChar(args[0].i); return 0; }},
+    {"writeString", [](const VmSlot *args) { writeString(args[0].p); return 0; }},
+    {"readInteger", [](const VmSlot *args) { return readInteger(); }},
+    {"readByte", [](const VmSlot *args) { return (int)(signed char)readByte(); }},
+    {"readChar", [](const VmSlot *args) { return (int)(signed char)readChar(); }},
+    {"readString", [](const VmSlot *args) { readString(args[0].i, args[1].p); return 0; }},
+    {"extend", [](const VmSlot *args) { return extend(args[0].i); }},
+    {"shrink", [](const VmSlot *args) { return (int)(signed char)shrink(args[0].i); }},
+    {"strlen", [](const VmSlot *args) { return __alan_strlen(args[0].p); }},
+    {"strcmp", [](const VmSlot *args) { return __alan_strcmp(args[0].p, args[1].p); }},
+    {"strcpy", [](const VmSlot *args) { __alan_strcpy(args[0].p, args[1].p); return 0; }},
+    {"strcat", [](const VmSlot *args) { __alan_strcat(args[0].p, args[1].p); return 0; }},
+};
+
+int vmBuiltin(const std::string &name)
+{
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i)
+    {
+        if (name == builtins[i].name)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *vmBuiltinName(int index)
+{
+    return builtins[index].name;
+}
+
+// Memory reserved for the registers and the call records of the program; its
+// pages are only committed when touched
+template <typename T> struct VmStack
+{
+    T *base;
+    T *end;
+    size_t size;
+
+    VmStack(size_t size) : size(size)
+    {
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            fprintf(stderr, "Error: cannot allocate the stack of the VM\n");
+            exit(1);
+        }
+        base = (T *)memory;
+        end = base + size / sizeof(T);
+    }
+
+    ~VmStack()
+    {
+        munmap(base, size);
+    }
+};
+
+const size_t REGISTER_STACK_SIZE = 1ull << 30;
+const size_t CALL_STACK_SIZE = 256ull << 20;
+
+// A running generator: its registers, where it yielded and the value it
+// yielded. Its runtime-sized arrays live as long as it does
+struct VmGenerator
+{
+    std::unique_ptr<VmSlot[]> regs;
+    const VmInstr *pc = nullptr;
+    int value = 0;
+    bool done = false;
+    std::vector<std::unique_ptr<char[]>> arrays;
+
+    VmGenerator(int frameSize) : regs(new VmSlot[frameSize]()) {}
+};
+
+// Where a call returns to: the caller's next instruction, registers and
+// generator, and the register of the result
+struct VmCall
+{
+    const VmInstr *pc;
+    VmSlot *regs;
+    VmGenerator *generator;
+    int dst;
+};
+
+__attribute__((noinline, cold)) static void runtimeError(const VmProgram &program, const VmInstr *pc,
+                                                         RuntimeError error)
+{
+    const std::pair<int, int> &position = program.positions[pc - program.code.data()];
+    __alan_runtime_error(error, position.first, position.second);
+}
+
+// Unchecked, division by zero and INT_MIN / -1 fault like the division of
+// the compiled program
+__attribute__((noinline, cold)) static void divisionFault(const VmProgram &program, const VmInstr *pc, bool zero)
+{
+    if (checkDivision)
+    {
+        runtimeError(program, pc, zero ? DIVISION_ERROR : OVERFLOW_ERROR);
+    }
+    raise(SIGFPE);
+}
+
+// The compiled program would run out of its stack; the VM runs out of its own
+__attribute__((noinline, cold)) static void stackOverflow()
+{
+    fflush(stdout);
+    fprintf(stderr, "Error: stack overflow in the VM\n");
+    signal(SIGSEGV, SIG_DFL);
+    raise(SIGSEGV);
+}
+
+// The tiered mode (--tiered). The calls of every function and the
+// iterations of its loops are counted; the first function to turn hot has
+// the whole program compiled on a thread of its own while the VM goes on.
+// Once the code is ready, the calls of the hot functions patch themselves
+// to call it. There is no on-stack replacement: a running call finishes in
+// the VM, and so does main
+struct VmTier
+{
+    VmCompiler *compiler;
+    std::vector<unsigned> counts;
+    std::vector<char> hot;
+    std::vector<VmNative> natives;
+    std::thread thread;
+    std::atomic<bool> ready{false};
+
+    VmTier(VmCompiler *compiler, size_t functions)
+        : compiler(compiler), counts(functions), hot(functions), natives(functions)
+    {
+    }
+};
+
+// Whether the program is being compiled, and the status of the program
+// that ended meanwhile
+static std::atomic<bool> tierCompiling{false};
+static int tierStatus = 1;
+
+// Exiting destroys the state of LLVM under the compiling thread, so a
+// program that ends before its code is ready does not wait for it either
+static void abandonTier()
+{
+    if (tierCompiling.load())
+    {
+        fflush(nullptr);
+        _exit(tierStatus);
+    }
+}
+
+__attribute__((noinline, cold)) static void tierUp(VmTier *tier, int function)
+{
+    tier->hot[function] = true;
+    if (tier->thread.joinable())
+    {
+        return;
+    }
+
+    tierCompiling = true;
+    atexit(abandonTier);
+    tier->thread = std::thread([tier]() {
+        tier->compiler->compile();
+        tierCompiling = false;
+        tier->ready.store(true, std::memory_order_release);
+    });
+}
+
+// What the call of a hot function becomes once the code is ready: a call of
+// its native code, or a plain call when it has none
+__attribute__((noinline, cold)) static VmOp tierPatch(VmTier *tier, const VmProgram &program, int function)
+{
+    VmNative entry = tier->compiler->entry(program.functions[function].name);
+    tier->natives[function] = entry;
+    return entry ? VM_CALLN : VM_CALL;
+}
+
+static int32_t loadInt(const char *address)
+{
+    int32_t value;
+    memcpy(&value, address, sizeof(value));
+    return value;
+}
+
+static void storeInt(char *address, int32_t value)
+{
+    memcpy(address, &value, sizeof(value));
+}
+
+static int32_t wrap(uint32_t value)
+{
+    return (int32_t)value;
+}
+
+// The dispatch loop. Every instruction ends by jumping to the handler of the
+// next one through the table of label addresses (computed goto), so each has
+// a branch of its own for the branch predictor
+static void run(VmProgram &program, VmStack<VmSlot> &stack, VmStack<VmCall> &calls, VmTier *tier)
+{
+#define VM_LABEL(name, operands) &&op_##name,
+    static const void *const dispatch[] = { VM_OPS(VM_LABEL) };
+#undef VM_LABEL
+
+#define DISPATCH() goto *dispatch[pc->op]
+#define NEXT() do { ++pc; DISPATCH(); } while (0)
+#define JUMP(t) do { pc = code + (t); DISPATCH(); } while (0)
+#define R(field) regs[pc->field]
+#define PUSH_CALL(returnPc, dstReg) \
+    do { \
+        if (++fp == calls.end) \
+            stackOverflow(); \
+        fp->pc = (returnPc); \
+        fp->regs = regs; \
+        fp->generator = generator; \
+        fp->dst = (dstReg); \
+    } while (0)
+#define POP_CALL() \
+    do { \
+        pc = fp->pc; \
+        regs = fp->regs; \
+        generator = fp->generator; \
+        --fp; \
+    } while (0)
+#define BRANCHES(name, op) \
+    op_J##name: if (R(a).i op R(b).i) JUMP(pc->target); NEXT(); \
+    op_J##name##I: if (R(a).i op pc->imm) JUMP(pc->target); NEXT(); \
+    op_J##name##X: if (loadInt(R(a).p + (ptrdiff_t)R(b).i * 4) op R(c).i) JUMP(pc->target); NEXT();
+
+    const VmInstr *code = program.code.data();
+    const VmFunction *functions = program.functions.data();
+    static const VmInstr halt = {VM_HALT, 0, 0, 0, 0, 0};
+    VmSlot result;
+
+    // The main function returns to the halt instruction
+    const VmFunction &main = functions[0];
+    VmSlot *regs = stack.base;
+    VmSlot *sp = regs + main.frameSize;
+    VmGenerator *generator = nullptr;
+    VmCall *fp = calls.base;
+    fp->pc = &halt;
+    fp->regs = &result;
+    fp->generator = nullptr;
+    fp->dst = 0;
+    const VmInstr *pc = code + main.entry;
+    DISPATCH();
+
+op_MOV:
+    R(a) = R(b);
+    NEXT();
+op_CONST:
+    R(a).i = pc->imm;
+    NEXT();
+op_STRING:
+    R(a).p = const_cast<char *>(program.strings[pc->imm]);
+    NEXT();
+op_LEA:
+    R(a).p = (char *)(regs + pc->imm);
+    NEXT();
+op_ALLOCA:
+op_ALLOCAN: {
+    if (pc->op == VM_ALLOCAN && R(b).i <= 0)
+    {
+        runtimeError(program, pc, SIZE_ERROR);
+    }
+    size_t bytes = pc->op == VM_ALLOCA ? (size_t)pc->imm : (size_t)R(b).i * pc->imm;
+    if (generator)
+    {
+        generator->arrays.push_back(std::unique_ptr<char[]>(new char[bytes]()));
+        R(a).p = generator->arrays.back().get();
+        NEXT();
+    }
+    size_t slots = (bytes + sizeof(VmSlot) - 1) / sizeof(VmSlot);
+    if (slots > (size_t)(stack.end - sp))
+    {
+        stackOverflow();
+    }
+    memset(sp, 0, slots * sizeof(VmSlot));
+    R(a).p = (char *)sp;
+    sp += slots;
+    NEXT();
+}
+op_LOADI:
+    R(a).i = loadInt(R(b).p);
+    NEXT();
+op_LOADB:
+    R(a).i = (signed char)*R(b).p;
+    NEXT();
+op_STOREI:
+    storeInt(R(a).p, R(b).i);
+    NEXT();
+op_STOREB:
+    *R(a).p = (char)R(b).i;
+    NEXT();
+op_LOADXI:
+    R(a).i = loadInt(R(b).p + (ptrdiff_t)R(c).i * 4);
+    NEXT();
+op_LOADXB:
+    R(a).i = (signed char)R(b).p[R(c).i];
+    NEXT();
+op_STOREXI:
+    storeInt(R(a).p + (ptrdiff_t)R(b).i * 4, R(c).i);
+    NEXT();
+op_STOREXB:
+    R(a).p[R(b).i] = (char)R(c).i;
+    NEXT();
+op_LEAX:
+    R(a).p = R(b).p + (ptrdiff_t)R(c).i * pc->imm;
+    NEXT();
+
+op_ADD:
+    R(a).i = wrap((uint32_t)R(b).i + (uint32_t)R(c).i);
+    NEXT();
+op_SUB:
+    R(a).i = wrap((uint32_t)R(b).i - (uint32_t)R(c).i);
+    NEXT();
+op_MUL:
+    R(a).i = wrap((uint32_t)R(b).i * (uint32_t)R(c).i);
+    NEXT();
+op_DIV:
+op_MOD: {
+    int32_t left = R(b).i, right = R(c).i;
+    if (right == 0 || (right == -1 && left == INT_MIN))
+    {
+        divisionFault(program, pc, right == 0);
+    }
+    R(a).i = pc->op == VM_DIV ? left / right : left % right;
+    NEXT();
+}
+op_NEG:
+    R(a).i = wrap(0u - (uint32_t)R(b).i);
+    NEXT();
+op_ADDI:
+    R(a).i = wrap((uint32_t)R(b).i + (uint32_t)pc->imm);
+    NEXT();
+op_MULI:
+    R(a).i = wrap((uint32_t)R(b).i * (uint32_t)pc->imm);
+    NEXT();
+op_DIVI:
+    R(a).i = R(b).i / pc->imm;
+    NEXT();
+op_MODI:
+    R(a).i = R(b).i % pc->imm;
+    NEXT();
+
+op_ADDV:
+    if (__builtin_add_overflow(R(b).i, R(c).i, &R(a).i))
+    {
+        runtimeError(program, pc, OVERFLOW_ERROR);
+    }
+    NEXT();
+op_SUBV:
+    if (__builtin_sub_overflow(R(b).i, R(c).i, &R(a).i))
+    {
+        runtimeError(program, pc, OVERFLOW_ERROR);
+    }
+    NEXT();
+op_MULV:
+    if (__builtin_mul_overflow(R(b).i, R(c).i, &R(a).i))
+    {
+        runtimeError(program, pc, OVERFLOW_ERROR);
+    }
+    NEXT();
+op_NEGV:
+    if (R(b).i == INT_MIN)
+    {
+        runtimeError(program, pc, OVERFLOW_ERROR);
+    }
+    R(a).i = -R(b).i;
+    NEXT();
+op_ADDIV:
+    if (__builtin_add_overflow(R(b).i, pc->imm, &R(a).i))
+    {
+        runtimeError(program, pc, OVERFLOW_ERROR);
+    }
+    NEXT();
+
+op_BADD:
+    R(a).i = (signed char)(R(b).i + R(c).i);
+    NEXT();
+op_BSUB:
+    R(a).i = (signed char)(R(b).i - R(c).i);
+    NEXT();
+op_BMUL:
+    R(a).i = (signed char)(R(b).i * R(c).i);
+    NEXT();
+op_BDIV:
+op_BMOD: {
+    int32_t left = R(b).i, right = R(c).i;
+    if (right == 0)
+    {
+        divisionFault(program, pc, true);
+    }
+    R(a).i = (signed char)(pc->op == VM_BDIV ? left / right : left % right);
+    NEXT();
+}
+op_TRUNC:
+    R(a).i = (signed char)R(b).i;
+    NEXT();
+
+op_JMP:
+    JUMP(pc->target);
+    BRANCHES(LT, <)
+    BRANCHES(GT, >)
+    BRANCHES(LE, <=)
+    BRANCHES(GE, >=)
+    BRANCHES(EQ, ==)
+    BRANCHES(NE, !=)
+
+op_CALL: {
+    const VmFunction &callee = functions[pc->imm];
+    if (callee.frameSize > stack.end - sp)
+    {
+        stackOverflow();
+    }
+    PUSH_CALL(pc + 1, pc->a);
+    memcpy(sp, regs + pc->b, callee.argCount * sizeof(VmSlot));
+    memset(sp + callee.argCount, 0, (callee.locals - callee.argCount) * sizeof(VmSlot));
+    regs = sp;
+    sp += callee.frameSize;
+    generator = nullptr;
+    JUMP(callee.entry);
+}
+op_CALLB:
+    R(a).i = builtins[pc->imm].call(regs + pc->b);
+    NEXT();
+op_CALLT: {
+    int function = pc->imm;
+    if (!tier->hot[function])
+    {
+        if (++tier->counts[function] == (unsigned)tierThreshold)
+        {
+            tierUp(tier, function);
+        }
+    }
+    else if (tier->ready.load(std::memory_order_acquire))
+    {
+        program.code[pc - code].op = tierPatch(tier, program, function);
+        DISPATCH();
+    }
+    goto op_CALL;
+}
+op_CALLN:
+    R(a).i = tier->natives[pc->imm](regs + pc->b);
+    NEXT();
+op_COUNT:
+    if (++tier->counts[pc->imm] == (unsigned)tierThreshold)
+    {
+        tierUp(tier, pc->imm);
+    }
+    NEXT();
+op_RET: {
+    // Generators finish with GENEND, so the frame that returns is on the stack
+    VmSlot value = R(a);
+    sp = regs;
+    int dst = fp->dst;
+    POP_CALL();
+    regs[dst] = value;
+    DISPATCH();
+}
+op_RETV:
+    sp = regs;
+    POP_CALL();
+    DISPATCH();
+
+op_GENNEW: {
+    const VmFunction &callee = functions[pc->imm];
+    VmGenerator *created = new VmGenerator(callee.frameSize);
+    memcpy(created->regs.get(), regs + pc->b, callee.argCount * sizeof(VmSlot));
+    R(a).p = (char *)created;
+    PUSH_CALL(pc + 1, 0);
+    regs = created->regs.get();
+    generator = created;
+    JUMP(callee.entry);
+}
+op_RESUME: {
+    VmGenerator *resumed = (VmGenerator *)R(a).p;
+    PUSH_CALL(code + pc->target, 0);
+    regs = resumed->regs.get();
+    generator = resumed;
+    pc = resumed->pc;
+    DISPATCH();
+}
+op_FORNEXT: {
+    VmGenerator *next = (VmGenerator *)R(a).p;
+    if (next->done)
+    {
+        JUMP(pc->target);
+    }
+    R(b).i = next->value;
+    NEXT();
+}
+op_YIELD:
+    generator->value = R(a).i;
+    generator->pc = pc + 1;
+    POP_CALL();
+    DISPATCH();
+op_GENEND:
+    generator->done = true;
+    POP_CALL();
+    DISPATCH();
+op_GENFREE:
+    delete (VmGenerator *)R(a).p;
+    NEXT();
+
+op_BOUND:
+    if ((uint32_t)R(a).i >= (uint32_t)R(b).i)
+    {
+        runtimeError(program, pc, BOUNDS_ERROR);
+    }
+    NEXT();
+op_BOUNDI:
+    if ((uint32_t)R(a).i >= (uint32_t)pc->imm)
+    {
+        runtimeError(program, pc, BOUNDS_ERROR);
+    }
+    NEXT();
+
+op_HALT:
+    return;
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef R
+#undef PUSH_CALL
+#undef POP_CALL
+#undef BRANCHES
+}
+
+int runVM(VmProgram &program, VmCompiler *compiler)
+{
+    tracePhase("run");
+    VmStack<VmSlot> stack(REGISTER_STACK_SIZE);
+    VmStack<VmCall> calls(CALL_STACK_SIZE);
+    // The tier is not deleted: a compile still running when the program
+    // ends is left to abandonTier
+    VmTier *tier = compiler ? new VmTier(compiler, program.functions.size()) : nullptr;
+    run(program, stack, calls, tier);
+    fflush(stdout);
+    timePhase("run");
+
+    tierStatus = 0;
+    if (tier && tier->thread.joinable())
+    {
+        if (tier->ready)
+        {
+            tier->thread.join();
+        }
+        else
+        {
+            tier->thread.detach();
+        }
+    }
+    return 0;
+}
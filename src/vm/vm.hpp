@@ -0,0 +1,214 @@
+#ifndef __VM_HPP__
+#define __VM_HPP__
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "../symbol/types.hpp"
+
+// Register bytecode of --vm: compiled from the checked AST (ast/bgen.cpp)
+// and run by a threaded dispatch loop (vm.cpp). A call has a frame of 8 byte
+// registers, with the arguments first: the parameters, then the captured
+// variables. Ints and bytes are held sign extended. The registers of arrays,
+// reference parameters and captured variables hold addresses, so the memory
+// of the program is laid out like in compiled code and the builtins of
+// lib/lib.c work on it directly.
+
+class MirVar;
+
+// The instructions and their operands, for the disassembly: r is a register
+// (a, b and c in order), i the immediate, t the jump target, s a string, f a
+// function and n a builtin of the program
+#define VM_OPS(X) \
+    /* a = b; a = i; a = the address of the string i */ \
+    X(MOV, "rr") X(CONST, "ri") X(STRING, "rs") \
+    /* a = the address of the register i of the frame */ \
+    X(LEA, "ri") \
+    /* a = zeroed storage of i bytes, or of b elements of i bytes */ \
+    X(ALLOCA, "ri") X(ALLOCAN, "rri") \
+    /* a = *b; *a = b */ \
+    X(LOADI, "rr") X(LOADB, "rr") X(STOREI, "rr") X(STOREB, "rr") \
+    /* a = b[c]; a[b] = c; a = &b[c], with elements of i bytes */ \
+    X(LOADXI, "rrr") X(LOADXB, "rrr") X(STOREXI, "rrr") X(STOREXB, "rrr") X(LEAX, "rrri") \
+    /* Int arithmetic, wrapping around; a = b op c, a = b op i */ \
+    X(ADD, "rrr") X(SUB, "rrr") X(MUL, "rrr") X(DIV, "rrr") X(MOD, "rrr") X(NEG, "rr") \
+    X(ADDI, "rri") X(MULI, "rri") X(DIVI, "rri") X(MODI, "rri") \
+    /* Int arithmetic of -ftrapv */ \
+    X(ADDV, "rrr") X(SUBV, "rrr") X(MULV, "rrr") X(NEGV, "rr") X(ADDIV, "rri") \
+    /* Byte arithmetic, and the byte of an int */ \
+    X(BADD, "rrr") X(BSUB, "rrr") X(BMUL, "rrr") X(BDIV, "rrr") X(BMOD, "rrr") X(TRUNC, "rr") \
+    /* Jumps; if a op b, if a op i, and if the int a[b] op c */ \
+    X(JMP, "t") \
+    X(JLT, "rrt") X(JGT, "rrt") X(JLE, "rrt") X(JGE, "rrt") X(JEQ, "rrt") X(JNE, "rrt") \
+    X(JLTI, "rit") X(JGTI, "rit") X(JLEI, "rit") X(JGEI, "rit") X(JEQI, "rit") X(JNEI, "rit") \
+    X(JLTX, "rrrt") X(JGTX, "rrrt") X(JLEX, "rrrt") X(JGEX, "rrrt") X(JEQX, "rrrt") X(JNEX, "rrrt") \
+    /* a = the result of the function or builtin called with the arguments from b */ \
+    X(CALL, "rrf") X(CALLB, "rrn") X(RET, "r") X(RETV, "") \
+    /* --tiered: a call that counts the calls of the function, and the call \
+       of its native code it patches itself to; count an iteration of a loop \
+       of the function */ \
+    X(CALLT, "rrf") X(CALLN, "rrf") X(COUNT, "f") \
+    /* Generators: a = a new generator run up to its first yield; resume the \
+       generator a, back at t; the next value of a in b, or jump to t when it \
+       is done; hand a to the loop; finish; free the generator a */ \
+    X(GENNEW, "rrf") X(RESUME, "rt") X(FORNEXT, "rrt") X(YIELD, "r") X(GENEND, "") X(GENFREE, "r") \
+    /* -fcheck-bounds: a is an index of an array of b or i elements */ \
+    X(BOUND, "rr") X(BOUNDI, "ri") \
+    X(HALT, "")
+
+#define VM_ENUM(name, operands) VM_##name,
+enum VmOp : uint16_t { VM_OPS(VM_ENUM) };
+#undef VM_ENUM
+
+struct VmInstr
+{
+    uint16_t op;
+    uint16_t a, b, c;
+    int32_t imm;
+    int32_t target;
+};
+
+union VmSlot
+{
+    int32_t i;
+    char *p;
+};
+
+struct VmFunction
+{
+    std::string name;
+    // First instruction of the function, and the one after its last
+    int entry;
+    int end;
+    int argCount;
+    // The registers zeroed by a call: the ones of the variables, after the arguments
+    int locals;
+    int frameSize;
+};
+
+struct VmProgram
+{
+    std::vector<VmInstr> code;
+    // Line and column of every instruction, for the runtime errors
+    std::vector<std::pair<int, int>> positions;
+    // The main function comes first
+    std::vector<VmFunction> functions;
+    std::vector<const char *> strings;
+
+    void print(std::ostream &out) const;
+};
+
+// Builds the code of a function at the end of the program
+class VmBuilder
+{
+public:
+    VmBuilder() : program(nullptr), function(-1), registers(0), maxRegisters(0), line(0), column(0) {}
+
+    void setProgram(VmProgram *p);
+    VmProgram *getProgram() const;
+    int addFunction(const std::string &name);
+    // Starts the code of a function, or starts it over
+    void beginFunction(int index);
+    void endFunction(int argCount, int locals);
+
+    // Registers are allocated like a stack: a statement gives back the
+    // temporaries it used by restoring the count it started with
+    int newRegister();
+    int newRegisters(int count);
+    int getRegisters() const;
+    void setRegisters(int count);
+
+    int newLabel();
+    void bind(int label);
+    void setPosition(int line, int column);
+    void emit(VmOp op, int a = 0, int b = 0, int c = 0, int imm = 0);
+    void emitJump(VmOp op, int label, int a = 0, int b = 0, int c = 0, int imm = 0);
+
+private:
+    VmProgram *program;
+    int function;
+    int registers;
+    int maxRegisters;
+    int line;
+    int column;
+    std::vector<int> labels;
+    // Jumps to labels, by instruction
+    std::vector<std::pair<int, int>> fixups;
+};
+
+// A variable of the function being compiled: its value in a register, the
+// address of a scalar in a register, or the address of an array's elements
+// in a register. Arrays declared in the function know their number of
+// elements for -fcheck-bounds, in size or at run time in sizeReg
+struct VmVar
+{
+    enum Kind { REG, PTR, ARRAY };
+
+    Kind kind;
+    int reg;
+    // Type of the scalar or of the array's elements
+    Type *type;
+    int size;
+    int sizeReg;
+};
+
+// What an lvalue denotes: a register variable, the scalar at the address in
+// reg, or the element index of the array at the address in reg
+struct VmLval
+{
+    enum Kind { REG, PTR, ELEM };
+
+    Kind kind;
+    int reg;
+    int index;
+    bool isByte;
+    const std::string *name;
+};
+
+// Names visible while compiling a function. Its own variables are found by
+// name; the captured ones also by their MirVar, for the closures of the
+// functions it calls
+struct VmScope
+{
+    std::unordered_map<std::string, VmVar> vars;
+    std::unordered_map<const MirVar *, VmVar> captured;
+    // Scalars whose address is taken live in memory behind a PTR register;
+    // when a register variable turns out to need an address it is added
+    // here, and the function is compiled again
+    std::unordered_set<std::string> addressed;
+    bool retry = false;
+    // Index of the function in the program
+    int function = -1;
+    bool isGenerator = false;
+    // Handles of the generators of the enclosing for loops, freed by a return
+    std::vector<int> generators;
+};
+
+// Index of a builtin of lib/lib.c for CALLB, or -1, and its name
+int vmBuiltin(const std::string &name);
+const char *vmBuiltinName(int index);
+
+// Native code of a function, called with the registers of its arguments
+typedef int (*VmNative)(const VmSlot *args);
+
+// The native tier of --tiered: compile() builds the native code of the
+// whole program, on a thread of the VM, and entry() then finds the code of
+// a function by its name
+class VmCompiler
+{
+public:
+    virtual ~VmCompiler() {}
+    virtual void compile() = 0;
+    virtual VmNative entry(const std::string &name) = 0;
+};
+
+// Runs the main function of the program, with the runtime library of lib/lib.c
+// linked into the compiler. Returns the exit status of the program. With a
+// compiler, the calls of the functions that turn hot are patched to their
+// native code.
+int runVM(VmProgram &program, VmCompiler *compiler = nullptr);
+
+#endif
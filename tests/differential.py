@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+
+"""Differential testing of the execution paths of the compiler.
+
+Runs every program of a test directory and a number of random programs
+(tests/randprog.py) through each engine in ENGINES and compares their
+standard output and exit status with those of the first engine. A program
+that fails to compile, or that behaves differently on some engine, is
+reported as a divergence; random programs that diverge are kept in
+--keep-dir so they can be reproduced and reduced.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+from concurrent.futures import ProcessPoolExecutor, as_completed
+
+import randprog
+
+# Every engine compiles the program with alanc and the given flags. The
+# runtime checks must not change the behaviour of a correct program, so the
+# checked engine also tests the analyses that remove them; neither must the
+# profiling and coverage instrumentation. Engines with -j, -r, -b and -t run the
+# program in the compiler's process instead of producing an executable.
+ENGINES = {
+    'O0': [],
+    'O': ['-O'],
+    'O-checked': ['-O', '-fcheck-div', '-fcheck-bounds'],
+    'O-profiled': ['-O', '-fprofile-functions'],
+    'O-coverage': ['-O', '-fcoverage'],
+    'O-loops': ['-O', '-fprofile-loops'],
+    'O-jit': ['-O', '-j'],
+    'interp': ['-r'],
+    'vm': ['-b'],
+    'tiered': ['-t', '-ftier-threshold=100'],
+    'C': ['-C'],
+    'C-checked': ['-C', '-fcheck-div', '-fcheck-bounds'],
+}
+
+IN_PROCESS = {'-j', '-r', '-b', '-t'}
+
+# The interpreter and the bytecode VM run programs much slower than native
+# code; their runs get this many times --timeout, so that a slow engine is
+# not reported as a divergence
+TIMEOUT_SCALE = {
+    'interp': 20,
+    'vm': 5,
+    'tiered': 5,
+}
+
+
+def run_engine(compiler_path, work_dir, source, flags, engine, stdin, timeout):
+    """Returns the behaviour of a program on an engine as plain data."""
+    if IN_PROCESS & set(ENGINES[engine]):
+        command = [compiler_path, *ENGINES[engine], *flags, source]
+    else:
+        command = [os.path.join(work_dir, f"a.{engine}")]
+        status = compile_engine(compiler_path, work_dir, source, flags, engine, command[0], timeout)
+        if status:
+            return status
+
+    try:
+        run_process = subprocess.run(command, input=stdin, capture_output=True, cwd=work_dir,
+                                     timeout=timeout * TIMEOUT_SCALE.get(engine, 1))
+    except subprocess.TimeoutExpired:
+        return {'status': 'timeout'}
+    return {
+        'status': 'ran',
+        'exit_code': run_process.returncode,
+        'stdout_sha1': hashlib.sha1(run_process.stdout).hexdigest(),
+        'stdout_bytes': len(run_process.stdout),
+        'message': run_process.stderr.decode(errors='replace')[:1000],
+    }
+
+
+def compile_engine(compiler_path, work_dir, source, flags, engine, executable, timeout):
+    """Compiles a program into an executable; returns the failure, if any."""
+    try:
+        compile_process = subprocess.run([compiler_path, *ENGINES[engine], *flags, '-o', executable, source],
+                                         capture_output=True, cwd=work_dir, timeout=timeout)
+    except subprocess.TimeoutExpired:
+        return {'status': 'compile-timeout'}
+    if compile_process.returncode != 0:
+        output = (compile_process.stdout + compile_process.stderr).decode(errors='replace')
+        return {'status': 'compile-error', 'message': output}
+    return None
+
+
+def behaviour(result):
+    # What has to agree between the engines
+    if result['status'] == 'ran':
+        return (result['exit_code'], result['stdout_sha1'])
+    return (result['status'],)
+
+
+def check_program(compiler_path, name, text, stdin, flags, engines, timeout):
+    with tempfile.TemporaryDirectory(prefix=f"alan_diff_{name}_") as work_dir:
+        source = os.path.join(work_dir, name + '.alan')
+        with open(source, 'w') as f:
+            f.write(text)
+        results = {engine: run_engine(compiler_path, work_dir, source, flags, engine, stdin, timeout)
+                   for engine in engines}
+
+    reference = behaviour(results[engines[0]])
+    diverging = [engine for engine in engines if behaviour(results[engine]) != reference]
+    failed = [engine for engine in engines if results[engine]['status'].startswith('compile')]
+    return {'name': name, 'results': results, 'diverging': diverging, 'compile_failures': failed}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compares the behaviour of programs on every execution path of the compiler.')
+    parser.add_argument('compiler_path', help='The path to the alanc script.')
+    parser.add_argument('test_dir', nargs='?', default='programs', help='Directory of .alan programs and their .input and .flags files (default: programs).')
+    parser.add_argument('-n', '--random', type=int, default=100, help='Number of random programs (default: 100).')
+    parser.add_argument('--seed', type=int, default=0, help='Seed of the first random program (default: 0).')
+    parser.add_argument('--engine', choices=ENGINES, action='append', help='Engine to compare (default: all); the first is the reference.')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(), help='Number of programs checked in parallel (default: number of CPUs).')
+    parser.add_argument('--timeout', type=float, default=60, help='Seconds before compiling or running a program is aborted (default: 60); the runs of the interpreter and the VM get a multiple of it.')
+    parser.add_argument('--keep-dir', help='Directory to keep the diverging random programs in (default: next to the --output report, or alan-divergences in the temporary directory).')
+    parser.add_argument('-o', '--output', help='Write the JSON report to this file.')
+    randprog.add_arguments(parser)
+
+    args = parser.parse_args()
+    compiler = os.path.abspath(args.compiler_path)
+    engines = args.engine or list(ENGINES)
+    if not args.keep_dir:
+        parent = os.path.dirname(os.path.abspath(args.output)) if args.output else tempfile.gettempdir()
+        args.keep_dir = os.path.join(parent, 'alan-divergences')
+    params = {name: getattr(args, name) for name in randprog.DEFAULTS}
+
+    programs = []
+    if os.path.isdir(args.test_dir):
+        for file in sorted(os.listdir(args.test_dir)):
+            if file.endswith('.alan'):
+                basename = file[:-len('.alan')]
+                with open(os.path.join(args.test_dir, file)) as f:
+                    text = f.read()
+                input_file = os.path.join(args.test_dir, basename + '.input')
+                stdin = open(input_file, 'rb').read() if os.path.exists(input_file) else b''
+                # The compiler options of a .flags file apply to every engine, as in tests/test.py
+                flags_file = os.path.join(args.test_dir, basename + '.flags')
+                flags = open(flags_file, 'r').read().split() if os.path.exists(flags_file) else []
+                programs.append((basename, text, stdin, flags))
+    for seed in range(args.seed, args.seed + args.random):
+        programs.append((f"random{seed}", randprog.generate(seed=seed, **params), b'', []))
+
+    reports = []
+    with ProcessPoolExecutor(max_workers=args.jobs) as pool:
+        futures = {pool.submit(check_program, compiler, name, text, stdin, flags, engines, args.timeout): (name, text)
+                   for name, text, stdin, flags in programs}
+        for future in as_completed(futures):
+            name, text = futures[future]
+            report = future.result()
+            reports.append(report)
+
+            if report['diverging'] or report['compile_failures']:
+                summary = ", ".join(f"{engine}: {' '.join(map(str, behaviour(report['results'][engine])))}"
+                                    for engine in engines)
+                print(f"{name} ... DIVERGES ({summary})")
+                for engine in report['compile_failures']:
+                    print(report['results'][engine].get('message', '').rstrip())
+                if name.startswith('random'):
+                    os.makedirs(args.keep_dir, exist_ok=True)
+                    with open(os.path.join(args.keep_dir, name + '.alan'), 'w') as f:
+                        f.write(text)
+            else:
+                print(f"{name} ... OK")
+    reports.sort(key=lambda r: r['name'])
+
+    diverging = [r['name'] for r in reports if r['diverging'] or r['compile_failures']]
+    print(f"\nChecked {len(reports)} programs on {len(engines)} engines: {len(diverging)} diverging")
+    if any(name.startswith('random') for name in diverging):
+        print(f"The diverging random programs are kept in {args.keep_dir}")
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump({'compiler': compiler, 'engines': engines, 'generator': params, 'programs': reports,
+                       'diverging': diverging}, f, indent=2)
+
+    return 1 if diverging else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,317 @@
+#!/usr/bin/env python3
+
+"""Generator of random, well-typed Alan programs for differential testing.
+
+The programs follow the type rules of src/ast/semantic.cpp: the operands of
+an arithmetic operator or a comparison have the same type (int or byte),
+unary operators and array indexes are int, reference arguments are
+l-values, arrays are only passed by reference, and every function that
+returns a value ends with a return statement.
+
+Their behaviour is defined on every execution path, so any difference in
+their output is a compiler bug:
+
+- divisors have the form (e % k + k + 1) with k > 0, so they are positive;
+- indexes have the form ((e % n + n) % n) for arrays of size n;
+- loops count a variable that only the loop header writes, and nested
+  functions are declared before the counters, so they cannot capture them;
+- a function only calls functions that are complete when it is defined, so
+  there is no recursion, and every call is charged to a budget of work;
+- bytes are only added, subtracted, multiplied and compared, and int
+  arithmetic wraps around.
+
+Everything the program computes ends up in its output.
+"""
+
+import argparse
+import random
+import sys
+
+ARRAY_SIZE = 8
+
+DEFAULTS = {
+    'functions': 6,
+    'depth': 3,
+    'statements': 12,
+    'expr_depth': 3,
+    'loop_depth': 2,
+}
+
+# Work (roughly statements executed) allowed per function, including callees
+BUDGET = 20000
+
+
+class Function:
+    def __init__(self, name, ret, params):
+        self.name = name
+        self.ret = ret          # 'int', 'byte' or 'proc'
+        self.params = params    # [(name, type, by_reference)]
+        self.cost = 1
+
+
+class Scope:
+    """Names visible in the body of a function."""
+
+    def __init__(self, parent=None):
+        self.vars = dict(parent.vars) if parent else {}           # name -> type
+        self.functions = list(parent.functions) if parent else []
+
+
+class Generator:
+    def __init__(self, functions, depth, statements, expr_depth, loop_depth, seed):
+        self.max_functions = functions
+        self.max_depth = depth
+        self.statements = statements
+        self.expr_depth = expr_depth
+        self.loop_depth = loop_depth
+        self.rng = random.Random(seed)
+        self.counter = 0
+        self.functions = 0
+        self.out = []
+
+    def fresh(self, prefix):
+        self.counter += 1
+        return f"{prefix}{self.counter}"
+
+    def emit(self, indent, line):
+        self.out.append('    ' * indent + line)
+
+    # Expressions
+
+    def constant(self, ty):
+        if ty == 'byte':
+            return "'" + self.rng.choice('abcdefghijklmnopqrstuvwxyz0123456789') + "'"
+        if self.rng.random() < 0.1:
+            return str(self.rng.choice([2147483647, 65536, 1000003, 46341]))
+        return str(self.rng.randint(0, 100))
+
+    def scalars(self, scope, ty):
+        return [name for name, t in scope.vars.items() if t == ty]
+
+    def arrays(self, scope, ty):
+        return [name for name, t in scope.vars.items() if t == ty + '[]']
+
+    def index(self, scope, depth):
+        n = ARRAY_SIZE
+        return f"(({self.expr(scope, 'int', depth)}) % {n} + {n}) % {n}"
+
+    def lvalue(self, scope, ty, depth):
+        names = self.scalars(scope, ty)
+        arrays = self.arrays(scope, ty)
+        if arrays and (not names or self.rng.random() < 0.3):
+            return f"{self.rng.choice(arrays)}[{self.index(scope, depth)}]"
+        if names:
+            return self.rng.choice(names)
+        return None
+
+    def call(self, scope, ret, depth):
+        # Calls charge the work of the callee to the current function
+        callees = [f for f in scope.functions if f.ret == ret and self.cost + self.weight * f.cost <= BUDGET]
+        if not callees:
+            return None
+        f = self.rng.choice(callees)
+        args = []
+        for _, ty, by_reference in f.params:
+            if ty.endswith('[]'):
+                arrays = self.arrays(scope, ty[:-2])
+                args.append(self.rng.choice(arrays) if arrays else None)
+            elif by_reference:
+                args.append(self.lvalue(scope, ty, depth))
+            else:
+                args.append(self.expr(scope, ty, depth))
+        if None in args:
+            return None
+        self.cost += self.weight * f.cost
+        return f"{f.name}({', '.join(args)})"
+
+    def atom(self, scope, ty, depth):
+        choice = self.rng.random()
+        if choice < 0.3:
+            return self.constant(ty)
+        if choice < 0.8:
+            value = self.lvalue(scope, ty, depth)
+            if value:
+                return value
+        if choice < 0.9:
+            value = self.call(scope, ty, depth)
+            if value:
+                return value
+        if ty == 'int':
+            if self.rng.random() < 0.5:
+                return f"extend({self.atom(scope, 'byte', depth)})"
+        elif self.rng.random() < 0.5:
+            return f"shrink({self.atom(scope, 'int', depth)})"
+        return self.constant(ty)
+
+    def expr(self, scope, ty, depth=None):
+        if depth is None:
+            depth = self.expr_depth
+        if depth <= 0 or self.rng.random() < 0.25:
+            return self.atom(scope, ty, depth - 1)
+
+        left = self.expr(scope, ty, depth - 1)
+        right = self.expr(scope, ty, depth - 1)
+        ops = ['+', '-', '*', '/', '%', 'u'] if ty == 'int' else ['+', '-', '*']
+        op = self.rng.choice(ops)
+        if op == 'u':
+            return f"{self.rng.choice(['-', '+'])}({left})"
+        if op in '/%':
+            k = self.rng.randint(1, 20)
+            right = f"(({right}) % {k} + {k + 1})"
+        return f"({left} {op} {right})"
+
+    def cond(self, scope, depth=2):
+        choice = self.rng.random()
+        if depth <= 0 or choice < 0.6:
+            ty = 'int' if self.rng.random() < 0.8 else 'byte'
+            op = self.rng.choice(['==', '!=', '<', '>', '<=', '>='])
+            return f"{self.expr(scope, ty, 2)} {op} {self.expr(scope, ty, 2)}"
+        if choice < 0.7:
+            return f"!({self.cond(scope, depth - 1)})"
+        if choice < 0.75:
+            return self.rng.choice(['true', 'false'])
+        op = self.rng.choice(['&', '|'])
+        return f"({self.cond(scope, depth - 1)}) {op} ({self.cond(scope, depth - 1)})"
+
+    # Statements
+
+    def stmt(self, indent, scope, counters, loops):
+        # Statements nested deeper than this are simple
+        compound = indent <= self.max_depth + self.loop_depth + 2
+        choice = self.rng.random()
+        if choice < 0.45:
+            ty = 'int' if self.rng.random() < 0.8 else 'byte'
+            target = self.lvalue(scope, ty, 2)
+            if target:
+                self.emit(indent, f"{target} = {self.expr(scope, ty)};")
+                return
+        if choice < 0.6:
+            ty = self.rng.choice(['int', 'byte', 'proc'])
+            call = self.call(scope, ty, 2)
+            if call:
+                if ty == 'proc':
+                    self.emit(indent, f"{call};")
+                else:
+                    self.emit(indent, f"{'writeInteger' if ty == 'int' else 'writeByte'}({call}); writeChar('\\n');")
+                return
+        if compound and choice < 0.75:
+            self.emit(indent, f"if ({self.cond(scope)}) {{")
+            self.block(indent + 1, scope, counters, loops, self.rng.randint(1, 3))
+            if self.rng.random() < 0.5:
+                self.emit(indent, "} else {")
+                self.block(indent + 1, scope, counters, loops, self.rng.randint(1, 3))
+            self.emit(indent, "}")
+            return
+        if compound and choice < 0.85 and loops < len(counters):
+            counter = counters[loops]
+            trips = self.rng.randint(1, 5)
+            self.emit(indent, f"{counter} = 0;")
+            self.emit(indent, f"while ({counter} < {trips}) {{")
+            self.weight *= trips
+            self.block(indent + 1, scope, counters, loops + 1, self.rng.randint(1, 4))
+            self.weight //= trips
+            self.emit(indent + 1, f"{counter} = {counter} + 1;")
+            self.emit(indent, "}")
+            return
+        ty = 'int' if self.rng.random() < 0.8 else 'byte'
+        self.emit(indent, f"{'writeInteger' if ty == 'int' else 'writeByte'}({self.expr(scope, ty)}); writeChar('\\n');")
+
+    def block(self, indent, scope, counters, loops, count):
+        for _ in range(count):
+            self.cost += self.weight
+            self.stmt(indent, scope, counters, loops)
+
+    def dump(self, indent, scope, names):
+        # Prints the variables, so every value the program computes is observed
+        for name in names:
+            ty = scope.vars[name]
+            if ty.endswith('[]'):
+                for i in range(ARRAY_SIZE):
+                    write = 'writeInteger' if ty == 'int[]' else 'writeByte'
+                    self.emit(indent, f"{write}({name}[{i}]); writeChar(' ');")
+            else:
+                self.emit(indent, f"{'writeInteger' if ty == 'int' else 'writeByte'}({name}); writeChar(' ');")
+        self.emit(indent, "writeChar('\\n');")
+
+    # Functions
+
+    def params(self):
+        params = []
+        for _ in range(self.rng.randint(0, 3)):
+            ty = self.rng.choice(['int', 'int', 'byte', 'int[]', 'byte[]'])
+            by_reference = ty.endswith('[]') or self.rng.random() < 0.4
+            params.append((self.fresh('p'), ty, by_reference))
+        return params
+
+    def function(self, indent, outer, name, ret, params, level):
+        self.functions += 1
+        header = ", ".join(f"{p} : {'reference ' if r else ''}{t}" for p, t, r in params)
+        self.emit(indent, f"{name} ({header}) : {ret}")
+
+        scope = Scope(outer)
+        for p, ty, _ in params:
+            scope.vars[p] = ty
+
+        locals_ = []
+        for _ in range(self.rng.randint(1, 4)):
+            ty = self.rng.choice(['int', 'int', 'byte', 'int[]', 'byte[]'])
+            var = self.fresh('v')
+            self.emit(indent + 1, f"{var} : {ty[:-2]}[{ARRAY_SIZE}];" if ty.endswith('[]') else f"{var} : {ty};")
+            scope.vars[var] = ty
+            locals_.append(var)
+
+        # Nested functions see the locals declared so far, but not the loop
+        # counters, which are declared after them
+        if level < self.max_depth:
+            for _ in range(self.rng.randint(0, 2)):
+                if self.functions >= self.max_functions:
+                    break
+                child = Function(self.fresh('f'), self.rng.choice(['int', 'byte', 'proc']), self.params())
+                cost, weight = self.cost, self.weight
+                self.cost, self.weight = 1, 1
+                self.function(indent + 1, scope, child.name, child.ret, child.params, level + 1)
+                child.cost = self.cost
+                self.cost, self.weight = cost, weight
+                scope.functions.append(child)
+
+        counters = [self.fresh('k') for _ in range(self.loop_depth)]
+        for counter in counters:
+            self.emit(indent + 1, f"{counter} : int;")
+
+        self.emit(indent, "{")
+        self.block(indent + 1, scope, counters, 0, self.rng.randint(1, self.statements))
+        if level == 0:
+            self.dump(indent + 1, scope, locals_)
+        if ret != 'proc':
+            self.emit(indent + 1, f"return {self.expr(scope, ret)};")
+        self.emit(indent, "}")
+        return scope
+
+    def generate(self):
+        self.cost, self.weight = 1, 1
+        self.function(0, None, 'main', 'proc', [], 0)
+        return "\n".join(self.out) + "\n"
+
+
+def generate(seed=42, **params):
+    values = dict(DEFAULTS)
+    values.update(params)
+    return Generator(seed=seed, **values).generate()
+
+
+def add_arguments(parser):
+    parser.add_argument('--functions', type=int, default=DEFAULTS['functions'], help='Maximum number of nested functions.')
+    parser.add_argument('--depth', type=int, default=DEFAULTS['depth'], help='Maximum nesting depth of the functions.')
+    parser.add_argument('--statements', type=int, default=DEFAULTS['statements'], help='Maximum number of statements of a function body.')
+    parser.add_argument('--expr-depth', type=int, default=DEFAULTS['expr_depth'], help='Depth of the expressions.')
+    parser.add_argument('--loop-depth', type=int, default=DEFAULTS['loop_depth'], help='Maximum nesting of the loops.')
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Writes a random Alan program to stdout.')
+    add_arguments(parser)
+    parser.add_argument('--seed', type=int, default=42, help='Seed of the random choices.')
+
+    args = parser.parse_args()
+    sys.stdout.write(generate(seed=args.seed, functions=args.functions, depth=args.depth, statements=args.statements,
+                              expr_depth=args.expr_depth, loop_depth=args.loop_depth))
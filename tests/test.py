@@ -1,8 +1,15 @@
 #!/usr/bin/env python3
 
 import argparse
+import json
 import os
+import shutil
 import subprocess
+import sys
+import tempfile
+import time
+import xml.etree.ElementTree as ET
+from concurrent.futures import ProcessPoolExecutor, as_completed
 
 class bcolors:
     HEADER = '\033[95m'
@@ -25,84 +32,172 @@ def extension(lang):
         return '.grc'
     elif lang == "llama":
         return '.lla'
-    
-def run_test(language, compiler_path, test_dir, optimize):
-    total = 0
-    ok = 0
-    failed = 0
+
+def run_one(compiler_path, test_dir, file, basename, optimize, timeout):
+    """Compiles and runs a single test in a directory of its own.
+
+    Runs in a worker process, so it only returns plain data: the status
+    ('passed', 'failed' or 'error'), a message and the compile and run time.
+    """
+    result = {'name': basename, 'status': 'passed', 'message': '', 'output': '',
+              'compile_time': None, 'run_time': None}
+
+    # The compiler writes its intermediate files next to the source, so the
+    # source is copied into the directory of the test as well
+    with tempfile.TemporaryDirectory(prefix=f"alan_test_{basename}_") as work_dir:
+        src_file = os.path.join(work_dir, file)
+        shutil.copyfile(os.path.join(test_dir, file), src_file)
+        executable = os.path.join(work_dir, basename)
+
+        # A .flags file holds compiler options the test needs, e.g. -fvla-heap-threshold=64
+        compile_command = [compiler_path]
+        if optimize:
+            compile_command.append("-O")
+        flags_file = os.path.join(test_dir, basename + '.flags')
+        if os.path.exists(flags_file):
+            compile_command += open(flags_file, 'r').read().split()
+        compile_command += ['-o', executable, src_file]
+
+        start = time.perf_counter()
+        try:
+            compile_process = subprocess.run(compile_command, text=True, capture_output=True, cwd=work_dir,
+                                             timeout=timeout)
+        except subprocess.TimeoutExpired:
+            result['compile_time'] = time.perf_counter() - start
+            result.update(status='error', message=f"Compilation timed out after {timeout} seconds")
+            return result
+        result['compile_time'] = time.perf_counter() - start
+
+        # Check if the compile process had an error
+        if compile_process.returncode != 0:
+            result.update(status='error', message="Compilation failed",
+                          output=compile_process.stdout + compile_process.stderr)
+            return result
+
+        # Run the compiled program, with the .input file as stdin if there is one
+        input_file = os.path.join(test_dir, basename + '.input')
+        stdin = open(input_file, 'r').read() if os.path.exists(input_file) else None
+
+        start = time.perf_counter()
+        try:
+            run_process = subprocess.run([executable], text=True, capture_output=True, input=stdin, cwd=work_dir,
+                                         timeout=timeout)
+        except subprocess.TimeoutExpired:
+            result['run_time'] = time.perf_counter() - start
+            result.update(status='error', message=f"Run timed out after {timeout} seconds")
+            return result
+        result['run_time'] = time.perf_counter() - start
+
+    # A test with a .error file must stop with that runtime error (exit status 1)
+    error_file = os.path.join(test_dir, basename + '.error')
+    if os.path.exists(error_file):
+        with open(error_file, 'r') as f:
+            expected_error = f.read()
+        if run_process.returncode != 1 or run_process.stderr != expected_error:
+            result.update(status='failed', message="Run did not stop with the expected error",
+                          output=f"Expected:\n{expected_error}\nGot (exit status {run_process.returncode}):\n{run_process.stderr}")
+            return result
+
+    # Check if the run process had an error
+    elif run_process.returncode != 0:
+        result.update(status='error', message=f"Run failed with exit status {run_process.returncode}",
+                      output=run_process.stderr)
+        return result
+
+    # Compare output to .result file
+    with open(os.path.join(test_dir, basename + '.result'), 'r') as f:
+        expected_output = f.read()
+
+    if run_process.stdout != expected_output:
+        result.update(status='failed', message="Output differs from the expected output",
+                      output=f"Expected:\n{expected_output}\nGot:\n{run_process.stdout}")
+    return result
+
+def print_result(result, optimize):
+    times = f"compile {result['compile_time']:.3f}s"
+    if result['run_time'] is not None:
+        times += f", run {result['run_time']:.3f}s"
+
+    print(f"{result['name']} (Optimization {'Enabled' if optimize else 'Disabled'}, {times})", end=" ... ")
+    if result['status'] == 'passed':
+        print_ok("OK")
+    else:
+        print_fail("FAILED")
+        print(result['message'])
+        if result['output']:
+            print(result['output'])
+
+def write_junit(results, suite_name, path):
+    suite = ET.Element('testsuite', name=suite_name, tests=str(len(results)),
+                       failures=str(sum(r['status'] == 'failed' for r in results)),
+                       errors=str(sum(r['status'] == 'error' for r in results)),
+                       time=f"{sum((r['compile_time'] or 0) + (r['run_time'] or 0) for r in results):.6f}")
+    for r in results:
+        case = ET.SubElement(suite, 'testcase', classname=suite_name, name=r['name'],
+                             time=f"{(r['compile_time'] or 0) + (r['run_time'] or 0):.6f}")
+        properties = ET.SubElement(case, 'properties')
+        for key in ('compile_time', 'run_time'):
+            if r[key] is not None:
+                ET.SubElement(properties, 'property', name=key, value=f"{r[key]:.6f}")
+        if r['status'] != 'passed':
+            failure = ET.SubElement(case, 'failure' if r['status'] == 'failed' else 'error', message=r['message'])
+            failure.text = r['output']
+    ET.ElementTree(suite).write(path, encoding='utf-8', xml_declaration=True)
+
+def write_json(results, suite_name, optimize, path):
+    report = {
+        'suite': suite_name,
+        'optimize': optimize,
+        'total': len(results),
+        'passed': sum(r['status'] == 'passed' for r in results),
+        'tests': results,
+    }
+    with open(path, 'w') as f:
+        json.dump(report, f, indent=2)
+
+def run_test(language, compiler_path, test_dir, optimize, jobs, timeout, junit=None, json_path=None):
     ext = extension(language)
-    optimize_flag = "-O" if optimize else ""  # Set optimization flag
-    
-    # Iterate over each file in the test directory
-    for file in os.listdir(test_dir):
-        if file.endswith(ext):
-            total += 1
-            basename = file[:-(len(ext))]
-            src_file = os.path.join(test_dir, file)
-            result_file = os.path.join(test_dir, basename + '.result')
-
-            # Compile the source file
-            print(f"Compiling {basename} (Optimization {'Enabled' if optimize else 'Disabled'})", end=" ... ")
-            compile_command = [compiler_path]
-            if optimize_flag:
-                compile_command.append(optimize_flag)
-            compile_command.append(src_file)
-            compile_process = subprocess.run(compile_command, text=True, capture_output=True)
-
-            # Check if the compile process had an error
-            if compile_process.returncode == 0:
-                print_ok("OK")
-            else:
-                failed += 1
-                print_fail("FAILED")
-                print(compile_process.stderr)
-                continue
-
-            print(f"  Running {basename}", end=" ... ")
-            # Check if basename .input file exists
-            input_file = os.path.join(test_dir, basename + '.input')
-            if os.path.exists(input_file):
-                # Run the compiled program with the input file as stdin
-                run_process = subprocess.run(['./a.out'], text=True, capture_output=True, input=open(input_file, 'r').read())
-            else:
-                # Run the compiled program
-                run_process = subprocess.run(['./a.out'], text=True, capture_output=True)
-
-            # Check if the run process had an error
-            if run_process.returncode == 0:
-                print_ok("OK")
-            else:
-                failed += 1
-                print_fail("FAILED")
-                print(run_process.stderr)
-                continue
-
-            # Compare output to .result file
-            with open(result_file, 'r') as f:
-                expected_output = f.read()
-
-            if run_process.stdout != expected_output:
-                failed += 1
-                print_fail(f"Test failed for {src_file}")
-                print("Expected:")
-                print(expected_output)
-                print("Got:")
-                print(run_process.stdout)
-            else:
-                ok += 1
-                print_ok(f"Test passed for {src_file}")
-
-    print(bcolors.OKBLUE + f"\nTotal tested: {total} ({ok} correct and {failed} failed)" + bcolors.ENDC)
+    compiler_path = os.path.abspath(compiler_path)
+    test_dir = os.path.abspath(test_dir)
+    files = sorted(file for file in os.listdir(test_dir) if file.endswith(ext))
+
+    # Compile and run the tests in a process pool, printing each one as it finishes
+    results = []
+    with ProcessPoolExecutor(max_workers=jobs) as pool:
+        futures = [pool.submit(run_one, compiler_path, test_dir, file, file[:-(len(ext))], optimize, timeout)
+                   for file in files]
+        for future in as_completed(futures):
+            result = future.result()
+            print_result(result, optimize)
+            results.append(result)
+    results.sort(key=lambda r: r['name'])
+
+    ok = sum(r['status'] == 'passed' for r in results)
+    failed = len(results) - ok
+    print(bcolors.OKBLUE + f"\nTotal tested: {len(results)} ({ok} correct and {failed} failed)" + bcolors.ENDC)
+
+    suite_name = language + ("-O" if optimize else "")
+    if junit:
+        write_junit(results, suite_name, junit)
+    if json_path:
+        write_json(results, suite_name, optimize, json_path)
+    return failed == 0
 
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description='Tests a Compiler for a Language by running all the tests residing in a Test Directory.'
-                                     ' Compiler should be an executable or script that takes as input a program of the language and creates an a.out executable in the directory where this test driver resides.')
+                                     ' Compiler should be an executable or script that takes as input a program of the language and an -o option naming the executable to create.')
     parser.add_argument('language', help='Currently one of: \'alan\', \'grace\' or \'llama\'.')
     parser.add_argument('compiler_path', help='The path to the compiler executable.')
-    parser.add_argument('test_dir', help='The directory containing the test programs, .result outputs expected for each program and .input files to be used as stdin for each program if needed.')
+    parser.add_argument('test_dir', help='The directory containing the test programs, .result outputs expected for each program, .input files to be used as stdin for each program if needed, .flags files of extra compiler options and .error files of the expected runtime errors.')
     parser.add_argument('--optimize', action='store_true', help='Enable optimization during compilation.')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(), help='Number of tests to run in parallel (default: number of CPUs).')
+    parser.add_argument('--timeout', type=float, default=60, help='Seconds before compiling or running a test is aborted (default: 60).')
+    parser.add_argument('--junit', help='Write the results as JUnit XML to this file.')
+    parser.add_argument('--json', help='Write the results, with the compile and run time of every test, as JSON to this file.')
 
     args = parser.parse_args()
 
-    run_test(args.language, args.compiler_path, args.test_dir, args.optimize)
\ No newline at end of file
+    passed = run_test(args.language, args.compiler_path, args.test_dir, args.optimize, args.jobs, args.timeout,
+                      args.junit, args.json)
+    sys.exit(0 if passed else 1)